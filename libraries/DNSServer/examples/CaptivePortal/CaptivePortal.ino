@@ -23,7 +23,8 @@ void setup() {
 }
 
 void loop() {
-  dnsServer.processNextRequest();
+  // answers every query that arrived since the last call
+  dnsServer.processRequests();
   WiFiClient client = server.available();   // listen for incoming clients
 
   if (client) {
@@ -2,44 +2,93 @@
 #include <lwip/def.h>
 #include <Arduino.h>
 
+#define DNS_FNV_OFFSET 2166136261UL
+#define DNS_FNV_PRIME  16777619UL
+
+static inline uint8_t dns_lower(uint8_t c)
+{
+  return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+// FNV-1a over the dotted, lower-cased name
+static uint32_t dns_hash_name(const char *name)
+{
+  uint32_t h = DNS_FNV_OFFSET;
+  while (*name) {
+    h = (h ^ dns_lower(*name++)) * DNS_FNV_PRIME;
+  }
+  return h;
+}
+
+// same hash computed straight from the wire labels, no string is built
+static uint32_t dns_hash_labels(const uint8_t *labels)
+{
+  uint32_t h = DNS_FNV_OFFSET;
+  bool first = true;
+  while (*labels) {
+    uint8_t len = *labels++;
+    if (!first) {
+      h = (h ^ '.') * DNS_FNV_PRIME;
+    }
+    first = false;
+    for (uint8_t i = 0; i < len; i++) {
+      h = (h ^ dns_lower(labels[i])) * DNS_FNV_PRIME;
+    }
+    labels += len;
+  }
+  return h;
+}
+
+static bool dns_labels_equal(const uint8_t *labels, const char *name)
+{
+  bool first = true;
+  while (*labels) {
+    uint8_t len = *labels++;
+    if (!first && *name++ != '.') {
+      return false;
+    }
+    first = false;
+    for (uint8_t i = 0; i < len; i++) {
+      if (!*name || dns_lower(labels[i]) != dns_lower(*name++)) {
+        return false;
+      }
+    }
+    labels += len;
+  }
+  return *name == '\0';
+}
+
 DNSServer::DNSServer()
 {
   _ttl = htonl(DNS_DEFAULT_TTL);
   _ErrReplyCode = DNSReplyCode::NonExistentDomain;
-  _DnsHeader    = (DNSHeader*) malloc( sizeof(DNSHeader) ) ;
-  _DnsQuestion  = (DNSQuestion*) malloc( sizeof(DNSQuestion) ) ;     
-  _buf     = NULL;
-  _CurPacketSize = 0;
   _port = 0;
+  clearRules();
+  resetStats();
 }
 
 DNSServer::~DNSServer()
 {
-  if (_DnsHeader) {
-    free(_DnsHeader);
-    _DnsHeader = NULL;
-  }
-  if (_DnsQuestion) {
-    free(_DnsQuestion);
-    _DnsQuestion = NULL;
-  }
-  if (_buf) {
-    free(_buf);
-    _buf = NULL;
-  }
+  stop();
 }
 
 bool DNSServer::start(const uint16_t &port, const String &domainName,
                      const IPAddress &resolvedIP)
 {
   _port = port;
-  _buf = NULL;
-  _domain = domainName;
-  _ResolveIP[0] = resolvedIP[0];
-  _ResolveIP[1] = resolvedIP[1];
-  _ResolveIP[2] = resolvedIP[2];
-  _ResolveIP[3] = resolvedIP[3];
-  downcaseAndRemoveWwwPrefix(_domain);
+  String domain = domainName;
+  downcaseAndRemoveWwwPrefix(domain);
+  clearRules();
+  if (domain == "*") {
+    addRule(domain, resolvedIP);
+  } else {
+    addRule(domain, resolvedIP);
+    addRule("www." + domain, resolvedIP);
+  }
+  // replies are built in place, so each pool buffer has room for the answer
+  if (!_Udp.setPacketPool(DNS_RX_PACKETS, DNS_MAX_PACKET + DNS_ANSWER_SIZE)) {
+    return false;
+  }
   return _Udp.begin(_port) == 1;
 }
 
@@ -56,8 +105,11 @@ void DNSServer::setTTL(const uint32_t &ttl)
 void DNSServer::stop()
 {
   _Udp.stop();
-  free(_buf);
-  _buf = NULL;
+}
+
+void DNSServer::resetStats()
+{
+  memset(&_stats, 0, sizeof(_stats));
 }
 
 void DNSServer::downcaseAndRemoveWwwPrefix(String &domainName)
@@ -66,232 +118,237 @@ void DNSServer::downcaseAndRemoveWwwPrefix(String &domainName)
   domainName.replace("www.", "");
 }
 
-void DNSServer::processNextRequest()
+bool DNSServer::parseRule(const String &domain, String &name, bool &wildcard)
 {
-  _CurPacketSize = _Udp.parsePacket();
-  if (_CurPacketSize)
-  {
-    bool parse_ok = true;
-    // Allocate buffer for the DNS query
-    if (_buf != NULL) 
-      free(_buf);
-    _buf = (unsigned char*)malloc(_CurPacketSize * sizeof(char));
-    if (_buf == NULL) 
-      return;
+  name = domain;
+  name.toLowerCase();
+  if (name.endsWith(".")) {
+    name.remove(name.length() - 1);
+  }
+  wildcard = name.startsWith("*.");
+  if (wildcard) {
+    name.remove(0, 2);
+  }
+  return name.length() && name.length() < DNS_RULE_NAME_MAX;
+}
 
-    // Put the packet received in the buffer and get DNS header (beginning of message)
-    // and the question
-    _Udp.read(_buf, _CurPacketSize);
-    
-    // Check if packet is large enough to contain DNS header
-    if (_CurPacketSize < DNS_HEADER_SIZE) {
-      parse_ok = false;
+DNSServer::DNSRule *DNSServer::findRule(const char *name, bool wildcard)
+{
+  uint32_t hash = dns_hash_name(name);
+  for (uint8_t i = 0; i < DNS_RULE_SLOTS; i++) {
+    DNSRule *r = &_rules[(hash + i) & (DNS_RULE_SLOTS - 1)];
+    if (r->state == 0) {
+      break;
     }
-    
-    if (parse_ok) {
-      memcpy( _DnsHeader, _buf, DNS_HEADER_SIZE );
+    if (r->state == 1 && r->hash == hash && r->wildcard == wildcard && !strcmp(r->name, name)) {
+      return r;
     }
-    
-    if ( parse_ok && requestIncludesOnlyOneQuestion() ) {
-      if (_CurPacketSize < DNS_HEADER_SIZE + 1) {
-        parse_ok = false;
-      }
-
-      if (parse_ok) {
-        // The QName has a variable length, maximum 255 bytes and is comprised of multiple labels.
-        // Each label contains a byte to describe its length and the label itself. The list of 
-        // labels terminates with a zero-valued byte. In "github.com", we have two labels "github" & "com"
-        // Iterate through the labels and copy them as they come into a single buffer (for simplicity's sake)
-        _DnsQuestion->QNameLength = 0 ;
-        while ( parse_ok && _DnsQuestion->QNameLength < sizeof(_DnsQuestion->QName) )
-        {
-          uint16_t q_off = _DnsQuestion->QNameLength;
-          uint16_t src_off = DNS_HEADER_SIZE + q_off;
-
-          // Check if we can read the length byte or terminator
-          if (src_off >= _CurPacketSize) {
-            parse_ok = false;
-            break;
-          }
-
-          // Check for terminator
-          if (_buf[src_off] == 0) {
-            break;
-          }
-
-          uint16_t label_len = _buf[src_off];
-          
-          if ((uint32_t)src_off + (uint32_t)label_len + 1u > (uint32_t)_CurPacketSize) {
-            parse_ok = false;
-            break;
-          }
-
-          // Keep room for the final trailing '\0'
-          if ((uint32_t)q_off + (uint32_t)label_len + 1u >= sizeof(_DnsQuestion->QName)) {
-            parse_ok = false;
-            break;
-          }
-
-          memcpy((void*)&_DnsQuestion->QName[q_off], (void*)&_buf[src_off], label_len + 1);
-          _DnsQuestion->QNameLength += label_len + 1;
-        }
-
-        if (parse_ok && _DnsQuestion->QNameLength < sizeof(_DnsQuestion->QName)) {
-          _DnsQuestion->QName[_DnsQuestion->QNameLength] = 0;
-          _DnsQuestion->QNameLength++;
+  }
+  return NULL;
+}
 
-          // Copy the QType and QClass
-          uint32_t qtype_off = DNS_HEADER_SIZE + _DnsQuestion->QNameLength;
-          uint32_t qclass_off = qtype_off + sizeof(_DnsQuestion->QType);
-          if (qclass_off + sizeof(_DnsQuestion->QClass) > (uint32_t)_CurPacketSize) {
-            parse_ok = false;
-          } else {
-            memcpy(&_DnsQuestion->QType, (void*)&_buf[qtype_off], sizeof(_DnsQuestion->QType));
-            memcpy(&_DnsQuestion->QClass, (void*)&_buf[qclass_off], sizeof(_DnsQuestion->QClass));
-          }
-        }
-      }
+bool DNSServer::addRule(const String &domain, const IPAddress &ip)
+{
+  if (domain == "*") {
+    _catchAll = true;
+    for (int i = 0; i < 4; i++) {
+      _catchAllIP[i] = ip[i];
     }
-    
-
-    if (parse_ok &&
-        _DnsHeader->QRFlag == DNS_QR_QUERY &&
-        _DnsHeader->OPCode == DNS_OPCODE_QUERY &&
-        requestIncludesOnlyOneQuestion() &&
-        (_domain == "*" || getDomainNameWithoutWwwPrefix() == _domain)
-       )
-    {
-      replyWithIP();
+    return true;
+  }
+  String name;
+  bool wildcard;
+  if (!parseRule(domain, name, wildcard)) {
+    return false;
+  }
+  DNSRule *r = findRule(name.c_str(), wildcard);
+  if (!r) {
+    if (_ruleCount >= DNS_MAX_RULES) {
+      return false;
     }
-    else if (parse_ok && _DnsHeader->QRFlag == DNS_QR_QUERY)
-    {
-      replyWithCustomCode();
+    uint32_t hash = dns_hash_name(name.c_str());
+    for (uint8_t i = 0; i < DNS_RULE_SLOTS; i++) {
+      r = &_rules[(hash + i) & (DNS_RULE_SLOTS - 1)];
+      if (r->state != 1) {
+        break;
+      }
     }
+    r->state = 1;
+    r->hash = hash;
+    r->wildcard = wildcard;
+    strcpy(r->name, name.c_str());
+    _ruleCount++;
+  }
+  for (int i = 0; i < 4; i++) {
+    r->ip[i] = ip[i];
+  }
+  return true;
+}
 
-    free(_buf);
-    _buf = NULL;
+bool DNSServer::removeRule(const String &domain)
+{
+  if (domain == "*") {
+    bool had = _catchAll;
+    _catchAll = false;
+    return had;
   }
+  String name;
+  bool wildcard;
+  if (!parseRule(domain, name, wildcard)) {
+    return false;
+  }
+  DNSRule *r = findRule(name.c_str(), wildcard);
+  if (!r) {
+    return false;
+  }
+  // keep probe chains intact
+  r->state = 2;
+  _ruleCount--;
+  return true;
 }
 
-bool DNSServer::requestIncludesOnlyOneQuestion()
+void DNSServer::clearRules()
 {
-  return ntohs(_DnsHeader->QuesCnt) == 1 &&
-         _DnsHeader->AnsCnt == 0 &&
-         _DnsHeader->AuthCnt == 0 &&
-         _DnsHeader->ResCnt == 0;
+  memset(_rules, 0, sizeof(_rules));
+  _ruleCount = 0;
+  _catchAll = false;
 }
 
+/*
+ * Exact name first, then "*.suffix" rules from the longest suffix to the
+ * shortest, then the catch-all. qname has been validated by the caller.
+ */
+const uint8_t *DNSServer::lookup(const uint8_t *qname, uint8_t labels)
+{
+  const uint8_t *p = qname;
+  for (uint8_t i = 0; _ruleCount && i < labels; i++) {
+    uint32_t hash = dns_hash_labels(p);
+    bool wildcard = (i > 0);
+    for (uint8_t s = 0; s < DNS_RULE_SLOTS; s++) {
+      DNSRule *r = &_rules[(hash + s) & (DNS_RULE_SLOTS - 1)];
+      if (r->state == 0) {
+        break;
+      }
+      if (r->state == 1 && r->hash == hash && r->wildcard == wildcard && dns_labels_equal(p, r->name)) {
+        return r->ip;
+      }
+    }
+    p += 1 + *p;
+  }
+  return _catchAll ? _catchAllIP : NULL;
+}
 
-String DNSServer::getDomainNameWithoutWwwPrefix()
+/*
+ * Turns the query in buf into its reply in place. Returns false when the
+ * packet is not a query this server answers and should be dropped.
+ */
+bool DNSServer::buildReply(uint8_t *buf, size_t &len)
 {
-  // Error checking : if the buffer containing the DNS request is a null pointer, return an empty domain
-  String parsedDomainName = "";
-  if (_buf == NULL) 
-    return parsedDomainName;
-  
-  // Check if packet is large enough to contain domain name
-  if (_CurPacketSize <= DNS_OFFSET_DOMAIN_NAME)
-    return parsedDomainName;
-  
-  // Set the start of the domain just after the header (12 bytes). If equal to null character, return an empty domain
-  unsigned char *start = _buf + DNS_OFFSET_DOMAIN_NAME;
-  if (*start == 0)
-  {
-    return parsedDomainName;
+  if (len < DNS_HEADER_SIZE || (buf[2] & 0x80)) {
+    return false;
   }
+  uint8_t opcode = (buf[2] >> 3) & 0x0F;
+  uint16_t qd = (buf[4] << 8) | buf[5];
+  uint16_t an = (buf[6] << 8) | buf[7];
+  uint16_t ns = (buf[8] << 8) | buf[9];
 
-  int pos = 0;
-  int maxLen = _CurPacketSize - DNS_OFFSET_DOMAIN_NAME;
-  
-  while(true)
-  {
-    // Check if we can read the label length byte
-    if (pos >= maxLen) {
-      return "";  // Invalid packet
-    }
-    
-    unsigned char labelLength = *(start + pos);
-    
-    // Check for terminator
-    if (labelLength == 0) {
-      downcaseAndRemoveWwwPrefix(parsedDomainName);
-      return parsedDomainName;
-    }
-    
-    // Validate label length (DNS labels are max 63 bytes)
-    if (labelLength > 63 || pos + labelLength >= maxLen) {
-      return "";  // Invalid packet
-    }
-    
-    // Read the label
-    for(int i = 0; i < labelLength; i++)
-    {
-      pos++;
-      if (pos >= maxLen) {
-        return "";  // Invalid packet
+  const uint8_t *ip = NULL;
+  bool answer = false;
+  size_t qEnd = 0;
+  if (opcode == DNS_OPCODE_QUERY && qd == 1 && !an && !ns) {
+    // walk the labels once; compression is not valid in a question here
+    size_t off = DNS_OFFSET_DOMAIN_NAME;
+    uint8_t labels = 0;
+    while (off < len && buf[off]) {
+      uint8_t l = buf[off];
+      if (l > 63 || off + 1 + l >= len) {
+        return false;
       }
-      parsedDomainName += (char)*(start + pos);
-    }
-    pos++;
-    
-    // Check if we can read the next byte (either next label length or terminator)
-    if (pos >= maxLen) {
-      return "";  // Invalid packet
-    }
-    
-    if (*(start + pos) == 0)
-    {
-      downcaseAndRemoveWwwPrefix(parsedDomainName);
-      return parsedDomainName;
+      off += 1 + l;
+      labels++;
     }
-    else
-    {
-      parsedDomainName += ".";
+    if (off + 5 > len || off - DNS_OFFSET_DOMAIN_NAME > 255) {
+      return false;
     }
+    qEnd = off + 5;
+    uint16_t qtype = (buf[off + 1] << 8) | buf[off + 2];
+    uint16_t qclass = (buf[off + 3] << 8) | buf[off + 4];
+    ip = lookup(buf + DNS_OFFSET_DOMAIN_NAME, labels);
+    answer = ip && (qclass & 0x7FFF) == DNS_CLASS_IN && (qtype == DNS_TYPE_HOST_ADDRESS || qtype == 255);
+  }
+
+  buf[2] |= 0x80;
+  // EDNS and other additional records are not echoed
+  buf[6] = 0;
+  buf[8] = buf[9] = 0;
+  buf[10] = buf[11] = 0;
+  if (!ip) {
+    // same as before: header only, carrying the error reply code
+    buf[3] = (uint8_t)_ErrReplyCode;
+    buf[4] = buf[5] = 0;
+    buf[7] = 0;
+    len = DNS_HEADER_SIZE;
+    _stats.rejected++;
+    return true;
   }
+  buf[3] = (uint8_t)DNSReplyCode::NoError;
+  buf[7] = answer ? 1 : 0;
+  len = qEnd;
+  if (answer) {
+    // pointer to the question name at offset 12
+    uint8_t *a = buf + qEnd;
+    a[0] = 0xC0;
+    a[1] = DNS_OFFSET_DOMAIN_NAME;
+    a[2] = 0;
+    a[3] = DNS_TYPE_HOST_ADDRESS;
+    a[4] = 0;
+    a[5] = DNS_CLASS_IN;
+    memcpy(a + 6, &_ttl, 4);
+    a[10] = 0;
+    a[11] = DNS_RDLENGTH_IPV4;
+    memcpy(a + 12, ip, 4);
+    len += DNS_ANSWER_SIZE;
+  }
+  _stats.answered++;
+  return true;
 }
 
-void DNSServer::replyWithIP()
+void DNSServer::processNextRequest()
 {
-  _Udp.beginPacket(_Udp.remoteIP(), _Udp.remotePort());
-  
-  // Change the type of message to a response and set the number of answers equal to 
-  // the number of questions in the header
-  _DnsHeader->QRFlag      = DNS_QR_RESPONSE;
-  _DnsHeader->AnsCnt = _DnsHeader->QuesCnt;
-  _Udp.write( (unsigned char*) _DnsHeader, DNS_HEADER_SIZE ) ;
-
-  // Write the question
-  _Udp.write(_DnsQuestion->QName, _DnsQuestion->QNameLength) ;
-  _Udp.write( (unsigned char*) &_DnsQuestion->QType, 2 ) ;
-  _Udp.write( (unsigned char*) &_DnsQuestion->QClass, 2 ) ;
-
-  // Write the answer 
-  // Use DNS name compression : instead of repeating the name in this RNAME occurrence,
-  // set the two MSB of the byte corresponding normally to the length to 1. The following
-  // 14 bits must be used to specify the offset of the domain name in the message 
-  // (<255 here so the first byte has the 6 LSB at 0) 
-  _Udp.write((uint8_t) 0xC0); 
-  _Udp.write((uint8_t) DNS_OFFSET_DOMAIN_NAME);  
-
-  // DNS type A : host address, DNS class IN for INternet, returning an IPv4 address 
-  uint16_t answerType = htons(DNS_TYPE_HOST_ADDRESS), answerClass = htons(DNS_CLASS_IN), answerIPv4 = htons(DNS_RDLENGTH_IPV4)  ; 
-  _Udp.write((unsigned char*) &answerType, 2 );
-  _Udp.write((unsigned char*) &answerClass, 2 );
-  _Udp.write((unsigned char*) &_ttl, 4);        // DNS Time To Live
-  _Udp.write((unsigned char*) &answerIPv4, 2 );
-  _Udp.write(_ResolveIP, sizeof(_ResolveIP)); // The IP address to return
-  _Udp.endPacket();
-
+  processRequests(0);
 }
 
-void DNSServer::replyWithCustomCode()
+int DNSServer::processRequests(uint32_t timeout_ms)
 {
-  _DnsHeader->QRFlag = DNS_QR_RESPONSE;
-  _DnsHeader->RspCode = (unsigned char)_ErrReplyCode;
-  _DnsHeader->QuesCnt = 0;
+  WiFiUDPPacket replies[DNS_RX_PACKETS];
+  int total = 0;
+  int batches = 0;
+  int n;
 
-  _Udp.beginPacket(_Udp.remoteIP(), _Udp.remotePort());
-  _Udp.write((unsigned char*)_DnsHeader, sizeof(DNSHeader));
-  _Udp.endPacket();
+  // the pool holds DNS_RX_PACKETS, so read until the socket is empty or
+  // DNS_RX_BATCHES are done; only the first read waits
+  do {
+    int count = 0;
+    n = _Udp.receivePackets(timeout_ms);
+    timeout_ms = 0;
+    for (int i = 0; i < n; i++) {
+      const WiFiUDPPacket *p = _Udp.packet(i);
+      size_t len = p->len;
+      _stats.received++;
+      if (len > DNS_MAX_PACKET || !buildReply(p->data, len)) {
+        _stats.dropped++;
+        continue;
+      }
+      replies[count] = *p;
+      replies[count].len = len;
+      count++;
+    }
+    if (count) {
+      // the replies point into the pool, send them before the next read
+      int sent = _Udp.sendPackets(replies, count);
+      _stats.dropped += count - sent;
+      total += sent;
+    }
+  } while (n > 0 && ++batches < DNS_RX_BATCHES);
+  return total;
 }
@@ -8,6 +8,13 @@
 #define DNS_DEFAULT_TTL 60        // Default Time To Live : time interval in seconds that the resource record should be cached before being discarded
 #define DNS_OFFSET_DOMAIN_NAME 12 // Offset in bytes to reach the domain name in the DNS message 
 #define DNS_HEADER_SIZE 12 
+#define DNS_MAX_PACKET 512        // plain DNS over UDP, no EDNS
+#define DNS_ANSWER_SIZE 16        // compressed name + type/class/ttl/rdlength + IPv4
+#define DNS_RX_PACKETS 4          // queries read per batch
+#define DNS_RX_BATCHES 4          // batches per processRequests(), so a flood cannot hold the loop
+#define DNS_MAX_RULES 12
+#define DNS_RULE_SLOTS 16         // hash table size, power of two > DNS_MAX_RULES
+#define DNS_RULE_NAME_MAX 64
 
 enum class DNSReplyCode
 {
@@ -72,12 +79,25 @@ struct DNSQuestion
   uint16_t  QClass ; 
 } ; 
 
+struct DNSServerStats
+{
+  uint32_t received;  // queries read from the socket
+  uint32_t answered;  // replies carrying an address, or NODATA for other types
+  uint32_t rejected;  // replies with the error reply code
+  uint32_t dropped;   // malformed packets, responses and failed sends
+};
+
 class DNSServer
 {
   public:
     DNSServer();
     ~DNSServer();
+    // kept for compatibility, same as processRequests(0)
     void processNextRequest();
+    // answers the queries already queued, up to DNS_RX_BATCHES * DNS_RX_PACKETS
+    // (waiting up to timeout_ms for the first one), from preallocated buffers;
+    // the rest wait for the next call. Returns the number of replies sent
+    int processRequests(uint32_t timeout_ms = 0);
     void setErrorReplyCode(const DNSReplyCode &replyCode);
     void setTTL(const uint32_t &ttl);
 
@@ -88,23 +108,39 @@ class DNSServer
     // stops the DNS server
     void stop();
 
+    // "name", "*.suffix" (any name below suffix) or "*" (everything else);
+    // adding a rule for an existing name replaces its address
+    bool addRule(const String &domain, const IPAddress &ip);
+    bool removeRule(const String &domain);
+    void clearRules();
+
+    const DNSServerStats &stats() const { return _stats; }
+    void resetStats();
+
   private:
+    struct DNSRule
+    {
+      uint32_t hash;
+      uint8_t  state;     // 0 empty, 1 used, 2 deleted
+      bool     wildcard;
+      uint8_t  ip[4];
+      char     name[DNS_RULE_NAME_MAX];
+    };
+
     WiFiUDP     _Udp;
     uint16_t    _port;
-    String      _domain;
-    unsigned char   _ResolveIP[4];
-    int             _CurPacketSize;
-    unsigned char*  _buf;
-    DNSHeader*      _DnsHeader;
     uint32_t        _ttl;
     DNSReplyCode    _ErrReplyCode;
-    DNSQuestion*    _DnsQuestion ; 
-
+    DNSRule         _rules[DNS_RULE_SLOTS];
+    uint8_t         _ruleCount;
+    bool            _catchAll;
+    uint8_t         _catchAllIP[4];
+    DNSServerStats  _stats;
 
     void downcaseAndRemoveWwwPrefix(String &domainName);
-    String getDomainNameWithoutWwwPrefix();
-    bool requestIncludesOnlyOneQuestion();
-    void replyWithIP();
-    void replyWithCustomCode();
+    bool parseRule(const String &domain, String &name, bool &wildcard);
+    DNSRule *findRule(const char *name, bool wildcard);
+    const uint8_t *lookup(const uint8_t *qname, uint8_t labels);
+    bool buildReply(uint8_t *buf, size_t &len);
 };
 #endif
@@ -0,0 +1,69 @@
+/**
+ * HttpKeepAlive.ino
+ *
+ * Sends several requests to the same server; after the first one they reuse
+ * the connection kept by HTTPPool, and the pool statistics show the hit rate.
+ */
+
+#include <Arduino.h>
+
+#include <WiFi.h>
+
+#include <HTTPClient.h>
+#define USE_SERIAL Serial
+
+HTTPClient http;
+void setup() {
+
+    USE_SERIAL.begin(115200);
+
+    for(uint8_t t = 4; t > 0; t--) {
+        USE_SERIAL.print("[SETUP] WAIT ...");
+        USE_SERIAL.println(t);
+        USE_SERIAL.flush();
+        delay(1000);
+    }
+
+    // at most two parked connections, closed after 20 s without use
+    HTTPPool.setMaxConnections(2);
+    HTTPPool.setIdleTimeout(20 * 1000);
+
+    WiFi.begin("your_ssid", "your_passwd");
+}
+
+void loop() {
+    if((WiFi.status() == WSS_GOT_IP)) {
+        http.begin("http://httpbin.org/get");
+
+        for (int i = 0; i < 5; i++) {
+            http_client_response_t http_response = {0};
+            unsigned long start = millis();
+            http_client_status_t http_status = http.GET(NULL, 0, NULL, 0, &http_response);
+            if (http_status != HTTP_CLIENT_SUCCESS) {
+                USE_SERIAL.print("http_request_send error:");
+                USE_SERIAL.println(http_status);
+                break;
+            }
+            USE_SERIAL.print("status ");
+            USE_SERIAL.print(http_response.status_code);
+            USE_SERIAL.print(", ");
+            USE_SERIAL.print(http_response.body_length);
+            USE_SERIAL.print(" bytes in ");
+            USE_SERIAL.print(millis() - start);
+            USE_SERIAL.println(" ms");
+            http.end(&http_response);
+        }
+
+        const HTTPPoolStats &stats = HTTPPool.stats();
+        USE_SERIAL.print("requests: ");
+        USE_SERIAL.print(stats.requests);
+        USE_SERIAL.print(", reused: ");
+        USE_SERIAL.print(stats.reused);
+        USE_SERIAL.print(", opened: ");
+        USE_SERIAL.print(stats.opened);
+        USE_SERIAL.print(", hit rate: ");
+        USE_SERIAL.print(HTTPPool.hitRate());
+        USE_SERIAL.println("%");
+    }
+    delay(10000);
+}
@@ -0,0 +1,75 @@
+/**
+ * HttpResumableDownload.ino
+ *
+ * Downloads a large file to LittleFS with HTTPDownloader: the file is split
+ * into segments fetched over parallel connections, progress is saved next to
+ * the file, and a download cut off by a network failure or a reset continues
+ * where it stopped on the next attempt.
+ */
+
+#include <Arduino.h>
+
+#include <WiFi.h>
+
+#include <HTTPDownloader.h>
+#include "File.h"
+#define USE_SERIAL Serial
+
+HTTPDownloader downloader;
+VFSFILE fs(LITTLEFS);
+bool done = false;
+
+void setup() {
+
+    USE_SERIAL.begin(115200);
+
+    for(uint8_t t = 4; t > 0; t--) {
+        USE_SERIAL.print("[SETUP] WAIT ...");
+        USE_SERIAL.println(t);
+        USE_SERIAL.flush();
+        delay(1000);
+    }
+
+    downloader.setSegments(2);
+    // CRC32 of the expected file, 0 skips the check
+    downloader.setCRC32(0);
+    downloader.onProgress([](size_t downloaded, size_t total, uint32_t bytesPerSecond) {
+        USE_SERIAL.print(downloaded);
+        USE_SERIAL.print(" / ");
+        USE_SERIAL.print(total);
+        USE_SERIAL.print(" bytes, ");
+        USE_SERIAL.print(bytesPerSecond / 1024);
+        USE_SERIAL.println(" KB/s");
+    });
+
+    WiFi.begin("your_ssid", "your_passwd");
+}
+
+void loop() {
+    if(!done && (WiFi.status() == WSS_GOT_IP)) {
+        http_dl_result_t res = downloader.download("http://example.com/firmware.bin", fs, "/firmware.bin");
+        switch (res) {
+        case HTTP_DL_OK:
+            USE_SERIAL.print("complete, ");
+            USE_SERIAL.print(downloader.total());
+            USE_SERIAL.print(" bytes at ");
+            USE_SERIAL.print(downloader.throughput() / 1024);
+            USE_SERIAL.println(" KB/s");
+            done = true;
+            break;
+        case HTTP_DL_ERR_NETWORK:
+            // progress is kept, the next call resumes
+            USE_SERIAL.println("network error, retrying");
+            break;
+        case HTTP_DL_ERR_CHECKSUM:
+            USE_SERIAL.println("checksum mismatch, starting over");
+            break;
+        default:
+            USE_SERIAL.print("download failed: ");
+            USE_SERIAL.println(res);
+            done = true;
+            break;
+        }
+    }
+    delay(5000);
+}
@@ -0,0 +1,66 @@
+/**
+ * HttpStreamDownload.ino
+ *
+ * Downloads a file to LittleFS with the streaming API: the headers are read
+ * first, then the body goes to the file through a 512 byte buffer, so the
+ * size of the download does not depend on free RAM.
+ */
+
+#include <Arduino.h>
+
+#include <WiFi.h>
+
+#include <HTTPClient.h>
+#include "File.h"
+#define USE_SERIAL Serial
+
+HTTPClient http;
+VFSFILE fs(LITTLEFS);
+bool done = false;
+
+void setup() {
+
+    USE_SERIAL.begin(115200);
+
+    for(uint8_t t = 4; t > 0; t--) {
+        USE_SERIAL.print("[SETUP] WAIT ...");
+        USE_SERIAL.println(t);
+        USE_SERIAL.flush();
+        delay(1000);
+    }
+
+    WiFi.begin("your_ssid", "your_passwd");
+}
+
+void loop() {
+    if(!done && (WiFi.status() == WSS_GOT_IP)) {
+        http.begin("http://httpbin.org/bytes/65536");
+
+        int code = http.sendRequest("GET");
+        if (code != 200) {
+            USE_SERIAL.print("request failed: ");
+            USE_SERIAL.println(code);
+            http.end();
+            delay(5000);
+            return;
+        }
+        USE_SERIAL.print("Content-Type: ");
+        USE_SERIAL.println(http.header("Content-Type"));
+        USE_SERIAL.print("size: ");
+        USE_SERIAL.println(http.getSize());
+
+        unsigned long start = millis();
+        int written = http.writeToFile(fs, "/download.bin");
+        http.end();
+
+        USE_SERIAL.print("written ");
+        USE_SERIAL.print(written);
+        USE_SERIAL.print(" bytes in ");
+        USE_SERIAL.print(millis() - start);
+        USE_SERIAL.println(" ms");
+        USE_SERIAL.print("file size: ");
+        USE_SERIAL.println(fs.filesize("/download.bin"));
+        done = true;
+    }
+    delay(1000);
+}
@@ -0,0 +1,74 @@
+/**
+ * HttpUpload.ino
+ *
+ * Uploads a binary buffer with an explicit length, a generated body sent
+ * with chunked transfer encoding, and a file from the SD card as
+ * multipart/form-data, without loading the file into RAM.
+ */
+
+#include <Arduino.h>
+
+#include <WiFi.h>
+
+#include <HTTPClient.h>
+#include "File.h"
+#define USE_SERIAL Serial
+
+HTTPClient http;
+VFSFILE sd(SDCARD);
+bool done = false;
+
+void setup() {
+
+    USE_SERIAL.begin(115200);
+
+    for(uint8_t t = 4; t > 0; t--) {
+        USE_SERIAL.print("[SETUP] WAIT ...");
+        USE_SERIAL.println(t);
+        USE_SERIAL.flush();
+        delay(1000);
+    }
+
+    WiFi.begin("your_ssid", "your_passwd");
+}
+
+void loop() {
+    if(!done && (WiFi.status() == WSS_GOT_IP)) {
+        http.begin("http://httpbin.org/post");
+
+        // 1. binary body: zero bytes are sent as well
+        uint8_t pcm[256];
+        for (int i = 0; i < (int)sizeof(pcm); i++) {
+            pcm[i] = i;
+        }
+        http_client_header_t headers[] = {{.key = "Content-Type", .value = "application/octet-stream"}};
+        http_client_response_t http_response = {0};
+        if (http.POST(headers, 1, NULL, 0, pcm, sizeof(pcm), &http_response) == HTTP_CLIENT_SUCCESS) {
+            USE_SERIAL.print("binary POST: ");
+            USE_SERIAL.println(http_response.status_code);
+        }
+        http.end(&http_response);
+
+        // 2. body produced while sending, length unknown: chunked
+        int blocks = 0;
+        int code = http.streamRequest("POST", headers, 1, [&blocks](uint8_t *buf, size_t size) {
+            if (blocks == 8) {
+                return 0;
+            }
+            memset(buf, '0' + blocks++, size);
+            return (int)size;
+        });
+        USE_SERIAL.print("chunked POST: ");
+        USE_SERIAL.println(code);
+        http.end();
+
+        // 3. file from the SD card as multipart/form-data
+        code = http.sendMultipart("POST", NULL, 0, sd, "/record.wav", "file", "audio/wav");
+        USE_SERIAL.print("multipart POST: ");
+        USE_SERIAL.println(code);
+        http.end();
+
+        done = true;
+    }
+    delay(1000);
+}
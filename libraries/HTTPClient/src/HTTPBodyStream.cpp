@@ -0,0 +1,201 @@
+#include "HTTPBodyStream.h"
+#include <ctype.h>
+
+HTTPBodyStream::HTTPBodyStream()
+{
+    reset();
+}
+
+void HTTPBodyStream::reset()
+{
+    _client = NULL;
+    _pre = NULL;
+    _preLen = 0;
+    _framing = HTTP_BODY_NONE;
+    _length = 0;
+    _remaining = 0;
+    _pos = 0;
+    _state = BODY_DONE;
+    _lineLen = 0;
+    _digits = 0;
+}
+
+void HTTPBodyStream::begin(WiFiClient *client, const uint8_t *pre, size_t preLen, http_body_framing_t framing, long length)
+{
+    reset();
+    _client = client;
+    _pre = pre;
+    _preLen = preLen;
+    _framing = framing;
+    _length = (framing == HTTP_BODY_LENGTH) ? length : -1;
+    switch (framing) {
+    case HTTP_BODY_LENGTH:
+        _remaining = length;
+        _state = length ? BODY_DATA : BODY_DONE;
+        break;
+    case HTTP_BODY_CHUNKED:
+        _state = BODY_CHUNK_SIZE;
+        break;
+    case HTTP_BODY_EOF:
+        _state = BODY_DATA;
+        break;
+    default:
+        _length = 0;
+        break;
+    }
+}
+
+int HTTPBodyStream::_rawAvailable()
+{
+    int n = _preLen;
+    if (_client) {
+        int avail = _client->available();
+        if (avail > 0) {
+            n += avail;
+        }
+    }
+    return n;
+}
+
+int HTTPBodyStream::_rawRead(uint8_t *buf, size_t size)
+{
+    if (_preLen) {
+        size_t n = (size < _preLen) ? size : _preLen;
+        memcpy(buf, _pre, n);
+        _pre += n;
+        _preLen -= n;
+        return n;
+    }
+    if (!_client || !_client->available()) {
+        return 0;
+    }
+    int n = _client->read(buf, size);
+    return (n > 0) ? n : 0;
+}
+
+// consumes chunk framing until data, the end of the body or no more bytes
+bool HTTPBodyStream::_advance()
+{
+    uint8_t c;
+    while (_state != BODY_DATA && _state < BODY_DONE) {
+        if (_rawRead(&c, 1) != 1) {
+            if (!_client || !_client->connected()) {
+                _state = BODY_FAILED;
+            }
+            return false;
+        }
+        switch (_state) {
+        case BODY_CHUNK_SIZE:
+            if (isxdigit(c)) {
+                if (++_digits > 7) {
+                    _state = BODY_FAILED;
+                    break;
+                }
+                _remaining = (_remaining << 4) | (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+                break;
+            }
+            if (c == ';' || c == ' ' || c == '\t') {
+                _state = BODY_CHUNK_EXT;
+                break;
+            }
+            if (c == '\r') {
+                break;
+            }
+            // fall through
+        case BODY_CHUNK_EXT:
+            if (c != '\n') {
+                if (_state == BODY_CHUNK_SIZE) {
+                    _state = BODY_FAILED;
+                }
+                break;
+            }
+            if (!_digits) {
+                _state = BODY_FAILED;
+                break;
+            }
+            _digits = 0;
+            _lineLen = 0;
+            _state = _remaining ? BODY_DATA : BODY_TRAILER;
+            break;
+        case BODY_CHUNK_END:
+            if (c == '\n') {
+                _state = BODY_CHUNK_SIZE;
+                _remaining = 0;
+            } else if (c != '\r') {
+                _state = BODY_FAILED;
+            }
+            break;
+        case BODY_TRAILER:
+            // trailer fields are skipped up to the empty line
+            if (c == '\n') {
+                if (!_lineLen) {
+                    _state = BODY_DONE;
+                }
+                _lineLen = 0;
+            } else if (c != '\r') {
+                _lineLen = 1;
+            }
+            break;
+        }
+    }
+    return _state == BODY_DATA;
+}
+
+int HTTPBodyStream::available()
+{
+    if (!_advance()) {
+        return 0;
+    }
+    int n = _rawAvailable();
+    if (_framing != HTTP_BODY_EOF && (size_t)n > _remaining) {
+        n = _remaining;
+    }
+    return n;
+}
+
+int HTTPBodyStream::read(uint8_t *buf, size_t size)
+{
+    if (!_advance()) {
+        return (_state == BODY_FAILED) ? -1 : 0;
+    }
+    if (_framing != HTTP_BODY_EOF && size > _remaining) {
+        size = _remaining;
+    }
+    int n = _rawRead(buf, size);
+    if (!n) {
+        if (!_client || !_client->connected()) {
+            _state = (_framing == HTTP_BODY_EOF) ? BODY_DONE : BODY_FAILED;
+        }
+        return (_state == BODY_FAILED) ? -1 : 0;
+    }
+    _pos += n;
+    if (_framing != HTTP_BODY_EOF) {
+        _remaining -= n;
+        if (!_remaining) {
+            _state = (_framing == HTTP_BODY_CHUNKED) ? BODY_CHUNK_END : BODY_DONE;
+        }
+    }
+    return n;
+}
+
+int HTTPBodyStream::read()
+{
+    uint8_t c;
+    return (read(&c, 1) == 1) ? c : -1;
+}
+
+int HTTPBodyStream::peek()
+{
+    if (!_advance()) {
+        return -1;
+    }
+    if (_preLen) {
+        return *_pre;
+    }
+    return _client ? _client->peek() : -1;
+}
+
+bool HTTPBodyStream::reusable()
+{
+    return _framing != HTTP_BODY_EOF && _state == BODY_DONE && !_preLen && (!_client || !_client->available());
+}
@@ -0,0 +1,71 @@
+#ifndef HTTPBodyStream_H_
+#define HTTPBodyStream_H_
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+typedef enum {
+    HTTP_BODY_NONE = 0,     // HEAD, 204, 304 or Content-Length: 0
+    HTTP_BODY_LENGTH,       // Content-Length
+    HTTP_BODY_CHUNKED,      // Transfer-Encoding: chunked
+    HTTP_BODY_EOF,          // ends when the server closes
+} http_body_framing_t;
+
+/*
+ * Response body of a streaming HTTPClient request. Bytes that arrived with
+ * the headers are returned first, then the socket is read directly; chunked
+ * framing is removed on the fly, so only the caller's buffer is needed. The
+ * stream never blocks: available() and read() return what is there now.
+ */
+class HTTPBodyStream : public Stream
+{
+public:
+    HTTPBodyStream();
+
+    void begin(WiFiClient *client, const uint8_t *pre, size_t preLen, http_body_framing_t framing, long length);
+    void reset();
+
+    int available() override;
+    int read() override;
+    int read(uint8_t *buf, size_t size);
+    int peek() override;
+    size_t write(uint8_t) override { return 0; }
+
+    // Content-Length, -1 for chunked or close-delimited bodies
+    long size() const { return _length; }
+    // body bytes returned so far
+    size_t position() const { return _pos; }
+    bool finished() const { return _state == BODY_DONE; }
+    // framing error, or the connection closed before the body was complete
+    bool failed() const { return _state == BODY_FAILED; }
+    // the connection carries nothing past the body and may be reused
+    bool reusable();
+
+private:
+    enum {
+        BODY_DATA = 0,
+        BODY_CHUNK_SIZE,
+        BODY_CHUNK_EXT,
+        BODY_CHUNK_END,
+        BODY_TRAILER,
+        BODY_DONE,
+        BODY_FAILED,
+    };
+
+    WiFiClient *_client;
+    const uint8_t *_pre;
+    size_t _preLen;
+    http_body_framing_t _framing;
+    long _length;
+    size_t _remaining;      // of the body or of the current chunk
+    size_t _pos;
+    uint8_t _state;
+    uint8_t _lineLen;
+    uint8_t _digits;
+
+    int _rawAvailable();
+    int _rawRead(uint8_t *buf, size_t size);
+    bool _advance();
+};
+
+#endif
@@ -1,12 +1,18 @@
 #include  <Arduino.h>
 #include "HTTPClient.h"
 #include "tal_log.h"
+#include "tal_memory.h"
+#include "tal_system.h"
+
+HTTPClientStats HTTPClient::_globalStats;
+
 HTTPClient::HTTPClient()
 {
 }
 
 HTTPClient::~HTTPClient()
 {
+    closeRequest();
 }
 
 bool HTTPClient::begin(String url)
@@ -65,94 +71,673 @@ bool HTTPClient::beginInternal(String url)
 
 http_client_status_t HTTPClient::GET(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca , size_t ca_len ,http_client_response_t *response)
 {
-    /* HTTP headers */
-    PR_DEBUG("http request send!");
-    const http_client_request_t http_request = {
-            .host = _host.c_str(),
-            .path = _path.c_str(),
-            .cacert = ca,
-            .cacert_len = ca_len,
-            .method = "GET",
-            .headers = headers,
-            .headers_count = headers_length,
-            .body = NULL,
-            .body_length = 0,
-            .timeout_ms = 5000
-        };
-    http_client_status_t http_status = http_client_request(&http_request, response);
-    if (HTTP_CLIENT_SUCCESS != http_status) {
-        PR_ERR("http_request_send error:%d", http_status);
-    }
-    return http_status;
+    return request("GET", headers, headers_length, ca, ca_len, NULL, 0, response);
 }
 
 http_client_status_t  HTTPClient::POST(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response)
+{
+    return request("POST", headers, headers_length, ca, ca_len, body, body ? strlen((const char *)body) : 0, response);
+}
+
+http_client_status_t HTTPClient::PUT(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response)
+{
+    return request("PUT", headers, headers_length, ca, ca_len, body, body ? strlen((const char *)body) : 0, response);
+}
+
+http_client_status_t HTTPClient:: PATCH(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response)
+{
+    return request("PATCH", headers, headers_length, ca, ca_len, body, body ? strlen((const char *)body) : 0, response);
+}
+
+http_client_status_t HTTPClient::POST(http_client_header_t *headers, uint8_t headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length, http_client_response_t *response)
+{
+    return request("POST", headers, headers_length, ca, ca_len, body, body_length, response);
+}
+
+http_client_status_t HTTPClient::PUT(http_client_header_t *headers, uint8_t headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length, http_client_response_t *response)
+{
+    return request("PUT", headers, headers_length, ca, ca_len, body, body_length, response);
+}
+
+http_client_status_t HTTPClient::PATCH(http_client_header_t *headers, uint8_t headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length, http_client_response_t *response)
+{
+    return request("PATCH", headers, headers_length, ca, ca_len, body, body_length, response);
+}
+
+http_client_status_t HTTPClient::request(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                                         const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length,
+                                         http_client_response_t *response)
 {
     PR_DEBUG("http request send!");
-    const http_client_request_t http_request = {
-            .host = _host.c_str(),
-            .path = _path.c_str(),
-            .cacert = ca,
-            .cacert_len = ca_len,
-            .method = "POST",
-            .headers = headers,
-            .headers_count = headers_length,
-            .body = body,
-            .body_length = body?strlen((const char*)body):0,
-            .timeout_ms = 5000
-        };
-    http_client_status_t http_status = http_client_request(&http_request, response);
+    http_client_status_t http_status;
+    // https joins the pool when the shared CA bundle can verify the server;
+    // a CA passed here is handled by http_client_request()
+    bool pooled = _reuse && (_protocol == "http" || (_protocol == "https" && !ca && WiFiClientSecure::hasCABundle()));
+    if (pooled) {
+        const http_request_body_t req_body = {body, body_length, NULL, 0, NULL};
+        bool tooLarge = false;
+        http_status = pooledRequest(method, headers, headers_length, &req_body, response, &tooLarge);
+        if (tooLarge) {
+            PR_DEBUG("http response larger than %d, sent again without the pool", HTTP_RESPONSE_MAX_SIZE);
+            pooled = false;
+        }
+    }
+    if (!pooled) {
+        const http_client_request_t http_request = {
+                .host = _host.c_str(),
+                .path = _path.c_str(),
+                .cacert = ca,
+                .cacert_len = ca_len,
+                .method = method,
+                .headers = headers,
+                .headers_count = headers_length,
+                .body = body,
+                .body_length = body_length,
+                .timeout_ms = HTTP_CLIENT_TIMEOUT_MS
+            };
+        http_status = http_client_request(&http_request, response);
+        count(&HTTPClientStats::requests, 1);
+        if (HTTP_CLIENT_SUCCESS != http_status) {
+            count(&HTTPClientStats::failures, 1);
+        } else {
+            count(&HTTPClientStats::bytesIn, response->buffer_length);
+        }
+    }
     if (HTTP_CLIENT_SUCCESS != http_status) {
         PR_ERR("http_request_send error:%d", http_status);
     }
     return http_status;
 }
 
-http_client_status_t HTTPClient::PUT(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response)
+http_client_status_t HTTPClient::pooledRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                                               const http_request_body_t *body, http_client_response_t *response,
+                                               bool *tooLarge)
 {
-    PR_DEBUG("http request send!");
-    const http_client_request_t http_request = {
-            .host = _host.c_str(),
-            .path = _path.c_str(),
-            .cacert = ca,
-            .cacert_len = ca_len,
-            .method = "PUT",
-            .headers = headers,
-            .headers_count = headers_length,
-            .body = body,
-            .body_length = body?strlen((const char*)body):0,
-            .timeout_ms = 5000
-        };
-    http_client_status_t http_status = http_client_request(&http_request, response);
+    int status = 0;
+    http_client_status_t http_status = openRequest(method, headers, headers_length, body, &status);
     if (HTTP_CLIENT_SUCCESS != http_status) {
-        PR_ERR("http_request_send error:%d", http_status);
+        return http_status;
+    }
+
+    // a response over HTTP_RESPONSE_MAX_SIZE is left to http_client_request()
+    // when the request may be sent twice; POST and PATCH are read whole here,
+    // and so is https, as the SDK client cannot verify against the CA bundle
+    bool resend = strcmp(method, "POST") && strcmp(method, "PATCH") && _protocol == "http";
+    size_t limit = resend ? HTTP_RESPONSE_MAX_SIZE : SIZE_MAX;
+
+    // head and body end up in one buffer, as with http_client_request()
+    long size = _stream.size();
+    size_t cap = _headEnd + ((size >= 0) ? size : HTTP_RESPONSE_CHUNK_SIZE) + 1;
+    if (cap > limit) {
+        *tooLarge = true;
+        closeRequest();
+        return HTTP_CLIENT_SEND_FAULT;
+    }
+    uint8_t *buf = (uint8_t *)tal_malloc(cap);
+    if (!buf) {
+        closeRequest();
+        return HTTP_CLIENT_MALLOC_FAULT;
     }
+    memcpy(buf, _head, _headEnd);
+    size_t len = _headEnd;
+    bool oom = false;
+    int n = writeToCallback([&](const uint8_t *data, size_t dlen) {
+        if (len + dlen + 1 > cap) {
+            size_t grow = cap;
+            while (len + dlen + 1 > grow) {
+                grow *= 2;
+            }
+            if (grow > limit) {
+                *tooLarge = true;
+                return false;
+            }
+            uint8_t *bigger = (uint8_t *)tal_malloc(grow);
+            if (!bigger) {
+                oom = true;
+                return false;
+            }
+            memcpy(bigger, buf, len);
+            tal_free(buf);
+            buf = bigger;
+            cap = grow;
+        }
+        memcpy(buf + len, data, dlen);
+        len += dlen;
+        return true;
+    });
+    size_t headEnd = _headEnd;
+    closeRequest();
+    if (n < 0) {
+        tal_free(buf);
+        return oom ? HTTP_CLIENT_MALLOC_FAULT : HTTP_CLIENT_SEND_FAULT;
+    }
+
+    buf[len] = '\0';
+    memset(response, 0, sizeof(*response));
+    response->buffer = buf;
+    response->buffer_length = len;
+    response->body = buf + headEnd;
+    response->body_length = len - headEnd;
+    response->status_code = status;
+    _pooledBuffers.push_back(buf);
+    return HTTP_CLIENT_SUCCESS;
+}
+
+http_client_status_t HTTPClient::openRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                                             const http_request_body_t *body, int *status)
+{
+    uint16_t port = _port ? _port : defaultPort();
+    http_client_status_t http_status = HTTP_CLIENT_SEND_FAULT;
+
+    closeRequest();
+    count(&HTTPClientStats::requests, 1);
+    for (int attempt = 0; attempt < 2; attempt++) {
+        bool reused = false;
+        unsigned long start = millis();
+        WiFiClient *client = HTTPPool.acquire(_protocol.c_str(), _host.c_str(), port, HTTP_CLIENT_TIMEOUT_MS, &reused);
+        if (!client) {
+            count(&HTTPClientStats::failures, 1);
+            return HTTP_CLIENT_SEND_FAULT;
+        }
+        if (!reused) {
+            latency(&HTTPClientStats::connect, millis() - start);
+        }
+        size_t received = 0;
+        if (!writeRequest(client, method, headers, headers_length, body)) {
+            http_status = HTTP_CLIENT_SEND_FAULT;
+        } else {
+            http_status = readHead(client, !strcmp(method, "HEAD"), status, &received);
+        }
+        if (HTTP_CLIENT_SUCCESS == http_status) {
+            _client = client;
+            return http_status;
+        }
+        HTTPPool.release(client, false);
+        closeRequest();
+        // the server may have closed a parked connection just before it was
+        // reused; that fails before the first response byte, so try once more
+        // on a fresh connection. A provider body cannot be produced twice.
+        if (HTTP_CLIENT_MALLOC_FAULT != http_status && reused && !received && !body->provider) {
+            PR_DEBUG("reused connection to %s dropped, retrying", _host.c_str());
+            continue;
+        }
+        break;
+    }
+    count(&HTTPClientStats::failures, 1);
     return http_status;
 }
 
-http_client_status_t HTTPClient:: PATCH(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response)
+bool HTTPClient::writeRequest(WiFiClient *client, const char *method, http_client_header_t *headers, uint8_t headers_length,
+                              const http_request_body_t *body)
 {
-    PR_DEBUG("http request send!");
-    const http_client_request_t http_request = {
-            .host = _host.c_str(),
-            .path = _path.c_str(),
-            .cacert = ca,
-            .cacert_len = ca_len,
-            .method = "PATCH",
-            .headers = headers,
-            .headers_count = headers_length,
-            .body = body,
-            .body_length = body?strlen((const char*)body):0,
-            .timeout_ms = 5000
-        };
-    http_client_status_t http_status = http_client_request(&http_request, response);
+    size_t size = strlen(method) + _path.length() + _host.length() + 96;
+    for (uint8_t i = 0; i < headers_length; i++) {
+        size += strlen(headers[i].key) + strlen(headers[i].value) + 4;
+    }
+    if (body->contentType) {
+        size += strlen(body->contentType) + 16;
+    }
+    char *head = (char *)tal_malloc(size);
+    if (!head) {
+        return false;
+    }
+    int len = snprintf(head, size, "%s %s HTTP/1.1\r\nHost: %s", method, _path.c_str(), _host.c_str());
+    if (_port && _port != defaultPort()) {
+        len += snprintf(head + len, size - len, ":%d", _port);
+    }
+    len += snprintf(head + len, size - len, "\r\nConnection: %s\r\n", _reuse ? "keep-alive" : "close");
+    for (uint8_t i = 0; i < headers_length; i++) {
+        len += snprintf(head + len, size - len, "%s: %s\r\n", headers[i].key, headers[i].value);
+    }
+    if (body->contentType) {
+        len += snprintf(head + len, size - len, "Content-Type: %s\r\n", body->contentType);
+    }
+    if (body->provider && body->providerLength < 0) {
+        len += snprintf(head + len, size - len, "Transfer-Encoding: chunked\r\n");
+    } else if (body->provider) {
+        len += snprintf(head + len, size - len, "Content-Length: %ld\r\n", body->providerLength);
+    } else if (body->data || strcmp(method, "GET")) {
+        len += snprintf(head + len, size - len, "Content-Length: %u\r\n", (unsigned)body->length);
+    }
+    len += snprintf(head + len, size - len, "\r\n");
+    bool sent = send(client, (const uint8_t *)head, len);
+    tal_free(head);
+    return sent && writeBody(client, body);
+}
+
+bool HTTPClient::send(WiFiClient *client, const uint8_t *data, size_t len)
+{
+    size_t n = client->write(data, len);
+    count(&HTTPClientStats::bytesOut, n);
+    return n == len;
+}
+
+#define HTTP_CHUNK_HEAD     (6)     // "FFF\r\n" right-aligned in front of the data
+
+bool HTTPClient::writeBody(WiFiClient *client, const http_request_body_t *body)
+{
+    if (!body->provider) {
+        return !body->length || send(client, body->data, body->length);
+    }
+    bool chunked = body->providerLength < 0;
+    uint8_t *buf = (uint8_t *)tal_malloc(HTTP_CHUNK_HEAD + HTTP_STREAM_BUFFER_SIZE + 2);
+    if (!buf) {
+        return false;
+    }
+    uint8_t *data = buf + HTTP_CHUNK_HEAD;
+    size_t sent = 0;
+    bool ok = true;
+    while (ok) {
+        size_t want = HTTP_STREAM_BUFFER_SIZE;
+        if (!chunked && (size_t)body->providerLength - sent < want) {
+            want = body->providerLength - sent;
+        }
+        if (!want) {
+            break;
+        }
+        int n = (*body->provider)(data, want);
+        if (n <= 0) {
+            // a provider that ends early cannot satisfy Content-Length
+            ok = !n && chunked;
+            break;
+        }
+        if (chunked) {
+            // one write per chunk: size line in front, CRLF behind the data
+            char line[HTTP_CHUNK_HEAD + 1];
+            int l = snprintf(line, sizeof(line), "%X\r\n", n);
+            memcpy(data - l, line, l);
+            data[n] = '\r';
+            data[n + 1] = '\n';
+            ok = send(client, data - l, l + n + 2);
+        } else {
+            ok = send(client, data, n);
+        }
+        sent += n;
+    }
+    if (ok && chunked) {
+        ok = send(client, (const uint8_t *)"0\r\n\r\n", 5);
+    }
+    if (!ok) {
+        PR_ERR("http request body failed after %u bytes", (unsigned)sent);
+    }
+    tal_free(buf);
+    return ok;
+}
+
+static const char *http_find_header(const char *head, size_t len, const char *name, size_t *vlen)
+{
+    size_t nlen = strlen(name);
+    const char *end = head + len;
+    const char *p = strstr(head, "\r\n");
+    while (p && p + 2 < end) {
+        p += 2;
+        if ((size_t)(end - p) > nlen && !strncasecmp(p, name, nlen) && p[nlen] == ':') {
+            const char *v = p + nlen + 1;
+            while (*v == ' ' || *v == '\t') {
+                v++;
+            }
+            const char *e = strstr(v, "\r\n");
+            *vlen = e ? (size_t)(e - v) : 0;
+            return v;
+        }
+        p = strstr(p, "\r\n");
+    }
+    return NULL;
+}
+
+static bool http_header_has(const char *v, size_t vlen, const char *token)
+{
+    size_t tlen = strlen(token);
+    for (size_t i = 0; i + tlen <= vlen; i++) {
+        if (!strncasecmp(v + i, token, tlen)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Reads the status line and headers into _head, skipping interim 1xx
+ * responses, and sets up _stream for the body. Body bytes that arrived with
+ * the headers stay in _head behind _headEnd. Responses to HEAD and 204/304
+ * responses have no body, whatever their headers say.
+ */
+http_client_status_t HTTPClient::readHead(WiFiClient *client, bool headRequest, int *status, size_t *received)
+{
+    size_t cap = HTTP_RESPONSE_CHUNK_SIZE;
+    size_t len = 0;
+    unsigned long start = millis();
+    bool first = true;
+
+    _head = (uint8_t *)tal_malloc(cap);
+    if (!_head) {
+        return HTTP_CLIENT_MALLOC_FAULT;
+    }
+    _headEnd = 0;
+    size_t scan = 0;
+    while (!_headEnd) {
+        for (size_t i = scan; i + 3 < len; i++) {
+            if (!memcmp(_head + i, "\r\n\r\n", 4)) {
+                _headEnd = i + 4;
+                break;
+            }
+        }
+        if (!_headEnd) {
+            scan = (len > 3) ? len - 3 : 0;
+            if (len + 1 >= cap) {
+                if (cap >= HTTP_RESPONSE_HEAD_MAX) {
+                    PR_ERR("http response head larger than %d", HTTP_RESPONSE_HEAD_MAX);
+                    return HTTP_CLIENT_SEND_FAULT;
+                }
+                uint8_t *bigger = (uint8_t *)tal_malloc(cap * 2);
+                if (!bigger) {
+                    return HTTP_CLIENT_MALLOC_FAULT;
+                }
+                memcpy(bigger, _head, len);
+                tal_free(_head);
+                _head = bigger;
+                cap *= 2;
+            }
+            int avail = client->available();
+            if (avail <= 0) {
+                if (!client->connected()) {
+                    return HTTP_CLIENT_SEND_FAULT;
+                }
+                if (millis() - start > HTTP_CLIENT_TIMEOUT_MS) {
+                    PR_ERR("http response timeout");
+                    return HTTP_CLIENT_SEND_FAULT;
+                }
+                delay(1);
+                continue;
+            }
+            if (first) {
+                first = false;
+                latency(&HTTPClientStats::firstByte, millis() - start);
+            }
+            size_t room = cap - 1 - len;
+            int n = client->read(_head + len, ((size_t)avail < room) ? avail : room);
+            if (n > 0) {
+                len += n;
+                *received += n;
+            }
+            continue;
+        }
+        _head[len] = '\0';
+        if (len < 12 || strncmp((char *)_head, "HTTP/1.", 7)) {
+            PR_ERR("bad http status line");
+            return HTTP_CLIENT_SEND_FAULT;
+        }
+        *status = atoi((char *)_head + 9);
+        if (*status >= 200) {
+            latency(&HTTPClientStats::head, millis() - start);
+        }
+        if (*status >= 100 && *status < 200) {
+            // the next head may have arrived in the same read, scan what is left first
+            memmove(_head, _head + _headEnd, len - _headEnd);
+            len -= _headEnd;
+            _headEnd = 0;
+            scan = 0;
+        }
+    }
+
+    const char *head = (const char *)_head;
+    const char *v;
+    size_t vlen;
+    // HTTP/1.1 is persistent unless told otherwise, HTTP/1.0 only on request
+    _keepAlive = (head[7] == '1');
+    if ((v = http_find_header(head, _headEnd, "Connection", &vlen))) {
+        if (http_header_has(v, vlen, "close")) {
+            _keepAlive = false;
+        } else if (http_header_has(v, vlen, "keep-alive")) {
+            _keepAlive = true;
+        }
+    }
+
+    http_body_framing_t framing = HTTP_BODY_EOF;
+    long length = -1;
+    if (headRequest || *status == 204 || *status == 304) {
+        framing = HTTP_BODY_NONE;
+    } else if ((v = http_find_header(head, _headEnd, "Transfer-Encoding", &vlen)) && http_header_has(v, vlen, "chunked")) {
+        framing = HTTP_BODY_CHUNKED;
+    } else if ((v = http_find_header(head, _headEnd, "Content-Length", &vlen))) {
+        framing = HTTP_BODY_LENGTH;
+        length = strtol(v, NULL, 10);
+        if (length < 0) {
+            return HTTP_CLIENT_SEND_FAULT;
+        }
+    }
+    _stream.begin(client, _head + _headEnd, len - _headEnd, framing, length);
+    return HTTP_CLIENT_SUCCESS;
+}
+
+void HTTPClient::closeRequest()
+{
+    if (_client) {
+        count(&HTTPClientStats::bytesIn, _headEnd + _stream.position());
+        HTTPPool.release(_client, _reuse && _keepAlive && _stream.reusable());
+        _client = NULL;
+    }
+    _stream.reset();
+    if (_head) {
+        tal_free(_head);
+        _head = NULL;
+    }
+    _headEnd = 0;
+}
+
+int HTTPClient::streamRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                              const http_request_body_t *body)
+{
+    if (_protocol != "http" && _protocol != "https") {
+        PR_ERR("streaming requests need an http:// or https:// url");
+        return -HTTP_CLIENT_SEND_FAULT;
+    }
+    int status = 0;
+    http_client_status_t http_status = openRequest(method, headers, headers_length, body, &status);
     if (HTTP_CLIENT_SUCCESS != http_status) {
+        closeRequest();
         PR_ERR("http_request_send error:%d", http_status);
+        return -http_status;
     }
-    return http_status;
+    return status;
+}
+
+int HTTPClient::sendRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                            const uint8_t *body, size_t body_length)
+{
+    const http_request_body_t req_body = {body, body_length, NULL, 0, NULL};
+    return streamRequest(method, headers, headers_length, &req_body);
+}
+
+int HTTPClient::streamRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                              HTTPBodyProvider provider, long length)
+{
+    const http_request_body_t req_body = {NULL, 0, &provider, length, NULL};
+    return streamRequest(method, headers, headers_length, &req_body);
+}
+
+int HTTPClient::streamRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                              Stream *body, long length)
+{
+    return streamRequest(method, headers, headers_length, [body](uint8_t *buf, size_t size) {
+        return (int)body->readBytes(buf, size);
+    }, length);
+}
+
+int HTTPClient::sendMultipart(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                              VFSFILE &fs, const char *path, const char *field, const char *contentType)
+{
+    int fileSize = fs.filesize(path);
+    TUYA_FILE fd = (fileSize >= 0) ? fs.open(path, "r") : NULL;
+    if (!fd) {
+        PR_ERR("open %s failed", path);
+        return -HTTP_CLIENT_SEND_FAULT;
+    }
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+
+    char boundary[32];
+    snprintf(boundary, sizeof(boundary), "----TuyaOpen%08lx%08lx",
+             (unsigned long)tal_system_get_random(0x7FFFFFFF), (unsigned long)tal_system_get_random(0x7FFFFFFF));
+    char type[64];
+    snprintf(type, sizeof(type), "multipart/form-data; boundary=%s", boundary);
+
+    // the part head and the closing boundary are small, the file is read in
+    // HTTP_STREAM_BUFFER_SIZE pieces between them
+    String pre = String("--") + boundary + "\r\nContent-Disposition: form-data; name=\"" + field +
+                 "\"; filename=\"" + name + "\"\r\nContent-Type: " + contentType + "\r\n\r\n";
+    String post = String("\r\n--") + boundary + "--\r\n";
+    size_t prePos = 0;
+    size_t postPos = 0;
+    int fileLeft = fileSize;
+    HTTPBodyProvider provider = [&](uint8_t *buf, size_t size) -> int {
+        if (prePos < pre.length()) {
+            size_t n = pre.length() - prePos;
+            n = (n < size) ? n : size;
+            memcpy(buf, pre.c_str() + prePos, n);
+            prePos += n;
+            return n;
+        }
+        if (fileLeft > 0) {
+            int n = fs.read((const char *)buf, ((size_t)fileLeft < size) ? fileLeft : size, fd);
+            if (n <= 0) {
+                PR_ERR("read %s failed", path);
+                return -1;
+            }
+            fileLeft -= n;
+            return n;
+        }
+        size_t n = post.length() - postPos;
+        n = (n < size) ? n : size;
+        memcpy(buf, post.c_str() + postPos, n);
+        postPos += n;
+        return n;
+    };
+    const http_request_body_t req_body = {NULL, 0, &provider, (long)(pre.length() + fileSize + post.length()), type};
+    int status = streamRequest(method, headers, headers_length, &req_body);
+    fs.close(fd);
+    return status;
+}
+
+String HTTPClient::header(const char *name)
+{
+    size_t vlen;
+    const char *v = _head ? http_find_header((const char *)_head, _headEnd, name, &vlen) : NULL;
+    if (!v) {
+        return String();
+    }
+    String value;
+    value.reserve(vlen);
+    for (size_t i = 0; i < vlen; i++) {
+        value += v[i];
+    }
+    return value;
+}
+
+int HTTPClient::writeToCallback(HTTPBodyCallback cb)
+{
+    if (!_client) {
+        return -1;
+    }
+    uint8_t *buf = (uint8_t *)tal_malloc(HTTP_STREAM_BUFFER_SIZE);
+    if (!buf) {
+        return -1;
+    }
+    int total = 0;
+    unsigned long last = millis();
+    while (!_stream.finished()) {
+        int n = _stream.read(buf, HTTP_STREAM_BUFFER_SIZE);
+        if (n < 0) {
+            PR_ERR("http body incomplete after %d bytes", total);
+            total = -1;
+            break;
+        }
+        if (!n) {
+            if (millis() - last > HTTP_CLIENT_TIMEOUT_MS) {
+                PR_ERR("http body timeout after %d bytes", total);
+                total = -1;
+                break;
+            }
+            delay(1);
+            continue;
+        }
+        if (!cb(buf, n)) {
+            total = -1;
+            break;
+        }
+        total += n;
+        last = millis();
+    }
+    tal_free(buf);
+    return total;
+}
+
+int HTTPClient::writeToStream(Stream *stream)
+{
+    return writeToCallback([stream](const uint8_t *data, size_t len) {
+        return stream->write(data, len) == len;
+    });
+}
+
+int HTTPClient::writeToFile(VFSFILE &fs, const char *path)
+{
+    TUYA_FILE fd = fs.open(path, "w");
+    if (!fd) {
+        PR_ERR("open %s failed", path);
+        return -1;
+    }
+    int n = writeToCallback([&fs, fd](const uint8_t *data, size_t len) {
+        return fs.write((const char *)data, len, fd) == (int)len;
+    });
+    fs.close(fd);
+    return n;
+}
+
+void HTTPClient::end()
+{
+    closeRequest();
 }
 
 bool HTTPClient::end(http_client_response_t *response)
 {
+    for (auto it = _pooledBuffers.begin(); response && it != _pooledBuffers.end(); ++it) {
+        if (*it == response->buffer) {
+            _pooledBuffers.erase(it);
+            tal_free(response->buffer);
+            memset(response, 0, sizeof(*response));
+            return true;
+        }
+    }
     return http_client_free(response);
-}
\ No newline at end of file
+}
+
+void HTTPClient::count(uint32_t HTTPClientStats::*counter, uint32_t n)
+{
+    _stats.*counter += n;
+    _globalStats.*counter += n;
+}
+
+void HTTPClient::latency(WiFiLatencyStats HTTPClientStats::*which, uint32_t ms)
+{
+    wifiStatsLatency(_stats.*which, ms);
+    wifiStatsLatency(_globalStats.*which, ms);
+}
+
+void HTTPClient::printStats(Print &p, const HTTPClientStats &stats)
+{
+    p.print("http: requests ");
+    p.print(stats.requests);
+    p.print(" failed ");
+    p.print(stats.failures);
+    p.print(" out ");
+    p.print(stats.bytesOut);
+    p.print("B in ");
+    p.print(stats.bytesIn);
+    p.println("B");
+    p.print("  ");
+    printLatencyStats(p, "connect", stats.connect);
+    p.print("  ");
+    printLatencyStats(p, "first byte", stats.firstByte);
+    p.print("  ");
+    printLatencyStats(p, "head", stats.head);
+}
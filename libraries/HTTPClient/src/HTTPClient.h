@@ -1,12 +1,53 @@
 #ifndef HTTPClient_H_
 #define HTTPClient_H_
 
+#include <functional>
+#include <vector>
+#include "HTTPConnectionPool.h"
+#include "HTTPBodyStream.h"
+#include "File.h"
+
+// return false to abort the transfer
+typedef std::function<bool(const uint8_t *data, size_t len)> HTTPBodyCallback;
+// fills buf with up to size bytes of a request body; returns the byte count,
+// 0 at the end of the body or -1 to abort
+typedef std::function<int(uint8_t *buf, size_t size)> HTTPBodyProvider;
+
+typedef struct {
+    const uint8_t *data;
+    size_t length;
+    HTTPBodyProvider *provider;     // used instead of data when set
+    long providerLength;            // -1 sends the provider body chunked
+    const char *contentType;
+} http_request_body_t;
+
+/*
+ * Requests that use HTTPPool or stream are measured in full. Those left to
+ * http_client_request() of the SDK, with their own CA or without reuse,
+ * only count requests, failures and bytesIn.
+ */
+typedef struct {
+    uint32_t requests;
+    uint32_t failures;          // no connection, send error or no valid response head
+    uint32_t bytesOut;          // request heads and bodies
+    uint32_t bytesIn;           // response heads and the body bytes read
+    WiFiLatencyStats connect;   // new connections, DNS and TLS included
+    WiFiLatencyStats firstByte; // request sent to the first response byte
+    WiFiLatencyStats head;      // request sent to the end of the response head
+} HTTPClientStats;
+
 #ifdef __cplusplus
 extern "C"{
 #endif
 
 #include "http_client_interface.h"
 
+#define HTTP_CLIENT_TIMEOUT_MS      (5000)
+#define HTTP_RESPONSE_CHUNK_SIZE    (1024)
+#define HTTP_RESPONSE_MAX_SIZE      (32 * 1024)
+#define HTTP_RESPONSE_HEAD_MAX      (4096)
+#define HTTP_STREAM_BUFFER_SIZE     (512)
+
 class HTTPClient
 {
 public:
@@ -18,15 +59,91 @@ public:
     http_client_status_t POST (http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response);
     http_client_status_t PUT  (http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response);
     http_client_status_t PATCH(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, http_client_response_t *response);
+    // binary bodies: body_length is used as given instead of strlen(body)
+    http_client_status_t POST (http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length, http_client_response_t *response);
+    http_client_status_t PUT  (http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length, http_client_response_t *response);
+    http_client_status_t PATCH(http_client_header_t *headers,uint8_t  headers_length, const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length, http_client_response_t *response);
+    // frees a response of this client, however it was read
     bool end(http_client_response_t *response);
 
+    // http:// requests, and https:// ones once WiFiClientSecure::loadCABundle()
+    // has been called, keep their connection in HTTPPool for the next request
+    // to the same host; false closes it after every request
+    void setReuse(bool reuse) { _reuse = reuse; }
+
+    /*
+     * Streaming requests; https:// is verified against the CA bundle loaded
+     * with WiFiClientSecure::loadCABundle(). sendRequest() sends the request and
+     * reads the status line and headers; it returns the status code or a
+     * negative http_client_status_t. The body is then read from getStream()
+     * or passed to one of the writeTo functions, which return the number of
+     * body bytes or -1. end() releases the connection, which is only kept
+     * when the whole body has been read.
+     */
+    int sendRequest(const char *method, http_client_header_t *headers = NULL, uint8_t headers_length = 0,
+                    const uint8_t *body = NULL, size_t body_length = 0);
+    // request bodies produced while sending, Content-Length when length is
+    // known, chunked otherwise; the response is read as after sendRequest()
+    int streamRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                      HTTPBodyProvider provider, long length = -1);
+    int streamRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                      Stream *body, long length = -1);
+    // multipart/form-data upload of one file, read from fs while sending
+    int sendMultipart(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                      VFSFILE &fs, const char *path, const char *field = "file",
+                      const char *contentType = "application/octet-stream");
+    // Content-Length of the response, -1 when it is chunked or ends on close
+    long getSize() const { return _stream.size(); }
+    String header(const char *name);
+    HTTPBodyStream &getStream() { return _stream; }
+    int writeToStream(Stream *stream);
+    int writeToFile(VFSFILE &fs, const char *path);
+    int writeToCallback(HTTPBodyCallback cb);
+    void end();
+
+    // requests of this client; globalStats() sums all clients
+    const HTTPClientStats &stats() const { return _stats; }
+    void resetStats() { memset(&_stats, 0, sizeof(_stats)); }
+    void printStats(Print &p) const { printStats(p, _stats); }
+    static const HTTPClientStats &globalStats() { return _globalStats; }
+    static void resetGlobalStats() { memset(&_globalStats, 0, sizeof(_globalStats)); }
+    static void printStats(Print &p, const HTTPClientStats &stats);
+
 protected:
     String _host;
     uint16_t _port = 0;
     String _path;
     String _protocol;
-    int sendRequest(char * method ,const uint8_t *body, http_client_response_t *response);
+    bool _reuse = true;
+    // buffers of pooled responses not yet passed to end(response)
+    std::vector<uint8_t *> _pooledBuffers;
+    WiFiClient *_client = NULL;
+    uint8_t *_head = NULL;
+    size_t _headEnd = 0;
+    bool _keepAlive = false;
+    HTTPBodyStream _stream;
+    HTTPClientStats _stats = {};
+    static HTTPClientStats _globalStats;
+    void count(uint32_t HTTPClientStats::*counter, uint32_t n);
+    void latency(WiFiLatencyStats HTTPClientStats::*which, uint32_t ms);
+    bool send(WiFiClient *client, const uint8_t *data, size_t len);
     bool beginInternal(String url);
+    uint16_t defaultPort() const { return (_protocol == "https") ? 443 : 80; }
+    http_client_status_t request(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                                 const uint8_t *ca, size_t ca_len, const uint8_t *body, size_t body_length,
+                                 http_client_response_t *response);
+    http_client_status_t pooledRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                                       const http_request_body_t *body, http_client_response_t *response,
+                                       bool *tooLarge);
+    http_client_status_t openRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                                     const http_request_body_t *body, int *status);
+    int streamRequest(const char *method, http_client_header_t *headers, uint8_t headers_length,
+                      const http_request_body_t *body);
+    bool writeRequest(WiFiClient *client, const char *method, http_client_header_t *headers, uint8_t headers_length,
+                      const http_request_body_t *body);
+    bool writeBody(WiFiClient *client, const http_request_body_t *body);
+    http_client_status_t readHead(WiFiClient *client, bool headRequest, int *status, size_t *received);
+    void closeRequest();
 };
 
 
@@ -0,0 +1,229 @@
+#include "HTTPConnectionPool.h"
+#include <new>
+#include "tal_log.h"
+
+HTTPConnectionPool HTTPPool;
+
+HTTPConnectionPool::HTTPConnectionPool()
+    : _max(HTTP_POOL_MAX_CONNECTIONS)
+    , _idleTimeout(HTTP_POOL_IDLE_TIMEOUT_MS)
+    , _mutex(NULL)
+{
+    memset(_entries, 0, sizeof(_entries));
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+HTTPConnectionPool::~HTTPConnectionPool()
+{
+    closeAll();
+    if (_mutex) {
+        tal_mutex_release(_mutex);
+        _mutex = NULL;
+    }
+}
+
+void HTTPConnectionPool::_lock()
+{
+    // created on first use, global constructors run before the kernel is up
+    if (!_mutex && tal_mutex_create_init(&_mutex) != OPRT_OK) {
+        PR_ERR("http pool mutex create failed");
+        return;
+    }
+    tal_mutex_lock(_mutex);
+}
+
+void HTTPConnectionPool::_unlock()
+{
+    if (_mutex) {
+        tal_mutex_unlock(_mutex);
+    }
+}
+
+WiFiClient *HTTPConnectionPool::_newClient(bool https)
+{
+    if (https) {
+        // verified against the shared bundle, resumes cached TLS sessions
+        return new (std::nothrow) WiFiClientSecure();
+    }
+    return new (std::nothrow) WiFiClient();
+}
+
+void HTTPConnectionPool::_close(http_pool_entry_t *e)
+{
+    e->client->stop();
+    delete e->client;
+    e->client = NULL;
+    e->busy = false;
+}
+
+void HTTPConnectionPool::_evictIdle(unsigned long now)
+{
+    for (uint8_t i = 0; i < HTTP_POOL_MAX_CONNECTIONS; i++) {
+        http_pool_entry_t *e = &_entries[i];
+        if (e->client && !e->busy && (i >= _max || now - e->lastUsed >= _idleTimeout)) {
+            _close(e);
+            _stats.evictedIdle++;
+        }
+    }
+}
+
+void HTTPConnectionPool::evictIdle()
+{
+    _lock();
+    _evictIdle(millis());
+    _unlock();
+}
+
+WiFiClient *HTTPConnectionPool::acquire(const char *protocol, const char *host, uint16_t port, int32_t timeout_ms, bool *reused)
+{
+    bool https = !strcmp(protocol, "https");
+    unsigned long now = millis();
+    *reused = false;
+
+    _lock();
+    _stats.requests++;
+    _evictIdle(now);
+    for (uint8_t i = 0; i < _max; i++) {
+        http_pool_entry_t *e = &_entries[i];
+        if (!e->client || e->busy || e->https != https || e->port != port || strcasecmp(e->host, host)) {
+            continue;
+        }
+        // nothing is expected on a parked connection: data there is a late
+        // close or garbage from the last response
+        if (e->client->available() || !e->client->connected()) {
+            _close(e);
+            _stats.closed++;
+            continue;
+        }
+        e->busy = true;
+        e->lastUsed = now;
+        _stats.reused++;
+        WiFiClient *client = e->client;
+        _unlock();
+        *reused = true;
+        return client;
+    }
+    _unlock();
+
+    WiFiClient *client = _newClient(https);
+    if (!client) {
+        return NULL;
+    }
+    if (!client->connect(host, port, timeout_ms)) {
+        PR_ERR("http pool connect %s:%d failed", host, port);
+        delete client;
+        _lock();
+        _stats.failures++;
+        _unlock();
+        return NULL;
+    }
+    client->setNoDelay(true);
+
+    _lock();
+    _stats.opened++;
+    if (strlen(host) < HTTP_POOL_HOST_MAX) {
+        http_pool_entry_t *slot = NULL;
+        http_pool_entry_t *lru = NULL;
+        for (uint8_t i = 0; i < _max; i++) {
+            http_pool_entry_t *e = &_entries[i];
+            if (!e->client) {
+                slot = e;
+                break;
+            }
+            if (!e->busy && (!lru || (now - e->lastUsed) > (now - lru->lastUsed))) {
+                lru = e;
+            }
+        }
+        if (!slot && lru) {
+            _close(lru);
+            _stats.evictedFull++;
+            slot = lru;
+        }
+        // every slot busy: the connection is closed again on release()
+        if (slot) {
+            slot->client = client;
+            slot->https = https;
+            slot->busy = true;
+            slot->port = port;
+            strcpy(slot->host, host);
+            slot->lastUsed = now;
+        }
+    }
+    _unlock();
+    return client;
+}
+
+void HTTPConnectionPool::release(WiFiClient *client, bool keepAlive)
+{
+    if (!client) {
+        return;
+    }
+    _lock();
+    for (uint8_t i = 0; i < HTTP_POOL_MAX_CONNECTIONS; i++) {
+        http_pool_entry_t *e = &_entries[i];
+        if (e->client != client) {
+            continue;
+        }
+        if (keepAlive && i < _max && client->connected()) {
+            e->busy = false;
+            e->lastUsed = millis();
+            _unlock();
+            return;
+        }
+        e->client = NULL;
+        e->busy = false;
+        break;
+    }
+    _stats.closed++;
+    _unlock();
+    client->stop();
+    delete client;
+}
+
+void HTTPConnectionPool::setMaxConnections(uint8_t max)
+{
+    if (max < 1) {
+        max = 1;
+    } else if (max > HTTP_POOL_MAX_CONNECTIONS) {
+        max = HTTP_POOL_MAX_CONNECTIONS;
+    }
+    _lock();
+    _max = max;
+    // idle connections above the new limit go now, busy ones on release()
+    _evictIdle(millis());
+    _unlock();
+}
+
+void HTTPConnectionPool::closeAll()
+{
+    _lock();
+    for (uint8_t i = 0; i < HTTP_POOL_MAX_CONNECTIONS; i++) {
+        http_pool_entry_t *e = &_entries[i];
+        if (!e->client) {
+            continue;
+        }
+        if (e->busy) {
+            // still owned by a request, release() closes it
+            e->client = NULL;
+            e->busy = false;
+        } else {
+            _close(e);
+        }
+    }
+    _unlock();
+}
+
+float HTTPConnectionPool::hitRate() const
+{
+    if (!_stats.requests) {
+        return 0;
+    }
+    return (float)_stats.reused * 100 / _stats.requests;
+}
+
+void HTTPConnectionPool::resetStats()
+{
+    _lock();
+    memset(&_stats, 0, sizeof(_stats));
+    _unlock();
+}
@@ -0,0 +1,76 @@
+#ifndef HTTPConnectionPool_H_
+#define HTTPConnectionPool_H_
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+#include "WiFiClientSecure.h"
+#include "tal_api.h"
+
+#define HTTP_POOL_MAX_CONNECTIONS   (4)
+#define HTTP_POOL_IDLE_TIMEOUT_MS   (30 * 1000)
+#define HTTP_POOL_HOST_MAX          (64)
+
+typedef struct {
+    uint32_t requests;          // acquire() calls
+    uint32_t reused;            // served by a parked connection
+    uint32_t opened;            // new TCP connections
+    uint32_t closed;            // not kept: Connection: close, no framing, errors
+    uint32_t evictedIdle;       // parked longer than the idle timeout
+    uint32_t evictedFull;       // closed to make room for another host
+    uint32_t failures;          // connect failed
+} HTTPPoolStats;
+
+/*
+ * Persistent HTTP/1.1 connections keyed by protocol, host and port. A
+ * connection is owned by one request between acquire() and release();
+ * release() parks it for the next request to the same origin unless the
+ * response said it has to be closed. Idle connections are closed after the
+ * idle timeout, and the least recently used one makes room when the pool is
+ * full, so at most maxConnections sockets are held.
+ */
+class HTTPConnectionPool
+{
+public:
+    HTTPConnectionPool();
+    ~HTTPConnectionPool();
+
+    // returns a connected client, or NULL; *reused tells if it was parked
+    WiFiClient *acquire(const char *protocol, const char *host, uint16_t port, int32_t timeout_ms, bool *reused);
+    void release(WiFiClient *client, bool keepAlive);
+
+    void setMaxConnections(uint8_t max);
+    void setIdleTimeout(uint32_t ms) { _idleTimeout = ms; }
+    void evictIdle();
+    void closeAll();
+
+    const HTTPPoolStats &stats() const { return _stats; }
+    // percentage of requests served by a reused connection
+    float hitRate() const;
+    void resetStats();
+
+private:
+    typedef struct {
+        WiFiClient *client;
+        bool https;
+        bool busy;
+        uint16_t port;
+        char host[HTTP_POOL_HOST_MAX];
+        unsigned long lastUsed;
+    } http_pool_entry_t;
+
+    http_pool_entry_t _entries[HTTP_POOL_MAX_CONNECTIONS];
+    uint8_t _max;
+    uint32_t _idleTimeout;
+    HTTPPoolStats _stats;
+    MUTEX_HANDLE _mutex;
+
+    void _lock();
+    void _unlock();
+    void _close(http_pool_entry_t *e);
+    void _evictIdle(unsigned long now);
+    WiFiClient *_newClient(bool https);
+};
+
+extern HTTPConnectionPool HTTPPool;
+
+#endif
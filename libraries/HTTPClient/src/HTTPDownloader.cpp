@@ -0,0 +1,448 @@
+#include "HTTPDownloader.h"
+#include "tal_log.h"
+#include "tal_memory.h"
+
+#define HTTP_DL_MAGIC   (0x48444C31)    // "HDL1"
+
+static uint32_t http_dl_hash(const char *s)
+{
+    uint32_t h = 2166136261UL;
+    while (*s) {
+        h = (h ^ (uint8_t)*s++) * 16777619UL;
+    }
+    return h;
+}
+
+HTTPDownloader::HTTPDownloader()
+    : _segments(1)
+    , _expectedCrc(0)
+    , _fs(NULL)
+    , _fd(NULL)
+    , _filePos(-1)
+    , _buf(NULL)
+    , _downloaded(0)
+    , _total(0)
+    , _sessionBytes(0)
+    , _unsaved(0)
+    , _startMs(0)
+    , _lastProgress(0)
+    , _changed(false)
+{
+    memset(&_state, 0, sizeof(_state));
+    memset(_conn, 0, sizeof(_conn));
+    _statePath[0] = '\0';
+}
+
+HTTPDownloader::~HTTPDownloader()
+{
+    if (_buf) {
+        tal_free(_buf);
+    }
+}
+
+void HTTPDownloader::setSegments(uint8_t count)
+{
+    if (count < 1) {
+        count = 1;
+    } else if (count > HTTP_DL_MAX_SEGMENTS) {
+        count = HTTP_DL_MAX_SEGMENTS;
+    }
+    _segments = count;
+}
+
+uint32_t HTTPDownloader::throughput() const
+{
+    unsigned long ms = millis() - _startMs;
+    return ms ? (uint32_t)((uint64_t)_sessionBytes * 1000 / ms) : 0;
+}
+
+// CRC-32 (IEEE 802.3), chained by passing the previous result
+uint32_t HTTPDownloader::crc32(uint32_t crc, const uint8_t *data, size_t len)
+{
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+    crc = ~crc;
+    while (len--) {
+        crc = table[(crc ^ *data) & 0x0F] ^ (crc >> 4);
+        crc = table[(crc ^ (*data++ >> 4)) & 0x0F] ^ (crc >> 4);
+    }
+    return ~crc;
+}
+
+http_dl_result_t HTTPDownloader::download(const char *url, VFSFILE &fs, const char *path)
+{
+    if (strlen(path) > HTTP_DL_PATH_MAX) {
+        PR_ERR("download path too long");
+        return HTTP_DL_ERR_FILE;
+    }
+    if (!_buf) {
+        _buf = (uint8_t *)tal_malloc(HTTP_DL_BUFFER_SIZE);
+        if (!_buf) {
+            return HTTP_DL_ERR_NO_MEMORY;
+        }
+    }
+    _fs = &fs;
+    snprintf(_statePath, sizeof(_statePath), "%s.part", path);
+    _downloaded = 0;
+    _total = 0;
+    _sessionBytes = 0;
+    _startMs = millis();
+    _lastProgress = 0;
+    for (uint8_t i = 0; i < HTTP_DL_MAX_SEGMENTS; i++) {
+        _http[i].begin(url);
+    }
+
+    uint32_t urlHash = http_dl_hash(url);
+    http_dl_result_t res = HTTP_DL_ERR_REQUEST;
+    // a second pass only runs when the file changed on the server mid-way
+    for (int attempt = 0; attempt < 2; attempt++) {
+        _changed = false;
+        bool resume = _loadState(urlHash);
+        char validator[HTTP_DL_VALIDATOR_MAX];
+        uint32_t total = 0;
+        int code = _probe(validator, &total);
+        if (code == 200) {
+            return _single(path);
+        }
+        if (code != 206) {
+            PR_ERR("download probe failed: %d", code);
+            _http[0].end();
+            return HTTP_DL_ERR_REQUEST;
+        }
+        if (resume && (total != _state.total || strcmp(validator, _state.validator))) {
+            PR_NOTICE("%s changed on the server, starting over", url);
+            resume = false;
+        }
+        // the file is reserved at full size when a download starts; missing
+        // or cut short, the saved ranges no longer describe what is in it
+        if (resume && _fs->filesize(path) != (int)_state.total) {
+            PR_NOTICE("%s is missing or truncated, starting over", path);
+            resume = false;
+        }
+        if (!resume) {
+            memset(&_state, 0, sizeof(_state));
+            _state.magic = HTTP_DL_MAGIC;
+            _state.urlHash = urlHash;
+            _state.total = total;
+            strcpy(_state.validator, validator);
+            uint32_t count = total / HTTP_DL_MIN_SEGMENT_SIZE;
+            _state.count = (count < 1) ? 1 : (count > _segments) ? _segments : count;
+            uint32_t step = total / _state.count;
+            for (uint8_t i = 0; i < _state.count; i++) {
+                _state.seg[i].start = _state.seg[i].pos = i * step;
+                _state.seg[i].end = (i == _state.count - 1) ? total : (i + 1) * step;
+            }
+        }
+        res = _segmented(path, resume);
+        if (!_changed) {
+            break;
+        }
+        _fs->remove(_statePath);
+    }
+    return res;
+}
+
+/*
+ * One byte range request on the first connection tells the size, the
+ * validator and whether ranges work at all. A 200 answer is left open for
+ * _single() to read.
+ */
+int HTTPDownloader::_probe(char *validator, uint32_t *total)
+{
+    http_client_header_t headers[] = {{.key = "Range", .value = "bytes=0-0"}};
+    int code = _http[0].sendRequest("GET", headers, 1);
+    if (code != 206) {
+        return code;
+    }
+    String range = _http[0].header("Content-Range");
+    const char *slash = strrchr(range.c_str(), '/');
+    if (!slash || slash[1] == '*') {
+        return -HTTP_CLIENT_SEND_FAULT;
+    }
+    *total = strtoul(slash + 1, NULL, 10);
+
+    // weak ETags are not allowed in If-Range, Last-Modified is used instead
+    String v = _http[0].header("ETag");
+    if (!v.length() || v.startsWith("W/")) {
+        v = _http[0].header("Last-Modified");
+    }
+    if (v.length() >= HTTP_DL_VALIDATOR_MAX) {
+        v = "";
+    }
+    strcpy(validator, v.c_str());
+    _http[0].writeToCallback([](const uint8_t *data, size_t len) { return true; });
+    _http[0].end();
+    return code;
+}
+
+// no Range support: one pass into a truncated file, nothing to resume
+http_dl_result_t HTTPDownloader::_single(const char *path)
+{
+    if (_fs->exist(_statePath)) {
+        _fs->remove(_statePath);
+    }
+    long size = _http[0].getSize();
+    _total = (size > 0) ? size : 0;
+    TUYA_FILE fd = _fs->open(path, "w");
+    if (!fd) {
+        PR_ERR("open %s failed", path);
+        _http[0].end();
+        return HTTP_DL_ERR_FILE;
+    }
+    int n = _http[0].writeToCallback([this, fd](const uint8_t *data, size_t len) {
+        if (_fs->write((const char *)data, len, fd) != (int)len) {
+            return false;
+        }
+        _downloaded += len;
+        _sessionBytes += len;
+        _progress(false);
+        return true;
+    });
+    _http[0].end();
+    _fs->close(fd);
+    if (n < 0) {
+        return HTTP_DL_ERR_NETWORK;
+    }
+    _total = _downloaded;
+    _progress(true);
+    return _verify(path);
+}
+
+http_dl_result_t HTTPDownloader::_segmented(const char *path, bool resume)
+{
+    http_dl_result_t res = HTTP_DL_OK;
+    _total = _state.total;
+    _downloaded = 0;
+    for (uint8_t i = 0; i < _state.count; i++) {
+        _downloaded += _state.seg[i].pos - _state.seg[i].start;
+    }
+    if (resume) {
+        PR_NOTICE("resuming download at %u of %u bytes", (unsigned)_downloaded, (unsigned)_total);
+        _fd = _fs->open(path, "r+");
+    } else {
+        _fd = _fs->open(path, "w");
+        // reserve the whole file up front, segments are written at their offsets
+        uint8_t zero = 0;
+        if (_fd && _total && (_fs->lseek(_fd, _total - 1, SEEK_SET) < 0 || _fs->write((const char *)&zero, 1, _fd) != 1)) {
+            _fs->close(_fd);
+            _fd = NULL;
+        }
+    }
+    if (!_fd) {
+        PR_ERR("open %s failed", path);
+        return HTTP_DL_ERR_FILE;
+    }
+    _filePos = -1;
+    _unsaved = 0;
+    memset(_conn, 0, sizeof(_conn));
+    if (!resume && !_saveState()) {
+        res = HTTP_DL_ERR_FILE;
+        goto out;
+    }
+    _progress(true);
+
+    while (1) {
+        bool pending = false;
+        bool alive = false;
+        bool moved = false;
+        unsigned long now = millis();
+        for (uint8_t i = 0; i < _state.count; i++) {
+            http_dl_range_t *r = &_state.seg[i];
+            http_dl_conn_t *c = &_conn[i];
+            if (r->pos >= r->end) {
+                continue;
+            }
+            pending = true;
+            if (c->failures > HTTP_DL_MAX_RETRIES) {
+                continue;
+            }
+            alive = true;
+            if (!c->active) {
+                if ((long)(now - c->retryAt) >= 0 && !_request(i)) {
+                    if (_changed) {
+                        res = HTTP_DL_ERR_REQUEST;
+                        goto out;
+                    }
+                    _fail(i);
+                }
+                continue;
+            }
+            HTTPBodyStream &s = _http[i].getStream();
+            size_t want = r->end - r->pos;
+            int n = s.read(_buf, (want < HTTP_DL_BUFFER_SIZE) ? want : HTTP_DL_BUFFER_SIZE);
+            if (n > 0) {
+                if (!_write(r->pos, _buf, n)) {
+                    res = HTTP_DL_ERR_FILE;
+                    goto out;
+                }
+                r->pos += n;
+                _downloaded += n;
+                _sessionBytes += n;
+                _unsaved += n;
+                c->lastData = now;
+                c->failures = 0;
+                moved = true;
+                if (r->pos >= r->end) {
+                    _http[i].end();
+                    c->active = false;
+                    _unsaved = HTTP_DL_PERSIST_BYTES;
+                }
+            } else if (n < 0 || s.finished() || now - c->lastData > HTTP_DL_STALL_TIMEOUT_MS) {
+                // finished before the end of the range counts as a failure too
+                _fail(i);
+            }
+        }
+        if (!pending) {
+            break;
+        }
+        if (!alive) {
+            PR_ERR("download gave up at %u of %u bytes", (unsigned)_downloaded, (unsigned)_total);
+            res = HTTP_DL_ERR_NETWORK;
+            goto out;
+        }
+        if (_unsaved >= HTTP_DL_PERSIST_BYTES) {
+            _saveState();
+            _unsaved = 0;
+        }
+        _progress(false);
+        if (!moved) {
+            delay(1);
+        }
+    }
+
+    _fs->close(_fd);
+    _fd = NULL;
+    _progress(true);
+    res = _verify(path);
+    if (res == HTTP_DL_OK) {
+        _fs->remove(_statePath);
+    }
+    return res;
+
+out:
+    for (uint8_t i = 0; i < _state.count; i++) {
+        _http[i].end();
+    }
+    _saveState();
+    _fs->close(_fd);
+    _fd = NULL;
+    return res;
+}
+
+bool HTTPDownloader::_request(uint8_t i)
+{
+    http_dl_range_t *r = &_state.seg[i];
+    char range[32];
+    snprintf(range, sizeof(range), "bytes=%u-%u", (unsigned)r->pos, (unsigned)(r->end - 1));
+    // If-Range: a changed file is answered with 200 instead of the range
+    http_client_header_t headers[] = {
+        {.key = "Range", .value = range},
+        {.key = "If-Range", .value = _state.validator},
+    };
+    int code = _http[i].sendRequest("GET", headers, _state.validator[0] ? 2 : 1);
+    if (code == 206) {
+        String cr = _http[i].header("Content-Range");
+        if (cr.startsWith("bytes ") && strtoul(cr.c_str() + 6, NULL, 10) == r->pos) {
+            _conn[i].active = true;
+            _conn[i].lastData = millis();
+            return true;
+        }
+        PR_ERR("unexpected Content-Range: %s", cr.c_str());
+    } else if (code == 200) {
+        _changed = true;
+    }
+    _http[i].end();
+    return false;
+}
+
+void HTTPDownloader::_fail(uint8_t i)
+{
+    http_dl_conn_t *c = &_conn[i];
+    _http[i].end();
+    c->active = false;
+    c->failures++;
+    c->retryAt = millis() + HTTP_DL_RETRY_DELAY_MS * c->failures;
+    PR_DEBUG("segment %d failed (%d), retry at %u", i, c->failures, (unsigned)_state.seg[i].pos);
+}
+
+bool HTTPDownloader::_write(uint32_t offset, const uint8_t *data, size_t len)
+{
+    if (_filePos != (long)offset && _fs->lseek(_fd, offset, SEEK_SET) < 0) {
+        PR_ERR("seek to %u failed", (unsigned)offset);
+        return false;
+    }
+    if (_fs->write((const char *)data, len, _fd) != (int)len) {
+        PR_ERR("write at %u failed", (unsigned)offset);
+        _filePos = -1;
+        return false;
+    }
+    _filePos = offset + len;
+    return true;
+}
+
+bool HTTPDownloader::_loadState(uint32_t urlHash)
+{
+    if (!_fs->exist(_statePath)) {
+        return false;
+    }
+    TUYA_FILE fd = _fs->open(_statePath, "r");
+    if (!fd) {
+        return false;
+    }
+    int n = _fs->read((const char *)&_state, sizeof(_state), fd);
+    _fs->close(fd);
+    return n == (int)sizeof(_state) && _state.magic == HTTP_DL_MAGIC && _state.urlHash == urlHash &&
+           _state.count >= 1 && _state.count <= HTTP_DL_MAX_SEGMENTS;
+}
+
+bool HTTPDownloader::_saveState()
+{
+    // data first, so the saved offsets never run ahead of the file
+    if (_fd) {
+        _fs->flush(_fd);
+    }
+    TUYA_FILE fd = _fs->open(_statePath, "w");
+    if (!fd) {
+        PR_ERR("open %s failed", _statePath);
+        return false;
+    }
+    bool ok = _fs->write((const char *)&_state, sizeof(_state), fd) == (int)sizeof(_state);
+    _fs->close(fd);
+    return ok;
+}
+
+void HTTPDownloader::_progress(bool force)
+{
+    unsigned long now = millis();
+    if (!_progressCb || (!force && now - _lastProgress < HTTP_DL_PROGRESS_MS)) {
+        return;
+    }
+    _lastProgress = now;
+    _progressCb(_downloaded, _total, throughput());
+}
+
+http_dl_result_t HTTPDownloader::_verify(const char *path)
+{
+    if (!_expectedCrc) {
+        return HTTP_DL_OK;
+    }
+    TUYA_FILE fd = _fs->open(path, "r");
+    if (!fd) {
+        return HTTP_DL_ERR_FILE;
+    }
+    uint32_t crc = 0;
+    int n;
+    while ((n = _fs->read((const char *)_buf, HTTP_DL_BUFFER_SIZE, fd)) > 0) {
+        crc = crc32(crc, _buf, n);
+    }
+    _fs->close(fd);
+    if (crc != _expectedCrc) {
+        PR_ERR("download crc %08x, expected %08x", (unsigned)crc, (unsigned)_expectedCrc);
+        _fs->remove(path);
+        _fs->remove(_statePath);
+        return HTTP_DL_ERR_CHECKSUM;
+    }
+    return HTTP_DL_OK;
+}
@@ -0,0 +1,116 @@
+#ifndef HTTPDownloader_H_
+#define HTTPDownloader_H_
+
+#include "HTTPClient.h"
+
+#define HTTP_DL_MAX_SEGMENTS        (4)
+#define HTTP_DL_MIN_SEGMENT_SIZE    (64 * 1024)
+#define HTTP_DL_BUFFER_SIZE         (1024)
+#define HTTP_DL_PERSIST_BYTES       (32 * 1024)
+#define HTTP_DL_MAX_RETRIES         (5)
+#define HTTP_DL_RETRY_DELAY_MS      (1000)
+#define HTTP_DL_STALL_TIMEOUT_MS    (10 * 1000)
+#define HTTP_DL_PROGRESS_MS         (500)
+#define HTTP_DL_VALIDATOR_MAX       (64)
+#define HTTP_DL_PATH_MAX            (96)
+
+typedef enum {
+    HTTP_DL_OK = 0,
+    HTTP_DL_ERR_REQUEST,        // unexpected status or no answer from the server
+    HTTP_DL_ERR_NETWORK,        // segments failed too often, progress is kept
+    HTTP_DL_ERR_FILE,
+    HTTP_DL_ERR_CHECKSUM,       // file and progress are removed
+    HTTP_DL_ERR_NO_MEMORY,
+} http_dl_result_t;
+
+typedef std::function<void(size_t downloaded, size_t total, uint32_t bytesPerSecond)> HTTPDownloadProgressCb;
+
+/*
+ * Downloads a URL into a file with Range requests. Progress is kept in
+ * "<path>.part" next to the file, so a download interrupted by a failure
+ * or a reset continues from the last saved offsets on the next call, as
+ * long as the server still reports the same size and ETag/Last-Modified.
+ * Large files are split into segments fetched over separate connections;
+ * all of them are served from one loop and written through one file handle
+ * into the preallocated file. Servers without Range support are read in
+ * one pass and cannot be resumed.
+ */
+class HTTPDownloader
+{
+public:
+    HTTPDownloader();
+    ~HTTPDownloader();
+
+    // parallel connections, 1 .. HTTP_DL_MAX_SEGMENTS
+    void setSegments(uint8_t count);
+    // verified after the download, 0 skips the check
+    void setCRC32(uint32_t crc) { _expectedCrc = crc; }
+    void onProgress(HTTPDownloadProgressCb cb) { _progressCb = cb; }
+
+    // blocks until the file is complete or the download gives up
+    http_dl_result_t download(const char *url, VFSFILE &fs, const char *path);
+
+    size_t downloaded() const { return _downloaded; }
+    // 0 while unknown
+    size_t total() const { return _total; }
+    // bytes per second received by this call
+    uint32_t throughput() const;
+
+    static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t len);
+
+private:
+    typedef struct {
+        uint32_t start;
+        uint32_t end;       // exclusive
+        uint32_t pos;       // next byte to write
+    } http_dl_range_t;
+
+    typedef struct {
+        uint32_t magic;
+        uint32_t urlHash;
+        uint32_t total;
+        uint8_t count;
+        char validator[HTTP_DL_VALIDATOR_MAX];
+        http_dl_range_t seg[HTTP_DL_MAX_SEGMENTS];
+    } http_dl_state_t;
+
+    typedef struct {
+        bool active;        // a request is open
+        uint8_t failures;
+        unsigned long retryAt;
+        unsigned long lastData;
+    } http_dl_conn_t;
+
+    HTTPClient _http[HTTP_DL_MAX_SEGMENTS];
+    http_dl_conn_t _conn[HTTP_DL_MAX_SEGMENTS];
+    http_dl_state_t _state;
+    uint8_t _segments;
+    uint32_t _expectedCrc;
+    HTTPDownloadProgressCb _progressCb;
+
+    VFSFILE *_fs;
+    TUYA_FILE _fd;
+    long _filePos;
+    char _statePath[HTTP_DL_PATH_MAX + 8];
+    uint8_t *_buf;
+    size_t _downloaded;
+    size_t _total;
+    size_t _sessionBytes;
+    size_t _unsaved;
+    unsigned long _startMs;
+    unsigned long _lastProgress;
+    bool _changed;              // a range request got the whole, changed file
+
+    int _probe(char *validator, uint32_t *total);
+    http_dl_result_t _single(const char *path);
+    http_dl_result_t _segmented(const char *path, bool resume);
+    bool _request(uint8_t i);
+    void _fail(uint8_t i);
+    bool _write(uint32_t offset, const uint8_t *data, size_t len);
+    bool _loadState(uint32_t urlHash);
+    bool _saveState();
+    void _progress(bool force);
+    http_dl_result_t _verify(const char *path);
+};
+
+#endif
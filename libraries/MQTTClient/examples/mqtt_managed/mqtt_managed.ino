@@ -0,0 +1,109 @@
+/*
+ MQTT managed mode example
+
+ The client runs its own network task, so loop() never calls mqtt.loop():
+  - begin() starts the task, which connects, keeps the connection alive and
+    reconnects after a loss, waiting longer after each failed attempt
+  - the subscription is made once and restored after every reconnect
+  - a second thread and loop() both publish; publish() only queues the
+    message and is safe to call from any thread
+*/
+
+#include <WiFi.h>
+#include <MQTTClient.h>
+#include "tal_thread.h"
+
+// Update these with values suitable for your network.
+const char * ssid ="your_ssid";
+const char * pass = "your_passwd";
+
+//MQTT broker
+const char *mqtt_broker = "broker.emqx.io";
+const char *mqtt_username = "emqx";
+const char *mqtt_password ="public";
+const int mqtt_port = 1883;
+
+const char *topic = "yourManaged/status";
+const char *sensorTopic = "yourManaged/sensor";
+const char *commandTopic = "yourManaged/command";
+
+void *cli;
+MQTTClient mqtt;
+THREAD_HANDLE sensorThread = NULL;
+unsigned long lastStatus = 0;
+
+void callback(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+  // runs in the network task
+  Serial.print("Message arrived in topic: ");
+  Serial.println(msg->topic);
+  Serial.print("Message:");
+  for (int i = 0; i < msg->length; i++) {
+    Serial.print((char) msg->payload[i]);
+  }
+  Serial.println();
+}
+
+void sensorTask(void *arg)
+{
+  uint32_t seq = 0;
+  for (;;) {
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "reading %u", (unsigned)seq++);
+    mqtt.publish(cli, sensorTopic, (const uint8_t *)buf, len);
+    delay(200);
+  }
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  WiFi.begin(ssid,pass);
+
+  while (WiFi.status() != WSS_GOT_IP) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("");
+  Serial.println("WiFi connected");
+
+  mqtt_client_config_t config = {0};
+  config.cacert = NULL;
+  config.cacert_len = 0;
+  config.host = mqtt_broker;
+  config.port = mqtt_port;
+  config.keepalive = 60;
+  config.timeout_ms = 100;
+  config.username = mqtt_username;
+  config.password = mqtt_password;
+  config.clientid = "ty_managed_id";
+
+  cli = mqtt.SetCallback(callback).init(&config);
+  // the task connects in the background
+  mqtt.begin(cli);
+  mqtt.subscribe(cli, commandTopic, MQTT_QOS_1);
+
+  THREAD_CFG_T param;
+  param.priority = THREAD_PRIO_3;
+  param.stackDepth = 2048;
+  char threadName[] = "sensor";
+  param.thrdname = threadName;
+  tal_thread_create_and_start(&sensorThread, NULL, NULL, sensorTask, NULL, &param);
+}
+
+void loop()
+{
+  if (millis() - lastStatus >= 5000) {
+    lastStatus = millis();
+    mqtt.publish(cli, topic, mqtt.connected() ? "online" : "offline");
+    Serial.print("connected: ");
+    Serial.print(mqtt.connected());
+    Serial.print(" reconnects: ");
+    Serial.print(mqtt.stats().reconnects);
+    Serial.print(" sent: ");
+    Serial.print(mqtt.stats().sent);
+    Serial.print(" dropped: ");
+    Serial.println(mqtt.stats().dropped);
+  }
+  delay(10);
+}
@@ -0,0 +1,94 @@
+/*
+ MQTT topic router example
+
+ Each subscription gets its own handler instead of one callback comparing
+ topics:
+  - "yourRouter/light/+/set" is handled for every light by one handler,
+    which reads the light name from the topic
+  - "yourRouter/config/#" receives everything below config
+  - messages no handler matches go to the callback of SetCallback()
+ The handlers read topic and payload in place, nothing is copied.
+*/
+
+#include <WiFi.h>
+#include <MQTTClient.h>
+
+// Update these with values suitable for your network.
+const char * ssid ="your_ssid";
+const char * pass = "your_passwd";
+
+//MQTT broker
+const char *mqtt_broker = "broker.emqx.io";
+const char *mqtt_username = "emqx";
+const char *mqtt_password ="public";
+const int mqtt_port = 1883;
+
+void *cli;
+MQTTClient mqtt;
+
+void onLightSet(const MQTTMessage *msg, void *arg)
+{
+  // "yourRouter/light/<name>/set": the name is the third level
+  const char *name = msg->topic + strlen("yourRouter/light/");
+  const char *end = strchr(name, '/');
+  Serial.print("light ");
+  Serial.write((const uint8_t *)name, end - name);
+  Serial.print(" -> ");
+  Serial.write(msg->payload, msg->length);
+  Serial.println();
+}
+
+void onConfig(const MQTTMessage *msg, void *arg)
+{
+  Serial.print((const char *)arg);
+  Serial.print(msg->topic);
+  Serial.print(" (");
+  Serial.print(msg->length);
+  Serial.println(" bytes)");
+}
+
+void callback(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+  Serial.print("unrouted message in topic: ");
+  Serial.println(msg->topic);
+}
+
+void setup()
+{
+  Serial.begin(115200);
+  WiFi.begin(ssid,pass);
+
+  while (WiFi.status() != WSS_GOT_IP) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("");
+  Serial.println("WiFi connected");
+
+  mqtt_client_config_t config = {0};
+  config.cacert = NULL;
+  config.cacert_len = 0;
+  config.host = mqtt_broker;
+  config.port = mqtt_port;
+  config.keepalive = 60;
+  config.timeout_ms = 100;
+  config.username = mqtt_username;
+  config.password = mqtt_password;
+  config.clientid = "ty_router_id";
+
+  cli = mqtt.SetCallback(callback).init(&config);
+  while (mqtt.connect(cli) != OPRT_OK) {
+    delay(2000);
+  }
+
+  mqtt.subscribe(cli, "yourRouter/light/+/set", onLightSet);
+  mqtt.subscribe(cli, "yourRouter/config/#", onConfig, (void *)"config: ");
+  // handled by the callback
+  mqtt.subscribe(cli, "yourRouter/other");
+}
+
+void loop()
+{
+  mqtt.loop(cli);
+  delay(10);
+}
@@ -0,0 +1,112 @@
+/*
+ MQTT telemetry example
+
+ Publishes a small binary sample 100 times per second without waiting for
+ the network:
+  - publish() copies each sample into the outbox and returns at once
+  - loop() sends the queued samples back to back, holding QoS 1 messages
+    while 8 of them wait for their PUBACK
+  - the client and per-topic counters are printed every 5 seconds
+*/
+
+#include <WiFi.h>
+#include <MQTTClient.h>
+
+// Update these with values suitable for your network.
+const char * ssid ="your_ssid";
+const char * pass = "your_passwd";
+
+//MQTT broker
+const char *mqtt_broker = "broker.emqx.io";
+const char *mqtt_username = "emqx";
+const char *mqtt_password ="public";
+const int mqtt_port = 1883;
+
+const char *sampleTopic = "yourTelemetry/samples";
+const char *statusTopic = "yourTelemetry/status";
+
+void *cli;
+MQTTClient mqtt;
+
+typedef struct {
+  uint32_t seq;
+  uint32_t ms;
+  int16_t value;
+} sample_t;
+
+uint32_t seq = 0;
+unsigned long lastSample = 0;
+unsigned long lastReport = 0;
+
+void setup()
+{
+  Serial.begin(115200);
+  WiFi.begin(ssid,pass);
+
+  while (WiFi.status() != WSS_GOT_IP) {
+    delay(500);
+    Serial.print(".");
+  }
+  Serial.println("");
+  Serial.println("WiFi connected");
+
+  mqtt_client_config_t config = {0};
+  config.cacert = NULL;
+  config.cacert_len = 0;
+  config.host = mqtt_broker;
+  config.port = mqtt_port;
+  config.keepalive = 60;
+  config.timeout_ms = 100;
+  config.username = mqtt_username;
+  config.password = mqtt_password;
+  config.clientid = "ty_telemetry_id";
+
+  cli = mqtt.init(&config);
+  // 4 KB of queued messages, at most 8 QoS 1 messages waiting for PUBACK
+  mqtt.setOutbox(4 * 1024, 8);
+  mqtt.connect(cli);
+}
+
+void loop()
+{
+  unsigned long now = millis();
+
+  if (now - lastSample >= 10) {
+    lastSample = now;
+    sample_t s = { seq++, (uint32_t)now, (int16_t)random(-1000, 1000) };
+    if (mqtt.publish(cli, sampleTopic, (const uint8_t *)&s, sizeof(s)) != OPRT_OK) {
+      // outbox full, the sample is counted as dropped
+    }
+    if (s.seq % 100 == 0) {
+      const char *status = "alive";
+      mqtt.publish(cli, statusTopic, (const uint8_t *)status, strlen(status), MQTT_QOS_1);
+    }
+  }
+
+  mqtt.loop(cli);
+
+  if (now - lastReport >= 5000) {
+    lastReport = now;
+    const MQTTClientStats &st = mqtt.stats();
+    Serial.print("queued: ");
+    Serial.print(st.queued);
+    Serial.print(" sent: ");
+    Serial.print(st.sent);
+    Serial.print(" dropped: ");
+    Serial.print(st.dropped);
+    Serial.print(" acked: ");
+    Serial.print(st.acked);
+    Serial.print(" outbox peak: ");
+    Serial.println(st.outboxPeak);
+    for (uint8_t i = 0; i < mqtt.topicStatsCount(); i++) {
+      const MQTTTopicStats *ts = mqtt.topicStats(i);
+      Serial.print("  ");
+      Serial.print(ts->topic);
+      Serial.print(": ");
+      Serial.print(ts->published);
+      Serial.print(" msgs, ");
+      Serial.print(ts->bytes);
+      Serial.println(" bytes");
+    }
+  }
+}
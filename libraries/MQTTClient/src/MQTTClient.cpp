@@ -1,5 +1,39 @@
 #include "MQTTClient.h"
+#include <Arduino.h>
+#include "tal_memory.h"
+#include "tal_system.h"
+#include "OfflineQueue.h"
 
+typedef struct {
+    uint32_t len;           // whole record, 4 byte aligned; 0 marks a wrap
+    uint32_t payloadLen;
+    uint16_t topicLen;      // with the terminating NUL
+    uint8_t qos;
+    uint8_t reserved;
+} mqtt_outbox_rec_t;
+
+#define MQTT_OUTBOX_ALIGN(n)    (((n) + 3) & ~3)
+
+// one topic level of a subscription filter
+struct MQTTRouteNode {
+    MQTTRouteNode *child;       // first exact level below
+    MQTTRouteNode *next;        // next exact level beside
+    MQTTRouteNode *single;      // "+" below
+    MQTTRouteNode *multi;       // "#" below
+    MQTTMessageHandler handler;
+    void *arg;
+    uint32_t hash;
+    uint16_t len;
+    char level[1];              // not NUL terminated
+};
+
+typedef struct {
+    MQTTMessageHandler handler;
+    void *arg;
+} mqtt_route_match_t;
+
+static void mqtt_route_free(MQTTRouteNode *node);
+static bool mqtt_filter_valid(const char *filter);
 
 MQTTClient::MQTTClient()
 {
@@ -7,6 +41,16 @@ MQTTClient::MQTTClient()
 
 MQTTClient::~MQTTClient()
 {
+    end();
+    tal_free(_outbox);
+    tal_free(_topics);
+    for (uint8_t i = 0; i < _subCount; i++) {
+        tal_free(_subs[i].topic);
+    }
+    mqtt_route_free(_routes);
+    if (_mutex) {
+        tal_mutex_release(_mutex);
+    }
 }
 
 MQTTClient& MQTTClient::SetCallback(MQTT_MSG_CB)
@@ -15,14 +59,20 @@ MQTTClient& MQTTClient::SetCallback(MQTT_MSG_CB)
     return *this;
 }
 
-static void mqtt_connected_cb(void *client, void *userdata)
+void MQTTClient::_onConnected(void *client, void *userdata)
 {
     PR_INFO("mqtt client connected!");
+    if (userdata) {
+        ((MQTTClient *)userdata)->is_connected = true;
+    }
 }
 
-static void mqtt_disconnected_cb(void *client, void *userdata)
+void MQTTClient::_onDisconnected(void *client, void *userdata)
 {
     PR_INFO("mqtt client disconnected!");
+    if (userdata) {
+        ((MQTTClient *)userdata)->is_connected = false;
+    }
 }
 
 
@@ -32,9 +82,25 @@ static void mqtt_subscribed_cb(void *client, uint16_t msgid, void *userdata)
     PR_DEBUG("Subscribe succeeded ID:%d", msgid);
 }
 
-static void mqtt_puback_cb(void *client, uint16_t msgid, void *userdata)
+void MQTTClient::_onPublished(void *client, uint16_t msgid, void *userdata)
 {
     PR_DEBUG("PUBACK ID:%d", msgid);
+    MQTTClient *self = (MQTTClient *)userdata;
+    if (!self) {
+        return;
+    }
+    for (uint8_t i = 0; i < self->_inflightCount; i++) {
+        if (self->_inflight[i].msgid == msgid) {
+            uint32_t ms = millis() - self->_inflight[i].sentAt;
+            self->_stats.ackTimeMs += ms;
+            if (ms > self->_stats.ackMaxMs) {
+                self->_stats.ackMaxMs = ms;
+            }
+            self->_inflight[i] = self->_inflight[--self->_inflightCount];
+            self->_stats.acked++;
+            break;
+        }
+    }
 }
 
 
@@ -47,21 +113,23 @@ void * MQTTClient::init(mqtt_client_config_t *config)
         return NULL;
     }
 
-    const mqtt_client_config_t mqtt_config = {.cacert = config->cacert,
-                                              .cacert_len = config->cacert_len,
-                                              .host = config->host,
-                                              .port = config->port,
-                                              .keepalive = config->keepalive,
-                                              .timeout_ms = config->timeout_ms,
-                                              .clientid = config->clientid,
-                                              .username = config->username,
-                                              .password = config->password,
-                                              .on_connected = mqtt_connected_cb,
-                                              .on_disconnected = mqtt_disconnected_cb,
-                                              .on_message = this->callback,
-                                              .on_published = mqtt_puback_cb,
-                                              .on_subscribed = mqtt_subscribed_cb,
-                                              };
+    mqtt_client_config_t mqtt_config = {.cacert = config->cacert,
+                                        .cacert_len = config->cacert_len,
+                                        .host = config->host,
+                                        .port = config->port,
+                                        .keepalive = config->keepalive,
+                                        .timeout_ms = config->timeout_ms,
+                                        .clientid = config->clientid,
+                                        .username = config->username,
+                                        .password = config->password,
+                                        .on_connected = _onConnected,
+                                        .on_disconnected = _onDisconnected,
+                                        .on_message = _onMessage,
+                                        .on_published = _onPublished,
+                                        .on_subscribed = mqtt_subscribed_cb,
+                                        };
+    // connection state, PUBACKs and message routes are kept per client
+    mqtt_config.userdata = this;
     mqtt_status = mqtt_client_init(cli, &mqtt_config);
     if (mqtt_status != MQTT_STATUS_SUCCESS) {
         PR_ERR("MQTT init failed: Status = %d.", mqtt_status);
@@ -76,17 +144,19 @@ int MQTTClient::connect(void *client)
     if(client==NULL){
           return OPRT_INVALID_PARM;
     }
-    if(is_connected)
+    if(is_connected || _running)
         return 0;
     PR_INFO("tuya_mqtt_start...");
     mqtt_client_status_t mqtt_status;
-    mqtt_status = mqtt_client_connect(client);
+    mqtt_status = _connect(client);
     if(mqtt_status != MQTT_STATUS_SUCCESS)
     {
         PR_ERR("MQTT connect fail:%d", mqtt_status);
         return OPRT_COM_ERROR;
     }
     is_connected = true;
+    // PUBACKs of the old session will not come
+    _inflightCount = 0;
     PR_ERR("MQTT connect OK:%d", mqtt_status);
     return OPRT_OK;
 }
@@ -100,6 +170,10 @@ int MQTTClient::disconnect(void *client)
 {
     if(client == NULL)
         return OPRT_INVALID_PARM;
+    if(_running) {
+        end();
+        return OPRT_OK;
+    }
     if(is_connected)
     {
         mqtt_client_status_t mqtt_status;
@@ -113,39 +187,856 @@ int MQTTClient::disconnect(void *client)
 
 int MQTTClient::publish(void *client, const char *topic, const char *payload)
 {
-    int payload_len = strlen(payload);
-    uint16_t msgid = mqtt_client_publish(client, topic, (uint8_t*)payload, payload_len, MQTT_QOS_0);
+    return publish(client, topic, (const uint8_t *)payload, strlen(payload), MQTT_QOS_0, false);
+}
+
+int MQTTClient::publish(void *client, const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos, bool retain)
+{
+    if (client == NULL || topic == NULL || (payload == NULL && length)) {
+        return OPRT_INVALID_PARM;
+    }
+    if (retain) {
+        PR_ERR("mqtt retain is not supported");
+        return OPRT_NOT_SUPPORTED;
+    }
+    return publish(client, topic, payload, length, qos, OFFLINE_PRIO_NORMAL, 0);
+}
+
+int MQTTClient::publish(void *client, const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos,
+                        uint8_t priority, uint32_t ttl)
+{
+    if (client == NULL || topic == NULL || (payload == NULL && length)) {
+        return OPRT_INVALID_PARM;
+    }
+    // once connected new messages go out directly, the stored ones are
+    // replayed next to them at the queue's rate
+    if (_offline && !is_connected) {
+        return _store(topic, payload, length, qos, priority, ttl);
+    }
+    if (!_outbox) {
+        int rt = _send(client, topic, payload, length, qos);
+        if (rt != OPRT_OK && _offline) {
+            rt = _store(topic, payload, length, qos, priority, ttl);
+        }
+        return rt;
+    }
+    // producers hold the lock only for the copy, never while the network
+    // task sends
+    if (!_lock()) {
+        return OPRT_MALLOC_FAILED;
+    }
+    int rt = OPRT_OK;
+    if (!_enqueue(topic, payload, length, qos)) {
+        if (_offline) {
+            _unlock();
+            return _store(topic, payload, length, qos, priority, ttl);
+        }
+        _stats.dropped++;
+        MQTTTopicStats *ts = _topicStats(topic, true);
+        if (ts) {
+            ts->dropped++;
+        }
+        rt = OPRT_EXCEED_UPPER_LIMIT;
+    } else {
+        _stats.queued++;
+        if (_outboxUsed > _stats.outboxPeak) {
+            _stats.outboxPeak = _outboxUsed;
+        }
+    }
+    _unlock();
+    return rt;
+}
+
+int MQTTClient::_store(const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos,
+                       uint8_t priority, uint32_t ttl)
+{
+    int rt = _offline->push(topic, payload, length, priority, ttl, qos);
+    if (!_lock()) {
+        return rt;
+    }
+    if (rt == OPRT_OK) {
+        _stats.stored++;
+    } else {
+        _stats.dropped++;
+        MQTTTopicStats *ts = _topicStats(topic, true);
+        if (ts) {
+            ts->dropped++;
+        }
+    }
+    _unlock();
+    return rt;
+}
+
+int MQTTClient::_replay(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, void *arg)
+{
+    MQTTClient *self = (MQTTClient *)arg;
+    if (qos != MQTT_QOS_0 && self->_inflightCount >= self->_window) {
+        return OPRT_RESOURCE_NOT_READY;
+    }
+    return self->_send(self->_client, topic, payload, length, (mqtt_qos_t)qos);
+}
+
+int MQTTClient::_send(void *client, const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos)
+{
+    uint16_t msgid = mqtt_client_publish(client, topic, payload, length, qos);
     if (msgid <= 0) {
+        _stats.failed++;
         return OPRT_COM_ERROR;
     }
+    _stats.sent++;
+    _stats.bytesOut += strlen(topic) + length;
+    if (_lock()) {
+        MQTTTopicStats *ts = _topicStats(topic, true);
+        if (ts) {
+            ts->published++;
+            ts->bytes += length;
+        }
+        _unlock();
+    }
+    if (qos != MQTT_QOS_0 && _inflightCount < MQTT_INFLIGHT_MAX) {
+        _inflight[_inflightCount].msgid = msgid;
+        _inflight[_inflightCount].sentAt = millis();
+        _inflightCount++;
+        if (_inflightCount > _stats.inflightPeak) {
+            _stats.inflightPeak = _inflightCount;
+        }
+    }
     return OPRT_OK;
 }
 
-int MQTTClient::subscribe(void *client,const char *topic)
+int MQTTClient::setOutbox(size_t bytes, uint8_t inflight)
 {
-    uint16_t msgid = mqtt_client_subscribe(client, topic, MQTT_QOS_1);
-    if (msgid <= 0) {
+    if (bytes > MQTT_OUTBOX_MAX_SIZE || inflight < 1 || inflight > MQTT_INFLIGHT_MAX) {
+        return OPRT_INVALID_PARM;
+    }
+    if (_running) {
         return OPRT_COM_ERROR;
     }
-     return OPRT_OK;
+    // queued messages are dropped with the old buffer
+    tal_free(_outbox);
+    _outbox = NULL;
+    _outboxSize = 0;
+    _outboxHead = _outboxTail = _outboxUsed = 0;
+    _window = inflight;
+    if (!bytes) {
+        return OPRT_OK;
+    }
+    bytes = MQTT_OUTBOX_ALIGN(bytes);
+    _outbox = (uint8_t *)tal_malloc(bytes);
+    if (!_outbox) {
+        PR_ERR("mqtt outbox malloc %d failed", (int)bytes);
+        return OPRT_MALLOC_FAILED;
+    }
+    _outboxSize = bytes;
+    return OPRT_OK;
+}
+
+// records are stored whole; one that does not fit before the end of the
+// buffer starts over at offset 0 and the rest of the end is skipped
+bool MQTTClient::_enqueue(const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos)
+{
+    size_t topicLen = strlen(topic) + 1;
+    size_t len = MQTT_OUTBOX_ALIGN(sizeof(mqtt_outbox_rec_t) + topicLen + length);
+    if (topicLen > 0xFFFF || len > _outboxSize - _outboxUsed) {
+        return false;
+    }
+    if (!_outboxUsed) {
+        _outboxHead = _outboxTail = 0;
+    }
+    size_t at = _outboxHead;
+    if (_outboxHead >= _outboxTail) {
+        size_t end = _outboxSize - _outboxHead;
+        if (len > end) {
+            if (len > _outboxTail || len + end > _outboxSize - _outboxUsed) {
+                return false;
+            }
+            if (end >= sizeof(mqtt_outbox_rec_t)) {
+                ((mqtt_outbox_rec_t *)(_outbox + _outboxHead))->len = 0;
+            }
+            _outboxUsed += end;
+            at = 0;
+        }
+    } else if (len > _outboxTail - _outboxHead) {
+        return false;
+    }
+    mqtt_outbox_rec_t *rec = (mqtt_outbox_rec_t *)(_outbox + at);
+    rec->len = len;
+    rec->payloadLen = length;
+    rec->topicLen = topicLen;
+    rec->qos = qos;
+    memcpy(rec + 1, topic, topicLen);
+    if (length) {
+        memcpy((uint8_t *)(rec + 1) + topicLen, payload, length);
+    }
+    _outboxHead = at + len;
+    if (_outboxHead == _outboxSize) {
+        _outboxHead = 0;
+    }
+    _outboxUsed += len;
+    return true;
+}
+
+void MQTTClient::_expireInflight()
+{
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < _inflightCount;) {
+        if (now - _inflight[i].sentAt >= MQTT_INFLIGHT_TIMEOUT_MS) {
+            PR_NOTICE("mqtt msg %d not acknowledged", _inflight[i].msgid);
+            _inflight[i] = _inflight[--_inflightCount];
+            _stats.ackTimeouts++;
+        } else {
+            i++;
+        }
+    }
+}
+
+void MQTTClient::_drain(void *client)
+{
+    _expireInflight();
+    if (!is_connected) {
+        return;
+    }
+    _client = client;
+    // the record at the tail stays counted in _outboxUsed while it is sent,
+    // so producers never write over it and the lock is not held meanwhile
+    for (int n = 0; _outbox && n < MQTT_OUTBOX_BURST; n++) {
+        if (!_lock()) {
+            return;
+        }
+        if (_outboxUsed && (_outboxSize - _outboxTail < sizeof(mqtt_outbox_rec_t) ||
+            ((mqtt_outbox_rec_t *)(_outbox + _outboxTail))->len == 0)) {
+            _outboxUsed -= _outboxSize - _outboxTail;
+            _outboxTail = 0;
+        }
+        mqtt_outbox_rec_t *rec = _outboxUsed ? (mqtt_outbox_rec_t *)(_outbox + _outboxTail) : NULL;
+        _unlock();
+        if (!rec || (rec->qos != MQTT_QOS_0 && _inflightCount >= _window)) {
+            break;
+        }
+        const char *topic = (const char *)(rec + 1);
+        if (_send(client, topic, (const uint8_t *)topic + rec->topicLen, rec->payloadLen, (mqtt_qos_t)rec->qos) != OPRT_OK) {
+            // kept for the next loop(), order is preserved
+            break;
+        }
+        _lock();
+        _outboxTail += rec->len;
+        if (_outboxTail == _outboxSize) {
+            _outboxTail = 0;
+        }
+        _outboxUsed -= rec->len;
+        _unlock();
+    }
+    // stored messages are older than anything queued after them
+    if (_offline && !_outboxUsed) {
+        _offline->replay(_replay, this);
+    }
+}
+
+static uint32_t mqtt_topic_hash(const char *topic)
+{
+    uint32_t hash = 2166136261u;
+    while (*topic) {
+        hash = (hash ^ (uint8_t)*topic++) * 16777619u;
+    }
+    return hash;
+}
+
+MQTTTopicStats *MQTTClient::_topicStats(const char *topic, bool create)
+{
+    uint32_t hash = mqtt_topic_hash(topic);
+    for (uint8_t i = 0; i < _topicCount; i++) {
+        if (_topics[i].hash == hash && !strncmp(_topics[i].stats.topic, topic, MQTT_TOPIC_STATS_NAME_MAX - 1)) {
+            return &_topics[i].stats;
+        }
+    }
+    if (!create || _topicCount >= MQTT_TOPIC_STATS_MAX) {
+        return NULL;
+    }
+    if (!_topics) {
+        _topics = (mqtt_topic_entry_t *)tal_malloc(MQTT_TOPIC_STATS_MAX * sizeof(mqtt_topic_entry_t));
+        if (!_topics) {
+            return NULL;
+        }
+    }
+    mqtt_topic_entry_t *e = &_topics[_topicCount++];
+    memset(e, 0, sizeof(*e));
+    e->hash = hash;
+    strncpy(e->stats.topic, topic, MQTT_TOPIC_STATS_NAME_MAX - 1);
+    return &e->stats;
+}
+
+const MQTTTopicStats *MQTTClient::topicStats(const char *topic)
+{
+    return _topicStats(topic, false);
+}
+
+const MQTTTopicStats *MQTTClient::topicStats(uint8_t index) const
+{
+    return (index < _topicCount) ? &_topics[index].stats : NULL;
+}
+
+void MQTTClient::resetStats()
+{
+    if (!_lock()) {
+        return;
+    }
+    memset(&_stats, 0, sizeof(_stats));
+    _topicCount = 0;
+    _unlock();
+}
+
+int MQTTClient::subscribe(void *client,const char *topic)
+{
+    return subscribe(client, topic, MQTT_QOS_1);
+}
+
+int MQTTClient::subscribe(void *client, const char *topic, mqtt_qos_t qos)
+{
+    if (client == NULL || topic == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+    bool running = _running;
+    if (!running) {
+        uint16_t msgid = mqtt_client_subscribe(client, topic, qos);
+        if (msgid <= 0) {
+            return OPRT_COM_ERROR;
+        }
+    }
+    // remembered for begin(); the network task sends it when connected
+    if (!_lock()) {
+        return running ? OPRT_MALLOC_FAILED : OPRT_OK;
+    }
+    mqtt_subscription_t *sub = NULL;
+    for (uint8_t i = 0; i < _subCount; i++) {
+        if (!strcmp(_subs[i].topic, topic)) {
+            sub = &_subs[i];
+            break;
+        }
+    }
+    if (!sub && _subCount < MQTT_SUBSCRIPTIONS_MAX) {
+        char *copy = (char *)tal_malloc(strlen(topic) + 1);
+        if (copy) {
+            strcpy(copy, topic);
+            sub = &_subs[_subCount++];
+            sub->topic = copy;
+        }
+    }
+    if (sub) {
+        sub->qos = qos;
+        sub->state = running ? MQTT_SUB_PENDING : MQTT_SUB_ACTIVE;
+    }
+    _unlock();
+    if (!sub) {
+        PR_NOTICE("mqtt subscription %s is not restored on reconnect", topic);
+        return running ? OPRT_EXCEED_UPPER_LIMIT : OPRT_OK;
+    }
+    return OPRT_OK;
+}
+
+int MQTTClient::subscribe(void *client, const char *filter, MQTTMessageHandler handler, void *arg, mqtt_qos_t qos)
+{
+    if (client == NULL || filter == NULL || handler == NULL || !mqtt_filter_valid(filter)) {
+        return OPRT_INVALID_PARM;
+    }
+    // routed before the broker is asked, so no message is missed
+    if (!_lock()) {
+        return OPRT_MALLOC_FAILED;
+    }
+    int rt = _addRoute(filter, handler, arg);
+    _unlock();
+    if (rt == OPRT_OK) {
+        rt = subscribe(client, filter, qos);
+    }
+    if (rt != OPRT_OK && _lock()) {
+        _removeRoute(filter);
+        _unlock();
+    }
+    return rt;
 }
 
 int MQTTClient::unsubscribe(void *client,const char *topic)
 {
-    uint16_t msgid = mqtt_client_unsubscribe(client, topic, MQTT_QOS_1);
-    if (msgid <= 0) {
-        return OPRT_COM_ERROR;
+    if (client == NULL || topic == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+    bool running = _running;
+    if (!running) {
+        uint16_t msgid = mqtt_client_unsubscribe(client, topic, MQTT_QOS_1);
+        if (msgid <= 0) {
+            return OPRT_COM_ERROR;
+        }
+    }
+    if (!_lock()) {
+        return running ? OPRT_MALLOC_FAILED : OPRT_OK;
+    }
+    int rt = (_removeRoute(topic) || !running) ? OPRT_OK : OPRT_NOT_FOUND;
+    for (uint8_t i = 0; i < _subCount; i++) {
+        if (strcmp(_subs[i].topic, topic)) {
+            continue;
+        }
+        if (running) {
+            _subs[i].state = MQTT_SUB_REMOVE;
+        } else {
+            tal_free(_subs[i].topic);
+            _subs[i] = _subs[--_subCount];
+        }
+        rt = OPRT_OK;
+        break;
+    }
+    _unlock();
+    return rt;
+}
+
+// called by the network task while connected, with pending changes retried
+// on the next pass if the MQTT core refuses them
+void MQTTClient::_syncSubscriptions(void *client)
+{
+    if (!_lock()) {
+        return;
+    }
+    for (uint8_t i = 0; i < _subCount;) {
+        mqtt_subscription_t *sub = &_subs[i];
+        if (sub->state == MQTT_SUB_PENDING) {
+            if (mqtt_client_subscribe(client, sub->topic, sub->qos) <= 0) {
+                break;
+            }
+            sub->state = MQTT_SUB_ACTIVE;
+        } else if (sub->state == MQTT_SUB_REMOVE) {
+            if (mqtt_client_unsubscribe(client, sub->topic, MQTT_QOS_1) <= 0) {
+                break;
+            }
+            tal_free(sub->topic);
+            *sub = _subs[--_subCount];
+            continue;
+        }
+        i++;
+    }
+    _unlock();
+}
+
+static uint32_t mqtt_level_hash(const char *level, size_t len)
+{
+    uint32_t hash = 2166136261u;
+    while (len--) {
+        hash = (hash ^ (uint8_t)*level++) * 16777619u;
+    }
+    return hash;
+}
+
+// a wildcard takes a whole level, and # only the last one
+static bool mqtt_filter_valid(const char *filter)
+{
+    int depth = 1;
+    if (!*filter) {
+        return false;
+    }
+    for (const char *p = filter; *p; p++) {
+        if (*p == '/') {
+            if (++depth > MQTT_ROUTE_DEPTH_MAX) {
+                return false;
+            }
+        } else if (*p == '+' || *p == '#') {
+            if ((p != filter && p[-1] != '/') || (p[1] && p[1] != '/') || (*p == '#' && p[1])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static MQTTRouteNode *mqtt_route_node_new(const char *level, size_t len)
+{
+    MQTTRouteNode *node = (MQTTRouteNode *)tal_malloc(sizeof(MQTTRouteNode) + len);
+    if (!node) {
+        return NULL;
+    }
+    memset(node, 0, sizeof(MQTTRouteNode));
+    memcpy(node->level, level, len);
+    node->len = len;
+    node->hash = mqtt_level_hash(level, len);
+    return node;
+}
+
+static void mqtt_route_free(MQTTRouteNode *node)
+{
+    while (node) {
+        MQTTRouteNode *next = node->next;
+        mqtt_route_free(node->child);
+        mqtt_route_free(node->single);
+        mqtt_route_free(node->multi);
+        tal_free(node);
+        node = next;
+    }
+}
+
+// where the node for one level of a filter hangs below `node`
+static MQTTRouteNode **mqtt_route_slot(MQTTRouteNode *node, const char *level, size_t len)
+{
+    if (len == 1 && *level == '+') {
+        return &node->single;
+    }
+    if (len == 1 && *level == '#') {
+        return &node->multi;
+    }
+    uint32_t hash = mqtt_level_hash(level, len);
+    MQTTRouteNode **slot = &node->child;
+    while (*slot && ((*slot)->hash != hash || (*slot)->len != len || memcmp((*slot)->level, level, len))) {
+        slot = &(*slot)->next;
+    }
+    return slot;
+}
+
+// collects the handlers of every filter matching the topic from `level` on,
+// NULL once all levels are consumed
+static void mqtt_route_match(const MQTTRouteNode *node, const char *level, bool root,
+                             mqtt_route_match_t *match, uint8_t *count)
+{
+    // wildcards on the first level do not match topics starting with $
+    bool wild = !(root && *level == '$');
+    if (node->multi && node->multi->handler && wild && *count < MQTT_ROUTE_MATCH_MAX) {
+        match[*count].handler = node->multi->handler;
+        match[(*count)++].arg = node->multi->arg;
+    }
+    if (!level) {
+        if (node->handler && *count < MQTT_ROUTE_MATCH_MAX) {
+            match[*count].handler = node->handler;
+            match[(*count)++].arg = node->arg;
+        }
+        return;
+    }
+    const char *end = strchr(level, '/');
+    size_t len = end ? (size_t)(end - level) : strlen(level);
+    const char *next = end ? end + 1 : NULL;
+    uint32_t hash = mqtt_level_hash(level, len);
+    for (const MQTTRouteNode *child = node->child; child; child = child->next) {
+        if (child->hash == hash && child->len == len && !memcmp(child->level, level, len)) {
+            mqtt_route_match(child, next, false, match, count);
+            break;
+        }
+    }
+    if (node->single && wild) {
+        mqtt_route_match(node->single, next, false, match, count);
+    }
+}
+
+int MQTTClient::_addRoute(const char *filter, MQTTMessageHandler handler, void *arg)
+{
+    if (!_routes) {
+        _routes = mqtt_route_node_new("", 0);
+        if (!_routes) {
+            return OPRT_MALLOC_FAILED;
+        }
+    }
+    MQTTRouteNode *node = _routes;
+    const char *level = filter;
+    for (;;) {
+        const char *end = strchr(level, '/');
+        size_t len = end ? (size_t)(end - level) : strlen(level);
+        MQTTRouteNode **slot = mqtt_route_slot(node, level, len);
+        if (!*slot) {
+            *slot = mqtt_route_node_new(level, len);
+            if (!*slot) {
+                return OPRT_MALLOC_FAILED;
+            }
+        }
+        node = *slot;
+        if (!end) {
+            break;
+        }
+        level = end + 1;
+    }
+    node->handler = handler;
+    node->arg = arg;
+    return OPRT_OK;
+}
+
+// also frees the levels a failed _addRoute() left behind
+bool MQTTClient::_removeRoute(const char *filter)
+{
+    MQTTRouteNode **path[MQTT_ROUTE_DEPTH_MAX];
+    uint8_t depth = 0;
+    bool found = false;
+    MQTTRouteNode *node = _routes;
+    const char *level = filter;
+    while (node && depth < MQTT_ROUTE_DEPTH_MAX) {
+        const char *end = strchr(level, '/');
+        size_t len = end ? (size_t)(end - level) : strlen(level);
+        MQTTRouteNode **slot = mqtt_route_slot(node, level, len);
+        if (!*slot) {
+            break;
+        }
+        path[depth++] = slot;
+        node = *slot;
+        if (!end) {
+            found = node->handler != NULL;
+            node->handler = NULL;
+            node->arg = NULL;
+            break;
+        }
+        level = end + 1;
+    }
+    // levels left without a handler or anything below are dropped, leaf first
+    while (depth) {
+        MQTTRouteNode **slot = path[--depth];
+        MQTTRouteNode *n = *slot;
+        if (n->handler || n->child || n->single || n->multi) {
+            break;
+        }
+        *slot = n->next;
+        tal_free(n);
+    }
+    return found;
+}
+
+void MQTTClient::printStats(Print &p)
+{
+    MQTTClientStats s = _stats;
+    p.print("mqtt: sent ");
+    p.print(s.sent);
+    p.print("/");
+    p.print(s.bytesOut);
+    p.print("B received ");
+    p.print(s.received);
+    p.print("/");
+    p.print(s.bytesIn);
+    p.print("B failed ");
+    p.print(s.failed);
+    p.print(" dropped ");
+    p.print(s.dropped);
+    p.print(" stored ");
+    p.println(s.stored);
+    p.print("  connect: last=");
+    p.print(s.connectTimeMs);
+    p.print("ms max=");
+    p.print(s.connectMaxMs);
+    p.print("ms reconnects ");
+    p.print(s.reconnects);
+    p.print(" failed ");
+    p.println(s.connectFails);
+    p.print("  puback: n=");
+    p.print(s.acked);
+    p.print(" avg=");
+    p.print(s.acked ? s.ackTimeMs / s.acked : 0);
+    p.print("ms max=");
+    p.print(s.ackMaxMs);
+    p.print("ms timeouts ");
+    p.println(s.ackTimeouts);
+    if (!_lock()) {
+        return;
     }
-     return OPRT_OK;
+    for (uint8_t i = 0; i < _topicCount; i++) {
+        const MQTTTopicStats *t = &_topics[i].stats;
+        p.print("  ");
+        p.print(t->topic);
+        p.print(": ");
+        p.print(t->published);
+        p.print("/");
+        p.print(t->bytes);
+        p.print("B dropped ");
+        p.println(t->dropped);
+    }
+    _unlock();
+}
+
+void MQTTClient::_onMessage(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+{
+    MQTTClient *self = (MQTTClient *)userdata;
+    if (!self || !msg || !msg->topic) {
+        return;
+    }
+    self->_stats.received++;
+    self->_stats.bytesIn += strlen(msg->topic) + msg->length;
+    mqtt_route_match_t match[MQTT_ROUTE_MATCH_MAX];
+    uint8_t count = 0;
+    // handlers run after the lock is released, they may publish or subscribe
+    if (self->_routes && self->_lock()) {
+        if (self->_routes) {
+            mqtt_route_match(self->_routes, msg->topic, true, match, &count);
+        }
+        self->_unlock();
+    }
+    if (!count) {
+        if (self->callback) {
+            self->callback(client, msgid, msg, userdata);
+        }
+        return;
+    }
+    MQTTMessage m;
+    m.client = client;
+    m.topic = msg->topic;
+    m.topicLen = strlen(msg->topic);
+    m.payload = msg->payload;
+    m.length = msg->length;
+    m.qos = (mqtt_qos_t)msg->qos;
+    m.msgid = msgid;
+    for (uint8_t i = 0; i < count; i++) {
+        match[i].handler(&m, match[i].arg);
+    }
+}
+
+bool MQTTClient::_lock()
+{
+    // created on first use, global clients are constructed before the kernel is up
+    if (!_mutex && tal_mutex_create_init(&_mutex) != OPRT_OK) {
+        return false;
+    }
+    tal_mutex_lock(_mutex);
+    return true;
+}
+
+void MQTTClient::_unlock()
+{
+    tal_mutex_unlock(_mutex);
+}
+
+int MQTTClient::begin(void *client)
+{
+    if (client == NULL) {
+        return OPRT_INVALID_PARM;
+    }
+    if (_running) {
+        return OPRT_OK;
+    }
+    // created here, before any other thread can publish
+    if (!_mutex && tal_mutex_create_init(&_mutex) != OPRT_OK) {
+        return OPRT_MALLOC_FAILED;
+    }
+    if (!_outbox) {
+        int rt = setOutbox(MQTT_OUTBOX_DEFAULT_SIZE, _window);
+        if (rt != OPRT_OK) {
+            return rt;
+        }
+    }
+    _client = client;
+    _backoff = MQTT_RECONNECT_MIN_MS;
+    _running = true;
+
+    THREAD_CFG_T param;
+    param.priority = THREAD_PRIO_2;
+    param.stackDepth = MQTT_TASK_STACK;
+    char threadName[] = "mqtt_client";
+    param.thrdname = threadName;
+    OPERATE_RET rt = tal_thread_create_and_start(&_task, NULL, NULL, _run, this, &param);
+    if (rt != OPRT_OK) {
+        PR_ERR("mqtt task create failed:%d", rt);
+        _running = false;
+        _task = NULL;
+        return rt;
+    }
+    return OPRT_OK;
+}
+
+// not to be called from a message callback, which runs in the task
+void MQTTClient::end()
+{
+    if (!_running) {
+        return;
+    }
+    _running = false;
+    // the task leaves after the current poll or connection attempt
+    while (_task) {
+        tal_system_sleep(MQTT_TASK_POLL_MS);
+    }
+    if (is_connected) {
+        mqtt_client_disconnect(_client);
+        is_connected = false;
+    }
+    // queued subscription changes are applied directly from now on
+    _lock();
+    for (uint8_t i = 0; i < _subCount;) {
+        if (_subs[i].state == MQTT_SUB_REMOVE) {
+            tal_free(_subs[i].topic);
+            _subs[i] = _subs[--_subCount];
+            continue;
+        }
+        _subs[i++].state = MQTT_SUB_ACTIVE;
+    }
+    _unlock();
+}
+
+mqtt_client_status_t MQTTClient::_connect(void *client)
+{
+    unsigned long start = millis();
+    mqtt_client_status_t mqtt_status = mqtt_client_connect(client);
+    if (mqtt_status != MQTT_STATUS_SUCCESS) {
+        _stats.connectFails++;
+        return mqtt_status;
+    }
+    _stats.connectTimeMs = millis() - start;
+    if (_stats.connectTimeMs > _stats.connectMaxMs) {
+        _stats.connectMaxMs = _stats.connectTimeMs;
+    }
+    return mqtt_status;
+}
+
+// returns the time to wait before the next attempt, 0 once connected
+int MQTTClient::_reconnect(void *client)
+{
+    mqtt_client_status_t mqtt_status = _connect(client);
+    if (mqtt_status != MQTT_STATUS_SUCCESS) {
+        // doubled up to the limit; waiting between half and all of it keeps
+        // a fleet that lost the broker together from coming back in step
+        uint32_t wait = _backoff / 2 + tal_system_get_random(_backoff / 2 + 1);
+        PR_ERR("MQTT connect fail:%d, retry in %d ms", mqtt_status, (int)wait);
+        _backoff = (_backoff >= MQTT_RECONNECT_MAX_MS / 2) ? MQTT_RECONNECT_MAX_MS : _backoff * 2;
+        return (int)wait;
+    }
+    is_connected = true;
+    _inflightCount = 0;
+    _backoff = MQTT_RECONNECT_MIN_MS;
+    _stats.reconnects++;
+    // a clean session starts without subscriptions
+    if (_lock()) {
+        for (uint8_t i = 0; i < _subCount; i++) {
+            if (_subs[i].state == MQTT_SUB_ACTIVE) {
+                _subs[i].state = MQTT_SUB_PENDING;
+            }
+        }
+        _unlock();
+    }
+    PR_INFO("MQTT connect OK");
+    return 0;
+}
+
+void MQTTClient::_run(void *arg)
+{
+    MQTTClient *self = (MQTTClient *)arg;
+    void *client = self->_client;
+    unsigned long retryAt = millis();
+
+    while (self->_running) {
+        if (!self->is_connected) {
+            if ((long)(millis() - retryAt) >= 0) {
+                retryAt = millis() + self->_reconnect(client);
+            }
+            if (!self->is_connected) {
+                tal_system_sleep(MQTT_TASK_POLL_MS);
+                continue;
+            }
+        }
+        mqtt_client_yield(client);
+        self->_syncSubscriptions(client);
+        self->_drain(client);
+        tal_system_sleep(MQTT_TASK_POLL_MS);
+    }
+
+    THREAD_HANDLE task = self->_task;
+    self->_task = NULL;
+    tal_thread_delete(task);
 }
 
 int MQTTClient :: loop(void *client)
 {
     if (client == NULL) {
         return OPRT_COM_ERROR;
-    } 
+    }
+    if (_running) {
+        return OPRT_OK;
+    }
     int rt = OPRT_OK;
+    // PUBACKs read here open the in-flight window for the outbox
     rt = mqtt_client_yield(client);
+    _drain(client);
     return rt;
 }
 void MQTTClient::free(void *client)
@@ -1,17 +1,148 @@
 #ifndef __MQTTCLIENT_H__
 #define __MQTTCLIENT_H__
 
+#include "api/Print.h"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 #include "mqtt_client_interface.h"
 #include "tal_log.h"
+#include "tal_mutex.h"
+#include "tal_thread.h"
 #define MQTT_MSG_CB void (*callback)(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata)
+
+#define MQTT_OUTBOX_MAX_SIZE        (60 * 1024)
+#define MQTT_OUTBOX_BURST           (32)            // publishes sent per loop()
+#define MQTT_INFLIGHT_DEFAULT       (8)
+#define MQTT_INFLIGHT_MAX           (32)
+#define MQTT_INFLIGHT_TIMEOUT_MS    (20 * 1000)
+#define MQTT_TOPIC_STATS_MAX        (16)
+#define MQTT_TOPIC_STATS_NAME_MAX   (48)
+#define MQTT_SUBSCRIPTIONS_MAX      (32)            // restored after a reconnect
+#define MQTT_ROUTE_DEPTH_MAX        (16)            // topic levels of a filter
+#define MQTT_ROUTE_MATCH_MAX        (8)             // handlers called for one message
+#define MQTT_OUTBOX_DEFAULT_SIZE    (4 * 1024)      // set up by begin() without setOutbox()
+#define MQTT_TASK_STACK             (4096)
+#define MQTT_TASK_POLL_MS           (20)
+#define MQTT_RECONNECT_MIN_MS       (1000)
+#define MQTT_RECONNECT_MAX_MS       (60 * 1000)
+
+typedef struct {
+    uint32_t queued;            // publishes accepted into the outbox
+    uint32_t sent;              // handed to the MQTT core
+    uint32_t failed;            // rejected by the MQTT core
+    uint32_t dropped;           // outbox full or message larger than the outbox
+    uint32_t acked;             // PUBACKs for QoS 1 and 2
+    uint32_t ackTimeouts;       // in flight longer than MQTT_INFLIGHT_TIMEOUT_MS
+    uint32_t outboxPeak;        // bytes
+    uint16_t inflightPeak;
+    uint16_t reconnects;        // connections made by the network task
+    uint32_t stored;            // handed to the offline queue
+    uint32_t connectFails;
+    uint32_t connectTimeMs;     // last connection, DNS, TLS and CONNACK included
+    uint32_t connectMaxMs;
+    uint32_t bytesOut;          // topic and payload of the messages sent
+    uint32_t received;          // messages from the broker
+    uint32_t bytesIn;           // their topic and payload
+    uint32_t ackTimeMs;         // summed time from publish to PUBACK
+    uint32_t ackMaxMs;
+} MQTTClientStats;
+
+typedef struct {
+    char topic[MQTT_TOPIC_STATS_NAME_MAX];     // truncated to fit
+    uint32_t published;
+    uint32_t bytes;
+    uint32_t dropped;
+} MQTTTopicStats;
+
+// points into the receive buffer of the MQTT core, valid until the handler returns
+typedef struct {
+    void *client;
+    const char *topic;
+    uint16_t topicLen;
+    const uint8_t *payload;
+    size_t length;
+    mqtt_qos_t qos;
+    uint16_t msgid;
+} MQTTMessage;
+
+typedef void (*MQTTMessageHandler)(const MQTTMessage *msg, void *arg);
+
+struct MQTTRouteNode;
+class OfflineQueue;
+
 class MQTTClient
 {
 private:
+    typedef struct {
+        uint16_t msgid;
+        unsigned long sentAt;
+    } mqtt_inflight_t;
+
+    typedef struct {
+        uint32_t hash;
+        MQTTTopicStats stats;
+    } mqtt_topic_entry_t;
+
+    typedef enum {
+        MQTT_SUB_ACTIVE,
+        MQTT_SUB_PENDING,       // to be sent to the broker
+        MQTT_SUB_REMOVE,        // to be unsubscribed and dropped
+    } mqtt_sub_state_t;
+
+    typedef struct {
+        char *topic;
+        mqtt_qos_t qos;
+        uint8_t state;
+    } mqtt_subscription_t;
+
     MQTT_MSG_CB;
-    bool is_connected =false;
+    // written from the callbacks of the MQTT core, which may run in the task
+    volatile bool is_connected =false;
+
+    uint8_t *_outbox = NULL;
+    size_t _outboxSize = 0;
+    size_t _outboxHead = 0;
+    size_t _outboxTail = 0;
+    size_t _outboxUsed = 0;
+    uint8_t _window = MQTT_INFLIGHT_DEFAULT;
+    mqtt_inflight_t _inflight[MQTT_INFLIGHT_MAX];
+    uint8_t _inflightCount = 0;
+    mqtt_topic_entry_t *_topics = NULL;
+    uint8_t _topicCount = 0;
+    MQTTClientStats _stats = {};
+    mqtt_subscription_t _subs[MQTT_SUBSCRIPTIONS_MAX] = {};
+    uint8_t _subCount = 0;
+
+    MQTTRouteNode *_routes = NULL;
+    OfflineQueue *_offline = NULL;
+
+    MUTEX_HANDLE _mutex = NULL;
+    THREAD_HANDLE _task = NULL;
+    void *_client = NULL;
+    volatile bool _running = false;
+    uint32_t _backoff = MQTT_RECONNECT_MIN_MS;
+
+    static void _onConnected(void *client, void *userdata);
+    static void _onDisconnected(void *client, void *userdata);
+    static void _onPublished(void *client, uint16_t msgid, void *userdata);
+    static void _onMessage(void *client, uint16_t msgid, const mqtt_client_message_t *msg, void *userdata);
+    static void _run(void *arg);
+    static int _replay(const char *topic, const uint8_t *payload, size_t length, uint8_t qos, void *arg);
+    int _store(const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos, uint8_t priority, uint32_t ttl);
+    bool _lock();
+    void _unlock();
+    int _reconnect(void *client);
+    mqtt_client_status_t _connect(void *client);
+    void _syncSubscriptions(void *client);
+    int _addRoute(const char *filter, MQTTMessageHandler handler, void *arg);
+    bool _removeRoute(const char *filter);
+    int _send(void *client, const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos);
+    bool _enqueue(const char *topic, const uint8_t *payload, size_t length, mqtt_qos_t qos);
+    void _drain(void *client);
+    void _expireInflight();
+    MQTTTopicStats *_topicStats(const char *topic, bool create);
 public:
     MQTTClient();
     ~MQTTClient();
@@ -22,11 +153,73 @@ public:
     int connected();
     int disconnect(void *client);
     int publish(void *client, const char *topic, const char *payload);
+    // binary payloads; retain is refused with OPRT_NOT_SUPPORTED, the MQTT
+    // core of the SDK has no way to set the flag
+    int publish(void *client, const char *topic, const uint8_t *payload, size_t length,
+                mqtt_qos_t qos = MQTT_QOS_0, bool retain = false);
+    // priority and TTL in seconds apply if the message goes to the offline queue
+    int publish(void *client, const char *topic, const uint8_t *payload, size_t length,
+                mqtt_qos_t qos, uint8_t priority, uint32_t ttl);
 
     int subscribe(void *client,const char *topic);
+    int subscribe(void *client, const char *topic, mqtt_qos_t qos);
+    /*
+     * Calls `handler` for each message whose topic matches `filter`, which
+     * may use the + and # wildcards. Filters are kept in a tree of topic
+     * levels, so a message is matched in one pass over its topic whatever
+     * the number of subscriptions. Messages no handler matches go to the
+     * callback of SetCallback(). unsubscribe() removes the handler.
+     */
+    int subscribe(void *client, const char *filter, MQTTMessageHandler handler, void *arg = NULL,
+                  mqtt_qos_t qos = MQTT_QOS_1);
     int unsubscribe(void *client,const char *topic);
     int loop(void *client);
     void free(void *client);
+
+    /*
+     * Managed mode: a network task owned by the client yields, sends the
+     * outbox and reconnects with exponential backoff plus jitter, restoring
+     * the subscriptions made with subscribe(). publish() and subscribe() may
+     * then be called from any thread and only queue their work; connect()
+     * and loop() do nothing while the task runs. Without setOutbox() an
+     * outbox of MQTT_OUTBOX_DEFAULT_SIZE bytes is set up.
+     */
+    int begin(void *client);
+    // stops the task and disconnects
+    void end();
+    bool running() const { return _running; }
+
+    /*
+     * With an outbox, publish() copies the message into a ring buffer and
+     * returns at once; loop() sends up to MQTT_OUTBOX_BURST queued messages
+     * back to back, in order, holding QoS 1/2 messages while `inflight` of
+     * them wait for their PUBACK. A full outbox drops the new message. 0
+     * bytes frees the outbox and publishes directly again. Refused while
+     * the network task runs.
+     */
+    int setOutbox(size_t bytes, uint8_t inflight = MQTT_INFLIGHT_DEFAULT);
+
+    /*
+     * Messages that cannot be sent, or queued in a full outbox, are kept in
+     * `queue`, which may spill to flash, and replayed in order at its rate
+     * once the client is connected and the outbox is empty. Messages
+     * published while connected are sent directly, so they may arrive
+     * before older stored ones; the stored ones keep their order among
+     * themselves. NULL turns this off.
+     */
+    void setOfflineQueue(OfflineQueue *queue) { _offline = queue; }
+    size_t outboxUsed() const { return _outboxUsed; }
+    uint8_t inflight() const { return _inflightCount; }
+
+    const MQTTClientStats &stats() const { return _stats; }
+    // counters of the first MQTT_TOPIC_STATS_MAX topics published to
+    const MQTTTopicStats *topicStats(const char *topic);
+    const MQTTTopicStats *topicStats(uint8_t index) const;
+    uint8_t topicStatsCount() const { return _topicCount; }
+    void resetStats();
+    // counters of stats() and the topics; the socket belongs to the MQTT core
+    // of the SDK, so bytes are those of the messages, not of the wire
+    void printStats(Print &p);
 };
 
 
@@ -0,0 +1,97 @@
+/*
+ Offline queue example
+
+ Readings are published every second whether the broker is reachable or not:
+  - while the client is offline they go to an OfflineQueue, collected in RAM
+    and written to LittleFS one page at a time
+  - after the connection is back they are replayed in order, 10 per second,
+    while new readings are sent right away
+  - alarms use a high priority so they are kept even when the queue is
+    nearly full, low priority readings expire after 10 minutes
+*/
+
+#include <WiFi.h>
+#include <MQTTClient.h>
+#include <OfflineQueue.h>
+
+// Update these with values suitable for your network.
+const char * ssid ="your_ssid";
+const char * pass = "your_passwd";
+
+//MQTT broker
+const char *mqtt_broker = "broker.emqx.io";
+const char *mqtt_username = "emqx";
+const char *mqtt_password ="public";
+const int mqtt_port = 1883;
+
+const char *readingTopic = "yourOffline/reading";
+const char *alarmTopic = "yourOffline/alarm";
+
+void *cli;
+MQTTClient mqtt;
+VFSFILE fs(LITTLEFS);
+OfflineQueue queue;
+unsigned long lastReading = 0;
+unsigned long lastStatus = 0;
+uint32_t seq = 0;
+
+void setup()
+{
+  Serial.begin(115200);
+  WiFi.begin(ssid,pass);
+
+  // messages kept from before a reset are replayed as well
+  if (!queue.begin(fs, "/mqtt_queue", 32 * 1024)) {
+    Serial.println("offline queue kept in RAM only");
+  }
+  Serial.print("messages waiting: ");
+  Serial.println(queue.count());
+
+  mqtt_client_config_t config = {0};
+  config.cacert = NULL;
+  config.cacert_len = 0;
+  config.host = mqtt_broker;
+  config.port = mqtt_port;
+  config.keepalive = 60;
+  config.timeout_ms = 100;
+  config.username = mqtt_username;
+  config.password = mqtt_password;
+  config.clientid = "ty_offline_id";
+
+  cli = mqtt.init(&config);
+  mqtt.setOfflineQueue(&queue);
+  // the task connects once WiFi is up and replays the queue
+  mqtt.begin(cli);
+}
+
+void loop()
+{
+  if (millis() - lastReading >= 1000) {
+    lastReading = millis();
+    char buf[32];
+    int len = snprintf(buf, sizeof(buf), "reading %u", (unsigned)seq);
+    mqtt.publish(cli, readingTopic, (const uint8_t *)buf, len, MQTT_QOS_1, OFFLINE_PRIO_LOW, 600);
+    if (seq % 60 == 0) {
+      len = snprintf(buf, sizeof(buf), "alarm %u", (unsigned)seq);
+      mqtt.publish(cli, alarmTopic, (const uint8_t *)buf, len, MQTT_QOS_1, OFFLINE_PRIO_HIGH, 0);
+    }
+    seq++;
+  }
+
+  if (millis() - lastStatus >= 5000) {
+    lastStatus = millis();
+    Serial.print("connected: ");
+    Serial.print(mqtt.connected());
+    Serial.print(" waiting: ");
+    Serial.print(queue.count());
+    Serial.print(" stored: ");
+    Serial.print(mqtt.stats().stored);
+    Serial.print(" replayed: ");
+    Serial.print(queue.stats().replayed);
+    Serial.print(" dropped: ");
+    Serial.print(queue.stats().dropped);
+    Serial.print(" expired: ");
+    Serial.println(queue.stats().expired);
+  }
+  delay(10);
+}
@@ -0,0 +1,392 @@
+#include "OfflineQueue.h"
+#include "tal_log.h"
+#include "tal_memory.h"
+#include "tal_time_service.h"
+
+#define OFFLINE_REC_MAGIC       (0x5146)
+#define OFFLINE_POS_MAGIC       (0x51465053)
+#define OFFLINE_TIME_VALID      (1577836800)    // 2020-01-01, the clock has been set
+#define OFFLINE_ALIGN(n)        (((n) + 3) & ~3)
+
+typedef struct {
+    uint16_t magic;
+    uint16_t check;         // of the lengths, key and data
+    uint8_t prio;
+    uint8_t tag;
+    uint16_t keyLen;        // with the terminating NUL
+    uint16_t dataLen;
+    uint16_t reserved;
+    uint32_t created;       // posix seconds, 0 while the time is not known
+    uint32_t ttl;
+} offline_rec_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t readPos;
+} offline_pos_t;
+
+static uint16_t offline_check(const offline_rec_t *rec)
+{
+    const uint8_t *p = (const uint8_t *)(rec + 1);
+    size_t len = rec->keyLen + rec->dataLen;
+    uint32_t hash = 2166136261u ^ len;
+    while (len--) {
+        hash = (hash ^ *p++) * 16777619u;
+    }
+    return (uint16_t)(hash ^ (hash >> 16));
+}
+
+static size_t offline_rec_len(const offline_rec_t *rec)
+{
+    return OFFLINE_ALIGN(sizeof(offline_rec_t) + rec->keyLen + rec->dataLen);
+}
+
+static bool offline_expired(const offline_rec_t *rec, uint32_t now)
+{
+    return rec->ttl && rec->created >= OFFLINE_TIME_VALID && now >= OFFLINE_TIME_VALID &&
+           now - rec->created > rec->ttl;
+}
+
+OfflineQueue::OfflineQueue()
+    : _fs(NULL), _fd(NULL), _maxLog(0), _logSize(0), _readPos(0), _savedPos(0), _logCount(0),
+      _ram(NULL), _ramHead(0), _ramUsed(0), _ramCount(0), _ramSince(0), _scratch(NULL),
+      _rate(OFFLINE_QUEUE_RATE_DEFAULT), _burst(OFFLINE_QUEUE_BURST_DEFAULT),
+      _tokens(OFFLINE_QUEUE_BURST_DEFAULT * 1000), _refillAt(0), _mutex(NULL)
+{
+    _path[0] = '\0';
+    _posPath[0] = '\0';
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+OfflineQueue::~OfflineQueue()
+{
+    end();
+    tal_free(_ram);
+    tal_free(_scratch);
+    if (_mutex) {
+        tal_mutex_release(_mutex);
+    }
+}
+
+bool OfflineQueue::_lock()
+{
+    // created on first use, global queues are constructed before the kernel is up
+    if (!_mutex && tal_mutex_create_init(&_mutex) != OPRT_OK) {
+        return false;
+    }
+    tal_mutex_lock(_mutex);
+    return true;
+}
+
+void OfflineQueue::_unlock()
+{
+    tal_mutex_unlock(_mutex);
+}
+
+bool OfflineQueue::begin(VFSFILE &fs, const char *path, size_t maxLogSize)
+{
+    if (!path || strlen(path) >= OFFLINE_QUEUE_PATH_MAX || maxLogSize < OFFLINE_QUEUE_PAGE_SIZE) {
+        return false;
+    }
+    if (!_lock()) {
+        return false;
+    }
+    if (_fd) {
+        _fs->close(_fd);
+        _fd = NULL;
+    }
+    _fs = &fs;
+    _maxLog = maxLogSize;
+    strcpy(_path, path);
+    snprintf(_posPath, sizeof(_posPath), "%s.pos", path);
+    _logSize = _readPos = _savedPos = _logCount = 0;
+
+    if (_fs->exist(_path)) {
+        _fd = _fs->open(_path, "r+");
+    }
+    if (_fd) {
+        _scan();
+    }
+    _unlock();
+    PR_DEBUG("offline queue %s: %d messages", _path, (int)_logCount);
+    return true;
+}
+
+void OfflineQueue::end()
+{
+    if (!_fs || !_lock()) {
+        return;
+    }
+    if (_ramUsed > _ramHead) {
+        _spill();
+    }
+    if (_fd) {
+        _savePos();
+        _fs->close(_fd);
+        _fd = NULL;
+    }
+    _fs = NULL;
+    _logSize = _readPos = _savedPos = _logCount = 0;
+    _unlock();
+}
+
+// reads the record at `pos` into _scratch; false if it is damaged or cut off
+bool OfflineQueue::_readRecord(uint32_t pos, bool verify)
+{
+    if (!_scratch) {
+        _scratch = (uint8_t *)tal_malloc(OFFLINE_QUEUE_PAGE_SIZE);
+        if (!_scratch) {
+            return false;
+        }
+    }
+    offline_rec_t *rec = (offline_rec_t *)_scratch;
+    if (_fs->lseek(_fd, pos, SEEK_SET) < 0 ||
+        _fs->read((const char *)rec, sizeof(*rec), _fd) != (int)sizeof(*rec) ||
+        rec->magic != OFFLINE_REC_MAGIC || offline_rec_len(rec) > OFFLINE_QUEUE_PAGE_SIZE) {
+        return false;
+    }
+    int body = rec->keyLen + rec->dataLen;
+    if (_fs->read((const char *)(rec + 1), body, _fd) != body) {
+        return false;
+    }
+    return !verify || (rec->check == offline_check(rec) && rec->keyLen &&
+                       ((const char *)(rec + 1))[rec->keyLen - 1] == '\0');
+}
+
+// finds the end of the last good record and counts the unread ones; a
+// record cut off by a reset during an append ends the log, and the next
+// append writes over it
+void OfflineQueue::_scan()
+{
+    int fileSize = _fs->filesize(_path);
+    if (_fs->exist(_posPath)) {
+        offline_pos_t saved;
+        TUYA_FILE fd = _fs->open(_posPath, "r");
+        if (fd) {
+            if (_fs->read((const char *)&saved, sizeof(saved), fd) == (int)sizeof(saved) &&
+                saved.magic == OFFLINE_POS_MAGIC && (int)saved.readPos <= fileSize) {
+                _readPos = _savedPos = saved.readPos;
+            }
+            _fs->close(fd);
+        }
+    }
+    uint32_t pos = _readPos;
+    while ((int)pos < fileSize && _readRecord(pos, true)) {
+        pos += offline_rec_len((offline_rec_t *)_scratch);
+        _logCount++;
+    }
+    _logSize = pos;
+    if ((int)pos < fileSize) {
+        PR_NOTICE("offline queue %s damaged at %d", _path, (int)pos);
+    }
+    if (!_logCount) {
+        _clearLog();
+    }
+}
+
+void OfflineQueue::_savePos()
+{
+    offline_pos_t saved = {OFFLINE_POS_MAGIC, _readPos};
+    TUYA_FILE fd = _fs->open(_posPath, "w");
+    if (!fd) {
+        return;
+    }
+    _fs->write((const char *)&saved, sizeof(saved), fd);
+    _fs->close(fd);
+    _savedPos = _readPos;
+}
+
+void OfflineQueue::_clearLog()
+{
+    if (_fd) {
+        _fs->close(_fd);
+        _fd = NULL;
+    }
+    _fs->remove(_path);
+    if (_fs->exist(_posPath)) {
+        _fs->remove(_posPath);
+    }
+    _logSize = _readPos = _savedPos = _logCount = 0;
+}
+
+// appends the messages in RAM to the log in one write
+bool OfflineQueue::_spill()
+{
+    size_t len = _ramUsed - _ramHead;
+    if (!_fs || !len || _logSize + len > _maxLog) {
+        return false;
+    }
+    if (!_fd) {
+        // created empty, then opened for reading and writing
+        TUYA_FILE fd = _fs->open(_path, "w");
+        if (fd) {
+            _fs->close(fd);
+            _fd = _fs->open(_path, "r+");
+        }
+        if (!_fd) {
+            PR_ERR("offline queue open %s failed", _path);
+            return false;
+        }
+    }
+    if (_fs->lseek(_fd, _logSize, SEEK_SET) < 0 ||
+        _fs->write((const char *)_ram + _ramHead, len, _fd) != (int)len) {
+        PR_ERR("offline queue write %s failed", _path);
+        return false;
+    }
+    _fs->flush(_fd);
+    _logSize += len;
+    _logCount += _ramCount;
+    _stats.pageWrites++;
+    _stats.bytesWritten += len;
+    _ramHead = _ramUsed = 0;
+    _ramCount = 0;
+    return true;
+}
+
+bool OfflineQueue::flush()
+{
+    if (!_lock()) {
+        return false;
+    }
+    bool ok = (_ramUsed == _ramHead) || _spill();
+    _unlock();
+    return ok;
+}
+
+int OfflineQueue::push(const char *key, const uint8_t *data, size_t len, uint8_t priority, uint32_t ttl, uint8_t tag)
+{
+    if (!key || (!data && len)) {
+        return OPRT_INVALID_PARM;
+    }
+    size_t keyLen = strlen(key) + 1;
+    size_t recLen = OFFLINE_ALIGN(sizeof(offline_rec_t) + keyLen + len);
+    if (!_lock()) {
+        return OPRT_MALLOC_FAILED;
+    }
+    size_t capacity = _fs ? _maxLog : OFFLINE_QUEUE_PAGE_SIZE;
+    size_t limit = (priority >= OFFLINE_PRIO_HIGH) ? capacity :
+                   (priority == OFFLINE_PRIO_NORMAL) ? capacity - capacity / 8 : capacity / 2;
+    // the log is appended to until it has been replayed completely, so the
+    // part already read still takes room; counted, the admission matches
+    // what _spill() can write
+    if (recLen > OFFLINE_QUEUE_PAGE_SIZE || _readPos + size() + recLen > limit) {
+        _stats.dropped++;
+        _unlock();
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+    if (!_ram) {
+        _ram = (uint8_t *)tal_malloc(OFFLINE_QUEUE_PAGE_SIZE);
+        if (!_ram) {
+            _unlock();
+            return OPRT_MALLOC_FAILED;
+        }
+    }
+    // a page that is full, or has waited long enough, goes to flash first
+    if (_ramUsed > _ramHead && (_ramUsed + recLen > OFFLINE_QUEUE_PAGE_SIZE ||
+                                millis() - _ramSince >= OFFLINE_QUEUE_FLUSH_MS)) {
+        if (!_spill() && _ramHead) {
+            memmove(_ram, _ram + _ramHead, _ramUsed - _ramHead);
+            _ramUsed -= _ramHead;
+            _ramHead = 0;
+        }
+    }
+    if (_ramUsed + recLen > OFFLINE_QUEUE_PAGE_SIZE) {
+        _stats.dropped++;
+        _unlock();
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+    if (_ramUsed == _ramHead) {
+        _ramHead = _ramUsed = 0;
+        _ramSince = millis();
+    }
+
+    offline_rec_t *rec = (offline_rec_t *)(_ram + _ramUsed);
+    memset(rec, 0, recLen);
+    rec->magic = OFFLINE_REC_MAGIC;
+    rec->prio = priority;
+    rec->tag = tag;
+    rec->keyLen = keyLen;
+    rec->dataLen = len;
+    rec->created = tal_time_get_posix();
+    rec->ttl = ttl;
+    memcpy(rec + 1, key, keyLen);
+    if (len) {
+        memcpy((uint8_t *)(rec + 1) + keyLen, data, len);
+    }
+    rec->check = offline_check(rec);
+    _ramUsed += recLen;
+    _ramCount++;
+    _stats.pushed++;
+    _unlock();
+    return OPRT_OK;
+}
+
+void OfflineQueue::setRate(uint16_t perSecond, uint8_t burst)
+{
+    _rate = perSecond ? perSecond : 1;
+    _burst = burst ? burst : 1;
+}
+
+int OfflineQueue::replay(OfflineQueueSender sender, void *arg)
+{
+    if (!sender || empty() || !_lock()) {
+        return 0;
+    }
+    unsigned long now = millis();
+    uint64_t tokens = _tokens + (uint64_t)(now - _refillAt) * _rate;
+    _tokens = (tokens > (uint32_t)_burst * 1000) ? (uint32_t)_burst * 1000 : (uint32_t)tokens;
+    _refillAt = now;
+
+    uint32_t posix = tal_time_get_posix();
+    int sent = 0;
+    while (_tokens >= 1000) {
+        offline_rec_t *rec;
+        bool fromLog = _logCount > 0;
+        if (fromLog) {
+            if (!_readRecord(_readPos, false)) {
+                // the log cannot be read on, what is left of it is given up
+                PR_ERR("offline queue %s unreadable at %d", _path, (int)_readPos);
+                _stats.lost += _logCount;
+                _clearLog();
+                continue;
+            }
+            rec = (offline_rec_t *)_scratch;
+        } else if (_ramCount) {
+            rec = (offline_rec_t *)(_ram + _ramHead);
+        } else {
+            break;
+        }
+        if (offline_expired(rec, posix)) {
+            _stats.expired++;
+        } else {
+            const char *key = (const char *)(rec + 1);
+            if (sender(key, (const uint8_t *)key + rec->keyLen, rec->dataLen, rec->tag, arg) != OPRT_OK) {
+                break;
+            }
+            _tokens -= 1000;
+            _stats.replayed++;
+            sent++;
+        }
+        if (fromLog) {
+            _readPos += offline_rec_len(rec);
+            if (!--_logCount) {
+                _clearLog();
+            }
+        } else {
+            _ramHead += offline_rec_len(rec);
+            if (!--_ramCount) {
+                _ramHead = _ramUsed = 0;
+            }
+        }
+    }
+    if (_logCount && _readPos - _savedPos >= OFFLINE_QUEUE_PAGE_SIZE) {
+        _savePos();
+    }
+    _unlock();
+    return sent;
+}
+
+void OfflineQueue::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
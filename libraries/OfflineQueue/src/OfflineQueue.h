@@ -0,0 +1,114 @@
+#ifndef __OFFLINE_QUEUE_H__
+#define __OFFLINE_QUEUE_H__
+
+#include <Arduino.h>
+#include "File.h"
+#include "tal_mutex.h"
+
+#define OFFLINE_QUEUE_PAGE_SIZE         (4096)          // RAM buffer, written to the log in one append
+#define OFFLINE_QUEUE_LOG_MAX           (64 * 1024)
+#define OFFLINE_QUEUE_FLUSH_MS          (60 * 1000)     // longest time a message waits in RAM
+#define OFFLINE_QUEUE_RATE_DEFAULT      (10)            // replayed messages per second
+#define OFFLINE_QUEUE_BURST_DEFAULT     (5)
+#define OFFLINE_QUEUE_PATH_MAX          (64)
+
+typedef enum {
+    OFFLINE_PRIO_LOW = 0,       // accepted while the queue is less than half full
+    OFFLINE_PRIO_NORMAL,        // accepted while it is less than 7/8 full
+    OFFLINE_PRIO_HIGH,          // accepted until it is full
+} offline_prio_t;
+
+typedef struct {
+    uint32_t pushed;
+    uint32_t replayed;
+    uint32_t dropped;           // refused for their priority or size
+    uint32_t expired;           // TTL ran out before the replay
+    uint32_t lost;              // log records that could not be read back
+    uint32_t pageWrites;        // appends to the log
+    uint32_t bytesWritten;
+} OfflineQueueStats;
+
+// OPRT_OK once the message is sent; anything else keeps it for the next replay()
+typedef int (*OfflineQueueSender)(const char *key, const uint8_t *data, size_t len, uint8_t tag, void *arg);
+
+/*
+ * Store-and-forward queue for messages that could not be sent. New messages
+ * are collected in a RAM page; a full page, or one older than
+ * OFFLINE_QUEUE_FLUSH_MS, is appended to a log file in one write, so flash
+ * sees few, large writes. replay() hands the messages back in the order
+ * they were pushed, oldest first, at a limited rate, and skips those whose
+ * TTL has run out. The read position is saved every page, so after a reset
+ * at most one page of messages is sent again.
+ *
+ * The priority of a message decides how full the queue may be for it to be
+ * accepted, so a queue filled with low priority data still takes important
+ * messages. The log only shrinks once it has been replayed completely, so
+ * until then the messages already replayed from it count as well. Without
+ * begin() the queue keeps one page in RAM only.
+ */
+class OfflineQueue
+{
+public:
+    OfflineQueue();
+    ~OfflineQueue();
+
+    bool begin(VFSFILE &fs, const char *path, size_t maxLogSize = OFFLINE_QUEUE_LOG_MAX);
+    // writes what is still in RAM to the log
+    void end();
+
+    // ttl in seconds, 0 keeps the message until it is sent; the tag is
+    // handed back to the sender unchanged
+    int push(const char *key, const uint8_t *data, size_t len, uint8_t priority = OFFLINE_PRIO_NORMAL,
+             uint32_t ttl = 0, uint8_t tag = 0);
+    // sends messages while the rate allows it and the sender succeeds; the
+    // sender must not push to this queue. Returns the number sent.
+    int replay(OfflineQueueSender sender, void *arg);
+    bool flush();
+    void setRate(uint16_t perSecond, uint8_t burst = OFFLINE_QUEUE_BURST_DEFAULT);
+
+    bool empty() const { return !_logCount && !_ramCount; }
+    uint32_t count() const { return _logCount + _ramCount; }
+    // bytes waiting, in RAM and in the log
+    size_t size() const { return (_logSize - _readPos) + (_ramUsed - _ramHead); }
+    const OfflineQueueStats &stats() const { return _stats; }
+    void resetStats();
+
+private:
+    VFSFILE *_fs;
+    TUYA_FILE _fd;
+    char _path[OFFLINE_QUEUE_PATH_MAX];
+    char _posPath[OFFLINE_QUEUE_PATH_MAX + 4];
+    size_t _maxLog;
+    uint32_t _logSize;          // end of the last good record
+    uint32_t _readPos;
+    uint32_t _savedPos;
+    uint32_t _logCount;
+
+    uint8_t *_ram;
+    size_t _ramHead;
+    size_t _ramUsed;
+    uint32_t _ramCount;
+    unsigned long _ramSince;    // when the oldest message in RAM was pushed
+    uint8_t *_scratch;          // one record read from the log
+
+    uint16_t _rate;
+    uint8_t _burst;
+    uint32_t _tokens;           // 1/1000 of a message
+    unsigned long _refillAt;
+
+    MUTEX_HANDLE _mutex;
+    OfflineQueueStats _stats;
+
+    bool _lock();
+    void _unlock();
+    bool _spill();
+    bool _readRecord(uint32_t pos, bool verify);
+    void _scan();
+    void _savePos();
+    void _clearLog();
+
+    OfflineQueue(const OfflineQueue &) = delete;
+    OfflineQueue &operator=(const OfflineQueue &) = delete;
+};
+
+#endif
@@ -0,0 +1,55 @@
+#include <WiFi.h>
+#include <SerialBridge.h>
+
+const char *ssid = "your_ssid";
+const char *pass = "your_passwd";
+
+// UART1 to TCP port 23, up to 4 clients
+SerialBridge bridge(TUYA_UART_NUM_1, 23);
+
+void setup()
+{
+    Serial.begin(115200);
+
+    WiFi.begin(ssid, pass);
+    while (WiFi.status() != WSS_GOT_IP) {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println();
+
+    bridge.setBufferSize(8192, 2048);
+    // lets pyserial's rfc2217:// clients change the line settings
+    bridge.enableRFC2217(true);
+    if (!bridge.begin(115200, SERIAL_8N1)) {
+        Serial.println("bridge failed to start");
+        return;
+    }
+
+    Serial.print("Ready! Use 'telnet ");
+    Serial.print(WiFi.localIP());
+    Serial.println(" 23' to connect");
+}
+
+void loop()
+{
+    static uint32_t lastUartIn = 0;
+    static uint32_t lastTcpIn = 0;
+
+    delay(5000);
+    const SerialBridgeStats &s = bridge.stats();
+    Serial.print("clients ");
+    Serial.print(bridge.clientCount());
+    Serial.print(" baud ");
+    Serial.print(bridge.baudRate());
+    Serial.print(" uart->tcp ");
+    Serial.print((s.uartIn - lastUartIn) / 5);
+    Serial.print("B/s tcp->uart ");
+    Serial.print((s.tcpIn - lastTcpIn) / 5);
+    Serial.print("B/s dropped ");
+    Serial.print(s.dropped);
+    Serial.print(" closed ");
+    Serial.println(s.closed);
+    lastUartIn = s.uartIn;
+    lastTcpIn = s.tcpIn;
+}
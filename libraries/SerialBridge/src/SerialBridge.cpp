@@ -0,0 +1,826 @@
+#include "SerialBridge.h"
+#include <lwip/sockets.h>
+#include <errno.h>
+#include "tal_log.h"
+#include "tal_memory.h"
+#include "tal_network.h"
+#include "tal_system.h"
+
+#define TN_SE           (240)
+#define TN_SB           (250)
+#define TN_WILL         (251)
+#define TN_WONT         (252)
+#define TN_DO           (253)
+#define TN_DONT         (254)
+#define TN_IAC          (255)
+
+#define TN_OPT_BINARY   (0)
+#define TN_OPT_SGA      (3)
+#define TN_OPT_COM_PORT (44)
+
+// RFC 2217 commands, the server answers with the command + 100
+#define CPO_SIGNATURE       (0)
+#define CPO_SET_BAUDRATE    (1)
+#define CPO_SET_DATASIZE    (2)
+#define CPO_SET_PARITY      (3)
+#define CPO_SET_STOPSIZE    (4)
+#define CPO_SET_CONTROL     (5)
+#define CPO_PURGE_DATA      (12)
+#define CPO_SERVER_OFFSET   (100)
+
+#define SERIAL_BRIDGE_SB_MAX        (16)
+#define SERIAL_BRIDGE_TELNET_CHUNK  (256)
+#define SERIAL_BRIDGE_UART_WAIT_MS  (100)
+#define SERIAL_BRIDGE_SIGNATURE     "TuyaOpen SerialBridge"
+
+enum {
+    TN_STATE_DATA = 0,
+    TN_STATE_IAC,
+    TN_STATE_OPT,
+    TN_STATE_SB,
+    TN_STATE_SB_IAC,
+};
+
+struct serial_bridge_client {
+    int fd;                     // -1 for a free slot
+    uint32_t tail;              // next byte of the UART ring to send
+    bool escape;                // a 0xFF was sent, the second one of its escape not yet
+    // telnet parser, RFC 2217 only
+    uint8_t state;
+    uint8_t verb;
+    uint8_t agreed;             // options answered, a bit per WILL and DO of each
+    uint8_t sb[SERIAL_BRIDGE_SB_MAX];
+    uint8_t sbLen;
+};
+
+static size_t serial_bridge_pow2(size_t n)
+{
+    size_t p = 64;
+    while (p * 2 <= n) {
+        p *= 2;
+    }
+    return p;
+}
+
+static void serial_bridge_uart_cfg(uint32_t baud, uint16_t config, bool rtscts, TUYA_UART_BASE_CFG_T *cfg)
+{
+    cfg->baudrate = baud;
+    switch (config & SERIAL_DATA_MASK) {
+    case SERIAL_DATA_5:
+        cfg->databits = TUYA_UART_DATA_LEN_5BIT;
+        break;
+    case SERIAL_DATA_6:
+        cfg->databits = TUYA_UART_DATA_LEN_6BIT;
+        break;
+    case SERIAL_DATA_7:
+        cfg->databits = TUYA_UART_DATA_LEN_7BIT;
+        break;
+    default:
+        cfg->databits = TUYA_UART_DATA_LEN_8BIT;
+        break;
+    }
+    switch (config & SERIAL_STOP_BIT_MASK) {
+    case SERIAL_STOP_BIT_1_5:
+        cfg->stopbits = TUYA_UART_STOP_LEN_1_5BIT1;
+        break;
+    case SERIAL_STOP_BIT_2:
+        cfg->stopbits = TUYA_UART_STOP_LEN_2BIT;
+        break;
+    default:
+        cfg->stopbits = TUYA_UART_STOP_LEN_1BIT;
+        break;
+    }
+    switch (config & SERIAL_PARITY_MASK) {
+    case SERIAL_PARITY_EVEN:
+        cfg->parity = TUYA_UART_PARITY_TYPE_EVEN;
+        break;
+    case SERIAL_PARITY_ODD:
+        cfg->parity = TUYA_UART_PARITY_TYPE_ODD;
+        break;
+    default:
+        cfg->parity = TUYA_UART_PARITY_TYPE_NONE;
+        break;
+    }
+    cfg->flowctrl = rtscts ? TUYA_UART_FLOWCTRL_RTSCTS : TUYA_UART_FLOWCTRL_NONE;
+}
+
+SerialBridge::SerialBridge(TUYA_UART_NUM_E uart, uint16_t port, uint8_t maxClients)
+    : _uart(uart), _port(port), _maxClients(maxClients ? maxClients : 1)
+{
+}
+
+SerialBridge::~SerialBridge()
+{
+    end();
+    // kept by end() for the next begin()
+    if (_uartMutex) {
+        tal_mutex_release(_uartMutex);
+        _uartMutex = NULL;
+    }
+    if (_txSem) {
+        tal_semaphore_release(_txSem);
+        _txSem = NULL;
+    }
+}
+
+void SerialBridge::setBufferSize(size_t uartToNet, size_t netToUart)
+{
+    if (_running) {
+        return;
+    }
+    _rxSize = serial_bridge_pow2(uartToNet);
+    _txSize = serial_bridge_pow2(netToUart);
+}
+
+// the driver keeps received data until the network task reads it in bulk
+void SerialBridge::_uartRxCb(TUYA_UART_NUM_E port)
+{
+}
+
+bool SerialBridge::_openUart()
+{
+    TUYA_UART_BASE_CFG_T cfg;
+    serial_bridge_uart_cfg(_baud, _config, _rtscts, &cfg);
+    OPERATE_RET rt = tkl_uart_init(_uart, &cfg);
+    if (rt != OPRT_OK) {
+        PR_ERR("serial bridge uart %d init failed:%d", _uart, rt);
+        return false;
+    }
+    tkl_uart_rx_irq_cb_reg(_uart, _uartRxCb);
+    return true;
+}
+
+bool SerialBridge::_listen()
+{
+    _listenFd = tal_net_socket_create(PROTOCOL_TCP);
+    if (_listenFd < 0) {
+        return false;
+    }
+    int enable = 1;
+    tal_net_setsockopt(_listenFd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
+    if (tal_net_bind(_listenFd, 0, _port) < 0 || tal_net_listen(_listenFd, _maxClients) < 0) {
+        PR_ERR("serial bridge listen on %d failed:%d", _port, errno);
+        tal_net_close(_listenFd);
+        _listenFd = -1;
+        return false;
+    }
+    tal_net_set_block(_listenFd, false);
+    return true;
+}
+
+bool SerialBridge::begin(uint32_t baud, uint16_t config)
+{
+    if (_running) {
+        return true;
+    }
+    _baud = baud;
+    _config = config;
+
+    _rx = (uint8_t *)tal_malloc(_rxSize);
+    _tx = (uint8_t *)tal_malloc(_txSize);
+    _clients = (serial_bridge_client *)tal_malloc(_maxClients * sizeof(serial_bridge_client));
+    if (!_rx || !_tx || !_clients) {
+        PR_ERR("serial bridge out of memory");
+        end();
+        return false;
+    }
+    for (uint8_t i = 0; i < _maxClients; i++) {
+        _clients[i].fd = -1;
+    }
+    _numClients = 0;
+    _rxHead = 0;
+    _rxFullSince = 0;
+    _txHead = 0;
+    _txTail = 0;
+
+    if ((!_uartMutex && tal_mutex_create_init(&_uartMutex) != OPRT_OK) ||
+        (!_txSem && tal_semaphore_create_init(&_txSem, 0, 1) != OPRT_OK)) {
+        end();
+        return false;
+    }
+    if (!_openUart()) {
+        end();
+        return false;
+    }
+    if (!_listen()) {
+        tkl_uart_deinit(_uart);
+        end();
+        return false;
+    }
+
+    _running = true;
+    THREAD_CFG_T param;
+    param.priority = THREAD_PRIO_2;
+    param.stackDepth = SERIAL_BRIDGE_UART_STACK;
+    char uartName[] = "bridge_uart";
+    param.thrdname = uartName;
+    OPERATE_RET rt = tal_thread_create_and_start(&_uartTask, NULL, NULL, _uartRun, this, &param);
+    if (rt == OPRT_OK) {
+        param.stackDepth = SERIAL_BRIDGE_NET_STACK;
+        char netName[] = "bridge_net";
+        param.thrdname = netName;
+        rt = tal_thread_create_and_start(&_netTask, NULL, NULL, _netRun, this, &param);
+    }
+    if (rt != OPRT_OK) {
+        PR_ERR("serial bridge task create failed:%d", rt);
+        end();
+        return false;
+    }
+    PR_INFO("serial bridge uart %d at %d baud on port %d", _uart, (int)_baud, _port);
+    return true;
+}
+
+void SerialBridge::end()
+{
+    bool opened = _running;
+    _running = false;
+    if (_txSem) {
+        tal_semaphore_post(_txSem);
+    }
+    // both tasks leave after their current wait
+    while (_netTask || _uartTask) {
+        tal_system_sleep(_pollMs);
+    }
+    if (_clients) {
+        for (uint8_t i = 0; i < _maxClients; i++) {
+            if (_clients[i].fd >= 0) {
+                _closeClient(&_clients[i]);
+            }
+        }
+        tal_free(_clients);
+        _clients = NULL;
+    }
+    if (_listenFd >= 0) {
+        tal_net_close(_listenFd);
+        _listenFd = -1;
+    }
+    if (opened) {
+        tkl_uart_deinit(_uart);
+    }
+    if (_rx) {
+        tal_free(_rx);
+        _rx = NULL;
+    }
+    if (_tx) {
+        tal_free(_tx);
+        _tx = NULL;
+    }
+}
+
+void SerialBridge::_accept()
+{
+    for (;;) {
+        int fd = tal_net_accept(_listenFd, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        serial_bridge_client *c = NULL;
+        for (uint8_t i = 0; i < _maxClients; i++) {
+            if (_clients[i].fd < 0) {
+                c = &_clients[i];
+                break;
+            }
+        }
+        if (!c) {
+            tal_net_close(fd);
+            _stats.rejected++;
+            continue;
+        }
+        tal_net_set_block(fd, false);
+        int val = 1;
+        tal_net_setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &val, sizeof(int));
+        memset(c, 0, sizeof(*c));
+        c->fd = fd;
+        // starts with the data that arrives from now on
+        c->tail = _rxHead;
+        _numClients++;
+        _stats.accepted++;
+    }
+}
+
+void SerialBridge::_closeClient(serial_bridge_client *c)
+{
+    tal_net_close(c->fd);
+    c->fd = -1;
+    _numClients--;
+}
+
+uint32_t SerialBridge::_slowestTail() const
+{
+    uint32_t tail = _rxHead;
+    for (uint8_t i = 0; i < _maxClients; i++) {
+        if (_clients[i].fd >= 0 && (int32_t)(_clients[i].tail - tail) < 0) {
+            tail = _clients[i].tail;
+        }
+    }
+    return tail;
+}
+
+void SerialBridge::_readUart()
+{
+    size_t mask = _rxSize - 1;
+    if (!_numClients) {
+        // nobody to send to: keep the driver from filling up with stale data
+        int n;
+        while ((n = tkl_uart_read(_uart, _rx, (_rxSize > 0xFFFF) ? 0xFFFF : _rxSize)) > 0) {
+            _stats.uartIn += n;
+            _stats.dropped += n;
+        }
+        _rxFullSince = 0;
+        return;
+    }
+    size_t used = _rxHead - _slowestTail();
+    while (used < _rxSize) {
+        size_t off = _rxHead & mask;
+        size_t span = _rxSize - used;
+        if (span > _rxSize - off) {
+            span = _rxSize - off;
+        }
+        if (span > 0xFFFF) {
+            span = 0xFFFF;
+        }
+        int n = tkl_uart_read(_uart, _rx + off, span);
+        if (n <= 0) {
+            break;
+        }
+        _rxHead += n;
+        used += n;
+        _stats.uartIn += n;
+        if ((size_t)n < span) {
+            break;
+        }
+    }
+    if (used < _rxSize) {
+        _rxFullSince = 0;
+    } else if (!_rxFullSince) {
+        // the UART stays unread until the slowest client catches up
+        _rxFullSince = millis() | 1;
+        _stats.uartPaused++;
+    }
+}
+
+void SerialBridge::_sendClient(serial_bridge_client *c)
+{
+    size_t mask = _rxSize - 1;
+    for (;;) {
+        if (c->escape) {
+            uint8_t iac = TN_IAC;
+            int n = send(c->fd, &iac, 1, MSG_DONTWAIT);
+            if (n != 1) {
+                break;
+            }
+            c->escape = false;
+        }
+        uint32_t pending = _rxHead - c->tail;
+        if (!pending) {
+            return;
+        }
+        size_t off = c->tail & mask;
+        size_t span = (pending < _rxSize - off) ? pending : _rxSize - off;
+        bool iac = false;
+        if (_rfc2217) {
+            // send up to and including a 0xFF, then its escape
+            const uint8_t *p = (const uint8_t *)memchr(_rx + off, TN_IAC, span);
+            if (p) {
+                span = p - (_rx + off) + 1;
+                iac = true;
+            }
+        }
+        int n = send(c->fd, _rx + off, span, MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                _closeClient(c);
+                return;
+            }
+            break;
+        }
+        c->tail += n;
+        _stats.tcpOut += n;
+        if ((size_t)n < span) {
+            break;
+        }
+        c->escape = iac;
+    }
+}
+
+void SerialBridge::_sendAll()
+{
+    for (uint8_t i = 0; i < _maxClients; i++) {
+        if (_clients[i].fd >= 0) {
+            _sendClient(&_clients[i]);
+        }
+    }
+    if (!_rxFullSince || _numClients < 2 || millis() - _rxFullSince < SERIAL_BRIDGE_STALL_MS) {
+        return;
+    }
+    // one client holds back the others: close the slowest
+    uint32_t tail = _slowestTail();
+    for (uint8_t i = 0; i < _maxClients; i++) {
+        if (_clients[i].fd >= 0 && _clients[i].tail == tail) {
+            PR_NOTICE("serial bridge closes a client %u bytes behind", (unsigned)(_rxHead - tail));
+            _closeClient(&_clients[i]);
+            _stats.closed++;
+            break;
+        }
+    }
+    _rxFullSince = 0;
+}
+
+void SerialBridge::_txPush(const uint8_t *data, size_t len)
+{
+    size_t mask = _txSize - 1;
+    size_t off = _txHead & mask;
+    size_t first = (len < _txSize - off) ? len : _txSize - off;
+    memcpy(_tx + off, data, first);
+    memcpy(_tx, data + first, len - first);
+    _txHead += len;
+}
+
+void SerialBridge::_readClient(serial_bridge_client *c)
+{
+    size_t mask = _txSize - 1;
+    bool got = false;
+    for (;;) {
+        size_t room = _txRoom();
+        if (!room) {
+            break;
+        }
+        int n;
+        if (_rfc2217) {
+            // telnet commands are removed, so what is received fits the room
+            uint8_t buf[SERIAL_BRIDGE_TELNET_CHUNK];
+            n = recv(c->fd, buf, (room < sizeof(buf)) ? room : sizeof(buf), MSG_DONTWAIT);
+            if (n > 0) {
+                _telnet(c, buf, n);
+            }
+        } else {
+            size_t off = _txHead & mask;
+            size_t span = (room < _txSize - off) ? room : _txSize - off;
+            n = recv(c->fd, _tx + off, span, MSG_DONTWAIT);
+            if (n > 0) {
+                _txHead += n;
+                _stats.tcpIn += n;
+            }
+        }
+        if (n == 0) {
+            _closeClient(c);
+            break;
+        }
+        if (n < 0) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                _closeClient(c);
+            }
+            break;
+        }
+        got = true;
+        if (c->fd < 0) {
+            break;
+        }
+    }
+    if (got) {
+        tal_semaphore_post(_txSem);
+    }
+}
+
+void SerialBridge::_reply(serial_bridge_client *c, const uint8_t *data, size_t len)
+{
+    // a few bytes in an otherwise idle direction, dropped if the socket is full
+    if (send(c->fd, data, len, MSG_DONTWAIT) != (int)len) {
+        PR_DEBUG("serial bridge telnet reply dropped");
+    }
+}
+
+void SerialBridge::_telnet(serial_bridge_client *c, const uint8_t *data, size_t len)
+{
+    uint8_t out[SERIAL_BRIDGE_TELNET_CHUNK];
+    size_t outLen = 0;
+    for (size_t i = 0; i < len && c->fd >= 0; i++) {
+        uint8_t b = data[i];
+        switch (c->state) {
+        case TN_STATE_DATA:
+            if (b == TN_IAC) {
+                c->state = TN_STATE_IAC;
+            } else {
+                out[outLen++] = b;
+            }
+            break;
+        case TN_STATE_IAC:
+            if (b == TN_IAC) {
+                out[outLen++] = b;
+                c->state = TN_STATE_DATA;
+            } else if (b >= TN_WILL && b <= TN_DONT) {
+                c->verb = b;
+                c->state = TN_STATE_OPT;
+            } else if (b == TN_SB) {
+                c->sbLen = 0;
+                c->state = TN_STATE_SB;
+            } else {
+                // NOP, break and the like are ignored
+                c->state = TN_STATE_DATA;
+            }
+            break;
+        case TN_STATE_OPT:
+            _telnetOption(c, c->verb, b);
+            c->state = TN_STATE_DATA;
+            break;
+        case TN_STATE_SB:
+            if (b == TN_IAC) {
+                c->state = TN_STATE_SB_IAC;
+            } else if (c->sbLen < SERIAL_BRIDGE_SB_MAX) {
+                c->sb[c->sbLen++] = b;
+            }
+            break;
+        case TN_STATE_SB_IAC:
+            if (b == TN_IAC) {
+                if (c->sbLen < SERIAL_BRIDGE_SB_MAX) {
+                    c->sb[c->sbLen++] = b;
+                }
+                c->state = TN_STATE_SB;
+                break;
+            }
+            if (b == TN_SE && c->sbLen >= 2 && c->sb[0] == TN_OPT_COM_PORT) {
+                _comPort(c);
+            }
+            c->state = TN_STATE_DATA;
+            break;
+        }
+    }
+    if (outLen) {
+        _txPush(out, outLen);
+        _stats.tcpIn += outLen;
+    }
+}
+
+void SerialBridge::_telnetOption(serial_bridge_client *c, uint8_t verb, uint8_t option)
+{
+    if (verb == TN_WONT || verb == TN_DONT) {
+        return;
+    }
+    int8_t index = -1;
+    switch (option) {
+    case TN_OPT_BINARY:
+        index = 0;
+        break;
+    case TN_OPT_SGA:
+        index = 1;
+        break;
+    case TN_OPT_COM_PORT:
+        index = 2;
+        break;
+    }
+    uint8_t reply[3] = {TN_IAC, 0, option};
+    if (index < 0) {
+        reply[1] = (verb == TN_WILL) ? TN_DONT : TN_WONT;
+        _reply(c, reply, sizeof(reply));
+        return;
+    }
+    // answered once, so the acknowledgement of an answer does not start a loop
+    uint8_t bit = 1 << (index * 2 + ((verb == TN_WILL) ? 0 : 1));
+    if (c->agreed & bit) {
+        return;
+    }
+    c->agreed |= bit;
+    reply[1] = (verb == TN_WILL) ? TN_DO : TN_WILL;
+    _reply(c, reply, sizeof(reply));
+}
+
+// IAC SB COM-PORT-OPTION <command + 100> <value, IAC doubled> IAC SE
+static size_t serial_bridge_cpo_reply(uint8_t *buf, uint8_t command, const uint8_t *value, size_t len)
+{
+    size_t n = 0;
+    buf[n++] = TN_IAC;
+    buf[n++] = TN_SB;
+    buf[n++] = TN_OPT_COM_PORT;
+    buf[n++] = command + CPO_SERVER_OFFSET;
+    for (size_t i = 0; i < len; i++) {
+        buf[n++] = value[i];
+        if (value[i] == TN_IAC) {
+            buf[n++] = TN_IAC;
+        }
+    }
+    buf[n++] = TN_IAC;
+    buf[n++] = TN_SE;
+    return n;
+}
+
+void SerialBridge::_comPort(serial_bridge_client *c)
+{
+    uint8_t command = c->sb[1];
+    const uint8_t *arg = c->sb + 2;
+    size_t argLen = c->sbLen - 2;
+    uint16_t config = _config;
+    uint32_t baud = _baud;
+    uint8_t value[sizeof(SERIAL_BRIDGE_SIGNATURE)];
+    size_t valueLen = 1;
+
+    switch (command) {
+    case CPO_SIGNATURE:
+        valueLen = strlen(SERIAL_BRIDGE_SIGNATURE);
+        memcpy(value, SERIAL_BRIDGE_SIGNATURE, valueLen);
+        break;
+    case CPO_SET_BAUDRATE:
+        if (argLen >= 4) {
+            uint32_t b = ((uint32_t)arg[0] << 24) | ((uint32_t)arg[1] << 16) | ((uint32_t)arg[2] << 8) | arg[3];
+            // 0 asks for the current rate
+            if (b) {
+                baud = b;
+            }
+        }
+        value[0] = baud >> 24;
+        value[1] = baud >> 16;
+        value[2] = baud >> 8;
+        value[3] = baud;
+        valueLen = 4;
+        break;
+    case CPO_SET_DATASIZE:
+        if (argLen && arg[0] >= 5 && arg[0] <= 8) {
+            config = (config & ~SERIAL_DATA_MASK) | ((arg[0] - 4) << 8);
+        }
+        value[0] = ((config & SERIAL_DATA_MASK) >> 8) + 4;
+        break;
+    case CPO_SET_PARITY:
+        // 1 none, 2 odd, 3 even; mark and space are not supported
+        if (argLen && arg[0] == 1) {
+            config = (config & ~SERIAL_PARITY_MASK) | SERIAL_PARITY_NONE;
+        } else if (argLen && arg[0] == 2) {
+            config = (config & ~SERIAL_PARITY_MASK) | SERIAL_PARITY_ODD;
+        } else if (argLen && arg[0] == 3) {
+            config = (config & ~SERIAL_PARITY_MASK) | SERIAL_PARITY_EVEN;
+        }
+        switch (config & SERIAL_PARITY_MASK) {
+        case SERIAL_PARITY_ODD:
+            value[0] = 2;
+            break;
+        case SERIAL_PARITY_EVEN:
+            value[0] = 3;
+            break;
+        default:
+            value[0] = 1;
+            break;
+        }
+        break;
+    case CPO_SET_STOPSIZE:
+        // 1 one, 2 two, 3 one and a half
+        if (argLen && arg[0] == 1) {
+            config = (config & ~SERIAL_STOP_BIT_MASK) | SERIAL_STOP_BIT_1;
+        } else if (argLen && arg[0] == 2) {
+            config = (config & ~SERIAL_STOP_BIT_MASK) | SERIAL_STOP_BIT_2;
+        } else if (argLen && arg[0] == 3) {
+            config = (config & ~SERIAL_STOP_BIT_MASK) | SERIAL_STOP_BIT_1_5;
+        }
+        switch (config & SERIAL_STOP_BIT_MASK) {
+        case SERIAL_STOP_BIT_2:
+            value[0] = 2;
+            break;
+        case SERIAL_STOP_BIT_1_5:
+            value[0] = 3;
+            break;
+        default:
+            value[0] = 1;
+            break;
+        }
+        break;
+    case CPO_SET_CONTROL:
+        // flow control is fixed by setFlowControl(); 0 asks for it, break,
+        // DTR and RTS requests are acknowledged without effect
+        if (!argLen || arg[0] <= 3) {
+            value[0] = _rtscts ? 3 : 1;
+        } else {
+            value[0] = arg[0];
+        }
+        break;
+    case CPO_PURGE_DATA:
+        // 1 data from the UART, 2 data for the UART, 3 both
+        if (argLen && (arg[0] & 1)) {
+            for (uint8_t i = 0; i < _maxClients; i++) {
+                _clients[i].tail = _rxHead;
+            }
+        }
+        if (argLen && (arg[0] & 2)) {
+            tal_mutex_lock(_uartMutex);
+            _txTail = _txHead;
+            tal_mutex_unlock(_uartMutex);
+        }
+        value[0] = argLen ? arg[0] : 0;
+        break;
+    default:
+        // masks and flow suspension are acknowledged as sent
+        valueLen = (argLen < sizeof(value)) ? argLen : sizeof(value);
+        memcpy(value, arg, valueLen);
+        break;
+    }
+
+    if (baud != _baud || config != _config) {
+        tal_mutex_lock(_uartMutex);
+        tkl_uart_deinit(_uart);
+        uint32_t oldBaud = _baud;
+        uint16_t oldConfig = _config;
+        _baud = baud;
+        _config = config;
+        if (!_openUart()) {
+            // keep the line working with the settings it had
+            _baud = oldBaud;
+            _config = oldConfig;
+            _openUart();
+        } else {
+            _stats.configChanges++;
+        }
+        tal_mutex_unlock(_uartMutex);
+        PR_INFO("serial bridge uart %d set to %d baud", _uart, (int)_baud);
+    }
+
+    uint8_t reply[8 + 2 * sizeof(value)];
+    _reply(c, reply, serial_bridge_cpo_reply(reply, command, value, valueLen));
+}
+
+void SerialBridge::_netRun(void *arg)
+{
+    SerialBridge *self = (SerialBridge *)arg;
+    bool txFull = false;
+
+    while (self->_running) {
+        TUYA_FD_SET_T rfds, wfds;
+        TAL_FD_ZERO(&rfds);
+        TAL_FD_ZERO(&wfds);
+        TAL_FD_SET(self->_listenFd, &rfds);
+        int maxfd = self->_listenFd;
+        // clients are left unread while the UART side is full, TCP then
+        // slows the senders down
+        bool room = self->_txRoom() > 0;
+        if (!room && !txFull && self->_numClients) {
+            self->_stats.tcpPaused++;
+        }
+        txFull = !room;
+        for (uint8_t i = 0; i < self->_maxClients; i++) {
+            serial_bridge_client *c = &self->_clients[i];
+            if (c->fd < 0) {
+                continue;
+            }
+            if (room) {
+                TAL_FD_SET(c->fd, &rfds);
+            }
+            // data left behind by _sendAll() means the socket was full
+            if (c->tail != self->_rxHead || c->escape) {
+                TAL_FD_SET(c->fd, &wfds);
+            }
+            if (c->fd > maxfd) {
+                maxfd = c->fd;
+            }
+        }
+
+        int res = tal_net_select(maxfd + 1, &rfds, &wfds, NULL, self->_pollMs);
+        if (res > 0) {
+            if (TAL_FD_ISSET(self->_listenFd, &rfds)) {
+                self->_accept();
+            }
+            for (uint8_t i = 0; i < self->_maxClients; i++) {
+                serial_bridge_client *c = &self->_clients[i];
+                if (c->fd >= 0 && TAL_FD_ISSET(c->fd, &rfds)) {
+                    self->_readClient(c);
+                }
+            }
+        }
+        self->_readUart();
+        self->_sendAll();
+    }
+
+    THREAD_HANDLE task = self->_netTask;
+    self->_netTask = NULL;
+    tal_thread_delete(task);
+}
+
+void SerialBridge::_uartRun(void *arg)
+{
+    SerialBridge *self = (SerialBridge *)arg;
+    size_t mask = self->_txSize - 1;
+
+    while (self->_running) {
+        tal_semaphore_wait(self->_txSem, SERIAL_BRIDGE_UART_WAIT_MS);
+        while (self->_running) {
+            tal_mutex_lock(self->_uartMutex);
+            uint32_t pending = self->_txHead - self->_txTail;
+            if (!pending) {
+                tal_mutex_unlock(self->_uartMutex);
+                break;
+            }
+            size_t off = self->_txTail & mask;
+            size_t span = (pending < self->_txSize - off) ? pending : self->_txSize - off;
+            if (span > SERIAL_BRIDGE_UART_CHUNK) {
+                span = SERIAL_BRIDGE_UART_CHUNK;
+            }
+            int n = tkl_uart_write(self->_uart, self->_tx + off, span);
+            if (n > 0) {
+                self->_txTail += n;
+                self->_stats.uartOut += n;
+            }
+            tal_mutex_unlock(self->_uartMutex);
+            if (n <= 0) {
+                tal_system_sleep(1);
+            }
+        }
+    }
+
+    THREAD_HANDLE task = self->_uartTask;
+    self->_uartTask = NULL;
+    tal_thread_delete(task);
+}
@@ -0,0 +1,143 @@
+#ifndef __SERIAL_BRIDGE_H__
+#define __SERIAL_BRIDGE_H__
+
+#include <Arduino.h>
+#include "tkl_uart.h"
+#include "tal_mutex.h"
+#include "tal_semaphore.h"
+#include "tal_thread.h"
+
+#define SERIAL_BRIDGE_MAX_CLIENTS       (4)
+#define SERIAL_BRIDGE_RX_SIZE           (4096)      // UART to TCP ring, a power of 2
+#define SERIAL_BRIDGE_TX_SIZE           (2048)      // TCP to UART ring, a power of 2
+#define SERIAL_BRIDGE_UART_CHUNK        (256)       // bytes per tkl_uart_write()
+#define SERIAL_BRIDGE_POLL_MS           (5)         // longest wait of the network task
+#define SERIAL_BRIDGE_STALL_MS          (2000)      // a client holding back the others is closed
+#define SERIAL_BRIDGE_NET_STACK         (4096)
+#define SERIAL_BRIDGE_UART_STACK        (2048)
+
+typedef struct {
+    uint32_t uartIn;            // bytes read from the UART
+    uint32_t uartOut;           // bytes written to the UART
+    uint32_t tcpIn;             // bytes received from clients, telnet commands removed
+    uint32_t tcpOut;            // bytes sent to clients, counted once per client
+    uint32_t accepted;
+    uint32_t rejected;          // all client slots taken
+    uint32_t closed;            // slow clients closed after SERIAL_BRIDGE_STALL_MS
+    uint32_t dropped;           // UART bytes read while no client was connected
+    uint32_t uartPaused;        // times the UART was left unread, the ring full
+    uint32_t tcpPaused;         // times clients were left unread, the UART side full
+    uint32_t configChanges;     // line settings changed by RFC 2217 clients
+} SerialBridgeStats;
+
+struct serial_bridge_client;
+
+/*
+ * Bridges a UART to TCP clients. The bridge owns the UART: do not use it
+ * through a SerialUART object at the same time.
+ *
+ * UART data is read in bulk by a network task into one ring buffer. Every
+ * client sends from its own position in that ring, so fan-out to several
+ * clients needs no copies. Data from clients is received straight into a
+ * second ring, which a UART task writes out in chunks of
+ * SERIAL_BRIDGE_UART_CHUNK bytes.
+ *
+ * Flow control: while the UART side is full, clients are not read, and
+ * TCP throttles the senders. While a client has not yet sent what is in
+ * the ring, the UART is not read. The driver then buffers the data, and
+ * with setFlowControl(true) it drops RTS. A client that holds back the
+ * others for SERIAL_BRIDGE_STALL_MS is closed. A single client is never
+ * closed for being slow.
+ *
+ * With RFC 2217 enabled, the TCP side speaks telnet. Clients such as
+ * pyserial's rfc2217:// URLs can then set the baud rate, data bits, parity
+ * and stop bits, and 0xFF bytes are escaped in both directions.
+ */
+class SerialBridge
+{
+public:
+    SerialBridge(TUYA_UART_NUM_E uart, uint16_t port = 23, uint8_t maxClients = SERIAL_BRIDGE_MAX_CLIENTS);
+    ~SerialBridge();
+
+    // all of these before begin()
+    // ring sizes, rounded down to a power of 2
+    void setBufferSize(size_t uartToNet, size_t netToUart);
+    void setFlowControl(bool rtscts) { _rtscts = rtscts; }
+    void enableRFC2217(bool enable) { _rfc2217 = enable; }
+    // the longest time UART data waits before it is sent to the clients
+    void setPollInterval(uint32_t ms) { _pollMs = ms ? ms : 1; }
+
+    // config is one of the SERIAL_8N1 style constants of HardwareSerial
+    bool begin(uint32_t baud, uint16_t config = SERIAL_8N1);
+    // not to be called from the bridge tasks
+    void end();
+    bool running() const { return _running; }
+
+    uint8_t clientCount() const { return _numClients; }
+    uint32_t baudRate() const { return _baud; }
+    // the bridge tasks count without a lock, so while they run a read or a
+    // reset may miss the transfers made at the same moment: the counters are
+    // approximate, not exact totals
+    const SerialBridgeStats &stats() const { return _stats; }
+    void resetStats() { memset(&_stats, 0, sizeof(_stats)); }
+
+private:
+    TUYA_UART_NUM_E _uart;
+    uint16_t _port;
+    uint8_t _maxClients;
+    bool _rtscts = false;
+    bool _rfc2217 = false;
+    uint32_t _pollMs = SERIAL_BRIDGE_POLL_MS;
+
+    uint32_t _baud = 0;
+    uint16_t _config = SERIAL_8N1;
+
+    // UART to TCP, written and read by the network task only
+    uint8_t *_rx = NULL;
+    size_t _rxSize = SERIAL_BRIDGE_RX_SIZE;
+    uint32_t _rxHead = 0;
+    unsigned long _rxFullSince = 0;
+
+    // TCP to UART, written by the network task, read by the UART task
+    uint8_t *_tx = NULL;
+    size_t _txSize = SERIAL_BRIDGE_TX_SIZE;
+    volatile uint32_t _txHead = 0;
+    volatile uint32_t _txTail = 0;
+
+    int _listenFd = -1;
+    serial_bridge_client *_clients = NULL;
+    uint8_t _numClients = 0;
+
+    MUTEX_HANDLE _uartMutex = NULL;     // tkl_uart_write() against a reconfiguration
+    SEM_HANDLE _txSem = NULL;
+    THREAD_HANDLE _netTask = NULL;
+    THREAD_HANDLE _uartTask = NULL;
+    volatile bool _running = false;
+    SerialBridgeStats _stats = {};
+
+    static void _netRun(void *arg);
+    static void _uartRun(void *arg);
+    static void _uartRxCb(TUYA_UART_NUM_E port);
+
+    bool _openUart();
+    bool _listen();
+    void _accept();
+    void _closeClient(serial_bridge_client *c);
+    void _readUart();
+    void _sendClient(serial_bridge_client *c);
+    void _sendAll();
+    void _readClient(serial_bridge_client *c);
+    size_t _txRoom() const { return _txSize - (_txHead - _txTail); }
+    void _txPush(const uint8_t *data, size_t len);
+    uint32_t _slowestTail() const;
+
+    void _telnet(serial_bridge_client *c, const uint8_t *data, size_t len);
+    void _telnetOption(serial_bridge_client *c, uint8_t verb, uint8_t option);
+    void _comPort(serial_bridge_client *c);
+    void _reply(serial_bridge_client *c, const uint8_t *data, size_t len);
+
+    SerialBridge(const SerialBridge &) = delete;
+    SerialBridge &operator=(const SerialBridge &) = delete;
+};
+
+#endif
@@ -83,6 +83,8 @@ void tuyaIoTEventCallback(tuya_event_msg_t *event)
     } break;
     case TUYA_EVENT_DP_RECEIVE_OBJ: {
         uint16_t dpNum = TuyaIoT.eventGetDpNum(event);
+        // the dps written back go to the cloud in one report
+        TuyaIoT.beginReport();
         for (uint16_t i = 0; i < dpNum; i++) {
             uint8_t dpid = TuyaIoT.eventGetDpId(event, i);
             switch (dpid) {
@@ -113,6 +115,7 @@ void tuyaIoTEventCallback(tuya_event_msg_t *event)
                 break;
             }
         }
+        TuyaIoT.commit();
     } break;
     case TUYA_EVENT_DP_RECEIVE_RAW: {
         uint8_t *rawValue = NULL;
@@ -42,6 +42,7 @@ static const char *sg_uuid            = NULL;
 static const char *sg_authKey         = NULL;
 
 static EvevntCallbackFunc_T eventCallback = NULL;
+static void (*loopCallback)(void) = NULL;
 
 static THREAD_HANDLE iot_thread = NULL;
 
@@ -63,6 +64,18 @@ void app_iot_event_register_cb(void (*callback)(tuya_event_msg_t *event))
     eventCallback = callback;
 }
 
+void app_iot_event_dispatch(tuya_event_msg_t *event)
+{
+    if (eventCallback != NULL) {
+        eventCallback(event);
+    }
+}
+
+void app_iot_loop_register_cb(void (*callback)(void))
+{
+    loopCallback = callback;
+}
+
 void app_iot_license_set(const char *uuid, const char *authKey)
 {
     sg_uuid    = uuid;
@@ -138,6 +151,9 @@ static void tuya_app_thread(void *arg)
 
     for (;;) {
         tuya_iot_yield(&ArduinoIoTClient);
+        if (loopCallback != NULL) {
+            loopCallback();
+        }
     }
 }
 
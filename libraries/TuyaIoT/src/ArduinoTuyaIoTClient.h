@@ -21,6 +21,12 @@ extern "C" {
  ******************************************************************************/
 void app_iot_event_register_cb(void (*callback)(tuya_event_msg_t* event));
 
+// hands an event that did not come from the cloud to the same callback
+void app_iot_event_dispatch(tuya_event_msg_t* event);
+
+// called by the iot task after each tuya_iot_yield()
+void app_iot_loop_register_cb(void (*callback)(void));
+
 void app_iot_license_set(const char *uuid, const char *authKey);
 
 void app_iot_task_start(const char *pid, const char *version);
@@ -9,6 +9,7 @@
  ******************************************************************************/
 #include "TuyaIoT.h"
 #include "ArduinoTuyaIoTClient.h"
+#include "OfflineQueue.h"
 
 extern "C" {
 #include <string.h>
@@ -22,6 +23,25 @@ extern "C" {
 #include "reset_netcfg.h"
 }
 
+/******************************************************************************
+ * TYPEDEF
+ ******************************************************************************/
+// one obj dp report in the offline queue: this head, count offline_dp_t,
+// then the string values in the same order
+typedef struct {
+    uint16_t count;
+    uint16_t reserved;
+    uint32_t timestamp;     // as passed to objWrite()
+} offline_report_t;
+
+typedef struct {
+    uint8_t id;
+    uint8_t type;           // dp_prop_tp_t
+    uint16_t strLen;        // with the '\0', 0 if the value is not a string
+    uint32_t time;          // of the value, the time of objWrite() if it was not given
+    uint32_t value;         // bool, value, enum or bitmap
+} offline_dp_t;
+
 /******************************************************************************
  * GLOBAL VARIABLES
  ******************************************************************************/
@@ -84,6 +104,11 @@ void TuyaIoTCloudClass::begin(const char *pid, const char *version, const char *
 }
 
 int TuyaIoTCloudClass::objWrite(uint8_t dpid, void *value, TIME_T timestamp)
+{
+    return objWrite(dpid, value, timestamp, OFFLINE_PRIO_NORMAL, 0);
+}
+
+int TuyaIoTCloudClass::objWrite(uint8_t dpid, void *value, TIME_T timestamp, uint8_t priority, uint32_t ttl)
 {
     dp_obj_t dpObj;
 
@@ -129,8 +154,81 @@ int TuyaIoTCloudClass::objWrite(uint8_t dpid, void *value, TIME_T timestamp)
     }
     }
 
-    return tuya_iot_dp_obj_report(&ArduinoIoTClient, ArduinoIoTClient.activate.devid, &dpObj, 1, timestamp);
-    ;
+    return _write(&dpObj, 1, timestamp, priority, ttl);
+}
+
+int TuyaIoTCloudClass::objWrite(const dp_obj_t *dps, uint16_t count, TIME_T timestamp)
+{
+    if (NULL == dps || 0 == count) {
+        return OPRT_INVALID_PARM;
+    }
+    return _write(const_cast<dp_obj_t *>(dps), count, timestamp, OFFLINE_PRIO_NORMAL, 0);
+}
+
+int TuyaIoTCloudClass::beginReport(TIME_T timestamp)
+{
+    int rt = _batchInit();
+    if (OPRT_OK != rt) {
+        return rt;
+    }
+
+    tal_mutex_lock(_batchMutex);
+    // writes held by the auto batch are not part of this one
+    rt = _batchFlush();
+    _batchOpen = true;
+    _batchTime = timestamp;
+    tal_mutex_unlock(_batchMutex);
+    return rt;
+}
+
+int TuyaIoTCloudClass::commit(void)
+{
+    int rt = OPRT_OK;
+
+    if (NULL == _batchMutex) {
+        return rt;
+    }
+    tal_mutex_lock(_batchMutex);
+    rt = _batchFlush();
+    _batchOpen = false;
+    _batchTime = 0;
+    tal_mutex_unlock(_batchMutex);
+    return rt;
+}
+
+void TuyaIoTCloudClass::setAutoBatch(uint32_t ms)
+{
+    if (ms && NULL == _batchTimer && OPRT_OK != tal_sw_timer_create(_batchTimerCb, this, &_batchTimer)) {
+        PR_ERR("batch timer create failed");
+        return;
+    }
+    _autoBatchMs = ms;
+    _loopRegister();
+    if (0 == ms) {
+        flush();
+    }
+}
+
+int TuyaIoTCloudClass::flush(void)
+{
+    int rt = OPRT_OK;
+
+    if (NULL == _batchMutex) {
+        return rt;
+    }
+    tal_mutex_lock(_batchMutex);
+    // an open batch waits for commit()
+    if (!_batchOpen) {
+        rt = _batchFlush();
+    }
+    tal_mutex_unlock(_batchMutex);
+    return rt;
+}
+
+void TuyaIoTCloudClass::setOfflineQueue(OfflineQueue *queue)
+{
+    _offline = queue;
+    _loopRegister();
 }
 
 int TuyaIoTCloudClass::rawWrite(uint8_t dpid, uint8_t *value, uint16_t len, uint32_t timeout)
@@ -340,6 +438,311 @@ int TuyaIoTCloudClass::resetNetconfigCheck(void)
 /******************************************************************************
  * PRIVATE MEMBER FUNCTIONS
  ******************************************************************************/
+int TuyaIoTCloudClass::_write(dp_obj_t *dps, uint16_t count, TIME_T timestamp, uint8_t priority, uint32_t ttl)
+{
+    int rt = OPRT_OK;
+
+    if (_batchOpen || _autoBatchMs) {
+        rt = _batchInit();
+        if (OPRT_OK != rt) {
+            return rt;
+        }
+        tal_mutex_lock(_batchMutex);
+        if (_batchOpen || (_autoBatchMs && 0 == timestamp)) {
+            for (uint16_t i = 0; i < count; i++) {
+                int ret = _batchAdd(&dps[i], priority, ttl);
+                if (OPRT_OK != ret) {
+                    rt = ret;
+                }
+            }
+            tal_mutex_unlock(_batchMutex);
+            return rt;
+        }
+        // held writes go first, so the order is kept
+        _batchFlush();
+        tal_mutex_unlock(_batchMutex);
+    }
+
+    return _report(dps, count, timestamp, (1 == count) ? &priority : NULL, (1 == count) ? &ttl : NULL);
+}
+
+int TuyaIoTCloudClass::_report(dp_obj_t *dps, uint16_t count, TIME_T timestamp, const uint8_t *priority, const uint32_t *ttl)
+{
+    int rt = OPRT_OK;
+
+    // while connected reports go out directly, the stored ones are replayed
+    // at the rate of the queue
+    bool store = _offline && !tuya_iot_is_connected();
+    if (!store) {
+        rt = tuya_iot_dp_obj_report(&ArduinoIoTClient, ArduinoIoTClient.activate.devid, dps, count, timestamp);
+        store = (OPRT_OK != rt && _offline && _transient(rt));
+    }
+    if (store) {
+        // the report is stored whole, with the highest priority and the
+        // longest TTL of its dps, so none is dropped sooner than asked
+        uint8_t prio = priority ? 0 : (uint8_t)OFFLINE_PRIO_NORMAL;
+        uint32_t keep = ttl ? ttl[0] : 0;
+        for (uint16_t i = 0; i < count; i++) {
+            if (priority && priority[i] > prio) {
+                prio = priority[i];
+            }
+            if (ttl && (0 == ttl[i] || (keep && ttl[i] > keep))) {
+                keep = ttl[i];
+            }
+        }
+        rt = _store(dps, count, timestamp, prio, keep);
+    }
+    return rt;
+}
+
+int TuyaIoTCloudClass::_batchInit(void)
+{
+    if (NULL == _batchMutex && OPRT_OK != tal_mutex_create_init(&_batchMutex)) {
+        return OPRT_COM_ERROR;
+    }
+    if (NULL == _batch) {
+        tal_mutex_lock(_batchMutex);
+        if (NULL == _batch) {
+            _batch = (dp_obj_t *)tal_malloc(TUYA_IOT_BATCH_MAX * sizeof(dp_obj_t));
+        }
+        tal_mutex_unlock(_batchMutex);
+        if (NULL == _batch) {
+            PR_ERR("malloc failed");
+            return OPRT_MALLOC_FAILED;
+        }
+    }
+    return OPRT_OK;
+}
+
+// called with _batchMutex held
+int TuyaIoTCloudClass::_batchAdd(const dp_obj_t *dpObj, uint8_t priority, uint32_t ttl)
+{
+    int rt = OPRT_OK;
+    uint16_t i;
+    char *str = NULL;
+
+    // copied first, so a failure leaves the batch as it was
+    if (PROP_STR == dpObj->type && dpObj->value.dp_str) {
+        size_t len = strlen(dpObj->value.dp_str) + 1;
+        str = (char *)tal_malloc(len);
+        if (NULL == str) {
+            PR_ERR("malloc failed");
+            return OPRT_MALLOC_FAILED;
+        }
+        memcpy(str, dpObj->value.dp_str, len);
+    }
+
+    // a dp written again keeps only its last value
+    for (i = 0; i < _batchCount; i++) {
+        if (_batch[i].id == dpObj->id) {
+            if (PROP_STR == _batch[i].type && _batch[i].value.dp_str) {
+                tal_free(_batch[i].value.dp_str);
+            }
+            break;
+        }
+    }
+    if (i == _batchCount) {
+        if (TUYA_IOT_BATCH_MAX == _batchCount) {
+            rt = _batchFlush();
+        }
+        i = _batchCount++;
+        // the first write of an auto batch starts its window
+        if (0 == i && !_batchOpen && _batchTimer) {
+            tal_sw_timer_start(_batchTimer, _autoBatchMs, TAL_TIMER_ONCE);
+        }
+    }
+
+    _batch[i] = *dpObj;
+    if (str) {
+        _batch[i].value.dp_str = str;
+    }
+    _batchPriority[i] = priority;
+    _batchTtl[i] = ttl;
+    return rt;
+}
+
+// called with _batchMutex held
+int TuyaIoTCloudClass::_batchFlush(void)
+{
+    int rt = OPRT_OK;
+
+    if (0 == _batchCount) {
+        return rt;
+    }
+    rt = _report(_batch, _batchCount, _batchTime, _batchPriority, _batchTtl);
+    PR_DEBUG("batch of %d dps reported: %d", _batchCount, rt);
+    for (uint16_t i = 0; i < _batchCount; i++) {
+        if (PROP_STR == _batch[i].type && _batch[i].value.dp_str) {
+            tal_free(_batch[i].value.dp_str);
+        }
+    }
+    _batchCount = 0;
+    return rt;
+}
+
+// the report blocks on the network, so it is left to the IoT task rather
+// than done on the timer task
+void TuyaIoTCloudClass::_batchTimerCb(TIMER_ID timer, void *arg)
+{
+    ((TuyaIoTCloudClass *)arg)->_batchDue = true;
+}
+
+int TuyaIoTCloudClass::_store(const dp_obj_t *dps, uint16_t count, TIME_T timestamp, uint8_t priority, uint32_t ttl)
+{
+    int rt = OPRT_OK;
+    size_t len = sizeof(offline_report_t) + count * sizeof(offline_dp_t);
+    for (uint16_t i = 0; i < count; i++) {
+        if (PROP_STR == dps[i].type && dps[i].value.dp_str) {
+            len += strlen(dps[i].value.dp_str) + 1;
+        }
+    }
+
+    uint8_t *buf = (uint8_t *)tal_malloc(len);
+    if (buf == NULL) {
+        PR_ERR("malloc failed");
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(buf, 0, sizeof(offline_report_t) + count * sizeof(offline_dp_t));
+    offline_report_t *head = (offline_report_t *)buf;
+    head->count = count;
+    head->timestamp = timestamp;
+    offline_dp_t *rec = (offline_dp_t *)(buf + sizeof(offline_report_t));
+    uint8_t *str = buf + sizeof(offline_report_t) + count * sizeof(offline_dp_t);
+    for (uint16_t i = 0; i < count; i++, rec++) {
+        const dp_obj_t *dpObj = &dps[i];
+        rec->id = dpObj->id;
+        rec->type = dpObj->type;
+        // the cloud gets the time the value was written, not the time it is sent
+        rec->time = dpObj->time_stamp;
+        if (0 == rec->time && isTimeSync()) {
+            rec->time = tal_time_get_posix();
+        }
+        switch (dpObj->type) {
+        case PROP_VALUE: {
+            rec->value = (uint32_t)dpObj->value.dp_value;
+        } break;
+        case PROP_ENUM: {
+            rec->value = dpObj->value.dp_enum;
+        } break;
+        case PROP_BITMAP: {
+            rec->value = dpObj->value.dp_bitmap;
+        } break;
+        case PROP_BOOL: {
+            rec->value = dpObj->value.dp_bool;
+        } break;
+        default: {
+            if (PROP_STR == dpObj->type && dpObj->value.dp_str) {
+                rec->strLen = strlen(dpObj->value.dp_str) + 1;
+                memcpy(str, dpObj->value.dp_str, rec->strLen);
+                str += rec->strLen;
+            }
+        } break;
+        }
+    }
+
+    rt = _offline->push("", buf, len, priority, ttl);
+    if (OPRT_OK != rt) {
+        PR_ERR("report of %d dps not stored: %d", count, rt);
+    }
+    tal_free(buf);
+    return rt;
+}
+
+// the IoT task has one loop hook, shared by the auto batch and the offline queue
+void TuyaIoTCloudClass::_loopRegister(void)
+{
+    app_iot_loop_register_cb((_offline || _autoBatchMs) ? _loop : NULL);
+}
+
+void TuyaIoTCloudClass::_loop(void)
+{
+    if (TuyaIoT._batchDue) {
+        TuyaIoT._batchDue = false;
+        TuyaIoT.flush();
+    }
+    if (TuyaIoT._offline && !TuyaIoT._offline->empty() && tuya_iot_is_connected()) {
+        TuyaIoT._offline->replay(_replay, NULL);
+    }
+}
+
+int TuyaIoTCloudClass::_replay(const char *key, const uint8_t *data, size_t len, uint8_t tag, void *arg)
+{
+    offline_report_t head;
+
+    if (len < sizeof(offline_report_t)) {
+        return OPRT_OK;
+    }
+    memcpy(&head, data, sizeof(offline_report_t));
+    size_t strPos = sizeof(offline_report_t) + head.count * sizeof(offline_dp_t);
+    if (0 == head.count || len < strPos) {
+        return OPRT_OK;
+    }
+
+    dp_obj_t *dps = (dp_obj_t *)tal_malloc(head.count * sizeof(dp_obj_t));
+    if (NULL == dps) {
+        return OPRT_MALLOC_FAILED;
+    }
+    memset(dps, 0, head.count * sizeof(dp_obj_t));
+    const uint8_t *pos = data + sizeof(offline_report_t);
+    for (uint16_t i = 0; i < head.count; i++, pos += sizeof(offline_dp_t)) {
+        offline_dp_t rec;
+        memcpy(&rec, pos, sizeof(offline_dp_t));
+        dp_obj_t *dpObj = &dps[i];
+        dpObj->id = rec.id;
+        dpObj->type = (dp_prop_tp_t)rec.type;
+        dpObj->time_stamp = rec.time;
+        switch (dpObj->type) {
+        case PROP_VALUE: {
+            dpObj->value.dp_value = (int)rec.value;
+        } break;
+        case PROP_ENUM: {
+            dpObj->value.dp_enum = rec.value;
+        } break;
+        case PROP_BITMAP: {
+            dpObj->value.dp_bitmap = rec.value;
+        } break;
+        case PROP_BOOL: {
+            dpObj->value.dp_bool = rec.value;
+        } break;
+        default: {
+            // a string dp stored without its value is never sent, drop it
+            if (0 == rec.strLen || len - strPos < rec.strLen || '\0' != data[strPos + rec.strLen - 1]) {
+                tal_free(dps);
+                return OPRT_OK;
+            }
+            dpObj->value.dp_str = (char *)(data + strPos);
+            strPos += rec.strLen;
+        } break;
+        }
+    }
+
+    int rt = tuya_iot_dp_obj_report(&ArduinoIoTClient, ArduinoIoTClient.activate.devid, dps, head.count, head.timestamp);
+    tal_free(dps);
+    if (OPRT_OK == rt) {
+        TuyaIoT._replayFails = 0;
+        return OPRT_OK;
+    }
+    if (!tuya_iot_is_connected()) {
+        return rt;
+    }
+    // a report the cloud keeps refusing would hold back all the ones after it
+    if (!_transient(rt) || ++TuyaIoT._replayFails >= TUYA_IOT_REPLAY_RETRIES) {
+        PR_ERR("stored report of %d dps dropped: %d", head.count, rt);
+        TuyaIoT._replayFails = 0;
+        return OPRT_OK;
+    }
+    return rt;
+}
+
+// worth storing and trying again: the connection is gone, or the error is not
+// one the same report would get again
+bool TuyaIoTCloudClass::_transient(int rt)
+{
+    if (!tuya_iot_is_connected()) {
+        return true;
+    }
+    return OPRT_INVALID_PARM != rt && OPRT_NOT_SUPPORTED != rt && OPRT_NOT_FOUND != rt;
+}
 
 /******************************************************************************
  * EXTERN DEFINITION
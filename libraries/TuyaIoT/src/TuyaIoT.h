@@ -11,11 +11,17 @@
 extern "C" {
 #include "tuya_cloud_types.h"
 #include "tuya_iot.h"
+#include "tal_mutex.h"
+#include "tal_sw_timer.h"
 }
 
+class OfflineQueue;
+
 /******************************************************************************
  * CONSTANTS
  ******************************************************************************/
+#define TUYA_IOT_BATCH_MAX      (32)    // dps per report, a full batch is reported at once
+#define TUYA_IOT_REPLAY_RETRIES (5)     // failed replays of a stored report before it is dropped
 
 
 /******************************************************************************
@@ -41,6 +47,30 @@ public:
 
   // obj dp write
   int objWrite(uint8_t dpid, void* value, TIME_T timestamp = 0);
+  // priority and TTL in seconds apply if the report goes to the offline queue
+  int objWrite(uint8_t dpid, void* value, TIME_T timestamp, uint8_t priority, uint32_t ttl);
+
+  // obj dps in one report; not checked against the schema
+  int objWrite(const dp_obj_t *dps, uint16_t count, TIME_T timestamp = 0);
+
+  // Writes between beginReport() and commit(), from any task, are
+  // reported together in one message. A dp written twice keeps the last
+  // value. Returns what the report returned, the writes return OPRT_OK.
+  int beginReport(TIME_T timestamp = 0);
+  int commit(void);
+
+  // Writes without a timestamp are held for up to ms and reported
+  // together by the IoT task; 0 reports every write at once.
+  void setAutoBatch(uint32_t ms);
+  // reports the writes held by the auto batch now
+  int flush(void);
+
+  // reports made while the cloud is not connected, or that fail for a
+  // reason other than the dp itself, are kept in the queue and sent in order
+  // once it is back. Reports made while connected go out directly, so they
+  // may arrive before older stored ones. A stored report that still fails
+  // after TUYA_IOT_REPLAY_RETRIES replays is dropped. NULL turns this off.
+  void setOfflineQueue(OfflineQueue *queue);
 
   int write(uint8_t dpid, String value, TIME_T timestamp = 0) {
     return objWrite(dpid, reinterpret_cast<void*>(const_cast<char*>(value.c_str())), timestamp);
@@ -160,6 +190,34 @@ private:
   char _version[MAX_LENGTH_SW_VER+1]  = {0};
   char _uuid[MAX_LENGTH_UUID+1]       = {0};
   char _authKey[MAX_LENGTH_AUTHKEY+1] = {0};
+
+  OfflineQueue *_offline = NULL;
+  uint8_t _replayFails = 0;           // of the oldest stored report, while connected
+
+  // held writes: the dps, and for the offline queue their priority and TTL
+  dp_obj_t *_batch = NULL;
+  uint8_t _batchPriority[TUYA_IOT_BATCH_MAX];
+  uint32_t _batchTtl[TUYA_IOT_BATCH_MAX];
+  uint16_t _batchCount = 0;
+  TIME_T _batchTime = 0;
+  bool _batchOpen = false;
+  uint32_t _autoBatchMs = 0;
+  TIMER_ID _batchTimer = NULL;
+  volatile bool _batchDue = false;    // the window is over, flushed by the IoT task
+  MUTEX_HANDLE _batchMutex = NULL;
+
+  int _write(dp_obj_t *dps, uint16_t count, TIME_T timestamp, uint8_t priority, uint32_t ttl);
+  // priority and ttl hold count entries, NULL for OFFLINE_PRIO_NORMAL and no TTL
+  int _report(dp_obj_t *dps, uint16_t count, TIME_T timestamp, const uint8_t *priority, const uint32_t *ttl);
+  int _batchInit(void);
+  int _batchAdd(const dp_obj_t *dpObj, uint8_t priority, uint32_t ttl);
+  int _batchFlush(void);
+  static void _batchTimerCb(TIMER_ID timer, void *arg);
+  int _store(const dp_obj_t *dps, uint16_t count, TIME_T timestamp, uint8_t priority, uint32_t ttl);
+  void _loopRegister(void);
+  static void _loop(void);
+  static int _replay(const char *key, const uint8_t *data, size_t len, uint8_t tag, void *arg);
+  static bool _transient(int rt);
 };
 
 
@@ -0,0 +1,765 @@
+/**
+ * @file TuyaIoTLocal.cpp
+ * @brief dp writes between devices on the LAN
+ * @copyright Copyright (c) 2021-2026 Tuya Inc. All Rights Reserved.
+ */
+
+/******************************************************************************
+ * INCLUDE
+ ******************************************************************************/
+#include "TuyaIoTLocal.h"
+#include "ArduinoTuyaIoTClient.h"
+
+extern "C" {
+#include <errno.h>
+#include <string.h>
+
+#include "tuya_iot_dp.h"
+#include "tal_log.h"
+#include "tal_memory.h"
+#include "tal_network.h"
+#include "tal_system.h"
+#include "tal_time_service.h"
+#include "mbedtls/md.h"
+}
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+#define LOCAL_MAGIC0            ('T')
+#define LOCAL_MAGIC1            ('L')
+#define LOCAL_VERSION           (1)
+#define LOCAL_TAG_LEN           (16)            // of the HMAC-SHA256
+#define LOCAL_MAX_PACKET        (512)
+#define LOCAL_MAX_PAYLOAD       (LOCAL_MAX_PACKET - sizeof(local_hdr_t) - LOCAL_TAG_LEN)
+#define LOCAL_POLL_MS           (500)
+#define LOCAL_BROADCAST         (0xFFFFFFFF)
+
+#define LOCAL_ANNOUNCE          (1)
+#define LOCAL_DP                (2)
+#define LOCAL_ACK               (3)
+#define LOCAL_CHALLENGE         (4)             // payload: a nonce to echo
+#define LOCAL_PROOF             (5)             // payload: the nonce echoed, proves the boot number
+
+#define LOCAL_FLAG_REPLY        (0x01)          // announce: answer with an announce
+
+/******************************************************************************
+ * TYPEDEF
+ ******************************************************************************/
+// little endian, like all chips this library runs on; the payload and the
+// tag follow it
+typedef struct {
+    uint8_t magic[2];
+    uint8_t version;
+    uint8_t type;
+    uint32_t boot;
+    uint32_t seq;
+    uint32_t time;                  // posix time, 0 if the clock is not synced
+    uint16_t len;                   // payload bytes
+    uint8_t flags;
+    uint8_t reserved;
+    char from[TUYA_LOCAL_ID_LEN];
+    char to[TUYA_LOCAL_ID_LEN];     // empty for a broadcast
+} local_hdr_t;
+
+// dp write payload: count, then per dp id, type, 16 bit length and the
+// value, 4 bytes or a string with its '\0'
+typedef struct {
+    uint32_t seq;
+    int32_t result;
+} local_ack_t;
+
+/******************************************************************************
+ * LOCAL MODULE FUNCTIONS
+ ******************************************************************************/
+static uint64_t local_random(void)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 4; i++) {
+        v = (v << 16) | (uint64_t)tal_system_get_random(0x10000);
+    }
+    return v;
+}
+
+static void local_tag(const uint8_t *key, size_t keyLen, const uint8_t *data, size_t len, uint8_t tag[32])
+{
+    mbedtls_md_hmac(mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), key, keyLen, data, len, tag);
+}
+
+static size_t local_encode(const dp_obj_t *dps, uint8_t count, uint8_t *buf, size_t size)
+{
+    size_t off = 0;
+    buf[off++] = count;
+    for (uint8_t i = 0; i < count; i++) {
+        const dp_obj_t *dp = &dps[i];
+        uint32_t value = 0;
+        const void *data = &value;
+        size_t len = sizeof(value);
+        switch (dp->type) {
+        case PROP_STR: {
+            data = dp->value.dp_str ? dp->value.dp_str : "";
+            len = strlen((const char *)data) + 1;
+        } break;
+        case PROP_VALUE: {
+            value = (uint32_t)dp->value.dp_value;
+        } break;
+        case PROP_ENUM: {
+            value = dp->value.dp_enum;
+        } break;
+        case PROP_BITMAP: {
+            value = dp->value.dp_bitmap;
+        } break;
+        case PROP_BOOL: {
+            value = dp->value.dp_bool;
+        } break;
+        default: {
+            return 0;
+        }
+        }
+        if (off + 4 + len > size) {
+            return 0;
+        }
+        buf[off++] = dp->id;
+        buf[off++] = dp->type;
+        buf[off++] = len & 0xFF;
+        buf[off++] = len >> 8;
+        memcpy(buf + off, data, len);
+        off += len;
+    }
+    return off;
+}
+
+/******************************************************************************
+ * PUBLIC MEMBER FUNCTIONS
+ ******************************************************************************/
+int TuyaIoTLocalClass::begin(const uint8_t *key, size_t keyLen, uint16_t port)
+{
+    if (NULL == key || keyLen < 16 || keyLen > TUYA_LOCAL_KEY_MAX) {
+        PR_ERR("local key must be 16 to %d bytes", TUYA_LOCAL_KEY_MAX);
+        return OPRT_INVALID_PARM;
+    }
+    if (_running) {
+        return OPRT_OK;
+    }
+
+    memcpy(_key, key, keyLen);
+    _keyLen = keyLen;
+    _port = port;
+    // peers accept the sequence starting over once the new boot number has
+    // answered their challenge; 0 stands for not proved
+    do {
+        _boot = (uint32_t)local_random();
+    } while (0 == _boot);
+    _seq = 0;
+    _numPeers = 0;
+    _lastAnnounce = 0;
+
+    if ((!_mutex && tal_mutex_create_init(&_mutex) != OPRT_OK) ||
+        (!_writeMutex && tal_mutex_create_init(&_writeMutex) != OPRT_OK) ||
+        (!_ackSem && tal_semaphore_create_init(&_ackSem, 0, 1) != OPRT_OK)) {
+        return OPRT_MALLOC_FAILED;
+    }
+
+    _fd = tal_net_socket_create(PROTOCOL_UDP);
+    if (_fd < 0) {
+        PR_ERR("local socket create failed");
+        return OPRT_COM_ERROR;
+    }
+    int yes = 1;
+    tal_net_setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    tal_net_setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes));
+    if (tal_net_bind(_fd, 0, _port) < 0) {
+        PR_ERR("local bind to %d failed", _port);
+        tal_net_close(_fd);
+        _fd = -1;
+        return OPRT_COM_ERROR;
+    }
+    tal_net_set_block(_fd, false);
+
+    _running = true;
+    THREAD_CFG_T thrd_param = {TUYA_LOCAL_STACK, THREAD_PRIO_1, (char *)"tuya_local"};
+    int rt = tal_thread_create_and_start(&_task, NULL, NULL, _run, this, &thrd_param);
+    if (OPRT_OK != rt) {
+        PR_ERR("local task create failed:%d", rt);
+        _running = false;
+        tal_net_close(_fd);
+        _fd = -1;
+    }
+    return rt;
+}
+
+void TuyaIoTLocalClass::end(void)
+{
+    _running = false;
+    while (_task) {
+        tal_system_sleep(10);
+    }
+    if (_fd >= 0) {
+        tal_net_close(_fd);
+        _fd = -1;
+    }
+}
+
+int TuyaIoTLocalClass::write(const char *devid, const dp_obj_t *dps, uint8_t count)
+{
+    uint8_t payload[LOCAL_MAX_PAYLOAD];
+
+    if (NULL == devid || NULL == dps || 0 == count || count > TUYA_LOCAL_MAX_DPS) {
+        return OPRT_INVALID_PARM;
+    }
+    size_t len = local_encode(dps, count, payload, sizeof(payload));
+    if (0 == len) {
+        PR_ERR("local write too long or of an unknown type");
+        return OPRT_EXCEED_UPPER_LIMIT;
+    }
+
+    bool answered = false;
+    int rt = _running ? _writeTo(devid, payload, len, answered) : OPRT_NOT_FOUND;
+    if (answered || NULL == _fallback) {
+        return rt;
+    }
+    _stats.fallbacks++;
+    return _fallback(devid, dps, count);
+}
+
+int TuyaIoTLocalClass::write(const char *devid, uint8_t dpid, bool value)
+{
+    dp_obj_t dp;
+    memset(&dp, 0, sizeof(dp));
+    dp.id = dpid;
+    dp.type = PROP_BOOL;
+    dp.value.dp_bool = value;
+    return write(devid, &dp, 1);
+}
+
+int TuyaIoTLocalClass::write(const char *devid, uint8_t dpid, int value)
+{
+    dp_obj_t dp;
+    memset(&dp, 0, sizeof(dp));
+    dp.id = dpid;
+    dp.type = PROP_VALUE;
+    dp.value.dp_value = value;
+    return write(devid, &dp, 1);
+}
+
+int TuyaIoTLocalClass::write(const char *devid, uint8_t dpid, const char *value)
+{
+    dp_obj_t dp;
+    memset(&dp, 0, sizeof(dp));
+    dp.id = dpid;
+    dp.type = PROP_STR;
+    dp.value.dp_str = const_cast<char *>(value);
+    return write(devid, &dp, 1);
+}
+
+int TuyaIoTLocalClass::writeEnum(const char *devid, uint8_t dpid, uint32_t value)
+{
+    dp_obj_t dp;
+    memset(&dp, 0, sizeof(dp));
+    dp.id = dpid;
+    dp.type = PROP_ENUM;
+    dp.value.dp_enum = value;
+    return write(devid, &dp, 1);
+}
+
+int TuyaIoTLocalClass::writeBitmap(const char *devid, uint8_t dpid, uint32_t value)
+{
+    dp_obj_t dp;
+    memset(&dp, 0, sizeof(dp));
+    dp.id = dpid;
+    dp.type = PROP_BITMAP;
+    dp.value.dp_bitmap = value;
+    return write(devid, &dp, 1);
+}
+
+bool TuyaIoTLocalClass::reachable(const char *devid)
+{
+    if (NULL == _mutex) {
+        return false;
+    }
+    tal_mutex_lock(_mutex);
+    int i = _findPeer(devid);
+    bool rt = (i >= 0 && _peers[i].lastSeen && millis() - _peers[i].lastSeen < TUYA_LOCAL_PEER_TIMEOUT_MS);
+    tal_mutex_unlock(_mutex);
+    return rt;
+}
+
+uint8_t TuyaIoTLocalClass::peerCount(void)
+{
+    return _numPeers;
+}
+
+bool TuyaIoTLocalClass::peer(uint8_t index, TuyaLocalPeer &peer)
+{
+    if (NULL == _mutex) {
+        return false;
+    }
+    tal_mutex_lock(_mutex);
+    bool rt = index < _numPeers;
+    if (rt) {
+        peer = _peers[index];
+    }
+    tal_mutex_unlock(_mutex);
+    return rt;
+}
+
+/******************************************************************************
+ * PRIVATE MEMBER FUNCTIONS
+ ******************************************************************************/
+void TuyaIoTLocalClass::_run(void *arg)
+{
+    TuyaIoTLocalClass *self = (TuyaIoTLocalClass *)arg;
+
+    while (self->_running) {
+        TUYA_FD_SET_T rfds;
+        TAL_FD_ZERO(&rfds);
+        TAL_FD_SET(self->_fd, &rfds);
+        if (tal_net_select(self->_fd + 1, &rfds, NULL, NULL, LOCAL_POLL_MS) > 0) {
+            while (self->_receive(true)) {
+                ;
+            }
+        }
+
+        // the device id is known once the device is activated
+        if (ArduinoIoTClient.activate.devid[0] &&
+            (0 == self->_lastAnnounce || millis() - self->_lastAnnounce >= TUYA_LOCAL_ANNOUNCE_MS)) {
+            // the first one asks the others to answer, so they are known at once
+            self->_announce(0 == self->_lastAnnounce, LOCAL_BROADCAST, self->_port);
+            self->_lastAnnounce = millis() | 1;
+        }
+    }
+
+    THREAD_HANDLE task = self->_task;
+    self->_task = NULL;
+    tal_thread_delete(task);
+}
+
+size_t TuyaIoTLocalClass::_seal(uint8_t *buf, uint8_t type, uint8_t flags, const char *to, const uint8_t *payload, size_t len, uint32_t *seq)
+{
+    local_hdr_t hdr;
+    uint8_t tag[32];
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic[0] = LOCAL_MAGIC0;
+    hdr.magic[1] = LOCAL_MAGIC1;
+    hdr.version = LOCAL_VERSION;
+    hdr.type = type;
+    hdr.boot = _boot;
+    hdr.time = (OPRT_OK == tal_time_check_time_sync()) ? tal_time_get_posix() : 0;
+    hdr.len = len;
+    hdr.flags = flags;
+    strncpy(hdr.from, ArduinoIoTClient.activate.devid, TUYA_LOCAL_ID_LEN - 1);
+    if (to) {
+        strncpy(hdr.to, to, TUYA_LOCAL_ID_LEN - 1);
+    }
+    tal_mutex_lock(_mutex);
+    if (0 == ++_seq) {
+        _seq = 1;
+    }
+    hdr.seq = _seq;
+    tal_mutex_unlock(_mutex);
+
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (len) {
+        memcpy(buf + sizeof(hdr), payload, len);
+    }
+    local_tag(_key, _keyLen, buf, sizeof(hdr) + len, tag);
+    memcpy(buf + sizeof(hdr) + len, tag, LOCAL_TAG_LEN);
+    if (seq) {
+        *seq = hdr.seq;
+    }
+    return sizeof(hdr) + len + LOCAL_TAG_LEN;
+}
+
+bool TuyaIoTLocalClass::_open(const uint8_t *buf, size_t len)
+{
+    local_hdr_t hdr;
+    uint8_t tag[32];
+
+    if (len < sizeof(hdr) + LOCAL_TAG_LEN) {
+        return false;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    if (LOCAL_MAGIC0 != hdr.magic[0] || LOCAL_MAGIC1 != hdr.magic[1] || LOCAL_VERSION != hdr.version ||
+        sizeof(hdr) + hdr.len + LOCAL_TAG_LEN != len) {
+        return false;
+    }
+    local_tag(_key, _keyLen, buf, sizeof(hdr) + hdr.len, tag);
+    // in constant time, so the tag cannot be guessed byte by byte
+    uint8_t diff = 0;
+    for (int i = 0; i < LOCAL_TAG_LEN; i++) {
+        diff |= tag[i] ^ buf[sizeof(hdr) + hdr.len + i];
+    }
+    return 0 == diff;
+}
+
+void TuyaIoTLocalClass::_sendTo(const uint8_t *buf, size_t len, TUYA_IP_ADDR_T ip, uint16_t port)
+{
+    if (tal_net_send_to(_fd, buf, len, ip, port) < 0) {
+        PR_DEBUG("local send failed:%d", errno);
+    }
+}
+
+void TuyaIoTLocalClass::_announce(bool replyWanted, TUYA_IP_ADDR_T ip, uint16_t port)
+{
+    uint8_t buf[sizeof(local_hdr_t) + LOCAL_TAG_LEN];
+    size_t len = _seal(buf, LOCAL_ANNOUNCE, replyWanted ? LOCAL_FLAG_REPLY : 0, NULL, NULL, 0, NULL);
+    _sendTo(buf, len, ip, port);
+}
+
+void TuyaIoTLocalClass::_ack(const TuyaLocalPeer *peer, uint32_t seq, int result)
+{
+    uint8_t buf[sizeof(local_hdr_t) + sizeof(local_ack_t) + LOCAL_TAG_LEN];
+    local_ack_t ack = {seq, result};
+    size_t len = _seal(buf, LOCAL_ACK, 0, peer->devid, (const uint8_t *)&ack, sizeof(ack), NULL);
+    _sendTo(buf, len, peer->ip, peer->port);
+}
+
+// a challenge, or the proof that echoes one
+void TuyaIoTLocalClass::_sendNonce(uint8_t type, const char *devid, uint64_t nonce, TUYA_IP_ADDR_T ip, uint16_t port)
+{
+    uint8_t buf[sizeof(local_hdr_t) + sizeof(nonce) + LOCAL_TAG_LEN];
+    size_t len = _seal(buf, type, 0, devid, (const uint8_t *)&nonce, sizeof(nonce), NULL);
+    _sendTo(buf, len, ip, port);
+}
+
+bool TuyaIoTLocalClass::_receive(bool dispatch)
+{
+    uint8_t buf[LOCAL_MAX_PACKET];
+    TUYA_IP_ADDR_T ip;
+    uint16_t port;
+    local_hdr_t hdr;
+
+    int n = tal_net_recvfrom(_fd, buf, sizeof(buf), &ip, &port);
+    if (n <= 0) {
+        return false;
+    }
+    if (!_open(buf, n)) {
+        _stats.rejected++;
+        return true;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+    hdr.from[TUYA_LOCAL_ID_LEN - 1] = '\0';
+    hdr.to[TUYA_LOCAL_ID_LEN - 1] = '\0';
+
+    const char *self = ArduinoIoTClient.activate.devid;
+    // our own broadcasts come back too
+    if (!self[0] || !hdr.from[0] || 0 == strcmp(hdr.from, self) || (hdr.to[0] && strcmp(hdr.to, self))) {
+        return true;
+    }
+    // left unacked, the peer sends it again once the write in progress is done
+    if (LOCAL_DP == hdr.type && !dispatch) {
+        return true;
+    }
+    if (hdr.time && OPRT_OK == tal_time_check_time_sync()) {
+        int32_t age = (int32_t)(tal_time_get_posix() - hdr.time);
+        if (age > TUYA_LOCAL_TIME_WINDOW || age < -TUYA_LOCAL_TIME_WINDOW) {
+            _stats.rejected++;
+            return true;
+        }
+    }
+
+    uint8_t *payload = buf + sizeof(hdr);
+    uint64_t nonce = 0;
+    if ((LOCAL_CHALLENGE == hdr.type || LOCAL_PROOF == hdr.type) && hdr.len >= sizeof(nonce)) {
+        memcpy(&nonce, payload, sizeof(nonce));
+    }
+    // answered whatever boot number it carries, the proof only tells our
+    // current one; a replayed challenge gets a proof nobody waits for
+    if (LOCAL_CHALLENGE == hdr.type && nonce && hdr.to[0]) {
+        _sendNonce(LOCAL_PROOF, hdr.from, nonce, ip, port);
+    }
+
+    tal_mutex_lock(_mutex);
+    int i = _findPeer(hdr.from);
+    if (i < 0) {
+        i = _addPeer(hdr.from);
+    }
+    TuyaLocalPeer *p = &_peers[i];
+    bool repeated = false;
+    int32_t ahead = (int32_t)(hdr.seq - p->seq);
+    if (p->boot != hdr.boot) {
+        // a boot number is taken only with the echo of our latest challenge,
+        // anything else may have been recorded during an earlier boot
+        if (LOCAL_PROOF != hdr.type || 0 == p->nonce || nonce != p->nonce) {
+            // a fresh nonce every time, at most one per TUYA_LOCAL_ACK_MS
+            bool send = (0 == p->nonce || millis() - p->challenged >= TUYA_LOCAL_ACK_MS);
+            if (send) {
+                do {
+                    p->nonce = local_random();
+                } while (0 == p->nonce);
+                p->challenged = millis();
+                _stats.challenges++;
+            }
+            uint64_t challenge = p->nonce;
+            tal_mutex_unlock(_mutex);
+            if (send) {
+                _sendNonce(LOCAL_CHALLENGE, hdr.from, challenge, ip, port);
+            }
+            return true;
+        }
+        p->boot = hdr.boot;
+        p->seq = hdr.seq;
+        p->window = 1;
+        PR_DEBUG("local peer %s proved boot %08x", p->devid, (unsigned)p->boot);
+    } else if (ahead > 0) {
+        p->window = (ahead < 32) ? (p->window << ahead) | 1 : 1;
+        p->seq = hdr.seq;
+    } else if (ahead > -32 && !(p->window & (1UL << -ahead))) {
+        // overtaken by a later message, but not seen before
+        p->window |= 1UL << -ahead;
+    } else {
+        // a write sent again because our ack was lost
+        repeated = (LOCAL_DP == hdr.type && hdr.seq == p->dpSeq);
+        if (!repeated) {
+            tal_mutex_unlock(_mutex);
+            _stats.rejected++;
+            return true;
+        }
+    }
+    if (LOCAL_DP == hdr.type) {
+        p->dpSeq = hdr.seq;
+    }
+    // answered, also when the boot number had not changed after all
+    if (LOCAL_PROOF == hdr.type && nonce == p->nonce) {
+        p->nonce = 0;
+    }
+    p->ip = ip;
+    p->port = port;
+    p->lastSeen = millis() | 1;
+    TuyaLocalPeer peer = *p;
+    tal_mutex_unlock(_mutex);
+
+    switch (hdr.type) {
+    case LOCAL_ANNOUNCE: {
+        if (hdr.flags & LOCAL_FLAG_REPLY) {
+            _announce(false, ip, port);
+        }
+    } break;
+    case LOCAL_ACK: {
+        local_ack_t ack;
+        if (hdr.len >= sizeof(ack)) {
+            memcpy(&ack, payload, sizeof(ack));
+            if (_waitSeq && ack.seq == _waitSeq) {
+                _ackResult = ack.result;
+                _waitSeq = 0;
+                tal_semaphore_post(_ackSem);
+            }
+        }
+    } break;
+    case LOCAL_DP: {
+        if (repeated) {
+            _ack(&peer, hdr.seq, OPRT_OK);
+        } else {
+            _deliver(&peer, hdr.seq, payload, hdr.len);
+        }
+    } break;
+    default:
+        break;
+    }
+    return true;
+}
+
+void TuyaIoTLocalClass::_deliver(const TuyaLocalPeer *peer, uint32_t seq, uint8_t *payload, size_t len)
+{
+    uint8_t count = len ? payload[0] : 0;
+    if (0 == count || count > TUYA_LOCAL_MAX_DPS) {
+        _ack(peer, seq, OPRT_INVALID_PARM);
+        return;
+    }
+
+    dp_obj_recv_t *dpObj = (dp_obj_recv_t *)tal_malloc(sizeof(dp_obj_recv_t) + count * sizeof(dp_obj_t));
+    if (NULL == dpObj) {
+        _ack(peer, seq, OPRT_MALLOC_FAILED);
+        return;
+    }
+    memset(dpObj, 0, sizeof(dp_obj_recv_t) + count * sizeof(dp_obj_t));
+
+    size_t off = 1;
+    for (uint8_t i = 0; i < count && off + 4 <= len; i++) {
+        uint8_t id = payload[off];
+        dp_prop_tp_t type = (dp_prop_tp_t)payload[off + 1];
+        size_t vlen = payload[off + 2] | (payload[off + 3] << 8);
+        uint8_t *value = payload + off + 4;
+        off += 4 + vlen;
+        if (off > len) {
+            break;
+        }
+
+        // only dps this device has, with the type of its schema
+        dp_node_t *dpNode = dp_node_find_by_devid(ArduinoIoTClient.activate.devid, id);
+        if (NULL == dpNode || T_OBJ != dpNode->desc.type || type != dpNode->desc.prop_tp) {
+            PR_DEBUG("local dp %d of type %d not in the schema", id, type);
+            continue;
+        }
+        dp_obj_t *dp = &dpObj->dps[dpObj->dpscnt];
+        uint32_t v = 0;
+        if (PROP_STR == type) {
+            if (0 == vlen || '\0' != value[vlen - 1]) {
+                continue;
+            }
+            dp->value.dp_str = (char *)value;
+        } else {
+            if (sizeof(v) != vlen) {
+                continue;
+            }
+            memcpy(&v, value, sizeof(v));
+        }
+        switch (type) {
+        case PROP_VALUE: {
+            dp->value.dp_value = (int)v;
+        } break;
+        case PROP_ENUM: {
+            dp->value.dp_enum = v;
+        } break;
+        case PROP_BITMAP: {
+            dp->value.dp_bitmap = v;
+        } break;
+        case PROP_BOOL: {
+            dp->value.dp_bool = v ? true : false;
+        } break;
+        default:
+            break;
+        }
+        dp->id = id;
+        dp->type = type;
+        dpObj->dpscnt++;
+    }
+
+    // acked before the callback runs, so the sender does not wait for it
+    _ack(peer, seq, dpObj->dpscnt ? OPRT_OK : OPRT_NOT_SUPPORTED);
+    if (dpObj->dpscnt) {
+        tuya_event_msg_t event;
+        memset(&event, 0, sizeof(event));
+        event.id = TUYA_EVENT_DP_RECEIVE_OBJ;
+        event.value.dpobj = dpObj;
+        _stats.received++;
+        PR_DEBUG("local dp write from %s, %d dps", peer->devid, dpObj->dpscnt);
+        app_iot_event_dispatch(&event);
+    }
+    tal_free(dpObj);
+}
+
+int TuyaIoTLocalClass::_findPeer(const char *devid)
+{
+    for (uint8_t i = 0; i < _numPeers; i++) {
+        if (0 == strcmp(_peers[i].devid, devid)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int TuyaIoTLocalClass::_addPeer(const char *devid)
+{
+    int i = _numPeers;
+    if (_numPeers < TUYA_LOCAL_MAX_PEERS) {
+        _numPeers++;
+    } else {
+        // the table is full: the peer heard from least recently goes
+        i = 0;
+        for (uint8_t j = 1; j < _numPeers; j++) {
+            if (_peers[j].lastSeen < _peers[i].lastSeen) {
+                i = j;
+            }
+        }
+    }
+    memset(&_peers[i], 0, sizeof(TuyaLocalPeer));
+    strncpy(_peers[i].devid, devid, TUYA_LOCAL_ID_LEN - 1);
+    return i;
+}
+
+bool TuyaIoTLocalClass::_waitAck(bool onTask)
+{
+    if (!onTask) {
+        return OPRT_OK == tal_semaphore_wait(_ackSem, TUYA_LOCAL_ACK_MS) && 0 == _waitSeq;
+    }
+    // called from the event callback on the local task: read the socket here,
+    // dp writes of others wait until the callback returns
+    unsigned long start = millis();
+    while (_waitSeq && millis() - start < TUYA_LOCAL_ACK_MS) {
+        TUYA_FD_SET_T rfds;
+        TAL_FD_ZERO(&rfds);
+        TAL_FD_SET(_fd, &rfds);
+        if (tal_net_select(_fd + 1, &rfds, NULL, NULL, TUYA_LOCAL_ACK_MS - (millis() - start)) > 0) {
+            while (_receive(false)) {
+                ;
+            }
+        }
+    }
+    return 0 == _waitSeq;
+}
+
+int TuyaIoTLocalClass::_writeTo(const char *devid, const uint8_t *payload, size_t len, bool &answered)
+{
+    uint8_t buf[LOCAL_MAX_PACKET];
+    TUYA_IP_ADDR_T ip = 0;
+    uint16_t port = 0;
+    int rt = OPRT_NOT_FOUND;
+
+    tal_mutex_lock(_writeMutex);
+    tal_mutex_lock(_mutex);
+    int i = _findPeer(devid);
+    bool known = (i >= 0 && _peers[i].lastSeen && millis() - _peers[i].lastSeen < TUYA_LOCAL_PEER_TIMEOUT_MS);
+    if (known) {
+        ip = _peers[i].ip;
+        port = _peers[i].port;
+    }
+    tal_mutex_unlock(_mutex);
+    if (!known) {
+        tal_mutex_unlock(_writeMutex);
+        return rt;
+    }
+
+    uint32_t seq;
+    size_t n = _seal(buf, LOCAL_DP, 0, devid, payload, len, &seq);
+    // a late ack of an earlier write
+    while (OPRT_OK == tal_semaphore_wait(_ackSem, 0)) {
+        ;
+    }
+    BOOL_T onTask = false;
+    tal_thread_is_self(_task, &onTask);
+
+    _stats.sent++;
+    _waitSeq = seq;
+    unsigned long start = millis();
+    for (int attempt = 0; attempt <= TUYA_LOCAL_RETRIES; attempt++) {
+        if (attempt) {
+            _stats.retries++;
+        }
+        // sent again as it was, so a peer that got it only acks again
+        _sendTo(buf, n, ip, port);
+        if (_waitAck(onTask)) {
+            answered = true;
+            break;
+        }
+    }
+
+    if (answered) {
+        uint32_t ms = millis() - start;
+        rt = _ackResult;
+        _stats.acked++;
+        _stats.ackTotalMs += ms;
+        if (ms > _stats.ackMaxMs) {
+            _stats.ackMaxMs = ms;
+        }
+    } else {
+        _waitSeq = 0;
+        rt = OPRT_TIMEOUT;
+        // written through the fallback until it is heard from again
+        tal_mutex_lock(_mutex);
+        i = _findPeer(devid);
+        if (i >= 0) {
+            _peers[i].lastSeen = 0;
+        }
+        tal_mutex_unlock(_mutex);
+        PR_NOTICE("local peer %s does not answer", devid);
+    }
+    tal_mutex_unlock(_writeMutex);
+    return rt;
+}
+
+/******************************************************************************
+ * EXTERN DEFINITION
+ ******************************************************************************/
+TuyaIoTLocalClass TuyaLocal;
@@ -0,0 +1,162 @@
+#ifndef __TUYA_IOT_LOCAL_H__
+#define __TUYA_IOT_LOCAL_H__
+
+/******************************************************************************
+ * INCLUDE
+ ******************************************************************************/
+#include <Arduino.h>
+
+extern "C" {
+#include "tuya_cloud_types.h"
+#include "tuya_iot.h"
+#include "tal_mutex.h"
+#include "tal_semaphore.h"
+#include "tal_thread.h"
+}
+
+/******************************************************************************
+ * CONSTANTS
+ ******************************************************************************/
+#define TUYA_LOCAL_PORT             (6680)
+#define TUYA_LOCAL_MAX_PEERS        (16)
+#define TUYA_LOCAL_MAX_DPS          (8)             // dps per write
+#define TUYA_LOCAL_ID_LEN           (32)            // device id, '\0' included
+#define TUYA_LOCAL_KEY_MAX          (64)
+#define TUYA_LOCAL_ANNOUNCE_MS      (30 * 1000)
+#define TUYA_LOCAL_PEER_TIMEOUT_MS  (3 * TUYA_LOCAL_ANNOUNCE_MS)
+#define TUYA_LOCAL_ACK_MS           (30)            // wait for an ack before sending again
+#define TUYA_LOCAL_RETRIES          (3)
+#define TUYA_LOCAL_TIME_WINDOW      (30)            // seconds, when both clocks are synced
+#define TUYA_LOCAL_STACK            (4 * 1024)
+
+/******************************************************************************
+ * TYPEDEF
+ ******************************************************************************/
+typedef struct {
+    char devid[TUYA_LOCAL_ID_LEN];
+    TUYA_IP_ADDR_T ip;
+    uint16_t port;
+    uint32_t boot;              // random per boot of the peer, 0 until it answered a challenge
+    uint32_t seq;               // highest sequence number accepted from it
+    uint32_t window;            // of the 32 below it, those accepted
+    uint32_t dpSeq;             // of the last dp write, acked again if it is repeated
+    unsigned long lastSeen;     // millis(), 0 once it failed to answer
+    uint64_t nonce;             // of the challenge it has not answered yet
+    unsigned long challenged;   // millis() of that challenge
+} TuyaLocalPeer;
+
+typedef struct {
+    uint32_t sent;              // dp writes to peers
+    uint32_t acked;
+    uint32_t retries;
+    uint32_t fallbacks;         // writes handed to the fallback, the peer unknown or silent
+    uint32_t received;          // dp writes from peers delivered to the event callback
+    uint32_t rejected;          // bad tag, replayed or too old
+    uint32_t challenges;        // sent to peers with a boot number not proved yet
+    uint32_t ackTotalMs;
+    uint32_t ackMaxMs;
+} TuyaLocalStats;
+
+// called with the dps of a write no peer acknowledged
+typedef int (*TuyaLocalFallback)(const char *devid, const dp_obj_t *dps, uint8_t count);
+
+/******************************************************************************
+ * CLASS DECLARATION
+ ******************************************************************************/
+/*
+ * Writes dps of other devices over the LAN, without the round trip through
+ * the cloud. Devices that share a key find each other by UDP broadcast and
+ * send dp writes to each other by unicast UDP, acked and sent again up to
+ * TUYA_LOCAL_RETRIES times. The receiver checks the dps against its own
+ * schema and hands them to the callback of TuyaIoT.setEventCallback() as a
+ * TUYA_EVENT_DP_RECEIVE_OBJ event, so the sketch handles them like dps
+ * from the cloud. The event is raised on the local task.
+ *
+ * Every message carries an HMAC-SHA256 tag made with the shared key, a
+ * random boot number and a sequence number. Messages with a bad tag, a
+ * sequence number seen before or, when both clocks are synced, a time more than
+ * TUYA_LOCAL_TIME_WINDOW seconds off are dropped. A boot number is only
+ * taken from a peer once it has echoed a fresh random challenge, so neither
+ * messages recorded during an earlier boot of the peer, nor those replayed
+ * after this device restarted or forgot the peer, are accepted. The message
+ * that caused the challenge is dropped; a dp write gets through when it is
+ * sent again. The content is not encrypted.
+ *
+ * A write to a peer that is unknown or does not answer is passed to the
+ * fallback, which usually reports a dp of this device that a cloud scene
+ * turns into the write.
+ */
+class TuyaIoTLocalClass {
+public:
+  TuyaIoTLocalClass() {};
+  ~TuyaIoTLocalClass() { end(); };
+
+  // key shared by all devices of the group, 16 to TUYA_LOCAL_KEY_MAX bytes
+  int begin(const uint8_t *key, size_t keyLen, uint16_t port = TUYA_LOCAL_PORT);
+  void end(void);
+  bool running(void) { return _running; }
+
+  void setFallback(TuyaLocalFallback fallback) { _fallback = fallback; }
+
+  // OPRT_OK once the peer acked, else what the fallback returns, or
+  // OPRT_NOT_FOUND / OPRT_TIMEOUT without a fallback
+  int write(const char *devid, const dp_obj_t *dps, uint8_t count);
+  int write(const char *devid, uint8_t dpid, bool value);
+  int write(const char *devid, uint8_t dpid, int value);
+  int write(const char *devid, uint8_t dpid, const char *value);
+  int writeEnum(const char *devid, uint8_t dpid, uint32_t value);
+  int writeBitmap(const char *devid, uint8_t dpid, uint32_t value);
+
+  // peers heard from within TUYA_LOCAL_PEER_TIMEOUT_MS
+  bool reachable(const char *devid);
+  uint8_t peerCount(void);
+  // a copy, false when out of range
+  bool peer(uint8_t index, TuyaLocalPeer &peer);
+
+  const TuyaLocalStats &stats(void) { return _stats; }
+  void resetStats(void) { memset(&_stats, 0, sizeof(_stats)); }
+
+private:
+  uint8_t _key[TUYA_LOCAL_KEY_MAX];
+  size_t _keyLen = 0;
+  uint16_t _port = TUYA_LOCAL_PORT;
+  int _fd = -1;
+  uint32_t _boot = 0;
+  uint32_t _seq = 0;
+
+  TuyaLocalPeer _peers[TUYA_LOCAL_MAX_PEERS];
+  uint8_t _numPeers = 0;
+
+  MUTEX_HANDLE _mutex = NULL;         // peers, _seq and the socket
+  MUTEX_HANDLE _writeMutex = NULL;    // one write waits for its ack at a time
+  SEM_HANDLE _ackSem = NULL;
+  volatile uint32_t _waitSeq = 0;
+  volatile int _ackResult = OPRT_OK;
+
+  THREAD_HANDLE _task = NULL;
+  volatile bool _running = false;
+  unsigned long _lastAnnounce = 0;
+  TuyaLocalFallback _fallback = NULL;
+  TuyaLocalStats _stats = {};
+
+  static void _run(void *arg);
+  bool _receive(bool dispatch);
+  size_t _seal(uint8_t *buf, uint8_t type, uint8_t flags, const char *to, const uint8_t *payload, size_t len, uint32_t *seq);
+  bool _open(const uint8_t *buf, size_t len);
+  void _sendTo(const uint8_t *buf, size_t len, TUYA_IP_ADDR_T ip, uint16_t port);
+  void _announce(bool replyWanted, TUYA_IP_ADDR_T ip, uint16_t port);
+  void _ack(const TuyaLocalPeer *peer, uint32_t seq, int result);
+  void _sendNonce(uint8_t type, const char *devid, uint64_t nonce, TUYA_IP_ADDR_T ip, uint16_t port);
+  void _deliver(const TuyaLocalPeer *peer, uint32_t seq, uint8_t *payload, size_t len);
+  int _findPeer(const char *devid);
+  int _addPeer(const char *devid);
+  bool _waitAck(bool onTask);
+  int _writeTo(const char *devid, const uint8_t *payload, size_t len, bool &answered);
+};
+
+/******************************************************************************
+ * EXTERN DECLARATION
+ ******************************************************************************/
+extern TuyaIoTLocalClass TuyaLocal;
+
+#endif // !__TUYA_IOT_LOCAL_H__
@@ -0,0 +1,94 @@
+/*
+ *  This sketch serves a small web UI. Dynamic pages are handled by routes,
+ *  everything under /static is read from LittleFS.
+ *
+ *  Try:
+ *    http://<ip>/
+ *    http://<ip>/led?state=on
+ *    http://<ip>/sensors/3
+ *    http://<ip>/stream
+ *    http://<ip>/static/index.html
+ */
+
+#include <WiFi.h>
+#include <WebServer.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+VFSFILE fs(LITTLEFS);
+WebServer server(80);
+
+static void handleRoot()
+{
+    server.send(200, "text/html",
+                "<h1>Hello from TuyaOpen</h1>"
+                "<p><a href=\"/led?state=on\">LED on</a> <a href=\"/led?state=off\">LED off</a></p>");
+}
+
+static void handleLed()
+{
+    const char *state = server.arg("state");
+    if (!state) {
+        server.send(400, "text/plain", "missing state");
+        return;
+    }
+    Serial.printf("LED %s\r\n", state);
+    server.send(200, "text/plain", state);
+}
+
+static void handleSensor()
+{
+    char json[64];
+    snprintf(json, sizeof(json), "{\"id\":%s,\"value\":%d}", server.pathArg(0), (int)random(100));
+    server.send(200, "application/json", json);
+}
+
+static void handleStream()
+{
+    // the length is not known up front, send it in chunks
+    server.beginChunked(200, "text/plain");
+    for (int i = 0; i < 10; i++) {
+        char line[32];
+        snprintf(line, sizeof(line), "line %d\n", i);
+        server.sendChunk(line);
+    }
+    server.endChunked();
+}
+
+static void handleNotFound()
+{
+    char msg[160];
+    snprintf(msg, sizeof(msg), "%s not found\n", server.uri());
+    server.send(404, "text/plain", msg);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(10);
+
+    WiFi.begin(ssid, password);
+    Serial.print("Waiting for WiFi... ");
+    while (WiFi.status() != WSS_GOT_IP) {
+        Serial.print(".");
+        delay(500);
+    }
+    Serial.println("");
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    server.on("/", HTTP_GET, handleRoot);
+    server.on("/led", HTTP_GET | HTTP_POST, handleLed);
+    server.on("/sensors/{}", HTTP_GET, handleSensor);
+    server.on("/stream", HTTP_GET, handleStream);
+    server.serveStatic("/static", fs, "/www", "max-age=86400");
+    server.onNotFound(handleNotFound);
+    server.begin();
+}
+
+void loop()
+{
+    // serves every ready connection, waits up to 10 ms for new data
+    server.handleClient(10);
+}
@@ -0,0 +1,1085 @@
+#include "WebServer.h"
+#include <new>
+#include <strings.h>
+
+extern "C" {
+#include "tal_log.h"
+#include "tal_memory.h"
+}
+
+#undef write
+#undef read
+#undef close
+
+struct WebServerConn {
+    uint8_t *buf;           // WEBSERVER_MAX_REQUEST_SIZE + 1, the extra byte terminates the body
+    size_t len;
+    size_t scanned;         // bytes already searched for the end of the headers
+    size_t headLen;         // 0 until the end of the headers was found
+    size_t bodyLen;
+    uint16_t requests;
+};
+
+struct WebServerRoute {
+    WebServerRoute *next;
+    char *uri;
+    uint32_t hash;
+    bool exact;             // no "{}" or "*" in uri
+    int method;
+    WebServer::THandlerFunction handler;
+    VFSFILE *fs;            // static routes only
+    char *path;
+    char *cacheControl;
+};
+
+static WiFiClient s_noClient;
+
+// FNV-1a
+static uint32_t _hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static char *_strdup(const char *s)
+{
+    if (!s) {
+        return NULL;
+    }
+    size_t len = strlen(s) + 1;
+    char *d = (char *)tal_malloc(len);
+    if (d) {
+        memcpy(d, s, len);
+    }
+    return d;
+}
+
+static int _hexval(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static void _urlDecode(char *s, bool plusIsSpace)
+{
+    char *d = s;
+    while (*s) {
+        if (*s == '%' && _hexval(s[1]) >= 0 && _hexval(s[2]) >= 0) {
+            *d++ = (char)((_hexval(s[1]) << 4) | _hexval(s[2]));
+            s += 3;
+        } else if (*s == '+' && plusIsSpace) {
+            *d++ = ' ';
+            s++;
+        } else {
+            *d++ = *s++;
+        }
+    }
+    *d = '\0';
+}
+
+// finds the byte after the empty line that ends the headers, 0 if not there yet
+static size_t _findHeadEnd(const uint8_t *buf, size_t len, size_t from)
+{
+    for (size_t i = from; i < len; i++) {
+        if (buf[i] != '\n') {
+            continue;
+        }
+        if (i + 1 < len && buf[i + 1] == '\n') {
+            return i + 2;
+        }
+        if (i + 2 < len && buf[i + 1] == '\r' && buf[i + 2] == '\n') {
+            return i + 3;
+        }
+    }
+    return 0;
+}
+
+// looks up a header without modifying the buffer, returns its value and length
+static const char *_peekHeader(const uint8_t *buf, size_t len, const char *name, size_t *valueLen)
+{
+    size_t nameLen = strlen(name);
+    const char *p = (const char *)buf;
+    const char *end = p + len;
+
+    // skip the request line
+    p = (const char *)memchr(p, '\n', end - p);
+    while (p && ++p < end) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (!eol) {
+            break;
+        }
+        if ((size_t)(eol - p) > nameLen && p[nameLen] == ':' && strncasecmp(p, name, nameLen) == 0) {
+            const char *v = p + nameLen + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) {
+                v++;
+            }
+            const char *ve = eol;
+            while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ' || ve[-1] == '\t')) {
+                ve--;
+            }
+            *valueLen = ve - v;
+            return v;
+        }
+        p = eol;
+    }
+    return NULL;
+}
+
+WebServer::WebServer(uint16_t port, uint8_t maxClients)
+    : _server(port, maxClients)
+    , _port(port)
+    , _keepAlive(true)
+    , _keepAliveTimeout(WEBSERVER_KEEPALIVE_TIMEOUT_MS)
+    , _conns(NULL)
+    , _maxClients(maxClients)
+    , _routes(NULL)
+    , _scratch(NULL)
+    , _slot(-1)
+    , _cur(NULL)
+    , _method(HTTP_GET)
+    , _uri(NULL)
+    , _query(NULL)
+    , _http10(false)
+    , _closeAfter(false)
+    , _headerCount(0)
+    , _argCount(0)
+    , _argsParsed(false)
+    , _pathArgCount(0)
+    , _body(NULL)
+    , _bodyLen(0)
+    , _responded(false)
+    , _chunked(false)
+    , _respHeaderLen(0)
+{
+}
+
+WebServer::~WebServer()
+{
+    close();
+    while (_routes) {
+        WebServerRoute *r = _routes;
+        _routes = r->next;
+        tal_free(r->uri);
+        if (r->path) {
+            tal_free(r->path);
+        }
+        if (r->cacheControl) {
+            tal_free(r->cacheControl);
+        }
+        delete r;
+    }
+}
+
+void WebServer::begin()
+{
+    if (!_conns) {
+        _conns = new (std::nothrow) WebServerConn[_maxClients];
+        if (!_conns) {
+            PR_ERR("WebServer: connection table alloc failed");
+            return;
+        }
+        memset(_conns, 0, sizeof(WebServerConn) * _maxClients);
+    }
+    if (!_scratch) {
+        _scratch = (uint8_t *)tal_malloc(WEBSERVER_STREAM_CHUNK_SIZE);
+        if (!_scratch) {
+            PR_ERR("WebServer: stream buffer alloc failed");
+            return;
+        }
+    }
+
+    _server.onClientConnect([this](uint8_t slot, WiFiClient &client) { _onConnect(slot); });
+    _server.onClientData([this](uint8_t slot, WiFiClient &client, const uint8_t *data, size_t len) { _onData(slot, data, len); });
+    _server.onClientDisconnect([this](uint8_t slot, WiFiClient &client) { _onDisconnect(slot); });
+    _server.setIdleTimeout(_keepAliveTimeout);
+    _server.setNoDelay(true);
+    _server.begin(_port);
+}
+
+void WebServer::close()
+{
+    _server.end();
+    if (_conns) {
+        for (uint8_t i = 0; i < _maxClients; i++) {
+            _onDisconnect(i);
+        }
+        delete[] _conns;
+        _conns = NULL;
+    }
+    if (_scratch) {
+        tal_free(_scratch);
+        _scratch = NULL;
+    }
+}
+
+void WebServer::handleClient(uint32_t timeout_ms)
+{
+    if (!_conns) {
+        return;
+    }
+    _server.handleClients(timeout_ms);
+}
+
+void WebServer::setKeepAlive(bool enable, uint32_t timeout_ms)
+{
+    _keepAlive = enable;
+    _keepAliveTimeout = timeout_ms;
+    _server.setIdleTimeout(timeout_ms);
+}
+
+void WebServer::on(const char *uri, int method, THandlerFunction handler)
+{
+    WebServerRoute *route = new (std::nothrow) WebServerRoute();
+    if (!route) {
+        return;
+    }
+    route->uri = _strdup(uri);
+    if (!route->uri) {
+        delete route;
+        return;
+    }
+    route->hash = _hash(uri, strlen(uri));
+    route->exact = (strstr(uri, "{}") == NULL) && (strchr(uri, '*') == NULL);
+    route->method = method;
+    route->handler = handler;
+    route->fs = NULL;
+    route->path = NULL;
+    route->cacheControl = NULL;
+
+    // keep registration order, the first matching route wins
+    route->next = NULL;
+    WebServerRoute **tail = &_routes;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = route;
+}
+
+void WebServer::serveStatic(const char *uri, VFSFILE &fs, const char *path, const char *cacheControl)
+{
+    WebServerRoute *route = new (std::nothrow) WebServerRoute();
+    if (!route) {
+        return;
+    }
+    route->uri = _strdup(uri);
+    route->path = _strdup(path);
+    route->cacheControl = _strdup(cacheControl);
+    if (!route->uri || !route->path) {
+        PR_ERR("WebServer: static route alloc failed");
+        if (route->uri) {
+            tal_free(route->uri);
+        }
+        if (route->path) {
+            tal_free(route->path);
+        }
+        if (route->cacheControl) {
+            tal_free(route->cacheControl);
+        }
+        delete route;
+        return;
+    }
+    // "/static/" and "/static" are the same prefix
+    size_t len = strlen(route->uri);
+    while (len > 1 && route->uri[len - 1] == '/') {
+        route->uri[--len] = '\0';
+    }
+    route->hash = 0;
+    route->exact = false;
+    route->method = HTTP_GET | HTTP_HEAD;
+    route->fs = &fs;
+
+    route->next = NULL;
+    WebServerRoute **tail = &_routes;
+    while (*tail) {
+        tail = &(*tail)->next;
+    }
+    *tail = route;
+}
+
+void WebServer::_onConnect(uint8_t slot)
+{
+    WebServerConn *conn = &_conns[slot];
+    if (!conn->buf) {
+        conn->buf = (uint8_t *)tal_malloc(WEBSERVER_MAX_REQUEST_SIZE + 1);
+        if (!conn->buf) {
+            PR_ERR("WebServer: request buffer alloc failed");
+            _server.closeClient(slot);
+            return;
+        }
+    }
+    conn->len = 0;
+    conn->scanned = 0;
+    conn->headLen = 0;
+    conn->bodyLen = 0;
+    conn->requests = 0;
+}
+
+void WebServer::_onDisconnect(uint8_t slot)
+{
+    if (!_conns) {
+        return;
+    }
+    WebServerConn *conn = &_conns[slot];
+    if (conn->buf) {
+        tal_free(conn->buf);
+        conn->buf = NULL;
+    }
+    conn->len = 0;
+}
+
+void WebServer::_onData(uint8_t slot, const uint8_t *data, size_t len)
+{
+    WebServerConn *conn = &_conns[slot];
+
+    while (len && conn->buf) {
+        size_t room = WEBSERVER_MAX_REQUEST_SIZE - conn->len;
+        if (!room) {
+            // a single request that does not fit, the body size was checked already
+            _slot = slot;
+            _http10 = false;
+            _sendError(431);
+            return;
+        }
+        size_t n = (len < room) ? len : room;
+        memcpy(conn->buf + conn->len, data, n);
+        conn->len += n;
+        data += n;
+        len -= n;
+
+        // serve every complete request in the buffer, clients may pipeline
+        while (conn->buf && conn->len) {
+            int used = _parseRequest(conn);
+            if (used <= 0) {
+                break;
+            }
+            if (!conn->buf) {
+                // closed by the handler
+                return;
+            }
+            memmove(conn->buf, conn->buf + used, conn->len - used);
+            conn->len -= used;
+            conn->scanned = 0;
+            conn->headLen = 0;
+            conn->bodyLen = 0;
+        }
+    }
+}
+
+// returns the size of the request it served, 0 while incomplete, -1 when the connection was closed
+int WebServer::_parseRequest(WebServerConn *conn)
+{
+    uint8_t slot = conn - _conns;
+
+    if (!conn->headLen) {
+        size_t from = conn->scanned > 3 ? conn->scanned - 3 : 0;
+        conn->headLen = _findHeadEnd(conn->buf, conn->len, from);
+        conn->scanned = conn->len;
+        if (!conn->headLen) {
+            return 0;
+        }
+
+        _slot = slot;
+        _http10 = false;
+        size_t vlen = 0;
+        const char *v = _peekHeader(conn->buf, conn->headLen, "Transfer-Encoding", &vlen);
+        if (v) {
+            // chunked request bodies are not supported
+            _sendError(411);
+            return -1;
+        }
+        v = _peekHeader(conn->buf, conn->headLen, "Content-Length", &vlen);
+        if (v) {
+            conn->bodyLen = strtoul(v, NULL, 10);
+            if (conn->headLen + conn->bodyLen > WEBSERVER_MAX_REQUEST_SIZE) {
+                _sendError(413);
+                return -1;
+            }
+        }
+        if (conn->len < conn->headLen + conn->bodyLen) {
+            v = _peekHeader(conn->buf, conn->headLen, "Expect", &vlen);
+            if (v && vlen == 12 && strncasecmp(v, "100-continue", 12) == 0) {
+                static const char cont[] = "HTTP/1.1 100 Continue\r\n\r\n";
+                _server.write(slot, (const uint8_t *)cont, sizeof(cont) - 1);
+            }
+        }
+    }
+
+    size_t total = conn->headLen + conn->bodyLen;
+    if (conn->len < total) {
+        return 0;
+    }
+
+    _slot = slot;
+    _cur = conn;
+    conn->requests++;
+    // the byte after the body may belong to a pipelined request
+    uint8_t saved = conn->buf[total];
+    conn->buf[total] = '\0';
+    if (!_parseHead((char *)conn->buf, conn->headLen)) {
+        _sendError(400);
+        _cur = NULL;
+        return -1;
+    }
+    _body = conn->bodyLen ? conn->buf + conn->headLen : NULL;
+    _bodyLen = conn->bodyLen;
+
+    _handleRequest();
+
+    _cur = NULL;
+    _uri = NULL;
+    _headerCount = 0;
+    if (_closeAfter) {
+        _server.closeClient(slot);
+        return -1;
+    }
+    conn->buf[total] = saved;
+    return (int)total;
+}
+
+bool WebServer::_parseHead(char *buf, size_t len)
+{
+    char *end = buf + len;
+    char *line = buf;
+    char *eol = (char *)memchr(line, '\n', end - line);
+    if (!eol) {
+        return false;
+    }
+    *eol = '\0';
+    if (eol > line && eol[-1] == '\r') {
+        eol[-1] = '\0';
+    }
+
+    // request line: METHOD SP URI SP VERSION
+    char *m = line;
+    char *u = strchr(m, ' ');
+    if (!u) {
+        return false;
+    }
+    *u++ = '\0';
+    char *ver = strchr(u, ' ');
+    if (!ver) {
+        return false;
+    }
+    *ver++ = '\0';
+
+    if (strcmp(m, "GET") == 0) {
+        _method = HTTP_GET;
+    } else if (strcmp(m, "HEAD") == 0) {
+        _method = HTTP_HEAD;
+    } else if (strcmp(m, "POST") == 0) {
+        _method = HTTP_POST;
+    } else if (strcmp(m, "PUT") == 0) {
+        _method = HTTP_PUT;
+    } else if (strcmp(m, "PATCH") == 0) {
+        _method = HTTP_PATCH;
+    } else if (strcmp(m, "DELETE") == 0) {
+        _method = HTTP_DELETE;
+    } else if (strcmp(m, "OPTIONS") == 0) {
+        _method = HTTP_OPTIONS;
+    } else {
+        return false;
+    }
+    if (strncmp(ver, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    _http10 = (ver[7] == '0');
+
+    _query = strchr(u, '?');
+    if (_query) {
+        *_query++ = '\0';
+    }
+    _urlDecode(u, false);
+    _uri = u;
+
+    _headerCount = 0;
+    line = eol + 1;
+    while (line < end) {
+        eol = (char *)memchr(line, '\n', end - line);
+        if (!eol) {
+            break;
+        }
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        if (!*line) {
+            break;
+        }
+        char *colon = strchr(line, ':');
+        if (colon && _headerCount < WEBSERVER_MAX_HEADERS) {
+            *colon = '\0';
+            char *v = colon + 1;
+            while (*v == ' ' || *v == '\t') {
+                v++;
+            }
+            char *ve = v + strlen(v);
+            while (ve > v && (ve[-1] == ' ' || ve[-1] == '\t')) {
+                *--ve = '\0';
+            }
+            _headers[_headerCount].name = line;
+            _headers[_headerCount].value = v;
+            _headerCount++;
+        }
+        line = eol + 1;
+    }
+
+    const char *conn = header("Connection");
+    if (_http10) {
+        _closeAfter = !(conn && strcasecmp(conn, "keep-alive") == 0);
+    } else {
+        _closeAfter = conn && strcasecmp(conn, "close") == 0;
+    }
+    if (!_keepAlive || _cur->requests >= WEBSERVER_KEEPALIVE_MAX_REQUESTS) {
+        _closeAfter = true;
+    }
+
+    _argCount = 0;
+    _argsParsed = false;
+    _pathArgCount = 0;
+    _responded = false;
+    _chunked = false;
+    _respHeaderLen = 0;
+    return true;
+}
+
+void WebServer::_handleRequest()
+{
+    uint32_t hash = _hash(_uri, strlen(_uri));
+    WebServerRoute *route;
+
+    for (route = _routes; route; route = route->next) {
+        if (!(route->method & _method) || !_matchRoute(route, _uri, hash)) {
+            continue;
+        }
+        if (route->fs) {
+            if (_serveStaticRoute(route)) {
+                break;
+            }
+            // file is missing, let later routes or onNotFound handle it
+            _pathArgCount = 0;
+            continue;
+        }
+        route->handler();
+        break;
+    }
+
+    if (!route) {
+        if (_notFoundHandler) {
+            _notFoundHandler();
+        } else {
+            send(404, "text/plain", "Not found");
+        }
+    }
+
+    if (_chunked) {
+        endChunked();
+    } else if (!_responded) {
+        PR_ERR("WebServer: no response for %s", _uri);
+        send(500, "text/plain", "No response");
+    }
+}
+
+bool WebServer::_matchRoute(WebServerRoute *route, const char *uri, uint32_t hash)
+{
+    if (route->exact) {
+        return route->hash == hash && strcmp(route->uri, uri) == 0;
+    }
+    if (route->fs) {
+        size_t len = strlen(route->uri);
+        if (len == 1) {
+            // "/" serves everything
+            return true;
+        }
+        return strncmp(route->uri, uri, len) == 0 && (uri[len] == '\0' || uri[len] == '/');
+    }
+
+    const char *p = route->uri;
+    const char *u = uri;
+    char *out = _pathArgBuf;
+    char *outEnd = _pathArgBuf + sizeof(_pathArgBuf);
+    _pathArgCount = 0;
+
+    while (*p) {
+        if (p[0] == '*' && p[1] == '\0') {
+            return true;
+        }
+        if (p[0] == '{' && p[1] == '}') {
+            const char *seg = u;
+            while (*u && *u != '/') {
+                u++;
+            }
+            size_t segLen = u - seg;
+            if (!segLen || _pathArgCount >= WEBSERVER_MAX_PATH_ARGS || out + segLen + 1 > outEnd) {
+                return false;
+            }
+            memcpy(out, seg, segLen);
+            out[segLen] = '\0';
+            _pathArgs[_pathArgCount++] = out;
+            out += segLen + 1;
+            p += 2;
+            continue;
+        }
+        if (*p != *u) {
+            return false;
+        }
+        p++;
+        u++;
+    }
+    return *u == '\0';
+}
+
+bool WebServer::_serveStaticRoute(WebServerRoute *route)
+{
+    char path[128];
+    size_t prefixLen = strlen(route->uri);
+    const char *rest = (prefixLen == 1) ? _uri : _uri + prefixLen;
+
+    if (strstr(rest, "..")) {
+        return false;
+    }
+    int n = snprintf(path, sizeof(path), "%s%s", route->path, rest);
+    if (n <= 0 || n >= (int)sizeof(path)) {
+        return false;
+    }
+    if (path[n - 1] == '/' || !*rest) {
+        const char *index = (path[n - 1] == '/') ? "index.html" : "/index.html";
+        if (snprintf(path + n, sizeof(path) - n, "%s", index) >= (int)(sizeof(path) - n)) {
+            return false;
+        }
+    }
+    return streamFile(*route->fs, path, NULL, route->cacheControl);
+}
+
+const char *WebServer::header(const char *name) const
+{
+    for (int i = 0; i < _headerCount; i++) {
+        if (strcasecmp(_headers[i].name, name) == 0) {
+            return _headers[i].value;
+        }
+    }
+    return NULL;
+}
+
+const char *WebServer::headerName(int i) const
+{
+    return (i >= 0 && i < _headerCount) ? _headers[i].name : NULL;
+}
+
+const char *WebServer::header(int i) const
+{
+    return (i >= 0 && i < _headerCount) ? _headers[i].value : NULL;
+}
+
+void WebServer::_parseArgs(char *s)
+{
+    while (s && *s && _argCount < WEBSERVER_MAX_ARGS) {
+        char *next = strchr(s, '&');
+        if (next) {
+            *next++ = '\0';
+        }
+        char *eq = strchr(s, '=');
+        if (eq) {
+            *eq++ = '\0';
+        }
+        if (*s) {
+            _urlDecode(s, true);
+            if (eq) {
+                _urlDecode(eq, true);
+            }
+            _args[_argCount].name = s;
+            _args[_argCount].value = eq ? eq : "";
+            _argCount++;
+        }
+        s = next;
+    }
+}
+
+int WebServer::args()
+{
+    if (!_argsParsed && _uri) {
+        _argsParsed = true;
+        _parseArgs(_query);
+        const char *type = header("Content-Type");
+        if (_body && type && strncasecmp(type, "application/x-www-form-urlencoded", 33) == 0) {
+            _parseArgs((char *)_body);
+        }
+    }
+    return _argCount;
+}
+
+const char *WebServer::arg(const char *name)
+{
+    int count = args();
+    for (int i = 0; i < count; i++) {
+        if (strcmp(_args[i].name, name) == 0) {
+            return _args[i].value;
+        }
+    }
+    return NULL;
+}
+
+const char *WebServer::argName(int i)
+{
+    return (i >= 0 && i < args()) ? _args[i].name : NULL;
+}
+
+const char *WebServer::arg(int i)
+{
+    return (i >= 0 && i < args()) ? _args[i].value : NULL;
+}
+
+const char *WebServer::pathArg(int i) const
+{
+    return (i >= 0 && i < _pathArgCount) ? _pathArgs[i] : NULL;
+}
+
+WiFiClient &WebServer::client()
+{
+    WiFiClient *c = (_slot >= 0) ? _server.client(_slot) : NULL;
+    return c ? *c : s_noClient;
+}
+
+size_t WebServer::_write(const void *data, size_t len)
+{
+    if (_slot < 0 || !len) {
+        return 0;
+    }
+    return _server.write((uint8_t)_slot, (const uint8_t *)data, len);
+}
+
+void WebServer::sendHeader(const char *name, const char *value)
+{
+    size_t room = sizeof(_respHeaderBuf) - _respHeaderLen;
+    int n = snprintf(_respHeaderBuf + _respHeaderLen, room, "%s: %s\r\n", name, value);
+    if (n < 0 || (size_t)n >= room) {
+        PR_ERR("WebServer: no room for header %s", name);
+        _respHeaderBuf[_respHeaderLen] = '\0';
+        return;
+    }
+    _respHeaderLen += n;
+}
+
+void WebServer::_sendStatus(int code, const char *contentType, int contentLength, bool chunked)
+{
+    char *buf = (char *)_scratch;
+    size_t size = WEBSERVER_STREAM_CHUNK_SIZE;
+    bool noBody = (code < 200) || code == 204 || code == 304;
+
+    if (!noBody && !chunked && contentLength < 0) {
+        // body ends when the connection does
+        _closeAfter = true;
+    }
+
+    int n = snprintf(buf, size, "HTTP/1.%d %d %s\r\n", _http10 ? 0 : 1, code, responseCodeToString(code));
+    if (contentType && !noBody) {
+        n += snprintf(buf + n, size - n, "Content-Type: %s\r\n", contentType);
+    }
+    if (chunked) {
+        n += snprintf(buf + n, size - n, "Transfer-Encoding: chunked\r\n");
+    } else if (contentLength >= 0 && !noBody) {
+        n += snprintf(buf + n, size - n, "Content-Length: %d\r\n", contentLength);
+    }
+    if (_closeAfter) {
+        n += snprintf(buf + n, size - n, "Connection: close\r\n");
+    } else {
+        n += snprintf(buf + n, size - n, "Connection: keep-alive\r\nKeep-Alive: timeout=%u\r\n",
+                      (unsigned)(_keepAliveTimeout / 1000));
+    }
+    // the fixed part is far below the buffer size, the extra headers are bounded by their own buffer
+    if ((size_t)n + _respHeaderLen + 2 <= size) {
+        memcpy(buf + n, _respHeaderBuf, _respHeaderLen);
+        n += _respHeaderLen;
+        buf[n++] = '\r';
+        buf[n++] = '\n';
+        _write(buf, n);
+    } else {
+        _write(buf, n);
+        _write(_respHeaderBuf, _respHeaderLen);
+        _write("\r\n", 2);
+    }
+    _respHeaderLen = 0;
+    _responded = true;
+}
+
+void WebServer::send(int code, const char *contentType, const uint8_t *content, size_t len)
+{
+    if (_responded) {
+        PR_ERR("WebServer: response already sent");
+        return;
+    }
+    _sendStatus(code, contentType, (int)len, false);
+    if (_method != HTTP_HEAD && content) {
+        _write(content, len);
+    }
+}
+
+void WebServer::send(int code, const char *contentType, const char *content)
+{
+    send(code, contentType, (const uint8_t *)content, content ? strlen(content) : 0);
+}
+
+void WebServer::send(int code, const char *contentType, const String &content)
+{
+    send(code, contentType, (const uint8_t *)content.c_str(), content.length());
+}
+
+void WebServer::_sendError(int code)
+{
+    _closeAfter = true;
+    _responded = false;
+    _respHeaderLen = 0;
+    _method = HTTP_GET;
+    send(code, "text/plain", responseCodeToString(code));
+    _server.closeClient(_slot);
+}
+
+void WebServer::beginChunked(int code, const char *contentType)
+{
+    if (_responded) {
+        PR_ERR("WebServer: response already sent");
+        return;
+    }
+    _chunked = !_http10;
+    _sendStatus(code, contentType, -1, _chunked);
+}
+
+size_t WebServer::sendChunk(const uint8_t *data, size_t len)
+{
+    if (!len || _method == HTTP_HEAD) {
+        return len;
+    }
+    if (!_chunked) {
+        return _write(data, len);
+    }
+    char head[12];
+    int n = snprintf(head, sizeof(head), "%x\r\n", (unsigned)len);
+    if (_write(head, n) != (size_t)n) {
+        return 0;
+    }
+    size_t sent = _write(data, len);
+    _write("\r\n", 2);
+    return sent;
+}
+
+void WebServer::endChunked()
+{
+    if (_chunked) {
+        _chunked = false;
+        if (_method != HTTP_HEAD) {
+            _write("0\r\n\r\n", 5);
+        }
+    }
+}
+
+bool WebServer::_fileETag(VFSFILE &fs, TUYA_FILE fd, int size, char *etag)
+{
+    // there is no modification time, so the tag is a hash of the content,
+    // taken on every request so a rewrite of the same size changes it too;
+    // the headers go out first, so large files are not read twice
+    if (size > WEBSERVER_ETAG_MAX_SIZE) {
+        return false;
+    }
+    uint32_t h = 2166136261u;
+    int left = size;
+    while (left > 0) {
+        int n = fs.read((const char *)_scratch, (left < WEBSERVER_STREAM_CHUNK_SIZE) ? left : WEBSERVER_STREAM_CHUNK_SIZE, fd);
+        if (n <= 0) {
+            fs.lseek(fd, 0, SEEK_SET);
+            return false;
+        }
+        for (int i = 0; i < n; i++) {
+            h ^= _scratch[i];
+            h *= 16777619u;
+        }
+        left -= n;
+    }
+    fs.lseek(fd, 0, SEEK_SET);
+
+    snprintf(etag, 12, "\"%08x\"", (unsigned)h);
+    return true;
+}
+
+bool WebServer::streamFile(VFSFILE &fs, const char *path, const char *contentType, const char *cacheControl)
+{
+    if (_responded || !_scratch) {
+        return false;
+    }
+    TUYA_FILE fd = fs.open(path, "r");
+    if (!fd) {
+        return false;
+    }
+    int size = fs.filesize(path);
+    if (size < 0) {
+        fs.close(fd);
+        return false;
+    }
+    if (!contentType) {
+        contentType = contentTypeFor(path);
+    }
+
+    char etag[12];
+    bool hasETag = _fileETag(fs, fd, size, etag);
+    if (hasETag) {
+        sendHeader("ETag", etag);
+    }
+    if (cacheControl) {
+        sendHeader("Cache-Control", cacheControl);
+    }
+
+    const char *inm = header("If-None-Match");
+    if (hasETag && inm && (strstr(inm, etag) || strcmp(inm, "*") == 0)) {
+        fs.close(fd);
+        _sendStatus(304, NULL, -1, false);
+        return true;
+    }
+
+    int start = 0;
+    int len = size;
+    int code = 200;
+    const char *range = header("Range");
+    const char *ifRange = header("If-Range");
+    if (range && ifRange && (!hasETag || strcmp(ifRange, etag) != 0)) {
+        // the client's copy is stale, send the whole file
+        range = NULL;
+    }
+    if (range && strncmp(range, "bytes=", 6) == 0 && !strchr(range, ',')) {
+        const char *r = range + 6;
+        char *endp;
+        long first = -1;
+        long last = -1;
+        if (*r != '-') {
+            first = strtol(r, &endp, 10);
+            r = endp;
+        }
+        if (*r == '-') {
+            r++;
+            if (*r) {
+                last = strtol(r, &endp, 10);
+            }
+        }
+        if (first < 0 && last > 0) {
+            // suffix range, the last N bytes
+            first = (last > size) ? 0 : size - last;
+            last = size - 1;
+        } else if (last < 0 || last >= size) {
+            last = size - 1;
+        }
+        if (first < 0 || first > last || first >= size) {
+            char cr[32];
+            snprintf(cr, sizeof(cr), "bytes */%d", size);
+            sendHeader("Content-Range", cr);
+            fs.close(fd);
+            _sendStatus(416, NULL, 0, false);
+            return true;
+        }
+        char cr[48];
+        snprintf(cr, sizeof(cr), "bytes %ld-%ld/%d", first, last, size);
+        sendHeader("Content-Range", cr);
+        start = first;
+        len = last - first + 1;
+        code = 206;
+    }
+    sendHeader("Accept-Ranges", "bytes");
+    _sendStatus(code, contentType, len, false);
+
+    if (_method != HTTP_HEAD) {
+        if (start) {
+            fs.lseek(fd, start, SEEK_SET);
+        }
+        // file to socket through one reused buffer
+        while (len > 0) {
+            int n = fs.read((const char *)_scratch, (len < WEBSERVER_STREAM_CHUNK_SIZE) ? len : WEBSERVER_STREAM_CHUNK_SIZE, fd);
+            if (n <= 0) {
+                PR_ERR("WebServer: read %s failed", path);
+                _closeAfter = true;
+                break;
+            }
+            if (_write(_scratch, n) != (size_t)n) {
+                _closeAfter = true;
+                break;
+            }
+            len -= n;
+        }
+    }
+    fs.close(fd);
+    return true;
+}
+
+const char *WebServer::contentTypeFor(const char *path)
+{
+    static const struct {
+        const char *ext;
+        const char *type;
+    } types[] = {
+        {".html", "text/html"},
+        {".htm", "text/html"},
+        {".css", "text/css"},
+        {".js", "application/javascript"},
+        {".json", "application/json"},
+        {".txt", "text/plain"},
+        {".xml", "text/xml"},
+        {".png", "image/png"},
+        {".jpg", "image/jpeg"},
+        {".jpeg", "image/jpeg"},
+        {".gif", "image/gif"},
+        {".svg", "image/svg+xml"},
+        {".ico", "image/x-icon"},
+        {".woff", "font/woff"},
+        {".woff2", "font/woff2"},
+        {".wasm", "application/wasm"},
+        {".pdf", "application/pdf"},
+        {".zip", "application/zip"},
+        {".gz", "application/gzip"},
+        {".mp3", "audio/mpeg"},
+        {".wav", "audio/wav"},
+    };
+    const char *ext = strrchr(path, '.');
+    if (ext && !strchr(ext, '/')) {
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            if (strcasecmp(ext, types[i].ext) == 0) {
+                return types[i].type;
+            }
+        }
+    }
+    return "application/octet-stream";
+}
+
+const char *WebServer::responseCodeToString(int code)
+{
+    switch (code) {
+    case 100: return "Continue";
+    case 101: return "Switching Protocols";
+    case 200: return "OK";
+    case 201: return "Created";
+    case 202: return "Accepted";
+    case 204: return "No Content";
+    case 206: return "Partial Content";
+    case 301: return "Moved Permanently";
+    case 302: return "Found";
+    case 303: return "See Other";
+    case 304: return "Not Modified";
+    case 307: return "Temporary Redirect";
+    case 308: return "Permanent Redirect";
+    case 400: return "Bad Request";
+    case 401: return "Unauthorized";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 408: return "Request Timeout";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 414: return "URI Too Long";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    case 500: return "Internal Server Error";
+    case 501: return "Not Implemented";
+    case 503: return "Service Unavailable";
+    default:  return "";
+    }
+}
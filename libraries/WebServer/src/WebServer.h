@@ -0,0 +1,160 @@
+#ifndef _WEBSERVER_H_
+#define _WEBSERVER_H_
+
+#include <Arduino.h>
+#include <functional>
+#include "WiFiServer.h"
+#include "File.h"
+
+#define WEBSERVER_MAX_REQUEST_SIZE          (2048)  // request line, headers and body of one request
+#define WEBSERVER_MAX_HEADERS               (24)
+#define WEBSERVER_MAX_ARGS                  (16)
+#define WEBSERVER_MAX_PATH_ARGS             (4)
+#define WEBSERVER_MAX_PATH_ARG_SIZE         (128)
+#define WEBSERVER_RESPONSE_HEADER_SIZE      (384)   // extra headers added with sendHeader()
+#define WEBSERVER_KEEPALIVE_TIMEOUT_MS      (5000)
+#define WEBSERVER_KEEPALIVE_MAX_REQUESTS    (100)
+#define WEBSERVER_STREAM_CHUNK_SIZE         (1024)
+#define WEBSERVER_ETAG_MAX_SIZE             (64 * 1024) // larger files are sent without an ETag
+
+// bit mask, so a route can accept several methods
+typedef enum {
+    HTTP_GET     = 0x01,
+    HTTP_HEAD    = 0x02,
+    HTTP_POST    = 0x04,
+    HTTP_PUT     = 0x08,
+    HTTP_PATCH   = 0x10,
+    HTTP_DELETE  = 0x20,
+    HTTP_OPTIONS = 0x40,
+    HTTP_ANY     = 0x7F,
+} HTTPMethod;
+
+typedef struct {
+    const char *name;
+    const char *value;
+} WebServerPair;
+
+struct WebServerConn;
+struct WebServerRoute;
+
+/*
+ * HTTP/1.1 server on top of the WiFiServer connection table.
+ *
+ * Each connection owns one request buffer of WEBSERVER_MAX_REQUEST_SIZE bytes.
+ * The request line, headers and arguments are split in place inside that
+ * buffer, so header(), arg() and uri() return pointers that stay valid until
+ * the handler returns. Handlers run from handleClient() on the caller's thread.
+ */
+class WebServer
+{
+public:
+    typedef std::function<void(void)> THandlerFunction;
+
+    WebServer(uint16_t port = 80, uint8_t maxClients = 4);
+    ~WebServer();
+
+    void begin();
+    void close();
+    void stop() { close(); }
+    // waits up to timeout_ms for network activity and serves every ready request
+    void handleClient(uint32_t timeout_ms = 0);
+
+    /*
+     * Patterns are matched segment by segment: "{}" matches one segment that
+     * can be read back with pathArg(), a trailing "*" matches the rest of the
+     * path. Plain paths are compared by hash first.
+     */
+    void on(const char *uri, THandlerFunction handler) { on(uri, HTTP_ANY, handler); }
+    void on(const char *uri, int method, THandlerFunction handler);
+    void onNotFound(THandlerFunction handler) { _notFoundHandler = handler; }
+    // maps uri/<rest> to path/<rest> on fs; directories are served with index.html
+    void serveStatic(const char *uri, VFSFILE &fs, const char *path, const char *cacheControl = NULL);
+
+    void setKeepAlive(bool enable, uint32_t timeout_ms = WEBSERVER_KEEPALIVE_TIMEOUT_MS);
+
+    // request, valid inside a handler
+    HTTPMethod method() const { return _method; }
+    const char *uri() const { return _uri; }
+    const char *header(const char *name) const;
+    bool hasHeader(const char *name) const { return header(name) != NULL; }
+    int headers() const { return _headerCount; }
+    const char *headerName(int i) const;
+    const char *header(int i) const;
+    // query string and application/x-www-form-urlencoded body; both are
+    // URL-decoded in place by the first call, body() changes accordingly
+    const char *arg(const char *name);
+    bool hasArg(const char *name) { return arg(name) != NULL; }
+    int args();
+    const char *argName(int i);
+    const char *arg(int i);
+    const char *pathArg(int i) const;
+    const uint8_t *body() const { return _body; }
+    size_t bodyLength() const { return _bodyLen; }
+    WiFiClient &client();
+
+    // response
+    void sendHeader(const char *name, const char *value);
+    void send(int code, const char *contentType, const uint8_t *content, size_t len);
+    void send(int code, const char *contentType = NULL, const char *content = NULL);
+    void send(int code, const char *contentType, const String &content);
+    // chunked transfer encoding; HTTP/1.0 clients get the body unframed and the connection closes
+    void beginChunked(int code, const char *contentType);
+    size_t sendChunk(const uint8_t *data, size_t len);
+    size_t sendChunk(const char *data) { return sendChunk((const uint8_t *)data, strlen(data)); }
+    void endChunked();
+    // streams a file with ETag, If-None-Match and single Range support
+    bool streamFile(VFSFILE &fs, const char *path, const char *contentType = NULL, const char *cacheControl = NULL);
+
+    static const char *contentTypeFor(const char *path);
+    static const char *responseCodeToString(int code);
+
+private:
+    WiFiServer _server;
+    uint16_t _port;
+    bool _keepAlive;
+    uint32_t _keepAliveTimeout;
+    WebServerConn *_conns;
+    uint8_t _maxClients;
+    WebServerRoute *_routes;
+    THandlerFunction _notFoundHandler;
+    uint8_t *_scratch;
+
+    // current request
+    int _slot;
+    WebServerConn *_cur;
+    HTTPMethod _method;
+    char *_uri;
+    char *_query;
+    bool _http10;
+    bool _closeAfter;
+    WebServerPair _headers[WEBSERVER_MAX_HEADERS];
+    int _headerCount;
+    WebServerPair _args[WEBSERVER_MAX_ARGS];
+    int _argCount;
+    bool _argsParsed;
+    const char *_pathArgs[WEBSERVER_MAX_PATH_ARGS];
+    uint8_t _pathArgCount;
+    uint8_t *_body;
+    size_t _bodyLen;
+    bool _responded;
+    bool _chunked;
+    char _pathArgBuf[WEBSERVER_MAX_PATH_ARG_SIZE];
+    char _respHeaderBuf[WEBSERVER_RESPONSE_HEADER_SIZE];
+    size_t _respHeaderLen;
+
+    void _onConnect(uint8_t slot);
+    void _onData(uint8_t slot, const uint8_t *data, size_t len);
+    void _onDisconnect(uint8_t slot);
+    int _parseRequest(WebServerConn *conn);
+    bool _parseHead(char *buf, size_t len);
+    void _handleRequest();
+    bool _matchRoute(WebServerRoute *route, const char *uri, uint32_t hash);
+    bool _serveStaticRoute(WebServerRoute *route);
+    void _parseArgs(char *s);
+    void _sendError(int code);
+    size_t _write(const void *data, size_t len);
+    void _sendStatus(int code, const char *contentType, int contentLength, bool chunked);
+    bool _fileETag(VFSFILE &fs, TUYA_FILE fd, int size, char *etag);
+};
+
+#endif /* _WEBSERVER_H_ */
@@ -0,0 +1,94 @@
+/*
+ *  This sketch connects to a WebSocket echo server, sends a counter once a
+ *  second and streams a larger binary message in fragments.
+ */
+
+#include <WiFi.h>
+#include <WebSocketClient.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+const char* host = "192.168.1.100";
+const uint16_t port = 8080;
+const char* path = "/";
+
+WebSocketClient ws;
+
+static void onWsEvent(ws_event_t event, const ws_frame_info_t *info, uint8_t *data, size_t len)
+{
+    switch (event) {
+    case WS_EVT_CONNECT:
+        Serial.println("connected");
+        break;
+    case WS_EVT_DISCONNECT:
+        Serial.println("disconnected");
+        break;
+    case WS_EVT_DATA:
+        if (info->opcode == WS_OP_TEXT) {
+            Serial.printf("text (%d bytes at %u%s): %s\r\n", (int)len, (unsigned)info->index, info->last ? ", last" : "", (const char *)data);
+        } else {
+            Serial.printf("binary (%d bytes at %u%s)\r\n", (int)len, (unsigned)info->index, info->last ? ", last" : "");
+        }
+        break;
+    case WS_EVT_PONG:
+        Serial.println("pong");
+        break;
+    case WS_EVT_ERROR:
+        Serial.println("connection failed");
+        break;
+    }
+}
+
+static void sendBlob()
+{
+    uint8_t block[256];
+    for (int i = 0; i < (int)sizeof(block); i++) {
+        block[i] = i;
+    }
+    // 4 KB as one message, never held in memory as a whole
+    ws.beginMessage(WS_OP_BINARY, block, sizeof(block));
+    for (int i = 1; i < 15; i++) {
+        ws.sendFragment(block, sizeof(block));
+    }
+    ws.sendFragment(block, sizeof(block), true);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(10);
+
+    WiFi.begin(ssid, password);
+    Serial.print("Waiting for WiFi... ");
+    while (WiFi.status() != WSS_GOT_IP) {
+        Serial.print(".");
+        delay(500);
+    }
+    Serial.println("");
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    ws.onEvent(onWsEvent);
+    ws.setReconnectInterval(5000);
+    ws.setHeartbeat(15000, 5000);
+    if (ws.connect(host, port, path)) {
+        sendBlob();
+    }
+}
+
+void loop()
+{
+    static unsigned long lastSend = 0;
+    static int counter = 0;
+
+    ws.loop();
+
+    if (ws.isConnected() && millis() - lastSend >= 1000) {
+        lastSend = millis();
+        char msg[32];
+        snprintf(msg, sizeof(msg), "count %d", counter++);
+        ws.sendText(msg);
+    }
+    delay(1);
+}
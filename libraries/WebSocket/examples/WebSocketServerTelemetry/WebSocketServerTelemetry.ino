@@ -0,0 +1,75 @@
+/*
+ *  This sketch pushes a sensor sample to every connected browser 20 times a
+ *  second over WebSocket and echoes text messages back to their sender.
+ *  Clients that cannot keep up skip samples instead of stalling the others.
+ */
+
+#include <WiFi.h>
+#include <WebSocketServer.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+#define SAMPLE_INTERVAL_MS 50
+
+WebSocketServer ws(81, 4);
+
+static void onWsEvent(uint8_t num, ws_event_t event, const ws_frame_info_t *info, uint8_t *data, size_t len)
+{
+    switch (event) {
+    case WS_EVT_CONNECT:
+        // data is the request path
+        Serial.printf("[%d] connected, path %s\r\n", num, (const char *)data);
+        ws.sendText(num, "hello");
+        break;
+    case WS_EVT_DISCONNECT:
+        Serial.printf("[%d] disconnected\r\n", num);
+        break;
+    case WS_EVT_DATA:
+        // large messages arrive in pieces, info->last marks the end
+        if (info->opcode == WS_OP_TEXT && info->first && info->last) {
+            Serial.printf("[%d] text: %s\r\n", num, (const char *)data);
+            ws.sendText(num, (const char *)data, len);
+        } else {
+            Serial.printf("[%d] piece of %d bytes at %u\r\n", num, (int)len, (unsigned)info->index);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(10);
+
+    WiFi.begin(ssid, password);
+    Serial.print("Waiting for WiFi... ");
+    while (WiFi.status() != WSS_GOT_IP) {
+        Serial.print(".");
+        delay(500);
+    }
+    Serial.println("");
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    ws.onEvent(onWsEvent);
+    // ping idle clients every 10 s, drop them after 3 s without an answer
+    ws.setHeartbeat(10000, 3000);
+    ws.begin();
+}
+
+void loop()
+{
+    static unsigned long lastSample = 0;
+
+    ws.loop(5);
+
+    if (millis() - lastSample >= SAMPLE_INTERVAL_MS) {
+        lastSample = millis();
+        char sample[48];
+        int n = snprintf(sample, sizeof(sample), "{\"t\":%lu,\"v\":%d}", lastSample, (int)random(1000));
+        ws.broadcastText(sample, n, true);
+    }
+}
@@ -0,0 +1,484 @@
+#include "WebSocket.h"
+#include <strings.h>
+
+extern "C" {
+#include "tal_log.h"
+#include "tal_network.h"
+#include "tal_system.h"
+#include "mbedtls/version.h"
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+}
+
+#undef write
+#undef read
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_MAX (32)
+
+size_t WebSocketConnection::base64Encode(const uint8_t *in, size_t len, char *out)
+{
+    size_t n = 0;
+    if (mbedtls_base64_encode((unsigned char *)out, 4 * ((len + 2) / 3) + 1, &n, in, len) != 0) {
+        n = 0;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+void WebSocketConnection::acceptKey(const char *key, size_t keyLen, char *out)
+{
+    // a Sec-WebSocket-Key is 24 characters, a longer one is cut and fails the handshake
+    uint8_t buf[WS_KEY_MAX + sizeof(WS_GUID) - 1];
+    uint8_t digest[20];
+    if (keyLen > WS_KEY_MAX) {
+        keyLen = WS_KEY_MAX;
+    }
+    memcpy(buf, key, keyLen);
+    memcpy(buf + keyLen, WS_GUID, sizeof(WS_GUID) - 1);
+#if MBEDTLS_VERSION_NUMBER >= 0x03000000
+    mbedtls_sha1(buf, keyLen + sizeof(WS_GUID) - 1, digest);
+#else
+    mbedtls_sha1_ret(buf, keyLen + sizeof(WS_GUID) - 1, digest);
+#endif
+    base64Encode(digest, sizeof(digest), out);
+}
+
+const char *WebSocketConnection::findHeader(const char *head, size_t len, const char *name, size_t *valueLen)
+{
+    size_t nameLen = strlen(name);
+    const char *end = head + len;
+    // the status or request line never matches
+    const char *p = (const char *)memchr(head, '\n', len);
+    while (p && ++p < end) {
+        const char *eol = (const char *)memchr(p, '\n', end - p);
+        if (!eol) {
+            eol = end;
+        }
+        if ((size_t)(eol - p) > nameLen && p[nameLen] == ':' && strncasecmp(p, name, nameLen) == 0) {
+            const char *v = p + nameLen + 1;
+            while (v < eol && (*v == ' ' || *v == '\t')) {
+                v++;
+            }
+            const char *ve = eol;
+            while (ve > v && (ve[-1] == '\r' || ve[-1] == ' ' || ve[-1] == '\t')) {
+                ve--;
+            }
+            *valueLen = ve - v;
+            return v;
+        }
+        p = (eol < end) ? eol : NULL;
+    }
+    return NULL;
+}
+
+bool WebSocketConnection::headerHasToken(const char *value, size_t len, const char *token)
+{
+    // comma separated list, e.g. "Connection: keep-alive, Upgrade"
+    size_t tokenLen = strlen(token);
+    const char *end = value + len;
+    while (value < end) {
+        while (value < end && (*value == ' ' || *value == ',')) {
+            value++;
+        }
+        const char *t = value;
+        while (value < end && *value != ',') {
+            value++;
+        }
+        const char *te = value;
+        while (te > t && te[-1] == ' ') {
+            te--;
+        }
+        if ((size_t)(te - t) == tokenLen && strncasecmp(t, token, tokenLen) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* ---------------------------------------------------------------------------
+ * Framing
+ * ------------------------------------------------------------------------- */
+WebSocketConnection::WebSocketConnection(bool maskOutgoing)
+    : _client(NULL)
+    , _open(false)
+    , _closeSent(false)
+    , _pingInterval(WS_DEF_PING_INTERVAL_MS)
+    , _pongTimeout(WS_DEF_PONG_TIMEOUT_MS)
+    , _lastRx(0)
+    , _pingSentAt(0)
+    , _awaitingPong(false)
+    , _maskOutgoing(maskOutgoing)
+    , _fragmenting(false)
+{
+    _resetFraming();
+}
+
+void WebSocketConnection::_resetFraming()
+{
+    _hdrLen = 0;
+    _frameOp = 0;
+    _frameFin = false;
+    _frameMasked = false;
+    _frameMask = 0;
+    _frameRemaining = 0;
+    _frameIndex = 0;
+    _msgOp = WS_OP_TEXT;
+    _msgIndex = 0;
+    _inMessage = false;
+    _ctrlLen = 0;
+    _closeSent = false;
+    _fragmenting = false;
+    _awaitingPong = false;
+    _lastRx = millis();
+}
+
+void WebSocketConnection::setHeartbeat(uint32_t pingIntervalMs, uint32_t pongTimeoutMs)
+{
+    _pingInterval = pingIntervalMs;
+    _pongTimeout = pongTimeoutMs;
+}
+
+void WebSocketConnection::mask(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key, size_t offset)
+{
+    const uint8_t *k = (const uint8_t *)&key;
+    size_t i = 0;
+
+    // words only when both buffers can reach the same alignment
+    if ((((uintptr_t)dst ^ (uintptr_t)src) & 3) == 0) {
+        while (i < len && ((uintptr_t)(dst + i) & 3)) {
+            dst[i] = src[i] ^ k[(offset + i) & 3];
+            i++;
+        }
+        if (len - i >= 4) {
+            // key rotated to the current position, in memory order
+            uint8_t r[4];
+            for (int j = 0; j < 4; j++) {
+                r[j] = k[(offset + i + j) & 3];
+            }
+            uint32_t kw;
+            memcpy(&kw, r, 4);
+            for (; len - i >= 4; i += 4) {
+                *(uint32_t *)(dst + i) = *(const uint32_t *)(src + i) ^ kw;
+            }
+        }
+    }
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ k[(offset + i) & 3];
+    }
+}
+
+bool WebSocketConnection::_write(const uint8_t *data, size_t len)
+{
+    if (!_client || !len) {
+        return _client != NULL;
+    }
+    if (_client->write(data, len) != len) {
+        PR_ERR("WebSocket: write failed");
+        _open = false;
+        return false;
+    }
+    return true;
+}
+
+bool WebSocketConnection::canSend()
+{
+    if (!_open || !_client) {
+        return false;
+    }
+    int fd = _client->fd();
+    if (fd < 0) {
+        return false;
+    }
+    TUYA_FD_SET_T wfds;
+    TAL_FD_ZERO(&wfds);
+    TAL_FD_SET(fd, &wfds);
+    return tal_net_select(fd + 1, NULL, &wfds, NULL, 0) > 0 && TAL_FD_ISSET(fd, &wfds);
+}
+
+bool WebSocketConnection::sendFrame(uint8_t opcode, bool fin, const uint8_t *data, size_t len)
+{
+    if (!_open || (_closeSent && opcode != WS_OP_CLOSE)) {
+        return false;
+    }
+    if (opcode < WS_OP_CLOSE) {
+        // data frames of different messages must not interleave
+        if ((opcode == WS_OP_CONTINUATION) != _fragmenting) {
+            PR_ERR("WebSocket: frame 0x%x out of sequence", opcode);
+            return false;
+        }
+        _fragmenting = !fin;
+    } else if (!fin || len > WS_MAX_CONTROL_PAYLOAD) {
+        return false;
+    }
+
+    uint8_t buf[14 + WS_TX_CHUNK_SIZE];
+    size_t n = 0;
+    uint8_t maskBit = _maskOutgoing ? 0x80 : 0;
+    buf[n++] = (fin ? 0x80 : 0) | opcode;
+    if (len < 126) {
+        buf[n++] = maskBit | (uint8_t)len;
+    } else if (len <= 0xFFFF) {
+        buf[n++] = maskBit | 126;
+        buf[n++] = (uint8_t)(len >> 8);
+        buf[n++] = (uint8_t)len;
+    } else {
+        buf[n++] = maskBit | 127;
+        for (int i = 7; i >= 0; i--) {
+            buf[n++] = (uint8_t)((uint64_t)len >> (i * 8));
+        }
+    }
+
+    if (!_maskOutgoing) {
+        // server frames go out as they are: small ones in one segment with
+        // the header, large ones straight from the caller's buffer
+        if (len <= WS_TX_CHUNK_SIZE) {
+            if (len) {
+                memcpy(buf + n, data, len);
+            }
+            return _write(buf, n + len);
+        }
+        return _write(buf, n) && _write(data, len);
+    }
+
+    uint32_t key = ((uint32_t)tal_system_get_random(0x10000) << 16) | (uint32_t)tal_system_get_random(0x10000);
+    memcpy(buf + n, &key, 4);
+    n += 4;
+    // the masked copy is streamed through the chunk buffer
+    size_t off = 0;
+    do {
+        size_t chunk = len - off;
+        if (chunk > sizeof(buf) - n) {
+            chunk = sizeof(buf) - n;
+        }
+        mask(buf + n, data + off, chunk, key, off);
+        if (!_write(buf, n + chunk)) {
+            return false;
+        }
+        off += chunk;
+        n = 0;
+    } while (off < len);
+    return true;
+}
+
+bool WebSocketConnection::beginMessage(ws_opcode_t opcode, const uint8_t *data, size_t len, bool fin)
+{
+    if (opcode != WS_OP_TEXT && opcode != WS_OP_BINARY) {
+        return false;
+    }
+    return sendFrame(opcode, fin, data, len);
+}
+
+bool WebSocketConnection::sendFragment(const uint8_t *data, size_t len, bool fin)
+{
+    return sendFrame(WS_OP_CONTINUATION, fin, data, len);
+}
+
+bool WebSocketConnection::ping(const uint8_t *data, size_t len)
+{
+    return sendFrame(WS_OP_PING, true, data, len);
+}
+
+void WebSocketConnection::_sendClose(uint16_t code)
+{
+    if (!_open || _closeSent) {
+        return;
+    }
+    uint8_t payload[2] = {(uint8_t)(code >> 8), (uint8_t)code};
+    sendFrame(WS_OP_CLOSE, true, payload, code ? 2 : 0);
+    _closeSent = true;
+}
+
+bool WebSocketConnection::_onControl()
+{
+    switch (_frameOp) {
+    case WS_OP_PING:
+        return sendFrame(WS_OP_PONG, true, _ctrl, _ctrlLen);
+    case WS_OP_PONG:
+        _awaitingPong = false;
+        _onPong(_ctrl, _ctrlLen);
+        return true;
+    case WS_OP_CLOSE:
+        if (!_closeSent) {
+            // echo the peer's status code
+            uint16_t code = (_ctrlLen >= 2) ? ((_ctrl[0] << 8) | _ctrl[1]) : 1000;
+            _sendClose(code);
+        }
+        return false;
+    default:
+        return false;
+    }
+}
+
+bool WebSocketConnection::_feed(uint8_t *data, size_t len)
+{
+    while (len) {
+        if (!_frameRemaining && _hdrLen < 2) {
+            _hdr[_hdrLen++] = *data++;
+            len--;
+            if (_hdrLen < 2) {
+                continue;
+            }
+        }
+
+        if (_hdrLen) {
+            // header still incomplete
+            uint8_t len7 = _hdr[1] & 0x7F;
+            uint8_t need = 2 + ((len7 == 126) ? 2 : (len7 == 127) ? 8 : 0) + ((_hdr[1] & 0x80) ? 4 : 0);
+            while (_hdrLen < need && len) {
+                _hdr[_hdrLen++] = *data++;
+                len--;
+            }
+            if (_hdrLen < need) {
+                return true;
+            }
+
+            _frameFin = (_hdr[0] & 0x80) != 0;
+            _frameOp = _hdr[0] & 0x0F;
+            _frameMasked = (_hdr[1] & 0x80) != 0;
+            uint8_t p = 2;
+            if (len7 == 126) {
+                _frameRemaining = ((uint64_t)_hdr[2] << 8) | _hdr[3];
+                p = 4;
+            } else if (len7 == 127) {
+                _frameRemaining = 0;
+                for (int i = 0; i < 8; i++) {
+                    _frameRemaining = (_frameRemaining << 8) | _hdr[2 + i];
+                }
+                p = 10;
+            } else {
+                _frameRemaining = len7;
+            }
+            if (_frameMasked) {
+                memcpy(&_frameMask, _hdr + p, 4);
+            }
+            _hdrLen = 0;
+            _frameIndex = 0;
+            _ctrlLen = 0;
+
+            // clients must mask, servers must not
+            if (_frameMasked == _maskOutgoing || (_hdr[0] & 0x70)) {
+                PR_ERR("WebSocket: protocol error in frame header");
+                _sendClose(1002);
+                return false;
+            }
+            if (_frameOp >= WS_OP_CLOSE) {
+                if (!_frameFin || _frameRemaining > WS_MAX_CONTROL_PAYLOAD) {
+                    _sendClose(1002);
+                    return false;
+                }
+            } else if (_frameOp == WS_OP_CONTINUATION) {
+                if (!_inMessage) {
+                    _sendClose(1002);
+                    return false;
+                }
+            } else if (_frameOp == WS_OP_TEXT || _frameOp == WS_OP_BINARY) {
+                if (_inMessage) {
+                    _sendClose(1002);
+                    return false;
+                }
+                _inMessage = true;
+                _msgOp = (ws_opcode_t)_frameOp;
+                _msgIndex = 0;
+            } else {
+                _sendClose(1002);
+                return false;
+            }
+
+            if (!_frameRemaining) {
+                if (_frameOp >= WS_OP_CLOSE) {
+                    if (!_onControl()) {
+                        return false;
+                    }
+                } else if (_frameFin) {
+                    ws_frame_info_t info = {_msgOp, _msgIndex == 0, true, _msgIndex};
+                    uint8_t saved = *data;
+                    *data = '\0';
+                    _inMessage = false;
+                    _onData(&info, data, 0);
+                    *data = saved;
+                }
+                continue;
+            }
+        }
+
+        // payload
+        size_t n = (len < _frameRemaining) ? len : (size_t)_frameRemaining;
+        if (!n) {
+            break;
+        }
+        if (_frameMasked) {
+            mask(data, data, n, _frameMask, (size_t)(_frameIndex & 3));
+        }
+        _frameRemaining -= n;
+        _frameIndex += n;
+
+        if (_frameOp >= WS_OP_CLOSE) {
+            memcpy(_ctrl + _ctrlLen, data, n);
+            _ctrlLen += n;
+            if (!_frameRemaining && !_onControl()) {
+                return false;
+            }
+        } else {
+            bool last = _frameFin && !_frameRemaining;
+            ws_frame_info_t info = {_msgOp, _msgIndex == 0, last, _msgIndex};
+            _msgIndex += n;
+            if (last) {
+                _inMessage = false;
+            }
+            // the byte after the payload is the next frame's or the spare one
+            uint8_t saved = data[n];
+            data[n] = '\0';
+            _onData(&info, data, n);
+            data[n] = saved;
+            if (!_open) {
+                return false;
+            }
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool WebSocketConnection::_poll(uint8_t *buf, size_t size)
+{
+    if (!_client || !_open) {
+        return false;
+    }
+    int avail;
+    while ((avail = _client->available()) > 0) {
+        // keep one byte to terminate text pieces
+        int n = _client->read(buf, ((size_t)avail < size - 1) ? avail : size - 1);
+        if (n <= 0) {
+            break;
+        }
+        _lastRx = millis();
+        _awaitingPong = false;
+        if (!_feed(buf, n) || !_open) {
+            return false;
+        }
+    }
+    return _client->connected();
+}
+
+bool WebSocketConnection::_heartbeat(unsigned long now)
+{
+    if (!_pingInterval || !_open) {
+        return true;
+    }
+    if (_awaitingPong) {
+        if (now - _pingSentAt > _pongTimeout) {
+            PR_DEBUG("WebSocket: no pong for %lu ms", now - _pingSentAt);
+            return false;
+        }
+        return true;
+    }
+    if (now - _lastRx >= _pingInterval) {
+        // anything received counts as a pong, idle links get an explicit ping
+        _awaitingPong = true;
+        _pingSentAt = now;
+        return ping();
+    }
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef _WEBSOCKET_H_
+#define _WEBSOCKET_H_
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+
+#define WS_RX_BUFFER_SIZE           (1024)
+#define WS_TX_CHUNK_SIZE            (256)   // payloads up to this size share a segment with the frame header
+#define WS_MAX_CONTROL_PAYLOAD      (125)
+#define WS_HANDSHAKE_TIMEOUT_MS     (5000)
+#define WS_DEF_PING_INTERVAL_MS     (15000)
+#define WS_DEF_PONG_TIMEOUT_MS      (5000)
+
+typedef enum {
+    WS_OP_CONTINUATION = 0x0,
+    WS_OP_TEXT         = 0x1,
+    WS_OP_BINARY       = 0x2,
+    WS_OP_CLOSE        = 0x8,
+    WS_OP_PING         = 0x9,
+    WS_OP_PONG         = 0xA,
+} ws_opcode_t;
+
+typedef enum {
+    WS_EVT_CONNECT = 0,
+    WS_EVT_DISCONNECT,
+    // a piece of a text or binary message, see ws_frame_info_t
+    WS_EVT_DATA,
+    WS_EVT_PONG,
+    WS_EVT_ERROR,
+} ws_event_t;
+
+typedef struct {
+    ws_opcode_t opcode;     // WS_OP_TEXT or WS_OP_BINARY, for every piece of the message
+    bool first;             // first piece of the message
+    bool last;              // the message is complete after this piece
+    uint64_t index;         // offset of this piece within the message
+} ws_frame_info_t;
+
+/*
+ * Framing shared by WebSocketClient and WebSocketServer.
+ *
+ * Received payloads are unmasked in place in the read buffer and handed to
+ * the event callback as they arrive, so a message is never reassembled: a
+ * message larger than the read buffer arrives in several WS_EVT_DATA
+ * events. Text pieces are NUL terminated.
+ */
+class WebSocketConnection
+{
+public:
+    WebSocketConnection(bool maskOutgoing);
+    virtual ~WebSocketConnection() {}
+
+    bool sendText(const char *text) { return sendText(text, strlen(text)); }
+    bool sendText(const char *text, size_t len) { return sendFrame(WS_OP_TEXT, true, (const uint8_t *)text, len); }
+    bool sendBinary(const uint8_t *data, size_t len) { return sendFrame(WS_OP_BINARY, true, data, len); }
+    bool ping(const uint8_t *data = NULL, size_t len = 0);
+
+    /*
+     * Streams a message in fragments without knowing its total size:
+     * beginMessage() with the first piece, then sendFragment() for the
+     * following ones; fin on the last piece ends the message.
+     */
+    bool beginMessage(ws_opcode_t opcode, const uint8_t *data, size_t len, bool fin = false);
+    bool sendFragment(const uint8_t *data, size_t len, bool fin = false);
+
+    // one frame with an explicit opcode and FIN bit
+    bool sendFrame(uint8_t opcode, bool fin, const uint8_t *data, size_t len);
+
+    // backpressure: false while the socket send buffer is full, so a
+    // periodic sender can skip a sample instead of blocking
+    bool canSend();
+
+    // 0 disables the keepalive; the connection is dropped after pongTimeoutMs without a pong
+    void setHeartbeat(uint32_t pingIntervalMs, uint32_t pongTimeoutMs = WS_DEF_PONG_TIMEOUT_MS);
+
+    static void mask(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key, size_t offset);
+    // computes Sec-WebSocket-Accept for a Sec-WebSocket-Key, out needs 29 bytes
+    static void acceptKey(const char *key, size_t keyLen, char *out);
+    static size_t base64Encode(const uint8_t *in, size_t len, char *out);
+    // case-insensitive lookup in an HTTP head, the value is not terminated
+    static const char *findHeader(const char *head, size_t len, const char *name, size_t *valueLen);
+    static bool headerHasToken(const char *value, size_t len, const char *token);
+
+protected:
+    WiFiClient *_client;
+    bool _open;
+    bool _closeSent;
+
+    // incoming frame state
+    uint8_t _hdr[14];
+    uint8_t _hdrLen;
+    uint8_t _frameOp;
+    bool _frameFin;
+    bool _frameMasked;
+    uint32_t _frameMask;
+    uint64_t _frameRemaining;
+    uint64_t _frameIndex;
+    ws_opcode_t _msgOp;
+    uint64_t _msgIndex;
+    bool _inMessage;
+    uint8_t _ctrl[WS_MAX_CONTROL_PAYLOAD];
+    uint8_t _ctrlLen;
+
+    uint32_t _pingInterval;
+    uint32_t _pongTimeout;
+    unsigned long _lastRx;
+    unsigned long _pingSentAt;
+    bool _awaitingPong;
+
+    void _resetFraming();
+    // parses and dispatches everything in data, which is modified in place;
+    // returns false when the connection has to be closed
+    bool _feed(uint8_t *data, size_t len);
+    // reads whatever the client has into buf and feeds it
+    bool _poll(uint8_t *buf, size_t size);
+    bool _heartbeat(unsigned long now);
+    void _sendClose(uint16_t code);
+
+    virtual void _onData(const ws_frame_info_t *info, uint8_t *data, size_t len) = 0;
+    virtual void _onPong(const uint8_t *data, size_t len) {}
+
+private:
+    bool _maskOutgoing;
+    bool _fragmenting;
+
+    bool _onControl();
+    bool _write(const uint8_t *data, size_t len);
+};
+
+#endif /* _WEBSOCKET_H_ */
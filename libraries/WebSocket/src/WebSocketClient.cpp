@@ -0,0 +1,228 @@
+#include "WebSocketClient.h"
+
+extern "C" {
+#include "tal_log.h"
+#include "tal_memory.h"
+#include "tal_system.h"
+}
+
+#undef write
+#undef read
+
+WebSocketClient::WebSocketClient()
+    : WebSocketConnection(true)
+    , _port(0)
+    , _rxBuf(NULL)
+    , _reconnectInterval(0)
+    , _lastAttempt(0)
+    , _reconnect(false)
+{
+}
+
+WebSocketClient::~WebSocketClient()
+{
+    disconnect();
+    if (_rxBuf) {
+        tal_free(_rxBuf);
+        _rxBuf = NULL;
+    }
+}
+
+bool WebSocketClient::connect(const char *host, uint16_t port, const char *path, const char *protocol)
+{
+    if (_open) {
+        disconnect();
+    }
+    // loop() reconnects with the members themselves
+    if (host != _host.c_str()) {
+        _host = host;
+    }
+    if (path != _path.c_str()) {
+        _path = path ? path : "/";
+    }
+    if (protocol != _protocol.c_str()) {
+        _protocol = protocol ? protocol : "";
+    }
+    _port = port;
+    _reconnect = true;
+    _lastAttempt = millis();
+
+    if (!_rxBuf) {
+        _rxBuf = (uint8_t *)tal_malloc(WS_RX_BUFFER_SIZE);
+        if (!_rxBuf) {
+            PR_ERR("WebSocketClient: rx buffer alloc failed");
+            return false;
+        }
+    }
+    if (!_tcp.connect(_host.c_str(), _port, WS_HANDSHAKE_TIMEOUT_MS)) {
+        PR_ERR("WebSocketClient: connect %s:%d failed", _host.c_str(), _port);
+        if (_cb) {
+            _cb(WS_EVT_ERROR, NULL, NULL, 0);
+        }
+        return false;
+    }
+    _tcp.setNoDelay(true);
+    _client = &_tcp;
+
+    if (!_handshake()) {
+        PR_ERR("WebSocketClient: handshake with %s failed", _host.c_str());
+        _tcp.stop();
+        if (_cb) {
+            _cb(WS_EVT_ERROR, NULL, NULL, 0);
+        }
+        return false;
+    }
+    return true;
+}
+
+bool WebSocketClient::_handshake()
+{
+    uint8_t nonce[16];
+    char key[25];
+    for (int i = 0; i < 16; i++) {
+        nonce[i] = (uint8_t)tal_system_get_random(256);
+    }
+    base64Encode(nonce, sizeof(nonce), key);
+
+    char *buf = (char *)_rxBuf;
+    const size_t size = WS_RX_BUFFER_SIZE - 1;
+    char portStr[8] = "";
+    if (_port != 80 && _port != 443) {
+        snprintf(portStr, sizeof(portStr), ":%u", _port);
+    }
+    int n = snprintf(buf, size,
+                     "GET %s HTTP/1.1\r\n"
+                     "Host: %s%s\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Key: %s\r\n"
+                     "Sec-WebSocket-Version: 13\r\n"
+                     "%s%s%s"
+                     "%s"
+                     "\r\n",
+                     _path.c_str(), _host.c_str(), portStr, key,
+                     _protocol.length() ? "Sec-WebSocket-Protocol: " : "", _protocol.c_str(), _protocol.length() ? "\r\n" : "",
+                     _extraHeaders.c_str());
+    if (n <= 0 || (size_t)n >= size) {
+        return false;
+    }
+    if (_tcp.write((const uint8_t *)buf, n) != (size_t)n) {
+        return false;
+    }
+
+    // read the response head; the server may send frames right after it
+    size_t len = 0;
+    size_t headEnd = 0;
+    unsigned long start = millis();
+    while (!headEnd) {
+        if (millis() - start > WS_HANDSHAKE_TIMEOUT_MS || len >= size) {
+            return false;
+        }
+        int avail = _tcp.available();
+        if (avail <= 0) {
+            if (!_tcp.connected()) {
+                return false;
+            }
+            delay(1);
+            continue;
+        }
+        int r = _tcp.read(_rxBuf + len, ((size_t)avail < size - len) ? avail : size - len);
+        if (r <= 0) {
+            continue;
+        }
+        size_t from = (len > 3) ? len - 3 : 0;
+        len += r;
+        for (size_t i = from; i + 3 < len; i++) {
+            if (buf[i] == '\r' && buf[i + 1] == '\n' && buf[i + 2] == '\r' && buf[i + 3] == '\n') {
+                headEnd = i + 4;
+                break;
+            }
+        }
+    }
+
+    if (headEnd < 12 || strncmp(buf, "HTTP/1.1 101", 12) != 0) {
+        return false;
+    }
+    size_t vlen;
+    const char *v = findHeader(buf, headEnd, "Upgrade", &vlen);
+    if (!v || !headerHasToken(v, vlen, "websocket")) {
+        return false;
+    }
+    v = findHeader(buf, headEnd, "Connection", &vlen);
+    if (!v || !headerHasToken(v, vlen, "Upgrade")) {
+        return false;
+    }
+    char expected[29];
+    acceptKey(key, strlen(key), expected);
+    v = findHeader(buf, headEnd, "Sec-WebSocket-Accept", &vlen);
+    if (!v || vlen != 28 || strncmp(v, expected, 28) != 0) {
+        return false;
+    }
+    if (_protocol.length()) {
+        v = findHeader(buf, headEnd, "Sec-WebSocket-Protocol", &vlen);
+        if (!v || vlen != _protocol.length() || strncmp(v, _protocol.c_str(), vlen) != 0) {
+            return false;
+        }
+    }
+
+    _resetFraming();
+    _open = true;
+    if (_cb) {
+        _cb(WS_EVT_CONNECT, NULL, NULL, 0);
+    }
+    if (len > headEnd) {
+        memmove(_rxBuf, _rxBuf + headEnd, len - headEnd);
+        if (!_feed(_rxBuf, len - headEnd)) {
+            _closed();
+            return true;
+        }
+    }
+    return true;
+}
+
+void WebSocketClient::loop()
+{
+    if (!_open) {
+        if (_reconnect && _reconnectInterval && millis() - _lastAttempt >= _reconnectInterval) {
+            connect(_host.c_str(), _port, _path.c_str(), _protocol.length() ? _protocol.c_str() : NULL);
+        }
+        return;
+    }
+    if (!_poll(_rxBuf, WS_RX_BUFFER_SIZE) || !_heartbeat(millis())) {
+        _closed();
+    }
+}
+
+void WebSocketClient::disconnect(uint16_t code)
+{
+    _reconnect = false;
+    if (_open) {
+        _sendClose(code);
+        _closed();
+    }
+}
+
+void WebSocketClient::_closed()
+{
+    bool wasOpen = _open;
+    _open = false;
+    _tcp.stop();
+    _lastAttempt = millis();
+    if (wasOpen && _cb) {
+        _cb(WS_EVT_DISCONNECT, NULL, NULL, 0);
+    }
+}
+
+void WebSocketClient::_onData(const ws_frame_info_t *info, uint8_t *data, size_t len)
+{
+    if (_cb) {
+        _cb(WS_EVT_DATA, info, data, len);
+    }
+}
+
+void WebSocketClient::_onPong(const uint8_t *data, size_t len)
+{
+    if (_cb) {
+        _cb(WS_EVT_PONG, NULL, (uint8_t *)data, len);
+    }
+}
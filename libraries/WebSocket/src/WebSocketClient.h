@@ -0,0 +1,50 @@
+#ifndef _WEBSOCKETCLIENT_H_
+#define _WEBSOCKETCLIENT_H_
+
+#include <functional>
+#include "WebSocket.h"
+
+typedef std::function<void(ws_event_t event, const ws_frame_info_t *info, uint8_t *data, size_t len)> WebSocketClientEvent;
+
+/*
+ * RFC 6455 client on a WiFiClient. connect() performs the opening handshake
+ * and blocks for at most WS_HANDSHAKE_TIMEOUT_MS; afterwards loop() has to be
+ * called regularly to receive, answer pings and run the keepalive.
+ */
+class WebSocketClient : public WebSocketConnection
+{
+public:
+    WebSocketClient();
+    ~WebSocketClient();
+
+    bool connect(const char *host, uint16_t port, const char *path = "/", const char *protocol = NULL);
+    // extra request lines for the handshake, each ending with "\r\n"
+    void setExtraHeaders(const char *headers) { _extraHeaders = headers ? headers : ""; }
+    // loop() reconnects after ms when the connection was lost (0 = never)
+    void setReconnectInterval(uint32_t ms) { _reconnectInterval = ms; }
+    void onEvent(WebSocketClientEvent cb) { _cb = cb; }
+
+    void loop();
+    void disconnect(uint16_t code = 1000);
+    bool isConnected() const { return _open; }
+
+private:
+    WiFiClient _tcp;
+    String _host;
+    uint16_t _port;
+    String _path;
+    String _protocol;
+    String _extraHeaders;
+    uint8_t *_rxBuf;
+    uint32_t _reconnectInterval;
+    unsigned long _lastAttempt;
+    bool _reconnect;
+    WebSocketClientEvent _cb;
+
+    bool _handshake();
+    void _closed();
+    void _onData(const ws_frame_info_t *info, uint8_t *data, size_t len) override;
+    void _onPong(const uint8_t *data, size_t len) override;
+};
+
+#endif /* _WEBSOCKETCLIENT_H_ */
@@ -0,0 +1,351 @@
+#include "WebSocketServer.h"
+#include <new>
+
+extern "C" {
+#include "tal_log.h"
+#include "tal_memory.h"
+}
+
+#undef write
+#undef read
+#undef close
+
+void WebSocketServerClient::_onData(const ws_frame_info_t *info, uint8_t *data, size_t len)
+{
+    if (_server->_cb) {
+        _server->_cb(_num, WS_EVT_DATA, info, data, len);
+    }
+}
+
+void WebSocketServerClient::_onPong(const uint8_t *data, size_t len)
+{
+    if (_server->_cb) {
+        _server->_cb(_num, WS_EVT_PONG, NULL, (uint8_t *)data, len);
+    }
+}
+
+WebSocketServer::WebSocketServer(uint16_t port, uint8_t maxClients, const char *protocol)
+    : _server(port, maxClients)
+    , _port(port)
+    , _maxClients(maxClients)
+    , _protocol(protocol ? protocol : "")
+    , _clients(NULL)
+    , _rxBuf(NULL)
+    , _pingInterval(WS_DEF_PING_INTERVAL_MS)
+    , _pongTimeout(WS_DEF_PONG_TIMEOUT_MS)
+{
+}
+
+WebSocketServer::~WebSocketServer()
+{
+    close();
+}
+
+void WebSocketServer::begin()
+{
+    if (!_clients) {
+        _clients = new (std::nothrow) WebSocketServerClient[_maxClients];
+        if (!_clients) {
+            PR_ERR("WebSocketServer: client table alloc failed");
+            return;
+        }
+        for (uint8_t i = 0; i < _maxClients; i++) {
+            _clients[i]._server = this;
+            _clients[i]._num = i;
+        }
+    }
+    if (!_rxBuf) {
+        _rxBuf = (uint8_t *)tal_malloc(WS_RX_BUFFER_SIZE);
+        if (!_rxBuf) {
+            PR_ERR("WebSocketServer: rx buffer alloc failed");
+            return;
+        }
+    }
+    // no data callback: frames are read by loop() into the shared buffer
+    _server.onClientConnect([this](uint8_t slot, WiFiClient &client) { _onConnect(slot); });
+    _server.onClientDisconnect([this](uint8_t slot, WiFiClient &client) { _onDisconnect(slot); });
+    _server.setNoDelay(true);
+    _server.begin(_port);
+}
+
+void WebSocketServer::close()
+{
+    if (_clients) {
+        disconnectAll();
+    }
+    _server.end();
+    if (_clients) {
+        delete[] _clients;
+        _clients = NULL;
+    }
+    if (_rxBuf) {
+        tal_free(_rxBuf);
+        _rxBuf = NULL;
+    }
+}
+
+void WebSocketServer::setHeartbeat(uint32_t pingIntervalMs, uint32_t pongTimeoutMs)
+{
+    _pingInterval = pingIntervalMs;
+    _pongTimeout = pongTimeoutMs;
+    if (_clients) {
+        for (uint8_t i = 0; i < _maxClients; i++) {
+            _clients[i].setHeartbeat(pingIntervalMs, pongTimeoutMs);
+        }
+    }
+}
+
+void WebSocketServer::_onConnect(uint8_t num)
+{
+    WebSocketServerClient *c = &_clients[num];
+    c->_client = _server.client(num);
+    c->_open = false;
+    c->_hsLen = 0;
+    c->_acceptedAt = millis();
+    c->_hs = (char *)tal_malloc(WS_SERVER_HANDSHAKE_SIZE);
+    if (!c->_hs) {
+        PR_ERR("WebSocketServer: handshake buffer alloc failed");
+        _server.closeClient(num);
+        return;
+    }
+    c->setHeartbeat(_pingInterval, _pongTimeout);
+}
+
+void WebSocketServer::_onDisconnect(uint8_t num)
+{
+    if (!_clients) {
+        return;
+    }
+    WebSocketServerClient *c = &_clients[num];
+    bool wasOpen = c->_open;
+    c->_open = false;
+    c->_client = NULL;
+    if (c->_hs) {
+        tal_free(c->_hs);
+        c->_hs = NULL;
+    }
+    if (wasOpen && _cb) {
+        _cb(num, WS_EVT_DISCONNECT, NULL, NULL, 0);
+    }
+}
+
+void WebSocketServer::loop(uint32_t timeout_ms)
+{
+    if (!_clients || !_rxBuf) {
+        return;
+    }
+    _server.handleClients(timeout_ms);
+
+    unsigned long now = millis();
+    for (uint8_t i = 0; i < _maxClients; i++) {
+        WebSocketServerClient *c = &_clients[i];
+        if (!c->_client) {
+            continue;
+        }
+        bool ok;
+        if (c->_hs) {
+            ok = _readHandshake(c);
+        } else {
+            ok = c->_poll(_rxBuf, WS_RX_BUFFER_SIZE) && c->_heartbeat(now);
+        }
+        if (!ok && c->_client) {
+            _server.closeClient(i);
+        }
+    }
+}
+
+bool WebSocketServer::_readHandshake(WebSocketServerClient *c)
+{
+    int avail = c->_client->available();
+    if (avail > 0) {
+        size_t room = WS_SERVER_HANDSHAKE_SIZE - 1 - c->_hsLen;
+        if (!room) {
+            _reject(c, 431);
+            return false;
+        }
+        int n = c->_client->read((uint8_t *)c->_hs + c->_hsLen, ((size_t)avail < room) ? avail : room);
+        if (n > 0) {
+            size_t from = (c->_hsLen > 3) ? c->_hsLen - 3 : 0;
+            c->_hsLen += n;
+            for (size_t i = from; i + 3 < c->_hsLen; i++) {
+                if (c->_hs[i] == '\r' && c->_hs[i + 1] == '\n' && c->_hs[i + 2] == '\r' && c->_hs[i + 3] == '\n') {
+                    return _acceptHandshake(c, i + 4);
+                }
+            }
+        }
+    }
+    if (millis() - c->_acceptedAt > WS_HANDSHAKE_TIMEOUT_MS) {
+        PR_DEBUG("WebSocketServer: handshake timeout");
+        return false;
+    }
+    return c->_client->connected();
+}
+
+bool WebSocketServer::_acceptHandshake(WebSocketServerClient *c, size_t headEnd)
+{
+    char *h = c->_hs;
+    size_t vlen;
+    const char *v;
+
+    if (strncmp(h, "GET ", 4) != 0) {
+        _reject(c, 400);
+        return false;
+    }
+    v = WebSocketConnection::findHeader(h, headEnd, "Upgrade", &vlen);
+    if (!v || !WebSocketConnection::headerHasToken(v, vlen, "websocket")) {
+        _reject(c, 400);
+        return false;
+    }
+    v = WebSocketConnection::findHeader(h, headEnd, "Connection", &vlen);
+    if (!v || !WebSocketConnection::headerHasToken(v, vlen, "Upgrade")) {
+        _reject(c, 400);
+        return false;
+    }
+    v = WebSocketConnection::findHeader(h, headEnd, "Sec-WebSocket-Version", &vlen);
+    if (!v || vlen != 2 || strncmp(v, "13", 2) != 0) {
+        _reject(c, 426);
+        return false;
+    }
+    const char *key = WebSocketConnection::findHeader(h, headEnd, "Sec-WebSocket-Key", &vlen);
+    if (!key || vlen != 24) {
+        _reject(c, 400);
+        return false;
+    }
+    char accept[29];
+    WebSocketConnection::acceptKey(key, vlen, accept);
+
+    bool withProtocol = false;
+    if (_protocol.length()) {
+        v = WebSocketConnection::findHeader(h, headEnd, "Sec-WebSocket-Protocol", &vlen);
+        withProtocol = v && WebSocketConnection::headerHasToken(v, vlen, _protocol.c_str());
+    }
+
+    char resp[192];
+    int n = snprintf(resp, sizeof(resp),
+                     "HTTP/1.1 101 Switching Protocols\r\n"
+                     "Upgrade: websocket\r\n"
+                     "Connection: Upgrade\r\n"
+                     "Sec-WebSocket-Accept: %s\r\n"
+                     "%s%s%s"
+                     "\r\n",
+                     accept,
+                     withProtocol ? "Sec-WebSocket-Protocol: " : "", withProtocol ? _protocol.c_str() : "", withProtocol ? "\r\n" : "");
+    if (n <= 0 || (size_t)n >= sizeof(resp) || c->_client->write((const uint8_t *)resp, n) != (size_t)n) {
+        return false;
+    }
+
+    // frames sent right behind the request go to the shared buffer, the
+    // request line stays in the handshake buffer for the connect event
+    size_t extra = c->_hsLen - headEnd;
+    memcpy(_rxBuf, h + headEnd, extra);
+    char *path = h + 4;
+    char *sp = strchr(path, ' ');
+    if (sp) {
+        *sp = '\0';
+    }
+
+    c->_resetFraming();
+    c->_open = true;
+    uint8_t num = c->_num;
+    if (_cb) {
+        _cb(num, WS_EVT_CONNECT, NULL, (uint8_t *)path, strlen(path));
+    }
+    if (!c->_client) {
+        // closed from the callback
+        return true;
+    }
+    tal_free(c->_hs);
+    c->_hs = NULL;
+    c->_hsLen = 0;
+    if (extra && !c->_feed(_rxBuf, extra)) {
+        return false;
+    }
+    return c->_open;
+}
+
+void WebSocketServer::_reject(WebSocketServerClient *c, int code)
+{
+    char resp[128];
+    int n = snprintf(resp, sizeof(resp), "HTTP/1.1 %d %s\r\nConnection: close\r\nContent-Length: 0\r\n%s\r\n",
+                     code, (code == 426) ? "Upgrade Required" : (code == 431) ? "Request Header Fields Too Large" : "Bad Request",
+                     (code == 426) ? "Sec-WebSocket-Version: 13\r\n" : "");
+    c->_client->write((const uint8_t *)resp, n);
+}
+
+WebSocketServerClient *WebSocketServer::client(uint8_t num)
+{
+    if (!_clients || num >= _maxClients || !_clients[num]._open) {
+        return NULL;
+    }
+    return &_clients[num];
+}
+
+int WebSocketServer::connectedClients()
+{
+    int count = 0;
+    for (uint8_t i = 0; _clients && i < _maxClients; i++) {
+        if (_clients[i]._open) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool WebSocketServer::sendText(uint8_t num, const char *text, size_t len)
+{
+    WebSocketServerClient *c = client(num);
+    return c && c->sendText(text, len);
+}
+
+bool WebSocketServer::sendBinary(uint8_t num, const uint8_t *data, size_t len)
+{
+    WebSocketServerClient *c = client(num);
+    return c && c->sendBinary(data, len);
+}
+
+bool WebSocketServer::ping(uint8_t num)
+{
+    WebSocketServerClient *c = client(num);
+    return c && c->ping();
+}
+
+int WebSocketServer::_broadcast(uint8_t opcode, const uint8_t *data, size_t len, bool skipBusy)
+{
+    int sent = 0;
+    for (uint8_t i = 0; _clients && i < _maxClients; i++) {
+        WebSocketServerClient *c = &_clients[i];
+        if (!c->_open || (skipBusy && !c->canSend())) {
+            continue;
+        }
+        if (c->sendFrame(opcode, true, data, len)) {
+            sent++;
+        }
+    }
+    return sent;
+}
+
+int WebSocketServer::broadcastText(const char *text, size_t len, bool skipBusy)
+{
+    return _broadcast(WS_OP_TEXT, (const uint8_t *)text, len, skipBusy);
+}
+
+int WebSocketServer::broadcastBinary(const uint8_t *data, size_t len, bool skipBusy)
+{
+    return _broadcast(WS_OP_BINARY, data, len, skipBusy);
+}
+
+void WebSocketServer::disconnect(uint8_t num, uint16_t code)
+{
+    if (!_clients || num >= _maxClients || !_clients[num]._client) {
+        return;
+    }
+    _clients[num]._sendClose(code);
+    _server.closeClient(num);
+}
+
+void WebSocketServer::disconnectAll()
+{
+    for (uint8_t i = 0; _clients && i < _maxClients; i++) {
+        disconnect(i);
+    }
+}
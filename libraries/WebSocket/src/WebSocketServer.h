@@ -0,0 +1,88 @@
+#ifndef _WEBSOCKETSERVER_H_
+#define _WEBSOCKETSERVER_H_
+
+#include <functional>
+#include "WiFiServer.h"
+#include "WebSocket.h"
+
+#define WS_SERVER_HANDSHAKE_SIZE    (1024)
+
+typedef std::function<void(uint8_t num, ws_event_t event, const ws_frame_info_t *info, uint8_t *data, size_t len)> WebSocketServerEvent;
+
+class WebSocketServer;
+
+// one accepted client; also gives access to the fragment and backpressure API
+class WebSocketServerClient : public WebSocketConnection
+{
+public:
+    WebSocketServerClient() : WebSocketConnection(false), _server(NULL), _num(0), _hs(NULL), _hsLen(0), _acceptedAt(0) {}
+    bool isConnected() const { return _open; }
+    IPAddress remoteIP() { return _client ? _client->remoteIP() : IPAddress(); }
+
+private:
+    friend class WebSocketServer;
+
+    WebSocketServer *_server;
+    uint8_t _num;
+    char *_hs;              // request head until the handshake is done
+    size_t _hsLen;
+    unsigned long _acceptedAt;
+
+    void _onData(const ws_frame_info_t *info, uint8_t *data, size_t len) override;
+    void _onPong(const uint8_t *data, size_t len) override;
+};
+
+/*
+ * RFC 6455 server on the WiFiServer connection table. loop() waits for all
+ * sockets with one select, completes handshakes, reads frames and runs the
+ * keepalive of every client; events are delivered from inside loop().
+ */
+class WebSocketServer
+{
+public:
+    WebSocketServer(uint16_t port = 81, uint8_t maxClients = 4, const char *protocol = NULL);
+    ~WebSocketServer();
+
+    void begin();
+    void close();
+    void loop(uint32_t timeout_ms = 0);
+    void onEvent(WebSocketServerEvent cb) { _cb = cb; }
+    void setHeartbeat(uint32_t pingIntervalMs, uint32_t pongTimeoutMs = WS_DEF_PONG_TIMEOUT_MS);
+
+    bool sendText(uint8_t num, const char *text) { return sendText(num, text, strlen(text)); }
+    bool sendText(uint8_t num, const char *text, size_t len);
+    bool sendBinary(uint8_t num, const uint8_t *data, size_t len);
+    // skipBusy leaves out clients whose send buffer is full instead of blocking on them
+    int broadcastText(const char *text, size_t len, bool skipBusy = false);
+    int broadcastText(const char *text, bool skipBusy = false) { return broadcastText(text, strlen(text), skipBusy); }
+    int broadcastBinary(const uint8_t *data, size_t len, bool skipBusy = false);
+    bool ping(uint8_t num);
+    void disconnect(uint8_t num, uint16_t code = 1000);
+    void disconnectAll();
+
+    // NULL unless num is connected and past the handshake
+    WebSocketServerClient *client(uint8_t num);
+    int connectedClients();
+
+private:
+    friend class WebSocketServerClient;
+
+    WiFiServer _server;
+    uint16_t _port;
+    uint8_t _maxClients;
+    String _protocol;
+    WebSocketServerClient *_clients;
+    uint8_t *_rxBuf;
+    WebSocketServerEvent _cb;
+    uint32_t _pingInterval;
+    uint32_t _pongTimeout;
+
+    void _onConnect(uint8_t num);
+    void _onDisconnect(uint8_t num);
+    bool _readHandshake(WebSocketServerClient *c);
+    bool _acceptHandshake(WebSocketServerClient *c, size_t headEnd);
+    void _reject(WebSocketServerClient *c, int code);
+    int _broadcast(uint8_t opcode, const uint8_t *data, size_t len, bool skipBusy);
+};
+
+#endif /* _WEBSOCKETSERVER_H_ */
@@ -0,0 +1,81 @@
+/*
+ *  This sketch keeps several non-blocking TCP connections open at once.
+ *  All sockets are served by the AsyncClient network task, so loop() is
+ *  never stalled by a slow peer.
+ */
+
+#include <WiFi.h>
+#include <AsyncClient.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+const char* host = "example.com";
+const uint16_t port = 80;
+
+#define CLIENT_NUM 4
+
+AsyncClient clients[CLIENT_NUM];
+
+static void onConnect(void *arg, AsyncClient *client)
+{
+    Serial.printf("[%d] connected to %s\r\n", (int)(intptr_t)arg, client->remoteIP().toString().c_str());
+    client->write("GET / HTTP/1.1\r\nHost: example.com\r\nConnection: close\r\n\r\n");
+}
+
+static void onData(void *arg, AsyncClient *client, void *data, size_t len)
+{
+    Serial.printf("[%d] received %d bytes\r\n", (int)(intptr_t)arg, (int)len);
+}
+
+static void onAck(void *arg, AsyncClient *client, size_t len, uint32_t time)
+{
+    Serial.printf("[%d] %d bytes sent in %u ms\r\n", (int)(intptr_t)arg, (int)len, time);
+}
+
+static void onError(void *arg, AsyncClient *client, int error)
+{
+    Serial.printf("[%d] error %d: %s\r\n", (int)(intptr_t)arg, error, AsyncClient::errorToString(error));
+}
+
+static void onDisconnect(void *arg, AsyncClient *client)
+{
+    Serial.printf("[%d] disconnected\r\n", (int)(intptr_t)arg);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(10);
+
+    WiFi.begin(ssid, password);
+    Serial.print("Waiting for WiFi... ");
+    while (WiFi.status() != WSS_GOT_IP) {
+        Serial.print(".");
+        delay(500);
+    }
+    Serial.println("");
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    for (int i = 0; i < CLIENT_NUM; i++) {
+        void *arg = (void *)(intptr_t)i;
+        clients[i].onConnect(onConnect, arg);
+        clients[i].onData(onData, arg);
+        clients[i].onAck(onAck, arg);
+        clients[i].onError(onError, arg);
+        clients[i].onDisconnect(onDisconnect, arg);
+        clients[i].setRxTimeout(10);
+    }
+}
+
+void loop()
+{
+    // reconnect every client that is idle; this never blocks
+    for (int i = 0; i < CLIENT_NUM; i++) {
+        if (clients[i].disconnected()) {
+            clients[i].connect(host, port);
+        }
+    }
+    delay(5000);
+}
@@ -0,0 +1,103 @@
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include "File.h"
+
+const char* ssid     = "********"; // Change this to your WiFi SSID
+const char* password = "********"; // Change this to your WiFi password
+
+const char* host = "www.howsmyssl.com";
+const int httpsPort = 443;
+
+// PEM file with the root certificates of the servers you talk to
+const char* bundlePath = "/ca_bundle.pem";
+
+VFSFILE fs(LITTLEFS);
+
+void setup()
+{
+    Serial.begin(115200);
+    while(!Serial){delay(100);}
+
+    Serial.print("Connecting to ");
+    Serial.println(ssid);
+
+    WiFi.begin(ssid, password);
+
+    while (WiFi.status() != WSS_GOT_IP) {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.println("WiFi connected");
+
+    if (!WiFiClientSecure::loadCABundle(fs, bundlePath)) {
+        Serial.println("CA bundle not loaded, upload it to LittleFS first");
+    }
+}
+
+void request(WiFiClientSecure &client)
+{
+    client.print(String("GET /a/check HTTP/1.1\r\nHost: ") + host + "\r\nConnection: close\r\n\r\n");
+
+    unsigned long timeout = millis();
+    size_t received = 0;
+    while (client.connected() && millis() - timeout < 5000) {
+        uint8_t buf[256];
+        int n = client.read(buf, sizeof(buf));
+        if (n > 0) {
+            received += n;
+            timeout = millis();
+        } else {
+            delay(10);
+        }
+    }
+    Serial.print("received ");
+    Serial.print(received);
+    Serial.println(" bytes");
+}
+
+void loop()
+{
+    // the first connection does a full handshake, the next ones resume the
+    // cached session
+    for (int i = 0; i < 3; i++) {
+        WiFiClientSecure client;
+        client.setMaxFragmentLength(4096);
+
+        if (!client.connect(host, httpsPort)) {
+            Serial.println("connection failed");
+            delay(5000);
+            return;
+        }
+        Serial.print(client.resumed() ? "resumed" : "full");
+        Serial.print(" handshake in ");
+        Serial.print(client.handshakeTime());
+        Serial.println(" ms");
+
+        request(client);
+        client.stop();
+    }
+
+    const WiFiClientSecureStats &stats = WiFiClientSecure::stats();
+    Serial.print("handshakes: ");
+    Serial.print(stats.handshakes);
+    Serial.print(", resumed: ");
+    Serial.print(stats.resumed);
+    Serial.print(", failures: ");
+    Serial.println(stats.failures);
+    if (stats.handshakes > stats.resumed) {
+        Serial.print("average full handshake: ");
+        Serial.print(stats.fullTimeMs / (stats.handshakes - stats.resumed));
+        Serial.println(" ms");
+    }
+    if (stats.resumed) {
+        Serial.print("average resumed handshake: ");
+        Serial.print(stats.resumedTimeMs / stats.resumed);
+        Serial.println(" ms");
+    }
+    Serial.print("handshake heap peak: ");
+    Serial.print(stats.heapPeak);
+    Serial.println(" bytes");
+
+    delay(30000);
+}
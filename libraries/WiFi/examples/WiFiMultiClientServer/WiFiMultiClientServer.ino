@@ -0,0 +1,76 @@
+/*
+ *  This sketch runs a small TCP chat server. Every line a client sends is
+ *  broadcast to all other connected clients. The server keeps its own
+ *  connection table, so one handleClients() call accepts and reads every
+ *  ready socket without looping over available() in the sketch.
+ */
+
+#include <WiFi.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+#define MAX_CLIENTS 8
+
+WiFiServer server(23, MAX_CLIENTS);
+
+static void onClientConnect(uint8_t slot, WiFiClient &client)
+{
+    Serial.printf("[%d] connected from %s\r\n", slot, client.remoteIP().toString().c_str());
+    client.printf("Welcome, you are client %d of %d\r\n", slot, server.clientCount());
+}
+
+static void onClientData(uint8_t slot, WiFiClient &client, const uint8_t *data, size_t len)
+{
+    // echo to everybody, sender included
+    server.write(data, len);
+}
+
+static void onClientDisconnect(uint8_t slot, WiFiClient &client)
+{
+    Serial.printf("[%d] disconnected\r\n", slot);
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    delay(10);
+
+    WiFi.begin(ssid, password);
+    Serial.print("Waiting for WiFi... ");
+    while (WiFi.status() != WSS_GOT_IP) {
+        Serial.print(".");
+        delay(500);
+    }
+    Serial.println("");
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    server.onClientConnect(onClientConnect);
+    server.onClientData(onClientData);
+    server.onClientDisconnect(onClientDisconnect);
+    // drop clients that stay silent for two minutes
+    server.setIdleTimeout(120 * 1000);
+    server.begin(23);
+}
+
+void loop()
+{
+    static unsigned long lastReport = 0;
+
+    // waits up to 100 ms for activity on the listening socket or any client
+    server.handleClients(100);
+
+    if (millis() - lastReport > 10000) {
+        lastReport = millis();
+        Serial.printf("%d/%d clients, %u rejected\r\n", server.clientCount(), server.maxClients(), server.rejectedClients());
+        for (uint8_t i = 0; i < server.maxClients(); i++) {
+            WiFiServerClientStats stats;
+            if (!server.clientStats(i, stats)) {
+                continue;
+            }
+            Serial.printf("  [%d] %s:%d rx %u tx %u idle %lu ms\r\n", i, stats.remoteIP.toString().c_str(), stats.remotePort,
+                          (unsigned)stats.rxBytes, (unsigned)stats.txBytes, millis() - stats.lastActivity);
+        }
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ *  Network statistics
+ *
+ *  Fetches a page every 10 seconds and prints how long the DNS lookup,
+ *  the TCP handshake and the wait for the first byte of the reply took,
+ *  then the counters summed over all TCP clients, servers and UDP sockets.
+ *  Slow first bytes with fast handshakes point at the server; slow
+ *  handshakes, send stalls and errors point at the WiFi link.
+ */
+
+#include <WiFi.h>
+
+const char *ssid = "your_ssid";
+const char *pass = "your_passwd";
+
+const char *host = "www.example.com";
+const uint16_t port = 80;
+
+unsigned long lastFetch = 0;
+
+void fetch()
+{
+    WiFiClient client;
+    if (!client.connect(host, port)) {
+        Serial.println("connection failed");
+        return;
+    }
+    client.print("GET / HTTP/1.1\r\nHost: ");
+    client.print(host);
+    client.print("\r\nConnection: close\r\n\r\n");
+
+    unsigned long start = millis();
+    while (client.connected() && millis() - start < 5000) {
+        while (client.available()) {
+            client.read();
+        }
+        delay(1);
+    }
+
+    // the counters of this connection, kept until stop()
+    const WiFiNetStats &s = client.stats();
+    Serial.print("dns ");
+    Serial.print(s.dns.totalMs);
+    Serial.print("ms connect ");
+    Serial.print(s.connect.totalMs);
+    Serial.print("ms first byte ");
+    Serial.print(s.firstByte.totalMs);
+    Serial.print("ms received ");
+    Serial.print(s.bytesIn);
+    Serial.println(" bytes");
+    client.stop();
+}
+
+void setup()
+{
+    Serial.begin(115200);
+    WiFi.begin(ssid, pass);
+    Serial.print("Waiting for WiFi");
+    while (WiFi.status() != WSS_GOT_IP) {
+        Serial.print(".");
+        delay(500);
+    }
+    Serial.println();
+}
+
+void loop()
+{
+    if (millis() - lastFetch >= 10000) {
+        lastFetch = millis();
+        fetch();
+        WiFi.printNetStats(Serial);
+        Serial.println();
+    }
+    delay(10);
+}
@@ -0,0 +1,87 @@
+/*
+ *  This sketch scans for WiFi networks in the background.
+ *  loop() keeps running while the scan takes place; the WiFi event task
+ *  publishes the results and calls onScanDone(). Every other scan looks
+ *  for one network only, on one channel.
+ */
+#include "WiFi.h"
+
+// the network to look for in the targeted scan
+const char *targetSsid = "your_ssid";
+const uint8_t targetChannel = 0;    // 0 for all channels
+
+volatile bool scanDone = false;
+bool targeted = false;
+unsigned long lastScan = 0;
+unsigned long ticks = 0;
+
+void onScanDone(arduino_event_id_t event, arduino_event_info_t info)
+{
+    // runs in the WiFi event task, leave the printing to loop()
+    scanDone = true;
+}
+
+void printResults()
+{
+    int16_t n = WiFi.scanComplete();
+    if (n == WIFI_SCAN_FAILED) {
+        Serial.println("scan failed");
+        return;
+    }
+    Serial.print(n);
+    Serial.print(targeted ? " matching networks" : " networks");
+    Serial.print(" found, loop ran ");
+    Serial.print(ticks);
+    Serial.println(" times during the scan");
+    for (int16_t i = 0; i < n; ++i) {
+        // a reference into the result array, nothing is copied
+        const AP_IF_S &ap = WiFi.getNetworkInfo(i);
+        Serial.print(i + 1);
+        Serial.print(" | ");
+        Serial.print((const char *)ap.ssid);
+        Serial.print(" | ");
+        Serial.print(ap.rssi);
+        Serial.print(" | ");
+        Serial.println(ap.channel);
+    }
+    Serial.println("");
+    WiFi.scanDelete();
+}
+
+void setup()
+{
+    Serial.begin(115200);
+
+    // Set WiFi to station mode and disconnect from an AP if it was previously connected.
+    WiFi.mode(WIFI_STA);
+    WiFi.disconnect();
+    delay(100);
+
+    WiFi.onEvent(onScanDone, ARDUINO_EVENT_WIFI_SCAN_DONE);
+    Serial.println("Setup done");
+}
+
+void loop()
+{
+    ticks++;
+
+    if (scanDone) {
+        scanDone = false;
+        printResults();
+        lastScan = millis();
+    }
+
+    if (WiFi.scanComplete() != WIFI_SCAN_RUNNING && millis() - lastScan >= 5000) {
+        lastScan = millis();
+        targeted = !targeted;
+        ticks = 0;
+        Serial.println(targeted ? "Targeted scan start" : "Scan start");
+        int16_t rt = targeted ? WiFi.scanNetworks(true, false, false, 300, targetChannel, targetSsid)
+                              : WiFi.scanNetworks(true);
+        if (rt == WIFI_SCAN_FAILED) {
+            Serial.println("scan not started");
+        }
+    }
+
+    delay(10);
+}
@@ -0,0 +1,61 @@
+#include <WiFi.h>
+#include <WiFiUdp.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+const int udpPort = 4557;
+
+#define POOL_PACKETS 8
+
+WiFiUDP udp;
+unsigned long lastReport = 0;
+unsigned long received = 0;
+unsigned long echoed = 0;
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Serial.println();
+    Serial.print("Connecting to ");
+    Serial.println(ssid);
+
+    WiFi.begin(ssid, password);
+    while (WiFi.status() != WSS_GOT_IP) {
+        delay(500);
+        Serial.print(".");
+    }
+
+    Serial.println("");
+    Serial.println("WiFi connected.");
+    Serial.println("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    // all receive buffers are allocated here, loop() does not touch the heap
+    if (!udp.setPacketPool(POOL_PACKETS)) {
+        Serial.println("packet pool allocation failed");
+        return;
+    }
+    udp.begin(udpPort);
+}
+
+void loop()
+{
+    // wait up to 100 ms, then take everything that is queued
+    int n = udp.receivePackets(100);
+    if (n > 0) {
+        WiFiUDPPacket replies[POOL_PACKETS];
+        for (int i = 0; i < n; i++) {
+            // echo each datagram back to its sender from the pool buffer
+            replies[i] = *udp.packet(i);
+        }
+        received += n;
+        echoed += udp.sendPackets(replies, n);
+    }
+
+    if (millis() - lastReport > 5000) {
+        lastReport = millis();
+        Serial.printf("received %lu, echoed %lu\r\n", received, echoed);
+    }
+}
@@ -0,0 +1,705 @@
+#include "AsyncClient.h"
+#include "WiFiGeneric.h"
+#include "lwip/sockets.h"
+#include "lwip/dns.h"
+#include <errno.h>
+#include <new>
+#include "tal_log.h"
+#include "tal_memory.h"
+#include "tal_mutex.h"
+#include "tal_thread.h"
+#include "tal_system.h"
+#include "tal_network.h"
+
+#undef connect
+#undef write
+#undef read
+#undef close
+
+#define ASYNC_TCP_TASK_STACK         (4096)
+#define ASYNC_TCP_SELECT_TIMEOUT_MS  (10)
+#define ASYNC_TCP_IDLE_SLEEP_MS      (20)
+#define ASYNC_TCP_POLL_INTERVAL_MS   (500)
+#define ASYNC_TCP_RX_SCRATCH_SIZE    (1460)
+#define ASYNC_TCP_MAX_RX_PER_PASS    (4)
+
+typedef struct {
+    AsyncClient *client;    // cleared when the client stops waiting for the answer
+    uint32_t addr;
+    bool done;
+} async_tcp_dns_req_t;
+
+struct AsyncTCPLoop {
+    static MUTEX_HANDLE mutex;
+    static THREAD_HANDLE task;
+    static AsyncClient *clients;
+    // client whose callbacks the task is running, see ~AsyncClient()
+    static AsyncClient *current;
+    static AsyncClient *currentNext;
+    static bool currentDeleted;
+    static uint8_t scratch[ASYNC_TCP_RX_SCRATCH_SIZE];
+
+    static bool start();
+    static void run(void *arg);
+    static void add(AsyncClient *client);
+    static void remove(AsyncClient *client);
+    static void lock() { tal_mutex_lock(mutex); }
+    static void unlock() { tal_mutex_unlock(mutex); }
+};
+
+MUTEX_HANDLE AsyncTCPLoop::mutex = NULL;
+THREAD_HANDLE AsyncTCPLoop::task = NULL;
+AsyncClient *AsyncTCPLoop::clients = NULL;
+AsyncClient *AsyncTCPLoop::current = NULL;
+AsyncClient *AsyncTCPLoop::currentNext = NULL;
+bool AsyncTCPLoop::currentDeleted = false;
+uint8_t AsyncTCPLoop::scratch[ASYNC_TCP_RX_SCRATCH_SIZE];
+
+bool AsyncTCPLoop::start()
+{
+    if (!mutex) {
+        if (tal_mutex_create_init(&mutex) != OPRT_OK) {
+            PR_ERR("async_tcp mutex create failed");
+            return false;
+        }
+    }
+    if (!task) {
+        THREAD_CFG_T param;
+        param.priority = THREAD_PRIO_2;
+        param.stackDepth = ASYNC_TCP_TASK_STACK;
+        char threadName[] = "async_tcp";
+        param.thrdname = threadName;
+        tal_thread_create_and_start(&task, NULL, NULL, run, NULL, &param);
+        if (!task) {
+            PR_ERR("async_tcp task start failed");
+            return false;
+        }
+    }
+    return true;
+}
+
+void AsyncTCPLoop::add(AsyncClient *client)
+{
+    for (AsyncClient *c = clients; c; c = c->_next) {
+        if (c == client) {
+            return;
+        }
+    }
+    client->_next = clients;
+    clients = client;
+}
+
+void AsyncTCPLoop::remove(AsyncClient *client)
+{
+    AsyncClient **pp = &clients;
+    while (*pp && *pp != client) {
+        pp = &(*pp)->_next;
+    }
+    if (!*pp) {
+        return;
+    }
+    *pp = client->_next;
+    if (current == client) {
+        currentNext = client->_next;
+        currentDeleted = true;
+    } else if (currentNext == client) {
+        currentNext = client->_next;
+    }
+    client->_next = NULL;
+}
+
+void AsyncTCPLoop::run(void *arg)
+{
+    TUYA_FD_SET_T rfds;
+    TUYA_FD_SET_T wfds;
+
+    for (;;) {
+        int maxfd = -1;
+        unsigned long now = millis();
+        TAL_FD_ZERO(&rfds);
+        TAL_FD_ZERO(&wfds);
+
+        lock();
+        for (AsyncClient *c = clients; c; c = c->_next) {
+            c->_prepare(&rfds, &wfds, &maxfd, now);
+        }
+        unlock();
+
+        if (maxfd < 0) {
+            tal_system_sleep(ASYNC_TCP_IDLE_SLEEP_MS);
+        } else if (tal_net_select(maxfd + 1, &rfds, &wfds, NULL, ASYNC_TCP_SELECT_TIMEOUT_MS) < 0) {
+            TAL_FD_ZERO(&rfds);
+            TAL_FD_ZERO(&wfds);
+        }
+
+        // callbacks run without the lock so that they can call back into the API
+        now = millis();
+        lock();
+        AsyncClient *c = clients;
+        while (c) {
+            current = c;
+            currentNext = c->_next;
+            currentDeleted = false;
+            unlock();
+            c->_process(&rfds, &wfds, now);
+            lock();
+            c = currentNext;
+        }
+        current = NULL;
+        currentNext = NULL;
+        unlock();
+    }
+}
+
+static void _async_tcp_dns_found(const char *name, const ip_addr_t *ipaddr, void *arg)
+{
+    async_tcp_dns_req_t *req = (async_tcp_dns_req_t *)arg;
+    AsyncTCPLoop::lock();
+    req->addr = ipaddr ? ipaddr->addr : 0;
+    req->done = true;
+    bool orphan = (req->client == NULL);
+    AsyncTCPLoop::unlock();
+    if (orphan) {
+        tal_free(req);
+    }
+}
+
+AsyncClient::AsyncClient()
+    : _next(NULL)
+    , _state(ASYNC_TCP_CLOSED)
+    , _fd(-1)
+    , _armed(false)
+    , _closeRequested(false)
+    , _abortRequested(false)
+    , _noDelay(false)
+    , _pendingError(0)
+    , _remotePort(0)
+    , _tx(NULL)
+    , _txSize(ASYNC_TCP_DEF_TX_BUFFER_SIZE)
+    , _dns(NULL)
+    , _connectTimeout(ASYNC_TCP_DEF_CONN_TIMEOUT_MS)
+    , _ackTimeout(0)
+    , _rxTimeout(0)
+    , _connectStart(0)
+    , _rxLast(0)
+    , _txSince(0)
+    , _pollLast(0)
+    , _connectArg(NULL)
+    , _discardArg(NULL)
+    , _ackArg(NULL)
+    , _errorArg(NULL)
+    , _dataArg(NULL)
+    , _timeoutArg(NULL)
+    , _pollArg(NULL)
+{
+}
+
+AsyncClient::~AsyncClient()
+{
+    if (!AsyncTCPLoop::mutex) {
+        return;
+    }
+    AsyncTCPLoop::lock();
+    AsyncTCPLoop::remove(this);
+    if (_dns) {
+        async_tcp_dns_req_t *req = (async_tcp_dns_req_t *)_dns;
+        _dns = NULL;
+        if (req->done) {
+            tal_free(req);
+        } else {
+            req->client = NULL;
+        }
+    }
+    if (_fd >= 0) {
+        tal_net_close(_fd);
+        _fd = -1;
+    }
+    _state = ASYNC_TCP_CLOSED;
+    if (_tx) {
+        delete _tx;
+        _tx = NULL;
+    }
+    AsyncTCPLoop::unlock();
+}
+
+void AsyncClient::onConnect(AcConnectHandler cb, void *arg)
+{
+    _connectCb = cb;
+    _connectArg = arg;
+}
+
+void AsyncClient::onDisconnect(AcConnectHandler cb, void *arg)
+{
+    _discardCb = cb;
+    _discardArg = arg;
+}
+
+void AsyncClient::onAck(AcAckHandler cb, void *arg)
+{
+    _ackCb = cb;
+    _ackArg = arg;
+}
+
+void AsyncClient::onError(AcErrorHandler cb, void *arg)
+{
+    _errorCb = cb;
+    _errorArg = arg;
+}
+
+void AsyncClient::onData(AcDataHandler cb, void *arg)
+{
+    _dataCb = cb;
+    _dataArg = arg;
+}
+
+void AsyncClient::onTimeout(AcTimeoutHandler cb, void *arg)
+{
+    _timeoutCb = cb;
+    _timeoutArg = arg;
+}
+
+void AsyncClient::onPoll(AcConnectHandler cb, void *arg)
+{
+    _pollCb = cb;
+    _pollArg = arg;
+}
+
+bool AsyncClient::connect(IPAddress ip, uint16_t port)
+{
+    if (!AsyncTCPLoop::start()) {
+        return false;
+    }
+    AsyncTCPLoop::lock();
+    if (_state != ASYNC_TCP_CLOSED) {
+        AsyncTCPLoop::unlock();
+        PR_ERR("async client already in use");
+        return false;
+    }
+    _remoteIP = ip;
+    _remotePort = port;
+    _closeRequested = false;
+    _abortRequested = false;
+    bool ok = _startConnect();
+    if (ok) {
+        AsyncTCPLoop::add(this);
+    }
+    AsyncTCPLoop::unlock();
+    return ok;
+}
+
+bool AsyncClient::connect(const char *host, uint16_t port)
+{
+    IPAddress ip;
+    // literal addresses and names still in the DNS cache connect right away
+    if (WiFiGenericClass::hostByNameCached(host, ip)) {
+        return connect(ip, port);
+    }
+    if (!AsyncTCPLoop::start()) {
+        return false;
+    }
+
+    async_tcp_dns_req_t *req = (async_tcp_dns_req_t *)tal_malloc(sizeof(async_tcp_dns_req_t));
+    if (!req) {
+        PR_ERR("async dns request malloc failed");
+        return false;
+    }
+    req->client = this;
+    req->addr = 0;
+    req->done = false;
+
+    AsyncTCPLoop::lock();
+    if (_state != ASYNC_TCP_CLOSED) {
+        AsyncTCPLoop::unlock();
+        tal_free(req);
+        PR_ERR("async client already in use");
+        return false;
+    }
+    _remotePort = port;
+    _closeRequested = false;
+    _abortRequested = false;
+    _state = ASYNC_TCP_DNS;
+    _connectStart = millis();
+    _dns = req;
+    AsyncTCPLoop::add(this);
+    AsyncTCPLoop::unlock();
+
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(host, &addr, &_async_tcp_dns_found, req);
+    if (err == ERR_OK) {
+        _async_tcp_dns_found(host, &addr, req);
+    } else if (err != ERR_INPROGRESS) {
+        _async_tcp_dns_found(host, NULL, req);
+    }
+    return true;
+}
+
+// called with the loop locked
+bool AsyncClient::_startConnect()
+{
+    int sockfd = tal_net_socket_create(PROTOCOL_TCP);
+    if (sockfd < 0) {
+        PR_ERR("socket: %d", errno);
+        return false;
+    }
+    tal_net_set_block(sockfd, 0);
+    if (_noDelay) {
+        int flag = 1;
+        tal_net_setsockopt(sockfd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+
+    uint32_t tmpIP = static_cast<uint32_t>(_remoteIP);
+    TUYA_IP_ADDR_T serverIP = (TUYA_IP_ADDR_T)UNI_HTONL(tmpIP);
+    int res = tal_net_connect(sockfd, serverIP, _remotePort);
+    if (res < 0 && errno != EINPROGRESS) {
+        PR_ERR("connect on fd %d, errno: %d, \"%s\"", sockfd, errno, strerror(errno));
+        tal_net_close(sockfd);
+        return false;
+    }
+    _fd = sockfd;
+    _armed = false;
+    _state = ASYNC_TCP_CONNECTING;
+    _connectStart = millis();
+    return true;
+}
+
+void AsyncClient::close(bool now)
+{
+    if (!AsyncTCPLoop::mutex) {
+        return;
+    }
+    AsyncTCPLoop::lock();
+    if (_state != ASYNC_TCP_CLOSED) {
+        _closeRequested = true;
+        _abortRequested = _abortRequested || now;
+    }
+    AsyncTCPLoop::unlock();
+}
+
+size_t AsyncClient::write(const char *data)
+{
+    if (data == NULL) {
+        return 0;
+    }
+    return write(data, strlen(data));
+}
+
+size_t AsyncClient::write(const char *data, size_t size)
+{
+    if (!data || !size || !AsyncTCPLoop::mutex) {
+        return 0;
+    }
+    size_t accepted = 0;
+    AsyncTCPLoop::lock();
+    if ((_state == ASYNC_TCP_CONNECTED || _state == ASYNC_TCP_CONNECTING) && !_closeRequested) {
+        if (!_tx) {
+            _tx = new (std::nothrow) cbuf(_txSize);
+        }
+        if (_tx) {
+            if (_tx->empty()) {
+                _txSince = millis();
+            }
+            accepted = _tx->write(data, size);
+        }
+    }
+    AsyncTCPLoop::unlock();
+    return accepted;
+}
+
+size_t AsyncClient::space()
+{
+    if (_state != ASYNC_TCP_CONNECTED) {
+        return 0;
+    }
+    if (!_tx) {
+        return _txSize;
+    }
+    size_t room = 0;
+    AsyncTCPLoop::lock();
+    room = _tx->room();
+    AsyncTCPLoop::unlock();
+    return room;
+}
+
+bool AsyncClient::canSend()
+{
+    return space() > 0;
+}
+
+void AsyncClient::setNoDelay(bool nodelay)
+{
+    _noDelay = nodelay;
+    if (_fd >= 0) {
+        int flag = nodelay;
+        tal_net_setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+    }
+}
+
+IPAddress AsyncClient::localIP() const
+{
+    if (_fd < 0) {
+        return IPAddress();
+    }
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(_fd, (struct sockaddr *)&addr, &len);
+    return IPAddress((uint32_t)addr.sin_addr.s_addr);
+}
+
+uint16_t AsyncClient::localPort() const
+{
+    if (_fd < 0) {
+        return 0;
+    }
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    getsockname(_fd, (struct sockaddr *)&addr, &len);
+    return ntohs(addr.sin_port);
+}
+
+// Called by the network task with the loop locked; no callbacks allowed here.
+void AsyncClient::_prepare(void *r, void *w, int *maxfd, unsigned long now)
+{
+    TUYA_FD_SET_T *rfds = (TUYA_FD_SET_T *)r;
+    TUYA_FD_SET_T *wfds = (TUYA_FD_SET_T *)w;
+
+    _armed = false;
+    if (_state == ASYNC_TCP_DNS && _dns) {
+        async_tcp_dns_req_t *req = (async_tcp_dns_req_t *)_dns;
+        if (req->done) {
+            uint32_t addr = req->addr;
+            _dns = NULL;
+            tal_free(req);
+            if (!_closeRequested) {
+                if (!addr) {
+                    _pendingError = EHOSTUNREACH;
+                } else {
+                    _remoteIP = IPAddress(addr);
+                    if (!_startConnect()) {
+                        _pendingError = errno ? errno : ECONNREFUSED;
+                    }
+                }
+            }
+        } else if (_closeRequested) {
+            // the resolver callback owns the request from now on
+            req->client = NULL;
+            _dns = NULL;
+        }
+    }
+    if (_fd < 0) {
+        return;
+    }
+    if (_state == ASYNC_TCP_CONNECTING) {
+        TAL_FD_SET(_fd, wfds);
+    } else if (_state == ASYNC_TCP_CONNECTED) {
+        TAL_FD_SET(_fd, rfds);
+        if (_tx && !_tx->empty()) {
+            TAL_FD_SET(_fd, wfds);
+        }
+    } else {
+        return;
+    }
+    _armed = true;
+    if (_fd > *maxfd) {
+        *maxfd = _fd;
+    }
+}
+
+bool AsyncClient::_close()
+{
+    AsyncTCPLoop::lock();
+    if (_fd >= 0) {
+        tal_net_close(_fd);
+        _fd = -1;
+    }
+    _armed = false;
+    _state = ASYNC_TCP_CLOSED;
+    _closeRequested = false;
+    _abortRequested = false;
+    _pendingError = 0;
+    if (_tx) {
+        _tx->flush();
+    }
+    AsyncTCPLoop::remove(this);
+    AsyncTCPLoop::unlock();
+    if (_discardCb) {
+        _discardCb(_discardArg, this);
+    }
+    return false;
+}
+
+bool AsyncClient::_fail(int error)
+{
+    PR_ERR("async client %s:%d error %d (%s)", _remoteIP.toString().c_str(), _remotePort, error, errorToString(error));
+    if (_errorCb) {
+        _errorCb(_errorArg, this, error);
+    }
+    // the error callback may have deleted us
+    if (AsyncTCPLoop::currentDeleted) {
+        return false;
+    }
+    return _close();
+}
+
+// Called by the network task without the lock. Returns false once the client
+// must not be touched anymore for this pass.
+bool AsyncClient::_process(void *r, void *w, unsigned long now)
+{
+    TUYA_FD_SET_T *rfds = (TUYA_FD_SET_T *)r;
+    TUYA_FD_SET_T *wfds = (TUYA_FD_SET_T *)w;
+    bool readable = _armed && TAL_FD_ISSET(_fd, rfds);
+    bool writable = _armed && TAL_FD_ISSET(_fd, wfds);
+
+    if (_pendingError) {
+        // resolving or starting the deferred connect failed
+        int error = _pendingError;
+        _pendingError = 0;
+        return _fail(error);
+    }
+
+    if (_closeRequested && (_abortRequested || _state != ASYNC_TCP_CONNECTED || !_tx || _tx->empty())) {
+        return _close();
+    }
+
+    if (_state == ASYNC_TCP_DNS || _state == ASYNC_TCP_CONNECTING) {
+        if (_state == ASYNC_TCP_CONNECTING && writable) {
+            int sockerr = 0;
+            int len = (int)sizeof(int);
+            if (tal_net_getsockopt(_fd, SOL_SOCKET, SO_ERROR, &sockerr, &len) < 0) {
+                sockerr = errno;
+            }
+            if (sockerr != 0) {
+                return _fail(sockerr);
+            }
+            _state = ASYNC_TCP_CONNECTED;
+            _rxLast = now;
+            _pollLast = now;
+            if (_tx && !_tx->empty()) {
+                _txSince = now;
+            }
+            if (_connectCb) {
+                _connectCb(_connectArg, this);
+                if (AsyncTCPLoop::currentDeleted) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        if (_connectTimeout && (now - _connectStart) > _connectTimeout) {
+            return _fail(ETIMEDOUT);
+        }
+        return true;
+    }
+
+    if (readable) {
+        for (int i = 0; i < ASYNC_TCP_MAX_RX_PER_PASS && _fd >= 0; i++) {
+            int res = ::recv(_fd, AsyncTCPLoop::scratch, sizeof(AsyncTCPLoop::scratch), MSG_DONTWAIT);
+            if (res > 0) {
+                _rxLast = now;
+                if (_dataCb) {
+                    _dataCb(_dataArg, this, AsyncTCPLoop::scratch, res);
+                    if (AsyncTCPLoop::currentDeleted) {
+                        return false;
+                    }
+                }
+                if ((size_t)res < sizeof(AsyncTCPLoop::scratch)) {
+                    break;
+                }
+            } else if (res == 0) {
+                // orderly shutdown by the peer
+                return _close();
+            } else {
+                if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                    return _fail(errno);
+                }
+                break;
+            }
+        }
+    }
+
+    if (writable && _tx) {
+        size_t sent = 0;
+        for (;;) {
+            AsyncTCPLoop::lock();
+            size_t chunk = _tx->peek((char *)AsyncTCPLoop::scratch, sizeof(AsyncTCPLoop::scratch));
+            AsyncTCPLoop::unlock();
+            if (!chunk) {
+                break;
+            }
+            int res = ::send(_fd, AsyncTCPLoop::scratch, chunk, MSG_DONTWAIT);
+            if (res < 0) {
+                if (errno != EWOULDBLOCK && errno != EAGAIN) {
+                    return _fail(errno);
+                }
+                break;
+            }
+            AsyncTCPLoop::lock();
+            _tx->remove(res);
+            AsyncTCPLoop::unlock();
+            sent += res;
+            if ((size_t)res < chunk) {
+                break;
+            }
+        }
+        if (sent) {
+            uint32_t elapsed = now - _txSince;
+            _txSince = now;
+            if (_ackCb) {
+                _ackCb(_ackArg, this, sent, elapsed);
+                if (AsyncTCPLoop::currentDeleted) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    if (_ackTimeout && _tx && !_tx->empty() && (now - _txSince) > _ackTimeout) {
+        uint32_t elapsed = now - _txSince;
+        _txSince = now;
+        if (_timeoutCb) {
+            _timeoutCb(_timeoutArg, this, elapsed);
+            if (AsyncTCPLoop::currentDeleted) {
+                return false;
+            }
+        }
+    }
+
+    if (_rxTimeout && (now - _rxLast) > (_rxTimeout * 1000)) {
+        PR_DEBUG("async client rx timeout on fd %d", _fd);
+        return _close();
+    }
+
+    if ((now - _pollLast) >= ASYNC_TCP_POLL_INTERVAL_MS) {
+        _pollLast = now;
+        if (_pollCb) {
+            _pollCb(_pollArg, this);
+            if (AsyncTCPLoop::currentDeleted) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+const char *AsyncClient::errorToString(int error)
+{
+    switch (error) {
+    case 0:
+        return "OK";
+    case ETIMEDOUT:
+        return "Timeout";
+    case ECONNREFUSED:
+        return "Connection refused";
+    case ECONNRESET:
+        return "Connection reset";
+    case ECONNABORTED:
+        return "Connection aborted";
+    case EHOSTUNREACH:
+        return "Host unreachable";
+    case ENOTCONN:
+        return "Not connected";
+    case ENOMEM:
+        return "Out of memory";
+    default:
+        return "Unknown error";
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef _ASYNCCLIENT_H_
+#define _ASYNCCLIENT_H_
+
+#include <Arduino.h>
+#include <functional>
+#include "api/IPAddress.h"
+#include <cbuf.h>
+
+#define ASYNC_TCP_DEF_CONN_TIMEOUT_MS   (5000)
+#define ASYNC_TCP_DEF_TX_BUFFER_SIZE    (1460)
+
+class AsyncClient;
+
+typedef std::function<void(void *arg, AsyncClient *client)> AcConnectHandler;
+typedef std::function<void(void *arg, AsyncClient *client, size_t len, uint32_t time)> AcAckHandler;
+typedef std::function<void(void *arg, AsyncClient *client, int error)> AcErrorHandler;
+typedef std::function<void(void *arg, AsyncClient *client, void *data, size_t len)> AcDataHandler;
+typedef std::function<void(void *arg, AsyncClient *client, uint32_t time)> AcTimeoutHandler;
+
+typedef enum {
+    ASYNC_TCP_CLOSED = 0,
+    ASYNC_TCP_DNS,
+    ASYNC_TCP_CONNECTING,
+    ASYNC_TCP_CONNECTED,
+} async_tcp_state_t;
+
+/*
+ * Non-blocking TCP client. All sockets are multiplexed by a single network
+ * task with tal_net_select(), and every callback runs on that task, so a
+ * callback must not block. connect(), write() and close() may be called from
+ * any thread, including from inside callbacks.
+ *
+ * A client may be deleted from inside its own callbacks (typically
+ * onDisconnect) or from another thread once it is closed.
+ */
+class AsyncClient
+{
+public:
+    AsyncClient();
+    ~AsyncClient();
+
+    bool connect(IPAddress ip, uint16_t port);
+    // resolves the host without blocking, then connects
+    bool connect(const char *host, uint16_t port);
+    // lets pending data drain before closing unless now is set
+    void close(bool now = false);
+    void abort() { close(true); }
+
+    // copies data into the send buffer; returns the number of bytes accepted
+    size_t write(const char *data, size_t size);
+    size_t write(const char *data);
+    size_t add(const char *data, size_t size) { return write(data, size); }
+    bool send() { return canSend(); }
+    size_t space();
+    bool canSend();
+    void setTxBufferSize(size_t size) { _txSize = size; }
+
+    async_tcp_state_t state() const { return _state; }
+    bool connected() const { return _state == ASYNC_TCP_CONNECTED; }
+    bool connecting() const { return _state == ASYNC_TCP_DNS || _state == ASYNC_TCP_CONNECTING; }
+    bool disconnected() const { return _state == ASYNC_TCP_CLOSED; }
+    bool freeable() const { return _state == ASYNC_TCP_CLOSED; }
+
+    void setConnectTimeout(uint32_t ms) { _connectTimeout = ms; }
+    // fired through onTimeout when written data sits unsent for longer than ms (0 = off)
+    void setAckTimeout(uint32_t ms) { _ackTimeout = ms; }
+    uint32_t getAckTimeout() const { return _ackTimeout; }
+    // closes the connection when nothing was received for that long (0 = off)
+    void setRxTimeout(uint32_t seconds) { _rxTimeout = seconds; }
+    uint32_t getRxTimeout() const { return _rxTimeout; }
+    void setNoDelay(bool nodelay);
+
+    IPAddress remoteIP() const { return _remoteIP; }
+    uint16_t remotePort() const { return _remotePort; }
+    IPAddress localIP() const;
+    uint16_t localPort() const;
+    int fd() const { return _fd; }
+
+    void onConnect(AcConnectHandler cb, void *arg = NULL);
+    void onDisconnect(AcConnectHandler cb, void *arg = NULL);
+    // len is the number of bytes handed to the stack since the last call
+    void onAck(AcAckHandler cb, void *arg = NULL);
+    void onError(AcErrorHandler cb, void *arg = NULL);
+    // data points into a buffer shared by all clients; consume it before returning
+    void onData(AcDataHandler cb, void *arg = NULL);
+    void onTimeout(AcTimeoutHandler cb, void *arg = NULL);
+    void onPoll(AcConnectHandler cb, void *arg = NULL);
+
+    static const char *errorToString(int error);
+
+private:
+    friend struct AsyncTCPLoop;
+
+    AsyncClient *_next;
+    async_tcp_state_t _state;
+    int _fd;
+    bool _armed;
+    bool _closeRequested;
+    bool _abortRequested;
+    bool _noDelay;
+    int _pendingError;
+    IPAddress _remoteIP;
+    uint16_t _remotePort;
+    cbuf *_tx;
+    size_t _txSize;
+    void *_dns;
+
+    uint32_t _connectTimeout;
+    uint32_t _ackTimeout;
+    uint32_t _rxTimeout;
+    unsigned long _connectStart;
+    unsigned long _rxLast;
+    unsigned long _txSince;
+    unsigned long _pollLast;
+
+    AcConnectHandler _connectCb;
+    void *_connectArg;
+    AcConnectHandler _discardCb;
+    void *_discardArg;
+    AcAckHandler _ackCb;
+    void *_ackArg;
+    AcErrorHandler _errorCb;
+    void *_errorArg;
+    AcDataHandler _dataCb;
+    void *_dataArg;
+    AcTimeoutHandler _timeoutCb;
+    void *_timeoutArg;
+    AcConnectHandler _pollCb;
+    void *_pollArg;
+
+    bool _startConnect();
+    void _prepare(void *rfds, void *wfds, int *maxfd, unsigned long now);
+    bool _process(void *rfds, void *wfds, unsigned long now);
+    bool _fail(int error);
+    bool _close();
+};
+
+#endif /* _ASYNCCLIENT_H_ */
@@ -28,6 +28,20 @@ void WiFiClass::printDiag(Print& p)
 
 }
 
+void WiFiClass::printNetStats(Print& p)
+{
+    ::printNetStats(p, "tcp", WiFiClient::globalStats());
+    ::printNetStats(p, "server", WiFiServer::globalStats());
+    ::printNetStats(p, "udp", WiFiUDP::globalStats());
+}
+
+void WiFiClass::resetNetStats()
+{
+    WiFiClient::resetGlobalStats();
+    WiFiServer::resetGlobalStats();
+    WiFiUDP::resetGlobalStats();
+}
+
 void WiFiClass::enableProv(bool status)
 {
     prov_enable = status;
@@ -13,6 +13,7 @@
 #include "WiFiClient.h"
 #include "WiFiServer.h"
 #include "WiFiUdp.h"
+#include "WiFiStats.h"
 
 class WiFiClass : public WiFiGenericClass, public WiFiSTAClass, public WiFiScanClass, public WiFiAPClass
 {
@@ -39,6 +40,9 @@ public:
     using WiFiScanClass::channel;
 public:  
     void printDiag(Print& dest);
+    // global TCP client, server and UDP counters
+    void printNetStats(Print& dest);
+    void resetNetStats();
     friend class WiFiClient;
     friend class WiFiServer;
     friend class WiFiUDP;
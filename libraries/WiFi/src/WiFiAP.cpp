@@ -61,7 +61,17 @@ bool WiFiAPClass::softAP(const char* ssid, const char* passphrase, int channel,
     }
     
     int ret = tkl_wifi_start_ap(&ap_cfg_info);
-    return (ret == OPRT_OK) ? true : false;
+    if(ret != OPRT_OK) {
+        return false;
+    }
+    // the AP keeps the addresses it was started with
+    WiFiGenericClass::_apCache.valid = false;
+    WiFiGenericClass::_apCache.ip = (uint32_t)IPAddress((const char *)ap_cfg_info.ip.ip);
+    WiFiGenericClass::_apCache.gateway = (uint32_t)IPAddress((const char *)ap_cfg_info.ip.gw);
+    WiFiGenericClass::_apCache.subnet = (uint32_t)IPAddress((const char *)ap_cfg_info.ip.mask);
+    tkl_wifi_get_mac(WF_AP, (NW_MAC_S *)WiFiGenericClass::_apCache.bssid);
+    WiFiGenericClass::_apCache.valid = true;
+    return true;
     
 }
 
@@ -101,6 +111,7 @@ bool WiFiAPClass::softAPConfig(IPAddress local_ip, IPAddress gateway, IPAddress
 
 bool WiFiAPClass::softAPdisconnect(bool wifioff)
 {
+    WiFiGenericClass::_apCache.valid = false;
     bool ret = 0;
     if(wifioff) {
         ret = WiFi.enableAP(false) == OPRT_OK;
@@ -131,6 +142,9 @@ uint8_t WiFiAPClass::softAPgetStationNum()
 
 IPAddress WiFiAPClass::softAPIP()
 {
+    if(WiFiGenericClass::_apCache.valid){
+        return IPAddress(WiFiGenericClass::_apCache.ip);
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -144,6 +158,9 @@ IPAddress WiFiAPClass::softAPIP()
 
 IPAddress WiFiAPClass::softAPBroadcastIP()
 {
+    if(WiFiGenericClass::_apCache.valid){
+        return WiFiGenericClass::calculateBroadcast(IPAddress(WiFiGenericClass::_apCache.gateway), IPAddress(WiFiGenericClass::_apCache.subnet));
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -158,6 +175,9 @@ IPAddress WiFiAPClass::softAPBroadcastIP()
 
 IPAddress WiFiAPClass::softAPNetworkID()
 {
+    if(WiFiGenericClass::_apCache.valid){
+        return WiFiGenericClass::calculateNetworkID(IPAddress(WiFiGenericClass::_apCache.gateway), IPAddress(WiFiGenericClass::_apCache.subnet));
+    }
    if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -171,6 +191,9 @@ IPAddress WiFiAPClass::softAPNetworkID()
 
 IPAddress WiFiAPClass::softAPSubnetMask()
 {
+    if(WiFiGenericClass::_apCache.valid){
+        return IPAddress(WiFiGenericClass::_apCache.subnet);
+    }
    if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -189,6 +212,10 @@ uint8_t WiFiAPClass::softAPSubnetCIDR()
 
 uint8_t* WiFiAPClass::softAPmacAddress(uint8_t* mac)
 {
+    if(WiFiGenericClass::_apCache.valid){
+        memcpy(mac, WiFiGenericClass::_apCache.bssid, 6);
+        return mac;
+    }
     if(WiFiGenericClass::getMode() != WWM_POWERDOWN){
         tkl_wifi_get_mac(WF_AP,(NW_MAC_S*)mac);
     }
@@ -200,7 +227,7 @@ String WiFiAPClass::softAPmacAddress(void)
     char macStr[18] = { 0 };
     uint8_t mac[6];
     
-    if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
+    if(!WiFiGenericClass::_apCache.valid && WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return String();
     }
 
@@ -31,19 +31,86 @@
 #define WIFI_CLIENT_MAX_WRITE_RETRY      (10)
 #define WIFI_CLIENT_SELECT_TIMEOUT_US    (1000000)
 #define WIFI_CLIENT_FLUSH_BUFFER_SIZE    (1024)
+#define WIFI_CLIENT_CONN_POLL_MS         (500)
 
 #undef connect
 #undef write
 #undef read
 
+static WiFiNetStats _tcp_stats;
+
+class WiFiClientSocketHandle {
+private:
+    int sockfd;
+    bool _waiting;              // written to, no reply byte read since
+    unsigned long _sentAt;
+
+public:
+    WiFiNetStats stats;
+
+    WiFiClientSocketHandle(int fd):sockfd(fd),_waiting(false),_sentAt(0)
+    {
+        memset(&stats, 0, sizeof(stats));
+    }
+
+    ~WiFiClientSocketHandle()
+    {
+        tal_net_close(sockfd);
+    }
+
+    int fd()
+    {
+        return sockfd;
+    }
+
+    void sent(int bytes)
+    {
+        stats.bytesOut += bytes;
+        stats.packetsOut++;
+        _tcp_stats.bytesOut += bytes;
+        _tcp_stats.packetsOut++;
+        // a request may take several writes, the reply is timed from the last
+        _waiting = true;
+        _sentAt = millis();
+    }
+
+    void received(int bytes)
+    {
+        stats.bytesIn += bytes;
+        stats.packetsIn++;
+        _tcp_stats.bytesIn += bytes;
+        _tcp_stats.packetsIn++;
+        if (_waiting) {
+            _waiting = false;
+            uint32_t ms = millis() - _sentAt;
+            wifiStatsLatency(stats.firstByte, ms);
+            wifiStatsLatency(_tcp_stats.firstByte, ms);
+        }
+    }
+
+    void stalled(uint32_t ms)
+    {
+        wifiStatsLatency(stats.stall, ms);
+        wifiStatsLatency(_tcp_stats.stall, ms);
+    }
+
+    void error(int err)
+    {
+        wifiStatsError(stats, err);
+        wifiStatsError(_tcp_stats, err);
+    }
+};
+
 class WiFiClientRxBuffer {
 private:
         size_t _size;
         uint8_t *_buffer;
         size_t _pos;
         size_t _fill;
+        WiFiClientSocketHandle *_owner;
         int _fd;
         bool _failed;
+        bool _eof;
 
         size_t r_available()
         {
@@ -81,21 +148,30 @@ private:
             if(res < 0) {
                 if(errno != EWOULDBLOCK) {
                     _failed = true;
+                    _owner->error(errno);
                 }
                 return 0;
             }
+            if(res == 0) {
+                // orderly shutdown by the peer
+                _eof = true;
+            } else {
+                _owner->received(res);
+            }
             _fill += res;
             return res;
         }
 
 public:
-    WiFiClientRxBuffer(int fd, size_t size=1436)
+    WiFiClientRxBuffer(WiFiClientSocketHandle *owner, size_t size=1436)
         :_size(size)
         ,_buffer(NULL)
         ,_pos(0)
         ,_fill(0)
-        ,_fd(fd)
+        ,_owner(owner)
+        ,_fd(owner->fd())
         ,_failed(false)
+        ,_eof(false)
     {
         //_buffer = (uint8_t *)tal_malloc(_size);
     }
@@ -109,6 +185,11 @@ public:
         return _failed;
     }
 
+    // peer has closed and everything it sent has been consumed
+    bool drained(){
+        return _eof && _pos == _fill;
+    }
+
     int read(uint8_t * dst, size_t len){
         if(!dst || !len || (_pos == _fill && !fillBuffer())){
             return _failed ? -1 : 0;
@@ -166,34 +247,16 @@ public:
     }
 };
 
-class WiFiClientSocketHandle {
-private:
-    int sockfd;
-
-public:
-    WiFiClientSocketHandle(int fd):sockfd(fd)
-    {
-    }
-
-    ~WiFiClientSocketHandle()
-    {
-        tal_net_close(sockfd);
-    }
-
-    int fd()
-    {
-        return sockfd;
-    }
-};
-
-WiFiClient::WiFiClient():_rxBuffer(nullptr),_connected(false),_timeout(WIFI_CLIENT_DEF_CONN_TIMEOUT_MS),next(NULL)
+WiFiClient::WiFiClient():_rxBuffer(nullptr),_connected(false),_timeout(WIFI_CLIENT_DEF_CONN_TIMEOUT_MS)
+    ,_pollInterval(WIFI_CLIENT_CONN_POLL_MS),_lastPollMs(0),_dnsMs(-1),next(NULL)
 {
 }
 
-WiFiClient::WiFiClient(int fd):_connected(true),_timeout(WIFI_CLIENT_DEF_CONN_TIMEOUT_MS),next(NULL)
+WiFiClient::WiFiClient(int fd):_connected(true),_timeout(WIFI_CLIENT_DEF_CONN_TIMEOUT_MS)
+    ,_pollInterval(WIFI_CLIENT_CONN_POLL_MS),_lastPollMs(millis()),_dnsMs(-1),next(NULL)
 {
     clientSocketHandle.reset(new WiFiClientSocketHandle(fd));
-    _rxBuffer.reset(new WiFiClientRxBuffer(fd));
+    _rxBuffer.reset(new WiFiClientRxBuffer(clientSocketHandle.get()));
 }
 
 WiFiClient::~WiFiClient()
@@ -207,9 +270,37 @@ WiFiClient & WiFiClient::operator=(const WiFiClient &other)
     clientSocketHandle = other.clientSocketHandle;
     _rxBuffer = other._rxBuffer;
     _connected = other._connected;
+    _timeout = other._timeout;
+    _pollInterval = other._pollInterval;
+    _lastPollMs = other._lastPollMs;
+    _dnsMs = other._dnsMs;
+    // _onDisconnect is left alone, the callback belongs to this object
     return *this;
 }
 
+void WiFiClient::_markAlive()
+{
+    _lastPollMs = millis();
+}
+
+void WiFiClient::_markDisconnected(int err)
+{
+    if (!_connected) {
+        return;
+    }
+    _connected = false;
+    if (_onDisconnect) {
+        _onDisconnect(*this, err);
+    }
+}
+
+void WiFiClient::_connectFailed(int err)
+{
+    _dnsMs = -1;
+    _tcp_stats.connectFails++;
+    wifiStatsError(_tcp_stats, err);
+}
+
 void WiFiClient::stop()
 {
     clientSocketHandle = NULL;
@@ -229,6 +320,7 @@ int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
     int sockfd = tal_net_socket_create(PROTOCOL_TCP);
     if (sockfd < 0) {
         PR_ERR("socket: %d\r\n", errno);
+        _connectFailed(errno);
         return 0;
     }
     tal_net_set_block(sockfd,0);
@@ -245,10 +337,12 @@ int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
     tv.tv_sec = _timeout / 1000;
     tv.tv_usec = (_timeout  % 1000) * 1000;
 
+    unsigned long start = millis();
     int res = tal_net_connect(sockfd,serverIP, port);
 
     if (res < 0 && errno != EINPROGRESS) {
         PR_ERR("connect on fd %d, errno: %d, \"%s\"", sockfd, errno, strerror(errno));
+        _connectFailed(errno);
         tal_net_close(sockfd);
         return 0;
     }
@@ -256,10 +350,12 @@ int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
     res = tal_net_select(sockfd + 1, nullptr, &fdset, nullptr, _timeout<0 ? 50 :_timeout);
     if (res < 0) {
         PR_ERR("select on fd %d, errno: %d, \"%s\"", sockfd, errno, strerror(errno));
+        _connectFailed(errno);
         tal_net_close(sockfd);
         return 0;
     } else if (res == 0) {
         PR_ERR("select returned due to timeout %d ms for fd %d", _timeout, sockfd);
+        _connectFailed(ETIMEDOUT);
         tal_net_close(sockfd);
         return 0;
     } else {
@@ -269,16 +365,19 @@ int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
 
         if (res < 0) {
             PR_ERR("getsockopt on fd %d, errno: %d, \"%s\"", sockfd, errno, strerror(errno));
+            _connectFailed(errno);
             tal_net_close(sockfd);
             return 0;
         }
 
         if (sockerr != 0) {
             PR_ERR("socket error on fd %d, errno: %d, \"%s\"", sockfd, sockerr, strerror(sockerr));
+            _connectFailed(sockerr);
             tal_net_close(sockfd);
             return 0;
         }
     }
+    uint32_t connectMs = millis() - start;
 
 #define ROE_WIFICLIENT(x,msg) { if (((x)<0)) { PR_ERR("Setsockopt '" msg "'' on fd %d failed. errno: %d, \"%s\"", sockfd, errno, strerror(errno)); return 0; }}
     ROE_WIFICLIENT(tal_net_setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)),"SO_SNDTIMEO");
@@ -290,9 +389,20 @@ int WiFiClient::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
 
     tal_net_set_block(sockfd,1);
     clientSocketHandle.reset(new WiFiClientSocketHandle(sockfd));
-    _rxBuffer.reset(new WiFiClientRxBuffer(sockfd));
+    _rxBuffer.reset(new WiFiClientRxBuffer(clientSocketHandle.get()));
+
+    WiFiNetStats &stats = clientSocketHandle->stats;
+    stats.connects = 1;
+    wifiStatsLatency(stats.connect, connectMs);
+    _tcp_stats.connects++;
+    wifiStatsLatency(_tcp_stats.connect, connectMs);
+    if (_dnsMs >= 0) {
+        wifiStatsLatency(stats.dns, _dnsMs);
+        _dnsMs = -1;
+    }
 
     _connected = true;
+    _markAlive();
     return 1;
 }
 
@@ -304,12 +414,70 @@ int WiFiClient::connect(const char *host, uint16_t port)
 int WiFiClient::connect(const char *host, uint16_t port, int32_t timeout_ms)
 {
     IPAddress srv((uint32_t)0);
-    if(!WiFiGenericClass::hostByName(host, srv)){
+    if(!_resolve(host, srv)){
         return 0;
     }
     return connect(srv, port, timeout_ms);
 }
 
+bool WiFiClient::_resolve(const char *host, IPAddress &ip)
+{
+    unsigned long start = millis();
+    if(!WiFiGenericClass::hostByName(host, ip)){
+        _tcp_stats.connectFails++;
+        wifiStatsError(_tcp_stats, EHOSTUNREACH);
+        _dnsMs = -1;
+        return false;
+    }
+    _dnsMs = millis() - start;
+    wifiStatsLatency(_tcp_stats.dns, _dnsMs);
+    return true;
+}
+
+void WiFiClient::_countSent(int bytes)
+{
+    if (clientSocketHandle) {
+        clientSocketHandle->sent(bytes);
+    }
+}
+
+void WiFiClient::_countReceived(int bytes)
+{
+    if (clientSocketHandle) {
+        clientSocketHandle->received(bytes);
+    }
+}
+
+void WiFiClient::_countStall(uint32_t ms)
+{
+    if (clientSocketHandle) {
+        clientSocketHandle->stalled(ms);
+    }
+}
+
+void WiFiClient::_countError(int err)
+{
+    if (clientSocketHandle) {
+        clientSocketHandle->error(err);
+    }
+}
+
+const WiFiNetStats &WiFiClient::stats() const
+{
+    static const WiFiNetStats none = {};
+    return clientSocketHandle ? clientSocketHandle->stats : none;
+}
+
+const WiFiNetStats &WiFiClient::globalStats()
+{
+    return _tcp_stats;
+}
+
+void WiFiClient::resetGlobalStats()
+{
+    memset(&_tcp_stats, 0, sizeof(_tcp_stats));
+}
+
 int WiFiClient::setSocketOption(int option, char* value, size_t len)
 {
     return setSocketOption(SOL_SOCKET, option, (const void*)value, len);
@@ -400,6 +568,9 @@ size_t WiFiClient::write(const uint8_t *buf, size_t size)
     if(!_connected || (socketFileDescriptor < 0)) {
         return 0;
     }
+    // shared by the copies, stop() below may release it
+    std::shared_ptr<WiFiClientSocketHandle> handle = clientSocketHandle;
+    uint32_t stallMs = 0;
 
     while(retry) {
         //use select to make sure the socket is ready for writing
@@ -410,13 +581,19 @@ size_t WiFiClient::write(const uint8_t *buf, size_t size)
         uint32_t timeoutMs = WIFI_CLIENT_SELECT_TIMEOUT_US / 1000;
         retry--;
 
-        if(tal_net_select(socketFileDescriptor + 1, NULL, &set, NULL, timeoutMs) < 0) {
+        unsigned long waitStart = millis();
+        int ready = tal_net_select(socketFileDescriptor + 1, NULL, &set, NULL, timeoutMs);
+        stallMs += millis() - waitStart;
+        if(ready < 0) {
+            handle->error(errno);
             return 0;
         }
 
         if(TAL_FD_ISSET(socketFileDescriptor, &set)) {
             res = send(socketFileDescriptor, (void*) buf, bytesRemaining, MSG_DONTWAIT);
             if(res > 0) {
+                _markAlive();
+                handle->sent(res);
                 totalBytesSent += res;
                 if (totalBytesSent >= size) {
                     //completed successfully
@@ -431,6 +608,8 @@ size_t WiFiClient::write(const uint8_t *buf, size_t size)
                 PR_ERR("write fail on fd %d, errno: %d, \"%s\"", fd(), errno, strerror(errno));
                 if(errno != EAGAIN) {
                     //if resource was busy, can try again, otherwise give up
+                    handle->error(errno);
+                    _markDisconnected(errno);
                     stop();
                     res = 0;
                     retry = 0;
@@ -441,6 +620,9 @@ size_t WiFiClient::write(const uint8_t *buf, size_t size)
             }
         }
     }
+    if(stallMs) {
+        handle->stalled(stallMs);
+    }
     return totalBytesSent;
 }
 
@@ -474,7 +656,10 @@ int WiFiClient::read(uint8_t *buf, size_t size)
         res = _rxBuffer->read(buf, size);
         if(_rxBuffer->failed()) {
             PR_ERR("read fail on fd %d, errno: %d, \"%s\"", fd(), errno, strerror(errno));
+            _markDisconnected(errno);
             stop();
+        } else if(res > 0) {
+            _markAlive();
         }
     }
     return res;
@@ -487,6 +672,7 @@ int WiFiClient::peek()
         res = _rxBuffer->peek();
         if(_rxBuffer->failed()) {
             PR_ERR("peek fail on fd %d, errno: %d, \"%s\"", fd(), errno, strerror(errno));
+            _markDisconnected(errno);
             stop();
         }
     }
@@ -502,6 +688,7 @@ int WiFiClient::available()
     int res = _rxBuffer->available();
     if(_rxBuffer->failed()) {
         PR_ERR("available fail on fd %d, errno: %d, \"%s\"", fd(), errno, strerror(errno));
+        _markDisconnected(errno);
         stop();
     }
     return res;
@@ -517,34 +704,44 @@ void WiFiClient::flush() {
 
 uint8_t WiFiClient::connected()
 {
-    if (_connected) {
-        uint8_t dummy;
-        int res = recv(fd(), &dummy, 0, MSG_DONTWAIT);
-        // avoid unused var warning by gcc
-        (void)res;
-        // recv only sets errno if res is <= 0
-        if (res <= 0){
-          switch (errno) {
-              case EWOULDBLOCK:
-              case ENOENT: //caused by vfs
-                  _connected = true;
-                  break;
-              case ENOTCONN:
-              case EPIPE:
-              case ECONNRESET:
-              case ECONNREFUSED:
-              case ECONNABORTED:
-                  _connected = false;
-                  PR_ERR("Disconnected: RES: %d, ERR: %d", res, errno);
-                  break;
-              default:
-                  PR_ERR("Unexpected: RES: %d, ERR: %d", res, errno);
-                  _connected = true;
-                  break;
-          }
-        } else {
-          _connected = true;
-        }
+    if (!_connected) {
+        return _connected;
+    }
+    if (_rxBuffer && _rxBuffer->drained()) {
+        _markDisconnected(0);
+        return _connected;
+    }
+    // Socket errors seen by read/write already cleared _connected; only probe
+    // the stack when nothing has proven the connection alive for a while.
+    unsigned long now = millis();
+    if (_pollInterval && (now - _lastPollMs) < _pollInterval) {
+        return _connected;
+    }
+    _lastPollMs = now;
+
+    uint8_t dummy;
+    int res = recv(fd(), &dummy, 0, MSG_DONTWAIT);
+    // recv only sets errno if res is <= 0
+    if (res <= 0){
+      switch (errno) {
+          case EWOULDBLOCK:
+          case ENOENT: //caused by vfs
+              break;
+          case ENOTCONN:
+          case EPIPE:
+          case ECONNRESET:
+          case ECONNREFUSED:
+          case ECONNABORTED:
+              PR_ERR("Disconnected: RES: %d, ERR: %d", res, errno);
+              if (clientSocketHandle) {
+                  clientSocketHandle->error(errno);
+              }
+              _markDisconnected(errno);
+              break;
+          default:
+              PR_ERR("Unexpected: RES: %d, ERR: %d", res, errno);
+              break;
+      }
     }
     return _connected;
 }
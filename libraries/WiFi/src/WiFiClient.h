@@ -3,10 +3,17 @@
 
 #include <Arduino.h>
 #include "api/Client.h"
+#include "WiFiStats.h"
 #include <memory>
+#include <functional>
 
 class WiFiClientSocketHandle;
 class WiFiClientRxBuffer;
+class WiFiClient;
+
+// Invoked once when the connection is found to be dropped by the peer or the
+// stack (not on a local stop()). err is the errno that revealed it, 0 on EOF.
+typedef std::function<void(WiFiClient &client, int err)> WiFiClientDisconnectCb;
 
 class LwIPClient : public Client
 {
@@ -23,12 +30,27 @@ protected:
     std::shared_ptr<WiFiClientRxBuffer> _rxBuffer;
     bool _connected;
     int _timeout;
+    uint32_t _pollInterval;
+    unsigned long _lastPollMs;
+    WiFiClientDisconnectCb _onDisconnect;
+    int32_t _dnsMs;             // lookup time of the next connect(), -1 for none
+
+    void _markAlive();
+    void _markDisconnected(int err);
+    void _connectFailed(int err);
+    // hostByName() timed for the stats of the connection that follows
+    bool _resolve(const char *host, IPAddress &ip);
+    // for subclasses that do their own socket I/O
+    void _countSent(int bytes);
+    void _countReceived(int bytes);
+    void _countStall(uint32_t ms);
+    void _countError(int err);
 
 public:
     WiFiClient *next;
     WiFiClient();
     WiFiClient(int fd);
-    ~WiFiClient();
+    virtual ~WiFiClient();
     int connect(IPAddress ip, uint16_t port);
     int connect(IPAddress ip, uint16_t port, int32_t timeout_ms);
     int connect(const char *host, uint16_t port);
@@ -45,6 +67,21 @@ public:
     void stop();
     uint8_t connected();
 
+    // connected() returns the cached state and only probes the socket once per
+    // interval; read/write errors update the state immediately. 0 probes on
+    // every call.
+    void setConnectionPollInterval(uint32_t ms) { _pollInterval = ms; }
+    uint32_t getConnectionPollInterval() const { return _pollInterval; }
+    // The callback belongs to this object and is kept across assignment.
+    void onDisconnect(WiFiClientDisconnectCb cb) { _onDisconnect = cb; }
+
+    // Counters of this connection, shared with the copies of the client and
+    // kept until it is stopped; all zero while there is no connection.
+    const WiFiNetStats &stats() const;
+    // summed over all TCP clients, those accepted by a WiFiServer included
+    static const WiFiNetStats &globalStats();
+    static void resetGlobalStats();
+
     operator bool()
     {
         return connected();
@@ -0,0 +1,698 @@
+#include "WiFiClientSecure.h"
+#include "WiFi.h"
+#include "lwip/sockets.h"
+#include <errno.h>
+#include <new>
+#include "tal_api.h"
+#include "tal_memory.h"
+#include "tal_log.h"
+#include "tal_network.h"
+#include "tal_system.h"
+
+#include "mbedtls/version.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ctr_drbg.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/net_sockets.h"
+
+#define WIFI_SECURE_HANDSHAKE_TIMEOUT_MS    (15 * 1000)
+#define WIFI_SECURE_WRITE_TIMEOUT_MS        (10 * 1000)
+#define WIFI_SECURE_PEM_MAX                 (4 * 1024)
+#define WIFI_SECURE_MASTER_LEN              (48)
+
+// mbedTLS 3 renames struct members it considers private
+#ifndef MBEDTLS_PRIVATE
+#define MBEDTLS_PRIVATE(member) member
+#endif
+
+#undef connect
+#undef write
+#undef read
+
+class WiFiClientSecureContext {
+public:
+    mbedtls_ssl_context ssl;
+    mbedtls_ssl_config conf;
+    mbedtls_ctr_drbg_context drbg;
+    int fd;
+
+    WiFiClientSecureContext(int sockfd) : fd(sockfd)
+    {
+        mbedtls_ssl_init(&ssl);
+        mbedtls_ssl_config_init(&conf);
+        mbedtls_ctr_drbg_init(&drbg);
+    }
+
+    ~WiFiClientSecureContext()
+    {
+        mbedtls_ssl_free(&ssl);
+        mbedtls_ssl_config_free(&conf);
+        mbedtls_ctr_drbg_free(&drbg);
+    }
+};
+
+typedef struct {
+    bool valid;
+    char host[WIFI_SECURE_HOST_MAX];
+    uint16_t port;
+    unsigned long lastUsed;
+    mbedtls_ssl_session session;
+} wifi_secure_session_t;
+
+WiFiClientSecureStats WiFiClientSecure::_stats;
+
+static wifi_secure_session_t s_sessions[WIFI_SECURE_SESSION_CACHE_SIZE];
+static MUTEX_HANDLE s_sessionMutex = NULL;
+static mbedtls_x509_crt *s_bundle = NULL;
+
+static bool _sessionLock()
+{
+    // created on first use, global constructors run before the kernel is up
+    if (!s_sessionMutex && tal_mutex_create_init(&s_sessionMutex) != OPRT_OK) {
+        PR_ERR("tls session mutex create failed");
+        return false;
+    }
+    tal_mutex_lock(s_sessionMutex);
+    return true;
+}
+
+static void _sessionUnlock()
+{
+    tal_mutex_unlock(s_sessionMutex);
+}
+
+static wifi_secure_session_t *_sessionFind(const char *key, uint16_t port)
+{
+    for (int i = 0; i < WIFI_SECURE_SESSION_CACHE_SIZE; i++) {
+        wifi_secure_session_t *e = &s_sessions[i];
+        if (e->valid && e->port == port && !strcasecmp(e->host, key)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+static void _sessionClear(wifi_secure_session_t *e)
+{
+    mbedtls_ssl_session_free(&e->session);
+    e->valid = false;
+}
+
+// offers the cached session for key:port; master gets its secret, which a
+// resumed handshake keeps and a full one replaces
+static bool _sessionLoad(mbedtls_ssl_context *ssl, const char *key, uint16_t port, unsigned char *master)
+{
+    if (!_sessionLock()) {
+        return false;
+    }
+    bool offered = false;
+    wifi_secure_session_t *e = _sessionFind(key, port);
+    if (e && mbedtls_ssl_set_session(ssl, &e->session) == 0) {
+        memcpy(master, e->session.MBEDTLS_PRIVATE(master), WIFI_SECURE_MASTER_LEN);
+        e->lastUsed = millis();
+        offered = true;
+    }
+    _sessionUnlock();
+    return offered;
+}
+
+// takes over session
+static void _sessionStore(const char *key, uint16_t port, mbedtls_ssl_session *session)
+{
+    if (strlen(key) >= WIFI_SECURE_HOST_MAX || !_sessionLock()) {
+        mbedtls_ssl_session_free(session);
+        return;
+    }
+    unsigned long now = millis();
+    wifi_secure_session_t *slot = _sessionFind(key, port);
+    for (int i = 0; !slot && i < WIFI_SECURE_SESSION_CACHE_SIZE; i++) {
+        if (!s_sessions[i].valid) {
+            slot = &s_sessions[i];
+        }
+    }
+    if (!slot) {
+        slot = &s_sessions[0];
+        for (int i = 1; i < WIFI_SECURE_SESSION_CACHE_SIZE; i++) {
+            if ((now - s_sessions[i].lastUsed) > (now - slot->lastUsed)) {
+                slot = &s_sessions[i];
+            }
+        }
+    }
+    if (slot->valid) {
+        _sessionClear(slot);
+    }
+    memcpy(&slot->session, session, sizeof(mbedtls_ssl_session));
+    strcpy(slot->host, key);
+    slot->port = port;
+    slot->lastUsed = now;
+    slot->valid = true;
+    _sessionUnlock();
+}
+
+static void _sessionDrop(const char *key, uint16_t port)
+{
+    if (!_sessionLock()) {
+        return;
+    }
+    wifi_secure_session_t *e = _sessionFind(key, port);
+    if (e) {
+        _sessionClear(e);
+    }
+    _sessionUnlock();
+}
+
+static int _entropy(void *data, unsigned char *output, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        output[i] = (unsigned char)tal_system_get_random(0x100);
+    }
+    return 0;
+}
+
+// the socket is only read and written with MSG_DONTWAIT, waiting happens in
+// the handshake and write loops so read() and available() never block
+int WiFiClientSecure::_bioSend(void *ctx, const unsigned char *buf, size_t len)
+{
+    WiFiClientSecure *self = (WiFiClientSecure *)ctx;
+    int res = send(self->_ctx->fd, buf, len, MSG_DONTWAIT);
+    if (res < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+            return MBEDTLS_ERR_SSL_WANT_WRITE;
+        }
+        self->_countError(errno);
+        return MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    self->_countSent(res);
+    return res;
+}
+
+int WiFiClientSecure::_bioRecv(void *ctx, unsigned char *buf, size_t len)
+{
+    WiFiClientSecure *self = (WiFiClientSecure *)ctx;
+    int res = recv(self->_ctx->fd, buf, len, MSG_DONTWAIT);
+    if (res < 0) {
+        if (errno == EWOULDBLOCK || errno == EAGAIN || errno == EINTR) {
+            return MBEDTLS_ERR_SSL_WANT_READ;
+        }
+        self->_countError(errno);
+        return MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    if (res > 0) {
+        self->_countReceived(res);
+    }
+    return res;
+}
+
+static void _waitSocket(int fd, bool forWrite, uint32_t ms)
+{
+    TUYA_FD_SET_T set;
+    TAL_FD_ZERO(&set);
+    TAL_FD_SET(fd, &set);
+    tal_net_select(fd + 1, forWrite ? NULL : &set, forWrite ? &set : NULL, NULL, ms);
+}
+
+static int _fragmentCode(uint16_t len)
+{
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    switch (len) {
+    case 512:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+    case 1024:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+    case 2048:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+    case 4096:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+    }
+#endif
+    return -1;
+}
+
+WiFiClientSecure::WiFiClientSecure()
+    : _ctx(NULL)
+    , _ca(NULL)
+    , _insecure(false)
+    , _resume(true)
+    , _resumed(false)
+    , _maxFragment(4096)
+    , _handshakeMs(0)
+    , _peeked(-1)
+{
+}
+
+WiFiClientSecure::~WiFiClientSecure()
+{
+    stop();
+    if (_ca) {
+        mbedtls_x509_crt_free(_ca);
+        tal_free(_ca);
+    }
+}
+
+bool WiFiClientSecure::setCACert(const char *rootCA)
+{
+    if (!_ca) {
+        _ca = (mbedtls_x509_crt *)tal_malloc(sizeof(mbedtls_x509_crt));
+        if (!_ca) {
+            return false;
+        }
+    } else {
+        mbedtls_x509_crt_free(_ca);
+    }
+    mbedtls_x509_crt_init(_ca);
+    int ret = mbedtls_x509_crt_parse(_ca, (const unsigned char *)rootCA, strlen(rootCA) + 1);
+    if (ret != 0) {
+        PR_ERR("ca cert parse failed: -0x%04x", -ret);
+        mbedtls_x509_crt_free(_ca);
+        tal_free(_ca);
+        _ca = NULL;
+        return false;
+    }
+    return true;
+}
+
+void WiFiClientSecure::_free()
+{
+    delete _ctx;
+    _ctx = NULL;
+    _peeked = -1;
+}
+
+int WiFiClientSecure::_handshake(const char *host, const char *key, uint16_t port)
+{
+    mbedtls_x509_crt *ca = _ca ? _ca : s_bundle;
+    if (!ca && !_insecure) {
+        PR_ERR("no CA for %s, use setCACert(), loadCABundle() or setInsecure()", key);
+        WiFiClient::stop();
+        return 0;
+    }
+    uint32_t heapStart = tal_system_get_free_heap_size();
+    uint32_t heapMin = heapStart;
+
+    _resumed = false;
+    _ctx = new (std::nothrow) WiFiClientSecureContext(fd());
+    if (!_ctx) {
+        PR_ERR("Not enough memory for tls context");
+        WiFiClient::stop();
+        return 0;
+    }
+    mbedtls_ssl_context *ssl = &_ctx->ssl;
+    mbedtls_ssl_config *conf = &_ctx->conf;
+
+    int ret = mbedtls_ctr_drbg_seed(&_ctx->drbg, _entropy, NULL, (const unsigned char *)"WiFiClientSecure", 16);
+    if (ret == 0) {
+        ret = mbedtls_ssl_config_defaults(conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT);
+    }
+    if (ret == 0) {
+        mbedtls_ssl_conf_rng(conf, mbedtls_ctr_drbg_random, &_ctx->drbg);
+        if (_insecure) {
+            mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_NONE);
+        } else {
+            mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+            mbedtls_ssl_conf_ca_chain(conf, ca, NULL);
+        }
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && (MBEDTLS_VERSION_NUMBER >= 0x03020000)
+        // resumption below relies on TLS 1.2 session IDs and tickets
+        mbedtls_ssl_conf_max_tls_version(conf, MBEDTLS_SSL_VERSION_TLS1_2);
+#endif
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+        if (_fragmentCode(_maxFragment) > 0) {
+            ret = mbedtls_ssl_conf_max_frag_len(conf, _fragmentCode(_maxFragment));
+        }
+#endif
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+        mbedtls_ssl_conf_session_tickets(conf, _resume ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+#endif
+    }
+    if (ret == 0) {
+        ret = mbedtls_ssl_setup(ssl, conf);
+    }
+    if (ret == 0 && host) {
+        ret = mbedtls_ssl_set_hostname(ssl, host);
+    }
+    if (ret != 0) {
+        PR_ERR("tls setup failed: -0x%04x", -ret);
+        _free();
+        WiFiClient::stop();
+        return 0;
+    }
+    mbedtls_ssl_set_bio(ssl, this, _bioSend, _bioRecv, NULL);
+
+    unsigned char master[WIFI_SECURE_MASTER_LEN];
+    bool offered = _resume && _sessionLoad(ssl, key, port, master);
+
+    unsigned long start = millis();
+    while ((ret = mbedtls_ssl_handshake(ssl)) != 0) {
+        // buffers and key exchange state are allocated by now
+        uint32_t heap = tal_system_get_free_heap_size();
+        if (heap < heapMin) {
+            heapMin = heap;
+        }
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            break;
+        }
+        unsigned long elapsed = millis() - start;
+        if (elapsed >= WIFI_SECURE_HANDSHAKE_TIMEOUT_MS) {
+            ret = MBEDTLS_ERR_SSL_TIMEOUT;
+            break;
+        }
+        _waitSocket(_ctx->fd, ret == MBEDTLS_ERR_SSL_WANT_WRITE, WIFI_SECURE_HANDSHAKE_TIMEOUT_MS - elapsed);
+    }
+    _handshakeMs = millis() - start;
+    _stats.lastTimeMs = _handshakeMs;
+    if (heapStart - heapMin > _stats.heapPeak) {
+        _stats.heapPeak = heapStart - heapMin;
+    }
+
+    if (ret != 0) {
+        uint32_t flags = mbedtls_ssl_get_verify_result(ssl);
+        if (flags && flags != (uint32_t)-1) {
+            PR_ERR("tls handshake with %s: certificate not verified, flags 0x%x", key, flags);
+        } else {
+            PR_ERR("tls handshake with %s failed: -0x%04x", key, -ret);
+        }
+        // a server that fails a resumed handshake gets a full one next time
+        if (offered) {
+            _sessionDrop(key, port);
+        }
+        _stats.failures++;
+        _free();
+        WiFiClient::stop();
+        return 0;
+    }
+
+    mbedtls_ssl_session session;
+    mbedtls_ssl_session_init(&session);
+    if (mbedtls_ssl_get_session(ssl, &session) == 0) {
+        _resumed = offered && !memcmp(session.MBEDTLS_PRIVATE(master), master, WIFI_SECURE_MASTER_LEN);
+        if (_resume) {
+            _sessionStore(key, port, &session);
+        } else {
+            mbedtls_ssl_session_free(&session);
+        }
+    }
+    _stats.handshakes++;
+    if (_resumed) {
+        _stats.resumed++;
+        _stats.resumedTimeMs += _handshakeMs;
+    } else {
+        _stats.fullTimeMs += _handshakeMs;
+    }
+    PR_DEBUG("tls %s:%d %s handshake in %u ms, %s", key, port, _resumed ? "resumed" : "full",
+             _handshakeMs, mbedtls_ssl_get_ciphersuite(ssl));
+    return 1;
+}
+
+int WiFiClientSecure::connect(IPAddress ip, uint16_t port)
+{
+    return connect(ip, port, _timeout);
+}
+
+int WiFiClientSecure::connect(IPAddress ip, uint16_t port, int32_t timeout_ms)
+{
+    stop();
+    // a verified certificate is only worth something for the name it was
+    // checked against, and an address gives none
+    if (!_insecure) {
+        PR_ERR("tls to %s needs a host name, use connect(host) or setInsecure()", ip.toString().c_str());
+        return 0;
+    }
+    if (!WiFiClient::connect(ip, port, timeout_ms)) {
+        return 0;
+    }
+    return _handshake(NULL, ip.toString().c_str(), port);
+}
+
+int WiFiClientSecure::connect(const char *host, uint16_t port)
+{
+    return connect(host, port, _timeout);
+}
+
+int WiFiClientSecure::connect(const char *host, uint16_t port, int32_t timeout_ms)
+{
+    stop();
+    IPAddress srv((uint32_t)0);
+    if (!_resolve(host, srv)) {
+        return 0;
+    }
+    if (!WiFiClient::connect(srv, port, timeout_ms)) {
+        return 0;
+    }
+    return _handshake(host, host, port);
+}
+
+int WiFiClientSecure::_read(uint8_t *buf, size_t size)
+{
+    if (!_ctx) {
+        return -1;
+    }
+    int ret = mbedtls_ssl_read(&_ctx->ssl, buf, size);
+    if (ret > 0) {
+        _markAlive();
+        return ret;
+    }
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        return 0;
+    }
+    if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        // orderly shutdown by the peer
+        _markDisconnected(0);
+        return 0;
+    }
+    PR_ERR("tls read fail on fd %d: -0x%04x", fd(), -ret);
+    _markDisconnected(ret);
+    stop();
+    return -1;
+}
+
+int WiFiClientSecure::read(uint8_t *buf, size_t size)
+{
+    if (!buf || !size) {
+        return 0;
+    }
+    int n = 0;
+    if (_peeked >= 0) {
+        buf[n++] = _peeked;
+        _peeked = -1;
+    }
+    if ((size_t)n == size) {
+        return n;
+    }
+    int res = _read(buf + n, size - n);
+    if (res < 0) {
+        return n ? n : -1;
+    }
+    return n + res;
+}
+
+int WiFiClientSecure::read()
+{
+    uint8_t data = 0;
+    int res = read(&data, 1);
+    if (res <= 0) {
+        return -1;
+    }
+    return data;
+}
+
+int WiFiClientSecure::peek()
+{
+    if (_peeked < 0) {
+        uint8_t data;
+        if (_read(&data, 1) == 1) {
+            _peeked = data;
+        }
+    }
+    return _peeked;
+}
+
+int WiFiClientSecure::available()
+{
+    if (!_ctx) {
+        return 0;
+    }
+    if (_peeked < 0 && !mbedtls_ssl_get_bytes_avail(&_ctx->ssl)) {
+        // reading one byte decrypts the next record if it has arrived
+        peek();
+    }
+    int n = (_peeked >= 0) ? 1 : 0;
+    if (_ctx) {
+        n += mbedtls_ssl_get_bytes_avail(&_ctx->ssl);
+    }
+    return n;
+}
+
+size_t WiFiClientSecure::write(uint8_t data)
+{
+    return write(&data, 1);
+}
+
+size_t WiFiClientSecure::write(const uint8_t *buf, size_t size)
+{
+    if (!_ctx || !_connected) {
+        return 0;
+    }
+    size_t sent = 0;
+    uint32_t stallMs = 0;
+    unsigned long start = millis();
+    while (sent < size) {
+        int ret = mbedtls_ssl_write(&_ctx->ssl, buf + sent, size - sent);
+        if (ret > 0) {
+            _markAlive();
+            sent += ret;
+            start = millis();
+            continue;
+        }
+        unsigned long elapsed = millis() - start;
+        if ((ret == MBEDTLS_ERR_SSL_WANT_WRITE || ret == MBEDTLS_ERR_SSL_WANT_READ) && elapsed < WIFI_SECURE_WRITE_TIMEOUT_MS) {
+            unsigned long waitStart = millis();
+            _waitSocket(_ctx->fd, ret == MBEDTLS_ERR_SSL_WANT_WRITE, WIFI_SECURE_WRITE_TIMEOUT_MS - elapsed);
+            stallMs += millis() - waitStart;
+            continue;
+        }
+        PR_ERR("tls write fail on fd %d: -0x%04x", fd(), -ret);
+        _markDisconnected(ret);
+        stop();
+        break;
+    }
+    if (stallMs) {
+        _countStall(stallMs);
+    }
+    return sent;
+}
+
+void WiFiClientSecure::flush()
+{
+    uint8_t buf[64];
+    _peeked = -1;
+    while (_ctx && _read(buf, sizeof(buf)) > 0) {
+    }
+}
+
+void WiFiClientSecure::stop()
+{
+    if (_ctx) {
+        if (_connected) {
+            // best effort, the socket is closed right after
+            mbedtls_ssl_close_notify(&_ctx->ssl);
+        }
+        _free();
+    }
+    WiFiClient::stop();
+}
+
+uint8_t WiFiClientSecure::connected()
+{
+    if (!_ctx) {
+        return 0;
+    }
+    // decrypted data is readable even after the peer has closed
+    if (_peeked >= 0 || mbedtls_ssl_get_bytes_avail(&_ctx->ssl)) {
+        return 1;
+    }
+    return WiFiClient::connected();
+}
+
+bool WiFiClientSecure::loadCABundle(VFSFILE &fs, const char *path)
+{
+    static const char pemEnd[] = "-----END CERTIFICATE-----";
+
+    TUYA_FILE file = fs.open(path, "r");
+    if (!file) {
+        PR_ERR("ca bundle %s not found", path);
+        return false;
+    }
+    mbedtls_x509_crt *crt = (mbedtls_x509_crt *)tal_malloc(sizeof(mbedtls_x509_crt));
+    char *buf = (char *)tal_malloc(WIFI_SECURE_PEM_MAX + 1);
+    if (!crt || !buf) {
+        PR_ERR("Not enough memory to load ca bundle");
+        tal_free(crt);
+        tal_free(buf);
+        fs.close(file);
+        return false;
+    }
+    mbedtls_x509_crt_init(crt);
+
+    // certificates are parsed one at a time, so the file is never held in RAM
+    int parsed = 0;
+    int skipped = 0;
+    size_t fill = 0;
+    bool eof = false;
+    while (true) {
+        if (!eof && fill < WIFI_SECURE_PEM_MAX) {
+            int n = fs.read(buf + fill, WIFI_SECURE_PEM_MAX - fill, file);
+            if (n <= 0) {
+                eof = true;
+            } else {
+                fill += n;
+            }
+        }
+        buf[fill] = '\0';
+        char *end = strstr(buf, pemEnd);
+        if (!end) {
+            if (eof || fill == WIFI_SECURE_PEM_MAX) {
+                break;
+            }
+            continue;
+        }
+        end += sizeof(pemEnd) - 1;
+        char c = *end;
+        *end = '\0';
+        if (mbedtls_x509_crt_parse(crt, (const unsigned char *)buf, end - buf + 1) == 0) {
+            parsed++;
+        } else {
+            skipped++;
+        }
+        *end = c;
+        fill -= end - buf;
+        memmove(buf, end, fill);
+    }
+    tal_free(buf);
+    fs.close(file);
+
+    if (!parsed) {
+        PR_ERR("no certificate in ca bundle %s", path);
+        mbedtls_x509_crt_free(crt);
+        tal_free(crt);
+        return false;
+    }
+    if (skipped) {
+        PR_NOTICE("ca bundle %s: %d certificates skipped", path, skipped);
+    }
+    PR_DEBUG("ca bundle %s: %d certificates", path, parsed);
+    freeCABundle();
+    s_bundle = crt;
+    return true;
+}
+
+void WiFiClientSecure::freeCABundle()
+{
+    if (s_bundle) {
+        mbedtls_x509_crt_free(s_bundle);
+        tal_free(s_bundle);
+        s_bundle = NULL;
+    }
+}
+
+bool WiFiClientSecure::hasCABundle()
+{
+    return s_bundle != NULL;
+}
+
+void WiFiClientSecure::clearSessionCache()
+{
+    if (!_sessionLock()) {
+        return;
+    }
+    for (int i = 0; i < WIFI_SECURE_SESSION_CACHE_SIZE; i++) {
+        if (s_sessions[i].valid) {
+            _sessionClear(&s_sessions[i]);
+        }
+    }
+    _sessionUnlock();
+}
+
+void WiFiClientSecure::resetStats()
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
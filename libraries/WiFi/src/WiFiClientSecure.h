@@ -0,0 +1,102 @@
+#ifndef _WIFICLIENTSECURE_H_
+#define _WIFICLIENTSECURE_H_
+
+#include <Arduino.h>
+#include "WiFiClient.h"
+#include "File.h"
+
+#define WIFI_SECURE_SESSION_CACHE_SIZE  (4)
+#define WIFI_SECURE_HOST_MAX            (64)
+
+typedef struct {
+    uint32_t handshakes;        // completed handshakes, full and resumed
+    uint32_t resumed;           // completed by resuming a cached session
+    uint32_t failures;          // handshakes that failed or timed out
+    uint32_t fullTimeMs;        // summed duration of full handshakes
+    uint32_t resumedTimeMs;     // summed duration of resumed handshakes
+    uint32_t lastTimeMs;
+    uint32_t heapPeak;          // largest heap use of one connection during the handshake
+} WiFiClientSecureStats;
+
+class WiFiClientSecureContext;
+struct mbedtls_x509_crt;
+
+/*
+ * TLS client on top of WiFiClient, using the mbedTLS of the SDK. Sessions
+ * are cached per host and port, so the next connection to the same server
+ * resumes with an abbreviated handshake (session ID or ticket) instead of a
+ * full key exchange and certificate check. Max Fragment Length is offered to
+ * let small record buffers work with servers that support it.
+ *
+ * The peer is verified against the certificate given with setCACert(), or
+ * else against the bundle shared by all clients, see loadCABundle();
+ * setInsecure() turns verification off. read() and available() never block.
+ */
+class WiFiClientSecure : public WiFiClient
+{
+public:
+    WiFiClientSecure();
+    ~WiFiClientSecure();
+
+    // refused unless setInsecure(): there is no host name to verify
+    int connect(IPAddress ip, uint16_t port);
+    int connect(IPAddress ip, uint16_t port, int32_t timeout_ms);
+    int connect(const char *host, uint16_t port);
+    int connect(const char *host, uint16_t port, int32_t timeout_ms);
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *buf, size_t size);
+    int available();
+    int read();
+    int read(uint8_t *buf, size_t size);
+    int peek();
+    void flush();
+    void stop();
+    uint8_t connected();
+
+    // PEM, one or more certificates; replaces the shared bundle for this client
+    bool setCACert(const char *rootCA);
+    void setInsecure() { _insecure = true; }
+    // 512, 1024, 2048 or 4096 bytes offered to the server, 0 to not ask
+    void setMaxFragmentLength(uint16_t len) { _maxFragment = len; }
+    // false neither offers nor caches sessions for this client
+    void setSessionResumption(bool enable) { _resume = enable; }
+
+    // the last handshake resumed a cached session
+    bool resumed() const { return _resumed; }
+    uint32_t handshakeTime() const { return _handshakeMs; }
+
+    // PEM bundle from flash, used by every client without its own CA; load
+    // it before the first connection, it is read without locking
+    static bool loadCABundle(VFSFILE &fs, const char *path);
+    static void freeCABundle();
+    static bool hasCABundle();
+    static void clearSessionCache();
+    static const WiFiClientSecureStats &stats() { return _stats; }
+    static void resetStats();
+
+    using Print::write;
+
+private:
+    WiFiClientSecureContext *_ctx;
+    mbedtls_x509_crt *_ca;      // from setCACert()
+    bool _insecure;
+    bool _resume;
+    bool _resumed;
+    uint16_t _maxFragment;
+    uint32_t _handshakeMs;
+    int _peeked;
+
+    static WiFiClientSecureStats _stats;
+
+    // socket I/O of mbedTLS, counted in the stats of the connection
+    static int _bioSend(void *ctx, const unsigned char *buf, size_t len);
+    static int _bioRecv(void *ctx, unsigned char *buf, size_t len);
+    int _handshake(const char *host, const char *key, uint16_t port);
+    int _read(uint8_t *buf, size_t size);
+    void _free();
+
+    WiFiClientSecure(const WiFiClientSecure &) = delete;
+    WiFiClientSecure &operator=(const WiFiClientSecure &) = delete;
+};
+
+#endif /* _WIFICLIENTSECURE_H_ */
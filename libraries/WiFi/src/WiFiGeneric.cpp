@@ -20,6 +20,7 @@
 #include "tal_api.h"
 #include "tkl_wifi.h"
 #include "tal_wifi.h"
+#include <strings.h>
 
 #define QUEUE_WAIT_FROEVER 0xFFFFFFFF
 
@@ -44,6 +45,9 @@ static std::vector<WiFiEventCbList_t> cbEventList;
 bool WiFiGenericClass::_wifiUseStaticBuffers = false;
 bool WiFiGenericClass::_persistent = true;
 bool WiFiGenericClass::_long_range = false;
+wifi_netif_cache_t WiFiGenericClass::_staCache = {};
+wifi_netif_cache_t WiFiGenericClass::_apCache = {};
+uint32_t WiFiGenericClass::_rssiRefreshMs = WIFI_RSSI_REFRESH_MS;
 
 wifi_event_id_t WiFiEventCbList::current_id = 1;
 
@@ -112,7 +116,6 @@ static bool _start_network_event_task()
             PR_ERR("Network Event Group Create Failed!");
             return false;
         }
-        xEventGroupSetBits(_arduino_event_group, WIFI_DNS_IDLE_BIT);
     }
     if(!_arduino_event_queue){
         tal_queue_create_init(&_arduino_event_queue,sizeof(arduino_event_t),32);
@@ -329,11 +332,18 @@ int WiFiGenericClass::_eventCallback(arduino_event_t *event)
 {
     if(!event) return OPRT_OK;        
     if(event->event_id == ARDUINO_EVENT_WIFI_STA_GOT_IP  ) {
+        // the new network may resolve names differently
+        clearDNSCache();
+        _updateStaCache(event);
         WiFiSTAClass::_setStatus(WSS_GOT_IP);
         setStatusBits(STA_CONNECTED_BIT);
 
-    } else if(event->event_id == ARDUINO_EVENT_WIFI_STA_DISCONNECTED) {
+    } else if(event->event_id == ARDUINO_EVENT_WIFI_STA_DISCONNECTED || event->event_id == ARDUINO_EVENT_WIFI_STA_LOST_IP) {
+        _staCache.valid = false;
         WiFiSTAClass::_setStatus(WSS_CONN_FAIL);
+    } else if(event->event_id == ARDUINO_EVENT_WIFI_SCAN_DONE) {
+        // publish the results before the callbacks look at them
+        WiFiScanClass::_scanDone(event);
     }
 
     for(uint32_t i = 0; i < cbEventList.size(); i++) {
@@ -353,6 +363,40 @@ int WiFiGenericClass::_eventCallback(arduino_event_t *event)
     return OPRT_OK;
 }
 
+// runs in the event task, once per connection
+void WiFiGenericClass::_updateStaCache(const arduino_event_t *event)
+{
+    const bk_netif_ip_info_t *info = &event->event_info.got_ip.ip_info;
+    char buf[16];
+
+    _staCache.valid = false;
+    memcpy(buf, info->ip, sizeof(buf));
+    buf[sizeof(buf) - 1] = 0;
+    _staCache.ip = (uint32_t)IPAddress(buf);
+    memcpy(buf, info->gw, sizeof(buf));
+    buf[sizeof(buf) - 1] = 0;
+    _staCache.gateway = (uint32_t)IPAddress(buf);
+    memcpy(buf, info->netmask, sizeof(buf));
+    buf[sizeof(buf) - 1] = 0;
+    _staCache.subnet = (uint32_t)IPAddress(buf);
+    for(int i = 0; i < 2; i++){
+        char dns_str[40] = {0};
+        const ip_addr_t *p_dns = dns_getserver(i);
+        ipaddr_ntoa_r(p_dns, dns_str, sizeof(dns_str));
+        _staCache.dns[i] = (uint32_t)IPAddress(dns_str);
+    }
+    if(tkl_wifi_get_bssid(_staCache.bssid) != OPRT_OK){
+        memset(_staCache.bssid, 0, sizeof(_staCache.bssid));
+    }
+    if(tkl_wifi_station_get_conn_ap_rssi(&_staCache.rssi) == OPRT_OK){
+        _staCache.rssiAt = millis();
+    } else {
+        // refreshed on the first WiFi.RSSI()
+        _staCache.rssiAt = millis() - _rssiRefreshMs - 1;
+    }
+    _staCache.valid = (_staCache.ip != 0);
+}
+
 int32_t WiFiGenericClass::channel(void)
 {
     if(!lowLevelInitDone){
@@ -390,6 +434,8 @@ bool WiFiGenericClass::mode(WiFiMode_t m)
     } 
     else if(cm && !m){
         PR_INFO("bkWiFiStop return\n");
+        _staCache.valid = false;
+        _apCache.valid = false;
         return bkWiFiStop();
     }
     err = tkl_wifi_set_work_mode(m);
@@ -397,6 +443,13 @@ bool WiFiGenericClass::mode(WiFiMode_t m)
         PR_ERR("Could not set mode! %d", err);
         return false;
     }
+    // the modes are an enumeration, not bits
+    if(m != WWM_STATION && m != WWM_STATIONAP){
+        _staCache.valid = false;
+    }
+    if(m != WWM_SOFTAP && m != WWM_STATIONAP){
+        _apCache.valid = false;
+    }
     if(!bkWiFiStart()){
         return false;
     }
@@ -454,37 +507,335 @@ bool WiFiGenericClass::setDualAntennaConfig(uint8_t gpio_ant1, uint8_t gpio_ant2
     return false;
 }
 
-static void wifi_dns_found_callback(const char *name, const ip_addr_t *ipaddr, void *callback_arg)
+/*
+ * DNS cache
+ *
+ * Answers are kept in a small LRU table. A miss starts one lwIP query per
+ * name; callers asking for a name that is already being resolved wait on
+ * that query's semaphore instead of starting another one, and lookups of
+ * different names run in parallel.
+ */
+typedef struct wifi_dns_query {
+    struct wifi_dns_query *next;
+    char name[WIFI_DNS_NAME_MAX];   // empty when the name is too long to cache
+    uint32_t addr;
+    bool done;
+    uint8_t waiters;
+    uint8_t refs;                   // waiters plus the pending lwIP callback
+    SEM_HANDLE sem;
+} wifi_dns_query_t;
+
+typedef struct {
+    char name[WIFI_DNS_NAME_MAX];
+    uint32_t addr;                  // 0 caches a failed lookup
+    unsigned long expires;
+    unsigned long lastUsed;
+} wifi_dns_entry_t;
+
+static MUTEX_HANDLE _dns_mutex = NULL;
+static wifi_dns_entry_t _dns_cache[WIFI_DNS_CACHE_SIZE];
+static wifi_dns_query_t *_dns_queries = NULL;
+static uint32_t _dns_min_ttl = WIFI_DNS_MIN_TTL_S;
+static uint32_t _dns_max_ttl = WIFI_DNS_MAX_TTL_S;
+static uint32_t _dns_negative_ttl = WIFI_DNS_NEGATIVE_TTL_S;
+static bool _dns_prefetch = true;
+
+static bool _dns_lock()
 {
-    if(ipaddr) {
-        (*reinterpret_cast<IPAddress*>(callback_arg)) = ipaddr->addr;
+    if(!_dns_mutex && tal_mutex_create_init(&_dns_mutex) != OPRT_OK){
+        PR_ERR("DNS cache mutex create failed");
+        return false;
     }
-    xEventGroupSetBits(_arduino_event_group, WIFI_DNS_DONE_BIT);
+    tal_mutex_lock(_dns_mutex);
+    return true;
 }
 
-int WiFiGenericClass::hostByName(const char* aHostname, IPAddress& aResult)
+static void _dns_unlock()
 {
+    tal_mutex_unlock(_dns_mutex);
+}
 
-    if (!aResult.fromString(aHostname))
-    {
-        ip_addr_t addr;
-        aResult = static_cast<uint32_t>(0);
-        waitStatusBits(WIFI_DNS_IDLE_BIT, 16000);
-        clearStatusBits(WIFI_DNS_IDLE_BIT | WIFI_DNS_DONE_BIT);
-        err_t err = dns_gethostbyname(aHostname, &addr, &wifi_dns_found_callback, &aResult);
-        if(err == ERR_OK && addr.addr) {
-            aResult = addr.addr;
-        } else if(err == ERR_INPROGRESS) {
-            waitStatusBits(WIFI_DNS_DONE_BIT, 15000);  
-            clearStatusBits(WIFI_DNS_DONE_BIT);
+// all helpers below expect the lock to be held
+static wifi_dns_entry_t *_dns_cache_find(const char *name)
+{
+    for(int i = 0; i < WIFI_DNS_CACHE_SIZE; i++){
+        if(_dns_cache[i].name[0] && strcasecmp(_dns_cache[i].name, name) == 0){
+            return &_dns_cache[i];
+        }
+    }
+    return NULL;
+}
+
+static void _dns_cache_store(const char *name, uint32_t addr)
+{
+    if(!name[0]){
+        return;
+    }
+    unsigned long now = millis();
+    wifi_dns_entry_t *e = _dns_cache_find(name);
+    if(e && !addr && e->addr && (long)(e->expires - now) > 0){
+        // a failed refresh does not evict an answer that is still valid
+        return;
+    }
+    if(!e){
+        // empty slot first, then the least recently used one
+        e = &_dns_cache[0];
+        for(int i = 0; i < WIFI_DNS_CACHE_SIZE; i++){
+            if(!_dns_cache[i].name[0]){
+                e = &_dns_cache[i];
+                break;
+            }
+            if((long)(_dns_cache[i].lastUsed - e->lastUsed) < 0){
+                e = &_dns_cache[i];
+            }
+        }
+        strcpy(e->name, name);
+        e->lastUsed = now;
+    }
+    uint32_t ttl = WIFI_DNS_DEFAULT_TTL_S;
+    if(ttl < _dns_min_ttl) ttl = _dns_min_ttl;
+    if(ttl > _dns_max_ttl) ttl = _dns_max_ttl;
+    e->addr = addr;
+    e->expires = now + (addr ? ttl : _dns_negative_ttl) * 1000;
+}
+
+static wifi_dns_query_t *_dns_query_find(const char *name)
+{
+    for(wifi_dns_query_t *q = _dns_queries; q; q = q->next){
+        if(!q->done && q->name[0] && strcasecmp(q->name, name) == 0){
+            return q;
+        }
+    }
+    return NULL;
+}
+
+static void _dns_query_unref(wifi_dns_query_t *q)
+{
+    if(--q->refs){
+        return;
+    }
+    for(wifi_dns_query_t **pp = &_dns_queries; *pp; pp = &(*pp)->next){
+        if(*pp == q){
+            *pp = q->next;
+            break;
         }
-        setStatusBits(WIFI_DNS_IDLE_BIT);
-        if((uint32_t)aResult == 0){
-            PR_ERR("DNS Failed for %s\r\n", aHostname);
+    }
+    if(q->sem){
+        tal_semaphore_release(q->sem);
+    }
+    tal_free(q);
+}
+
+static wifi_dns_query_t *_dns_query_new(const char *name, uint8_t waiters)
+{
+    wifi_dns_query_t *q = (wifi_dns_query_t *)tal_malloc(sizeof(wifi_dns_query_t));
+    if(!q){
+        return NULL;
+    }
+    memset(q, 0, sizeof(wifi_dns_query_t));
+    // created for refreshes too, a hostByName() may join them later
+    if(tal_semaphore_create_init(&q->sem, 0, 0xFF) != OPRT_OK){
+        tal_free(q);
+        return NULL;
+    }
+    size_t len = strlen(name);
+    if(len < WIFI_DNS_NAME_MAX){
+        memcpy(q->name, name, len + 1);
+    }
+    q->waiters = waiters;
+    q->refs = waiters + 1;
+    q->next = _dns_queries;
+    _dns_queries = q;
+    return q;
+}
+
+static void _dns_query_complete(wifi_dns_query_t *q, uint32_t addr)
+{
+    q->addr = addr;
+    q->done = true;
+    _dns_cache_store(q->name, addr);
+    for(uint8_t i = 0; i < q->waiters; i++){
+        tal_semaphore_post(q->sem);
+    }
+    // drops the reference held for lwIP
+    _dns_query_unref(q);
+}
+
+static void wifi_dns_found_callback(const char *name, const ip_addr_t *ipaddr, void *callback_arg)
+{
+    if(!_dns_lock()){
+        return;
+    }
+    _dns_query_complete((wifi_dns_query_t *)callback_arg, ipaddr ? ipaddr->addr : 0);
+    _dns_unlock();
+}
+
+// hands the query to lwIP, must be called without the lock
+static void _dns_query_start(wifi_dns_query_t *q, const char *name)
+{
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(name, &addr, &wifi_dns_found_callback, q);
+    if(err == ERR_INPROGRESS){
+        return;
+    }
+    // answered from lwIP's own table, or failed right away: no callback follows
+    _dns_lock();
+    _dns_query_complete(q, (err == ERR_OK) ? addr.addr : 0);
+    _dns_unlock();
+}
+
+// starts a background refresh unless one is already running
+static void _dns_refresh(const char *name)
+{
+    if(!_dns_lock()){
+        return;
+    }
+    wifi_dns_query_t *q = NULL;
+    if(!_dns_query_find(name)){
+        q = _dns_query_new(name, 0);
+    }
+    _dns_unlock();
+    if(q){
+        _dns_query_start(q, name);
+    }
+}
+
+// returns 1 on a positive hit, -1 on a cached failure, 0 on a miss
+static int _dns_cache_lookup(const char *name, uint32_t *addr, bool *refresh)
+{
+    int res = 0;
+    unsigned long now = millis();
+    *refresh = false;
+    if(!_dns_lock()){
+        return 0;
+    }
+    wifi_dns_entry_t *e = _dns_cache_find(name);
+    if(e && (long)(e->expires - now) > 0){
+        e->lastUsed = now;
+        *addr = e->addr;
+        res = e->addr ? 1 : -1;
+        *refresh = e->addr && _dns_prefetch && (long)(e->expires - now) < WIFI_DNS_PREFETCH_S * 1000;
+    }
+    _dns_unlock();
+    return res;
+}
+
+bool WiFiGenericClass::hostByNameCached(const char* aHostname, IPAddress& aResult)
+{
+    if(aResult.fromString(aHostname)){
+        return true;
+    }
+    uint32_t addr = 0;
+    bool refresh;
+    if(_dns_cache_lookup(aHostname, &addr, &refresh) <= 0){
+        return false;
+    }
+    if(refresh){
+        _dns_refresh(aHostname);
+    }
+    aResult = addr;
+    return true;
+}
+
+int WiFiGenericClass::hostByName(const char* aHostname, IPAddress& aResult, uint32_t timeout_ms)
+{
+    if(aResult.fromString(aHostname)){
+        return 1;
+    }
+    aResult = static_cast<uint32_t>(0);
+
+    uint32_t addr = 0;
+    bool refresh;
+    int hit = _dns_cache_lookup(aHostname, &addr, &refresh);
+    if(hit){
+        if(refresh){
+            _dns_refresh(aHostname);
         }
+        aResult = addr;
+        return hit > 0;
+    }
+
+    if(!_dns_lock()){
+        return 0;
     }
+    bool owner = false;
+    wifi_dns_query_t *q = _dns_query_find(aHostname);
+    if(q){
+        // somebody is resolving this name already, share the answer
+        q->waiters++;
+        q->refs++;
+    } else {
+        q = _dns_query_new(aHostname, 1);
+        owner = true;
+    }
+    _dns_unlock();
+    if(!q){
+        PR_ERR("DNS query alloc failed for %s", aHostname);
+        return 0;
+    }
+    if(owner){
+        _dns_query_start(q, aHostname);
+    }
+
+    tal_semaphore_wait(q->sem, timeout_ms);
 
-    return (uint32_t)aResult != 0;
+    _dns_lock();
+    if(q->done){
+        addr = q->addr;
+    } else {
+        addr = 0;
+        q->waiters--;
+    }
+    _dns_query_unref(q);
+    _dns_unlock();
+
+    aResult = addr;
+    if(!addr){
+        PR_ERR("DNS Failed for %s\r\n", aHostname);
+    }
+    return addr != 0;
+}
+
+void WiFiGenericClass::prefetchHostByName(const char *aHostname)
+{
+    IPAddress ip;
+    if(ip.fromString(aHostname)){
+        return;
+    }
+    uint32_t addr;
+    bool refresh;
+    if(_dns_cache_lookup(aHostname, &addr, &refresh) > 0 && !refresh){
+        return;
+    }
+    _dns_refresh(aHostname);
+}
+
+void WiFiGenericClass::setDNSCacheTTL(uint32_t minSeconds, uint32_t maxSeconds)
+{
+    if(maxSeconds < minSeconds){
+        maxSeconds = minSeconds;
+    }
+    _dns_min_ttl = minSeconds;
+    _dns_max_ttl = maxSeconds;
+}
+
+void WiFiGenericClass::setDNSNegativeTTL(uint32_t seconds)
+{
+    _dns_negative_ttl = seconds;
+}
+
+void WiFiGenericClass::setDNSPrefetch(bool enable)
+{
+    _dns_prefetch = enable;
+}
+
+void WiFiGenericClass::clearDNSCache()
+{
+    if(!_dns_lock()){
+        return;
+    }
+    memset(_dns_cache, 0, sizeof(_dns_cache));
+    _dns_unlock();
 }
 
 IPAddress WiFiGenericClass::calculateNetworkID(IPAddress ip, IPAddress subnet) {
@@ -157,8 +157,28 @@ static const int ETH_HAS_IP_BIT    = BIT9;
 static const int ETH_HAS_IP6_BIT   = BIT10;
 static const int WIFI_SCANNING_BIT = BIT11;
 static const int WIFI_SCAN_DONE_BIT= BIT12;
-static const int WIFI_DNS_IDLE_BIT = BIT13;
-static const int WIFI_DNS_DONE_BIT = BIT14;
+
+#define WIFI_DNS_CACHE_SIZE         (8)
+#define WIFI_DNS_NAME_MAX           (96)     // longer names are resolved without caching
+#define WIFI_DNS_DEFAULT_TTL_S      (300)
+#define WIFI_DNS_MIN_TTL_S          (30)
+#define WIFI_DNS_MAX_TTL_S          (3600)
+#define WIFI_DNS_NEGATIVE_TTL_S     (10)
+#define WIFI_DNS_PREFETCH_S         (30)     // a hit this close to expiry refreshes in the background
+#define WIFI_DNS_TIMEOUT_MS         (15000)
+#define WIFI_RSSI_REFRESH_MS        (1000)
+
+// addresses as IPAddress keeps them, read by the getters without an SDK call
+typedef struct {
+    volatile bool valid;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns[2];
+    uint8_t bssid[6];           // of the AP connected to, or the MAC of the soft AP
+    int8_t rssi;
+    unsigned long rssiAt;
+} wifi_netif_cache_t;
 
 typedef enum {
 	WIFI_RX_ANT0 = 0,
@@ -206,16 +226,40 @@ class WiFiGenericClass
     static void useStaticBuffers(bool bufferMode);
     static bool useStaticBuffers();
 
+    // longest age of the RSSI returned by WiFi.RSSI(), 0 asks the SDK every time
+    static void setRSSIRefreshInterval(uint32_t ms) { _rssiRefreshMs = ms; }
+
   protected:
     static bool _persistent;
     static bool _long_range;
     static bool _wifiUseStaticBuffers;
 
+    /*
+     * Snapshots of the station and soft AP interfaces. The station one is
+     * filled by the event task on got IP and cleared on disconnect; the AP
+     * one by softAP(). Getters fall back to the SDK while they are not valid.
+     */
+    static wifi_netif_cache_t _staCache;
+    static wifi_netif_cache_t _apCache;
+    static uint32_t _rssiRefreshMs;
+    static void _updateStaCache(const arduino_event_t *event);
+
     static int setStatusBits(int bits);
     static int clearStatusBits(int bits);
 
   public:
-    static int hostByName(const char *aHostname, IPAddress &aResult);
+    // answers from the DNS cache when possible; concurrent lookups of the
+    // same name share one query, different names resolve in parallel
+    static int hostByName(const char *aHostname, IPAddress &aResult, uint32_t timeout_ms = WIFI_DNS_TIMEOUT_MS);
+    // cache only, never blocks
+    static bool hostByNameCached(const char *aHostname, IPAddress &aResult);
+    // starts a lookup in the background so a later hostByName() hits the cache
+    static void prefetchHostByName(const char *aHostname);
+    // lwIP does not report record TTLs, entries live WIFI_DNS_DEFAULT_TTL_S clamped to [min, max]
+    static void setDNSCacheTTL(uint32_t minSeconds, uint32_t maxSeconds);
+    static void setDNSNegativeTTL(uint32_t seconds);
+    static void setDNSPrefetch(bool enable);
+    static void clearDNSCache();
 
     static IPAddress calculateNetworkID(IPAddress ip, IPAddress subnet);
     static IPAddress calculateBroadcast(IPAddress ip, IPAddress subnet);
@@ -3,14 +3,47 @@
 #include "tal_system.h"
 #include "tal_log.h"
 #include "tal_memory.h"
+#include "tal_kv.h"
 
 extern "C" {
 #include <limits.h>
 #include <string.h>
 }
 
+#define WIFI_MULTI_KV_KEY       "wifi_multi_ap"
+#define WIFI_MULTI_CACHE_MAGIC  (0x574D)
+
+// kept in KV, followed by the fast connect info of the SDK if it has one
+struct wifi_multi_cache_t {
+    uint16_t magic;
+    uint8_t channel;
+    uint8_t reserved;
+    uint8_t bssid[6];
+    char ssid[33];
+    uint32_t passHash;          // a changed passphrase invalidates the entry
+    uint32_t infoLen;
+};
+
+static uint32_t wifi_multi_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+    while (s && *s) {
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    }
+    return h;
+}
+
 WiFiMulti::WiFiMulti()
 {
+    _cache = NULL;
+    _cacheLen = 0;
+    _cacheLoaded = false;
+    _fast = true;
+    _fastFailed = false;
+    _asyncScan = false;
+    _current = NULL;
+    _lastPath = WIFI_MULTI_NONE;
+    _lastConnectMs = 0;
 }
 
 WiFiMulti::~WiFiMulti()
@@ -25,6 +58,9 @@ WiFiMulti::~WiFiMulti()
         }
     }
     APlist.clear();
+    if(_cache) {
+        tal_free(_cache);
+    }
 }
 
 bool WiFiMulti::addAP(const char* ssid, const char *passphrase)
@@ -78,6 +114,190 @@ bool WiFiMulti::addAP(const char* ssid, const char *passphrase)
     return true;
 }
 
+WifiAPlist_t *WiFiMulti::_find(const char *ssid)
+{
+    for(uint32_t x = 0; x < APlist.size(); x++) {
+        if(strcmp(APlist[x].ssid, ssid) == 0) {
+            return &APlist[x];
+        }
+    }
+    return NULL;
+}
+
+void WiFiMulti::_loadCache()
+{
+    uint8_t *value = NULL;
+    size_t len = 0;
+
+    // KV is not ready while global constructors run, so read it on first use
+    if(_cacheLoaded) {
+        return;
+    }
+    _cacheLoaded = true;
+    if(tal_kv_get(WIFI_MULTI_KV_KEY, &value, &len) != OPRT_OK || !value) {
+        return;
+    }
+    wifi_multi_cache_t *cache = (wifi_multi_cache_t *)value;
+    if(len >= sizeof(wifi_multi_cache_t) && cache->magic == WIFI_MULTI_CACHE_MAGIC &&
+       len == sizeof(wifi_multi_cache_t) + cache->infoLen) {
+        _cache = (wifi_multi_cache_t *)tal_malloc(len);
+        if(_cache) {
+            memcpy(_cache, value, len);
+            _cache->ssid[sizeof(_cache->ssid) - 1] = 0;
+            _cacheLen = len;
+        }
+    }
+    tal_kv_free(value);
+}
+
+void WiFiMulti::_saveCache(WifiAPlist_t *ap)
+{
+    FAST_WF_CONNECTED_AP_INFO_T *info = NULL;
+    uint8_t channel = 0;
+
+    if(tkl_wifi_get_connected_ap_info(&info) != OPRT_OK) {
+        info = NULL;
+    }
+    uint32_t infoLen = info ? sizeof(FAST_WF_CONNECTED_AP_INFO_T) + info->len : 0;
+    size_t len = sizeof(wifi_multi_cache_t) + infoLen;
+    wifi_multi_cache_t *cache = (wifi_multi_cache_t *)tal_malloc(len);
+    if(!cache) {
+        if(info) {
+            tal_free(info);
+        }
+        return;
+    }
+    memset(cache, 0, sizeof(wifi_multi_cache_t));
+    cache->magic = WIFI_MULTI_CACHE_MAGIC;
+    tkl_wifi_get_cur_channel(&channel);
+    cache->channel = channel;
+    tkl_wifi_get_bssid(cache->bssid);
+    strncpy(cache->ssid, ap->ssid, sizeof(cache->ssid) - 1);
+    cache->passHash = wifi_multi_hash(ap->passphrase);
+    cache->infoLen = infoLen;
+    if(info) {
+        memcpy(cache + 1, info, infoLen);
+        tal_free(info);
+    }
+
+    // reconnecting to the same AP writes nothing
+    if(_cache && _cacheLen == len && memcmp(_cache, cache, len) == 0) {
+        tal_free(cache);
+        return;
+    }
+    if(tal_kv_set(WIFI_MULTI_KV_KEY, (const uint8_t *)cache, len) != OPRT_OK) {
+        PR_ERR("[WIFI] save AP cache failed\r\n");
+    }
+    if(_cache) {
+        tal_free(_cache);
+    }
+    _cache = cache;
+    _cacheLen = len;
+}
+
+void WiFiMulti::clearCache()
+{
+    _loadCache();
+    if(_cache) {
+        tal_free(_cache);
+        _cache = NULL;
+        _cacheLen = 0;
+        tal_kv_del(WIFI_MULTI_KV_KEY);
+    }
+}
+
+uint8_t WiFiMulti::_wait(uint32_t timeout)
+{
+    uint8_t status = WiFi.status();
+
+    auto startTime = millis();
+    // wait for connection, fail, or timeout
+    while(status != WSS_GOT_IP && status != WSS_NO_AP_FOUND && status != WSS_CONN_FAIL && (millis() - startTime) <= timeout) {
+        tal_system_sleep(10);
+        status = WiFi.status();
+    }
+    return status;
+}
+
+uint8_t WiFiMulti::_connect(WifiAPlist_t *ap, int32_t channel, const uint8_t *bssid, uint32_t timeout)
+{
+    if(bssid) {
+        PR_INFO("[WIFI] Connecting BSSID: %02X:%02X:%02X:%02X:%02X:%02X SSID: %s Channel: %d\r\n", bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5], ap->ssid, channel);
+    }
+    WiFi.begin(ap->ssid, ap->passphrase, channel, bssid);
+    return _wait(timeout);
+}
+
+uint8_t WiFiMulti::_fastConnect(uint32_t timeout)
+{
+    if(!_fast || _fastFailed || !_cache || !_cache->infoLen) {
+        return WSS_IDLE;
+    }
+    WifiAPlist_t *ap = _find(_cache->ssid);
+    if(!ap || wifi_multi_hash(ap->passphrase) != _cache->passHash) {
+        return WSS_IDLE;
+    }
+    if(!WiFi.enableSTA(true)) {
+        return WSS_CONN_FAIL;
+    }
+
+    PR_INFO("[WIFI] fast connect SSID: %s Channel: %d\r\n", _cache->ssid, _cache->channel);
+    if(tkl_wifi_station_fast_connect((const FAST_WF_CONNECTED_AP_INFO_T *)(_cache + 1)) != OPRT_OK) {
+        _fastFailed = true;
+        return WSS_CONN_FAIL;
+    }
+    uint8_t status = _wait(timeout < WIFI_MULTI_FAST_TIMEOUT ? timeout : WIFI_MULTI_FAST_TIMEOUT);
+    if(status != WSS_GOT_IP) {
+        PR_NOTICE("[WIFI] fast connect failed (%d)\r\n", status);
+        _fastFailed = true;
+        tkl_wifi_station_disconnect();
+        return status;
+    }
+    _current = ap->ssid;
+    return status;
+}
+
+uint8_t WiFiMulti::_targetedConnect(uint32_t timeout)
+{
+    if(!_cache) {
+        return WSS_IDLE;
+    }
+    WifiAPlist_t *ap = _find(_cache->ssid);
+    if(!ap) {
+        return WSS_IDLE;
+    }
+    if(!WiFi.enableSTA(true)) {
+        return WSS_CONN_FAIL;
+    }
+
+    // a directed probe for one SSID, keeping the APs on its last channel
+    int16_t n = WiFi.scanNetworks(false, false, false, 300, _cache->channel, ap->ssid);
+    if(n <= 0) {
+        return WSS_NO_AP_FOUND;
+    }
+    const AP_IF_S *best = NULL;
+    for(int16_t i = 0; i < n; i++) {
+        const AP_IF_S &it = WiFi.getNetworkInfo(i);
+        if(!best || it.rssi > best->rssi) {
+            best = &it;
+        }
+    }
+    uint8_t status = WSS_NO_AP_FOUND;
+    if(best->security == WAAM_OPEN || ap->passphrase) {
+        uint8_t bssid[6];
+        int32_t channel = best->channel;
+        memcpy(bssid, best->bssid, sizeof(bssid));
+        WiFi.scanDelete();
+        status = _connect(ap, channel, bssid, timeout);
+        if(status == WSS_GOT_IP) {
+            _current = ap->ssid;
+        }
+    } else {
+        WiFi.scanDelete();
+    }
+    return status;
+}
+
 uint8_t WiFiMulti::run(uint32_t connectTimeout)
 {
 
@@ -85,10 +305,10 @@ uint8_t WiFiMulti::run(uint32_t connectTimeout)
     uint8_t status = WiFi.status();
 
     if(status == WSS_GOT_IP) {
-        for(uint32_t x = 0; x < APlist.size(); x++) {
-            if(WiFi.SSID()==APlist[x].ssid) {
-                return status;
-            }
+        // the SDK cannot tell the SSID of the connection, so an unknown one is kept
+        String ssid = WiFi.SSID();
+        if(_current || ssid.length() == 0 || _find(ssid.c_str())) {
+            return status;
         }
         PR_ERR("WiFi.disconnect\r\n");
         WiFi.disconnect(false,false);
@@ -97,14 +317,44 @@ uint8_t WiFiMulti::run(uint32_t connectTimeout)
         status = WiFi.status();
     }
 
-    scanResult = WiFi.scanNetworks();
+    _current = NULL;
+    _loadCache();
+    auto connectStart = millis();
+
+    // the sync scans below cannot start while a scan runs, come back later
+    scanResult = WiFi.scanComplete();
+    if(scanResult == WIFI_SCAN_RUNNING) {
+        return WSS_NO_AP_FOUND;
+    }
+    if(_asyncScan) {
+        // results of the scan started by an earlier call
+        _asyncScan = false;
+    } else {
+        status = _fastConnect(connectTimeout);
+        if(status == WSS_GOT_IP) {
+            _lastPath = WIFI_MULTI_FAST;
+            _lastConnectMs = millis() - connectStart;
+            PR_INFO("[WIFI] Connecting done in %d ms.\r\n", (int)_lastConnectMs);
+            return status;
+        }
+        status = _targetedConnect(connectTimeout);
+        if(status == WSS_GOT_IP) {
+            _lastPath = WIFI_MULTI_TARGETED;
+            _lastConnectMs = millis() - connectStart;
+            _fastFailed = false;
+            _saveCache(_find(_current));
+            PR_INFO("[WIFI] Connecting done in %d ms.\r\n", (int)_lastConnectMs);
+            return status;
+        }
+        scanResult = WiFi.scanNetworks();
+    }
     if(scanResult == WIFI_SCAN_RUNNING) {
         // scan is running
         return WSS_NO_AP_FOUND;
     }
     else if(scanResult >= 0) {
         // scan done analyze
-        WifiAPlist_t bestNetwork { NULL, NULL };
+        WifiAPlist_t *bestNetwork = NULL;
         int bestNetworkDb = INT_MIN;
         uint8_t bestBSSID[6];
         int32_t bestChannel = 0;
@@ -116,34 +366,29 @@ uint8_t WiFiMulti::run(uint32_t connectTimeout)
         } else {
             PR_INFO("[WIFI] %d networks found\r\n", scanResult);
             for(int8_t i = 0; i < scanResult; ++i) {
+                AP_IF_S *it = (AP_IF_S *)WiFi.getScanInfoByIndex(i);
+                if(!it) {
+                    continue;
+                }
+                const char *ssid_scan = (const char *)it->ssid;
+                int32_t rssi_scan = it->rssi;
+                uint8_t sec_scan = it->security;
+                uint8_t *BSSID_scan = it->bssid;
+                int32_t chan_scan = it->channel;
 
-                String ssid_scan;
-                int32_t rssi_scan;
-                uint8_t sec_scan;
-                uint8_t* BSSID_scan;
-                int32_t chan_scan;
-
-                WiFi.getNetworkInfo(i, ssid_scan, sec_scan, rssi_scan, BSSID_scan, chan_scan);
-
-                bool known = false;
-                for(uint32_t x = APlist.size() ; x > 0; x--) {
-                    WifiAPlist_t entry = APlist[x-1];
-
-                    if(ssid_scan == entry.ssid) { // SSID match
-                        known = true;
-                        if(rssi_scan > bestNetworkDb) { // best network
-                            if(sec_scan == WAAM_OPEN || entry.passphrase) { // check for passphrase if not open wlan
-                                bestNetworkDb = rssi_scan;
-                                bestChannel = chan_scan;
-                                memcpy((void*) &bestNetwork, (void*) &entry, sizeof(bestNetwork));
-                                memcpy((void*) &bestBSSID, (void*) BSSID_scan, sizeof(bestBSSID));
-                            }
+                WifiAPlist_t *entry = _find(ssid_scan);
+                if(entry) { // SSID match
+                    if(rssi_scan > bestNetworkDb) { // best network
+                        if(sec_scan == WAAM_OPEN || entry->passphrase) { // check for passphrase if not open wlan
+                            bestNetworkDb = rssi_scan;
+                            bestChannel = chan_scan;
+                            bestNetwork = entry;
+                            memcpy((void*) &bestBSSID, (void*) BSSID_scan, sizeof(bestBSSID));
                         }
-                        break;
                     }
                 }
 
-                if(known) {
+                if(entry) {
                     PR_INFO(" --->   %d: [%d][%02X:%02X:%02X:%02X:%02X:%02X] %s (%d) %c\r\n", i, chan_scan, BSSID_scan[0], BSSID_scan[1], BSSID_scan[2], BSSID_scan[3], BSSID_scan[4], BSSID_scan[5], ssid_scan, rssi_scan, (sec_scan == WAAM_OPEN) ? ' ' : '*');
                 } else {
                     PR_INFO("       %d: [%d][%02X:%02X:%02X:%02X:%02X:%02X] %s (%d) %c\r\n", i, chan_scan, BSSID_scan[0], BSSID_scan[1], BSSID_scan[2], BSSID_scan[3], BSSID_scan[4], BSSID_scan[5], ssid_scan, rssi_scan, (sec_scan == WAAM_OPEN) ? ' ' : '*');
@@ -154,24 +399,19 @@ uint8_t WiFiMulti::run(uint32_t connectTimeout)
         // clean up ram
         WiFi.scanDelete();
 
-        if(bestNetwork.ssid) {
-            PR_INFO("[WIFI] Connecting BSSID: %02X:%02X:%02X:%02X:%02X:%02X SSID: %s Channel: %d (%d)\r\n", bestBSSID[0], bestBSSID[1], bestBSSID[2], bestBSSID[3], bestBSSID[4], bestBSSID[5], bestNetwork.ssid, bestChannel, bestNetworkDb);
-
-            WiFi.begin(bestNetwork.ssid, bestNetwork.passphrase, bestChannel, bestBSSID);
-            status = WiFi.status();
-
-            auto startTime = millis();
-            // wait for connection, fail, or timeout
-            while(status != WSS_GOT_IP && status != WSS_NO_AP_FOUND && status != WSS_CONN_FAIL && (millis() - startTime) <= connectTimeout) {
-                //rtos_delay_milliseconds(10);
-                tal_system_sleep(10);
-                status = WiFi.status();
-            }
+        if(bestNetwork) {
+            PR_INFO("[WIFI] RSSI: %d\r\n", bestNetworkDb);
+            status = _connect(bestNetwork, bestChannel, bestBSSID, connectTimeout);
 
             switch(status) {
             case WSS_GOT_IP:
-                PR_INFO("[WIFI] Connecting done.\r\n");
-                PR_INFO("[WIFI] SSID: %s\r\n", WiFi.SSID().c_str());
+                _current = bestNetwork->ssid;
+                _lastPath = WIFI_MULTI_FULL;
+                _lastConnectMs = millis() - connectStart;
+                _fastFailed = false;
+                _saveCache(bestNetwork);
+                PR_INFO("[WIFI] Connecting done in %d ms.\r\n", (int)_lastConnectMs);
+                PR_INFO("[WIFI] SSID: %s\r\n", bestNetwork->ssid);
                 PR_INFO("[WIFI] IP: %s\r\n", WiFi.localIP().toString().c_str());
                 PR_INFO("[WIFI] MAC: %s\r\n", WiFi.BSSIDstr().c_str());
                 PR_INFO("[WIFI] Channel: %d\r\n", WiFi.channel());
@@ -197,8 +437,8 @@ uint8_t WiFiMulti::run(uint32_t connectTimeout)
         WiFi.disconnect();
 
         PR_INFO("[WIFI] start scan\r\n");
-        // scan wifi async mode
-        WiFi.scanNetworks(true);
+        // scan wifi async mode, the next run() picks up the results
+        _asyncScan = (WiFi.scanNetworks(true) == WIFI_SCAN_RUNNING);
     }
     return status;
 }
@@ -4,11 +4,22 @@
 #include "WiFi.h"
 #include <vector>
 
+#define WIFI_MULTI_FAST_TIMEOUT     (3000)      // ms, for the cached AP before scanning
+
 typedef struct {
     char * ssid;
     char * passphrase;
 } WifiAPlist_t;
 
+typedef enum {
+    WIFI_MULTI_NONE = 0,
+    WIFI_MULTI_FAST,            // cached BSSID and channel, no scan
+    WIFI_MULTI_TARGETED,        // scan for the cached SSID only
+    WIFI_MULTI_FULL,            // full scan of all channels
+} wifi_multi_path_t;
+
+struct wifi_multi_cache_t;
+
 class WiFiMulti
 {
 public:
@@ -16,10 +27,39 @@ public:
     ~WiFiMulti();
 
     bool addAP(const char* ssid, const char *passphrase = NULL);
+    /*
+     * The AP of the last successful connection is kept in KV. run() first
+     * connects to it directly with its BSSID and channel, then scans for
+     * its SSID only, and scans all networks only if both fail.
+     */
     uint8_t run(uint32_t connectTimeout=5000);
 
+    void setFastConnect(bool enable) { _fast = enable; }
+    // forgets the cached AP, also in KV
+    void clearCache();
+    // how and how fast the last connection made by run() was established
+    wifi_multi_path_t lastPath() const { return _lastPath; }
+    uint32_t lastConnectTime() const { return _lastConnectMs; }
+
 private:
     std::vector<WifiAPlist_t> APlist;
+    wifi_multi_cache_t *_cache;
+    size_t _cacheLen;
+    bool _cacheLoaded;
+    bool _fast;
+    bool _fastFailed;           // skip the cached AP until the next connection
+    bool _asyncScan;            // run() started a scan that has not been used yet
+    const char *_current;       // SSID of the entry run() connected to
+    wifi_multi_path_t _lastPath;
+    uint32_t _lastConnectMs;
+
+    WifiAPlist_t *_find(const char *ssid);
+    uint8_t _wait(uint32_t timeout);
+    uint8_t _connect(WifiAPlist_t *ap, int32_t channel, const uint8_t *bssid, uint32_t timeout);
+    uint8_t _fastConnect(uint32_t timeout);
+    uint8_t _targetedConnect(uint32_t timeout);
+    void _loadCache();
+    void _saveCache(WifiAPlist_t *ap);
 };
 
 #endif /* WIFICLIENTMULTI_H_ */
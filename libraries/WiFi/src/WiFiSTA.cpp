@@ -97,6 +97,7 @@ bool WiFiSTAClass::reconnect()
 
 bool WiFiSTAClass::disconnect(bool wifioff, bool eraseap)
 {
+    WiFiGenericClass::_staCache.valid = false;
     OPERATE_RET rt = OPRT_OK;
     WiFiMode_t workMode = WiFi.getMode();
     if (workMode == WIFI_AP) {
@@ -142,7 +143,10 @@ bool WiFiSTAClass::config(IPAddress local_ip, IPAddress gateway, IPAddress subne
     sta_ip.mask[sizeof(sta_ip.mask) - 1] = '\0';
     
     int res = tkl_wifi_set_ip(WF_STATION, &sta_ip);
-    
+    // the cached addresses are the old ones now, read them from the SDK
+    // until the next got-ip event fills the cache again
+    WiFiGenericClass::_staCache.valid = false;
+
     return (res == OPRT_OK);
 }
 
@@ -182,6 +186,9 @@ uint8_t WiFiSTAClass::waitForConnectResult(unsigned long timeoutLength)
 
 IPAddress WiFiSTAClass::localIP()
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return IPAddress(WiFiGenericClass::_staCache.ip);
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -210,6 +217,9 @@ String WiFiSTAClass::macAddress(void)
 
 IPAddress WiFiSTAClass::subnetMask()
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return IPAddress(WiFiGenericClass::_staCache.subnet);
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -222,6 +232,9 @@ IPAddress WiFiSTAClass::subnetMask()
 
 IPAddress WiFiSTAClass::gatewayIP()
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return IPAddress(WiFiGenericClass::_staCache.gateway);
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -236,6 +249,9 @@ IPAddress WiFiSTAClass::gatewayIP()
 
 IPAddress WiFiSTAClass::dnsIP(uint8_t dns_no)
 {
+    if(WiFiGenericClass::_staCache.valid && dns_no < 2){
+        return IPAddress(WiFiGenericClass::_staCache.dns[dns_no]);
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -252,6 +268,9 @@ IPAddress WiFiSTAClass::dnsIP(uint8_t dns_no)
 
 IPAddress WiFiSTAClass::broadcastIP()
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return WiFiGenericClass::calculateBroadcast(IPAddress(WiFiGenericClass::_staCache.gateway), IPAddress(WiFiGenericClass::_staCache.subnet));
+    }
     
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
@@ -267,6 +286,9 @@ IPAddress WiFiSTAClass::broadcastIP()
 
 IPAddress WiFiSTAClass::networkID()
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return WiFiGenericClass::calculateNetworkID(IPAddress(WiFiGenericClass::_staCache.gateway), IPAddress(WiFiGenericClass::_staCache.subnet));
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
     }
@@ -282,6 +304,9 @@ IPAddress WiFiSTAClass::networkID()
 
 uint8_t WiFiSTAClass::subnetCIDR()
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return WiFiGenericClass::calculateSubnetCIDR(IPAddress(WiFiGenericClass::_staCache.subnet));
+    }
 
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return IPAddress();
@@ -312,6 +337,9 @@ String WiFiSTAClass::psk() const
 
 uint8_t* WiFiSTAClass::BSSID(void)
 {
+    if(WiFiGenericClass::_staCache.valid){
+        return WiFiGenericClass::_staCache.bssid;
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return NULL;
     }
@@ -335,6 +363,18 @@ String WiFiSTAClass::BSSIDstr(void)
 
 int8_t WiFiSTAClass::RSSI(void)
 {
+    if(WiFiGenericClass::_staCache.valid){
+        unsigned long now = millis();
+        if(now - WiFiGenericClass::_staCache.rssiAt <= WiFiGenericClass::_rssiRefreshMs){
+            return WiFiGenericClass::_staCache.rssi;
+        }
+        int8_t rssi;
+        if(tkl_wifi_station_get_conn_ap_rssi(&rssi) == OPRT_OK){
+            WiFiGenericClass::_staCache.rssi = rssi;
+            WiFiGenericClass::_staCache.rssiAt = now;
+        }
+        return WiFiGenericClass::_staCache.rssi;
+    }
     if(WiFiGenericClass::getMode() == WWM_POWERDOWN){
         return 0;
     }
@@ -3,6 +3,8 @@
 #include "WiFiGeneric.h"
 #include "WiFiScan.h"
 #include "tal_log.h"
+#include "tal_mutex.h"
+#include "tal_thread.h"
 
 extern "C" {
 #include <stdint.h>
@@ -15,19 +17,206 @@ extern "C" {
 #include "lwip/err.h"
 }
 
+typedef struct {
+    bool show_hidden;
+    bool has_bssid;
+    uint8_t channel;
+    uint8_t bssid[6];
+    char ssid[33];
+} wifi_scan_filter_t;
+
+extern bool tcpipInit();
+extern int postArduinoEvent(arduino_event_t *data);
+
+AP_IF_S * WiFiScanClass::ap_info = NULL;
+uint32_t WiFiScanClass::ap_num = 0;
+volatile int16_t WiFiScanClass::_scanStatus = WIFI_SCAN_FAILED;
+
+static MUTEX_HANDLE _scan_mutex = NULL;
+static THREAD_HANDLE _scan_task = NULL;
+static wifi_scan_filter_t _scan_filter;
+// results of the async scan until the event task publishes them
+static AP_IF_S *_scan_pending = NULL;
+static uint32_t _scan_pending_num = 0;
+
+static bool _scan_lock()
+{
+    if(!_scan_mutex && tal_mutex_create_init(&_scan_mutex) != OPRT_OK){
+        PR_ERR("scan mutex create failed");
+        return false;
+    }
+    tal_mutex_lock(_scan_mutex);
+    return true;
+}
+
+static void _scan_unlock()
+{
+    tal_mutex_unlock(_scan_mutex);
+}
+
+// drops the entries the filter does not want, in place
+static OPERATE_RET _scan_run(const wifi_scan_filter_t *filter, AP_IF_S **result, uint32_t *count)
+{
+    AP_IF_S *ap = NULL;
+    uint32_t num = 0;
+
+    *result = NULL;
+    *count = 0;
+    OPERATE_RET rt = tkl_wifi_scan_ap(filter->ssid[0] ? (const int8_t *)filter->ssid : NULL, &ap, &num);
+    if(rt != OPRT_OK || !ap){
+        return rt;
+    }
+
+    uint32_t n = 0;
+    for(uint32_t i = 0; i < num; i++){
+        AP_IF_S *it = &ap[i];
+        if(!filter->show_hidden && !it->ssid[0]){
+            continue;
+        }
+        if(filter->channel && it->channel != filter->channel){
+            continue;
+        }
+        if(filter->has_bssid && memcmp(it->bssid, filter->bssid, sizeof(filter->bssid)) != 0){
+            continue;
+        }
+        if(filter->ssid[0] && strcmp((const char *)it->ssid, filter->ssid) != 0){
+            continue;
+        }
+        if(n != i){
+            ap[n] = *it;
+        }
+        n++;
+    }
+    if(!n){
+        tkl_wifi_release_ap(ap);
+        return OPRT_OK;
+    }
+    *result = ap;
+    *count = n;
+    return OPRT_OK;
+}
+
+static void _scan_task_fn(void *arg)
+{
+    arduino_event_t event;
+    AP_IF_S *result = NULL;
+    uint32_t num = 0;
+
+    OPERATE_RET rt = _scan_run(&_scan_filter, &result, &num);
+    _scan_pending = result;
+    _scan_pending_num = num;
+
+    memset(&event, 0, sizeof(event));
+    event.event_id = ARDUINO_EVENT_WIFI_SCAN_DONE;
+    event.event_info.wifi_scan_done.status = (rt == OPRT_OK) ? 0 : 1;
+    event.event_info.wifi_scan_done.number = (num > 0xFF) ? 0xFF : num;
+    if(postArduinoEvent(&event) != OPRT_OK){
+        // the queue is full, publish the results without the event
+        WiFiScanClass::_scanDone(&event);
+    }
+
+    THREAD_HANDLE task = _scan_task;
+    _scan_task = NULL;
+    tal_thread_delete(task);
+}
+
+void WiFiScanClass::_scanDone(arduino_event_t *event)
+{
+    if(!_scan_lock()){
+        return;
+    }
+    if(_scanStatus == WIFI_SCAN_RUNNING){
+        ap_info = _scan_pending;
+        ap_num = _scan_pending_num;
+        _scan_pending = NULL;
+        _scan_pending_num = 0;
+        _scanStatus = (event->event_info.wifi_scan_done.status == 0) ? (int16_t)ap_num : WIFI_SCAN_FAILED;
+        WiFiGenericClass::clearStatusBits(WIFI_SCANNING_BIT);
+        WiFiGenericClass::setStatusBits(WIFI_SCAN_DONE_BIT);
+    }
+    _scan_unlock();
+}
+
 int16_t WiFiScanClass::scanNetworks(bool async, bool show_hidden, bool passive, uint32_t max_ms_per_chan, uint8_t channel, const char * ssid, const uint8_t * bssid)
 {
+    if(!_scan_lock()){
+        return WIFI_SCAN_FAILED;
+    }
+    if(_scanStatus == WIFI_SCAN_RUNNING){
+        _scan_unlock();
+        return WIFI_SCAN_RUNNING;
+    }
+    if(ap_info){
+        tkl_wifi_release_ap(ap_info);
+    }
     ap_info = NULL;
     ap_num = 0;
-    tkl_wifi_scan_ap(NULL,&ap_info,&ap_num);
-    return ap_num;
+    _scanStatus = WIFI_SCAN_RUNNING;
+    _scan_unlock();
+
+    memset(&_scan_filter, 0, sizeof(_scan_filter));
+    _scan_filter.show_hidden = show_hidden;
+    _scan_filter.channel = channel;
+    if(bssid){
+        _scan_filter.has_bssid = true;
+        memcpy(_scan_filter.bssid, bssid, sizeof(_scan_filter.bssid));
+    }
+    if(ssid){
+        strncpy(_scan_filter.ssid, ssid, sizeof(_scan_filter.ssid) - 1);
+    }
+    WiFiGenericClass::clearStatusBits(WIFI_SCAN_DONE_BIT);
+    WiFiGenericClass::setStatusBits(WIFI_SCANNING_BIT);
+
+    if(async){
+        // the results are handed over through the event task
+        if(tcpipInit()){
+            THREAD_CFG_T param;
+            param.priority = THREAD_PRIO_3;
+            param.stackDepth = WIFI_SCAN_TASK_STACK;
+            char threadName[] = "wifi_scan";
+            param.thrdname = threadName;
+            if(tal_thread_create_and_start(&_scan_task, NULL, NULL, _scan_task_fn, NULL, &param) == OPRT_OK){
+                return WIFI_SCAN_RUNNING;
+            }
+        }
+        PR_ERR("scan task start failed");
+        _scan_task = NULL;
+        _scanStatus = WIFI_SCAN_FAILED;
+        WiFiGenericClass::clearStatusBits(WIFI_SCANNING_BIT);
+        return WIFI_SCAN_FAILED;
+    }
+
+    AP_IF_S *result = NULL;
+    uint32_t num = 0;
+    OPERATE_RET rt = _scan_run(&_scan_filter, &result, &num);
+    _scan_lock();
+    ap_info = result;
+    ap_num = num;
+    _scanStatus = (rt == OPRT_OK) ? (int16_t)num : WIFI_SCAN_FAILED;
+    _scan_unlock();
+    WiFiGenericClass::clearStatusBits(WIFI_SCANNING_BIT);
+    WiFiGenericClass::setStatusBits(WIFI_SCAN_DONE_BIT);
+    return _scanStatus;
+}
+
+int16_t WiFiScanClass::scanComplete()
+{
+    return _scanStatus;
 }
 
 void WiFiScanClass::scanDelete()
 {
+    bool locked = _scan_lock();
     if( ap_info != NULL)
         tkl_wifi_release_ap(ap_info);
+    ap_info = NULL;
     ap_num = 0;
+    if(_scanStatus != WIFI_SCAN_RUNNING){
+        _scanStatus = WIFI_SCAN_FAILED;
+    }
+    if(locked){
+        _scan_unlock();
+    }
     PR_INFO("scanDelete Done!\n"); 
 }
 
@@ -54,6 +243,16 @@ bool WiFiScanClass::getNetworkInfo(uint32_t i, String &ssid, uint8_t &encType, i
     return true;
 }
 
+const AP_IF_S &WiFiScanClass::getNetworkInfo(uint32_t i) const
+{
+    static const AP_IF_S empty = {};
+    AP_IF_S* it = reinterpret_cast<AP_IF_S*>(_getScanInfoByIndex(i));
+    if(!it) {
+        return empty;
+    }
+    return *it;
+}
+
 String WiFiScanClass::SSID(uint8_t i)
 {
     AP_IF_S* it = reinterpret_cast<AP_IF_S*>(_getScanInfoByIndex(i));
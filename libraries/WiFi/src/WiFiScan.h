@@ -4,12 +4,28 @@
 #include "WiFiType.h"
 #include "WiFiGeneric.h"
 
+#define WIFI_SCAN_TASK_STACK    (2048)
+
 class WiFiScanClass
 {
 public:
+    /*
+     * An async scan runs in its own task and returns WIFI_SCAN_RUNNING at
+     * once; the results are published by the WiFi event task, which then
+     * sends ARDUINO_EVENT_WIFI_SCAN_DONE. Poll scanComplete() or register
+     * for the event. A scan started while one runs returns WIFI_SCAN_RUNNING.
+     *
+     * `ssid` makes the SDK probe for that network only; `channel`, `bssid`
+     * and show_hidden filter the results. The SDK has no passive scan and
+     * no dwell time setting, so `passive` and `max_ms_per_chan` are ignored.
+     */
     int16_t scanNetworks(bool async = false, bool show_hidden = false, bool passive = false, uint32_t max_ms_per_chan = 300, uint8_t channel = 0, const char * ssid=nullptr, const uint8_t * bssid=nullptr);
+    // number of networks found, WIFI_SCAN_RUNNING or WIFI_SCAN_FAILED
+    int16_t scanComplete();
     void scanDelete();
     bool getNetworkInfo(uint32_t networkItem, String &ssid, uint8_t &encryptionType, int32_t &RSSI, uint8_t* &BSSID, int32_t &channel);
+    // no copy; valid until scanDelete() or the next scan, an empty entry when out of range
+    const AP_IF_S &getNetworkInfo(uint32_t networkItem) const;
 
     String SSID(uint8_t networkItem);
     WF_AP_AUTH_MODE_E encryptionType(uint8_t networkItem);
@@ -19,12 +35,16 @@ public:
     int32_t channel(uint8_t networkItem);
     void * getScanInfoByIndex(uint32_t i) { return _getScanInfoByIndex(i); };
 
+    // called by the WiFi event task when an async scan has finished
+    static void _scanDone(arduino_event_t *event);
+
 protected:
-    void * _getScanInfoByIndex(uint32_t i);
+    static void * _getScanInfoByIndex(uint32_t i);
 
 private:
-    AP_IF_S * ap_info;
-    uint32_t ap_num;
+    static AP_IF_S * ap_info;
+    static uint32_t ap_num;
+    static volatile int16_t _scanStatus;
 };
 
 
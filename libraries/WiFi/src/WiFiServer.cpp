@@ -19,11 +19,27 @@
 #include "WiFiServer.h"
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
+#include <new>
+#include <errno.h>
 #include "tal_log.h"
+#include "tal_memory.h"
 #include "tal_network.h"
 
 #undef write
 #undef close
+#undef read
+
+#define WIFI_SERVER_RX_CHUNK_SIZE   (1436)
+
+static WiFiNetStats _server_stats;
+
+struct WiFiServerConnection {
+  bool used;
+  WiFiClient client;
+  WiFiServerClientStats stats;
+
+  WiFiServerConnection():used(false) {}
+};
 
 int WiFiServer::setTimeout(uint32_t seconds){
   struct timeval tv;
@@ -35,10 +51,221 @@ int WiFiServer::setTimeout(uint32_t seconds){
 }
 
 size_t WiFiServer::write(const uint8_t *data, size_t len){
-  return 0;
+  if(!_conns || !_numClients || !data || !len)
+    return 0;
+  // report the smallest amount any client accepted
+  size_t res = len;
+  for(uint8_t i = 0; i < _max_clients; i++){
+    if(!_conns[i].used)
+      continue;
+    size_t sent = write(i, data, len);
+    if(sent < res)
+      res = sent;
+  }
+  return res;
+}
+
+size_t WiFiServer::write(uint8_t slot, const uint8_t *data, size_t len){
+  if(!_conns || slot >= _max_clients || !_conns[slot].used)
+    return 0;
+  size_t sent = _conns[slot].client.write(data, len);
+  _conns[slot].stats.txBytes += sent;
+  _stats.bytesOut += sent;
+  _server_stats.bytesOut += sent;
+  return sent;
+}
+
+void WiFiServer::stopAll(){
+  if(!_conns)
+    return;
+  for(uint8_t i = 0; i < _max_clients; i++){
+    if(_conns[i].used)
+      _releaseClient(i);
+  }
+}
+
+bool WiFiServer::_allocClientTable(){
+  if(_conns)
+    return true;
+  if(!_max_clients)
+    return false;
+  _conns = new(std::nothrow) WiFiServerConnection[_max_clients];
+  _rxScratch = (uint8_t *)tal_malloc(WIFI_SERVER_RX_CHUNK_SIZE);
+  if(!_conns || !_rxScratch){
+    PR_ERR("WiFiServer client table alloc failed (%d clients)", _max_clients);
+    _freeClientTable();
+    return false;
+  }
+  _numClients = 0;
+  return true;
+}
+
+void WiFiServer::_freeClientTable(){
+  if(_conns){
+    stopAll();
+    delete[] _conns;
+    _conns = NULL;
+  }
+  if(_rxScratch){
+    tal_free(_rxScratch);
+    _rxScratch = NULL;
+  }
+  _numClients = 0;
+}
+
+void WiFiServer::_releaseClient(uint8_t slot){
+  WiFiServerConnection &conn = _conns[slot];
+  conn.used = false;
+  _numClients--;
+  if(_disconnectCb)
+    _disconnectCb(slot, conn.client);
+  conn.client.stop();
+}
+
+int WiFiServer::_acceptClients(unsigned long now){
+  int accepted = 0;
+  for(;;){
+    int client_sock;
+    if(_accepted_sockfd >= 0){
+      client_sock = _accepted_sockfd;
+      _accepted_sockfd = -1;
+    } else {
+      client_sock = tal_net_accept(sockfd, NULL, NULL);
+    }
+    if(client_sock < 0)
+      break;
+
+    uint8_t slot = _max_clients;
+    for(uint8_t i = 0; i < _max_clients; i++){
+      if(!_conns[i].used){
+        slot = i;
+        break;
+      }
+    }
+    if(slot == _max_clients){
+      // table full, refuse instead of letting it queue in the backlog
+      tal_net_close(client_sock);
+      _rejected++;
+      _stats.connectFails++;
+      _server_stats.connectFails++;
+      continue;
+    }
+
+    int val = 1;
+    tal_net_setsockopt(client_sock, SOL_SOCKET, SO_KEEPALIVE, (char*)&val, sizeof(int));
+    val = _noDelay;
+    tal_net_setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, (char*)&val, sizeof(int));
+
+    WiFiServerConnection &conn = _conns[slot];
+    conn.client = WiFiClient(client_sock);
+    conn.used = true;
+    conn.stats.remoteIP = conn.client.remoteIP();
+    conn.stats.remotePort = conn.client.remotePort();
+    conn.stats.connectedAt = now;
+    conn.stats.lastActivity = now;
+    conn.stats.rxBytes = 0;
+    conn.stats.txBytes = 0;
+    _countAccepted();
+    _numClients++;
+    accepted++;
+    if(_connectCb)
+      _connectCb(slot, conn.client);
+  }
+  return accepted;
+}
+
+int WiFiServer::_readClient(uint8_t slot, unsigned long now){
+  WiFiServerConnection &conn = _conns[slot];
+  conn.stats.lastActivity = now;
+  if(!_dataCb)
+    return 0;
+  int total = 0;
+  int avail;
+  while(conn.used && (avail = conn.client.available()) > 0){
+    int n = conn.client.read(_rxScratch, (avail > WIFI_SERVER_RX_CHUNK_SIZE) ? WIFI_SERVER_RX_CHUNK_SIZE : avail);
+    if(n <= 0)
+      break;
+    conn.stats.rxBytes += n;
+    _stats.bytesIn += n;
+    _server_stats.bytesIn += n;
+    total += n;
+    _dataCb(slot, conn.client, _rxScratch, n);
+  }
+  return total;
 }
 
-void WiFiServer::stopAll(){}
+int WiFiServer::handleClients(uint32_t timeout_ms){
+  if(!_listening || !_allocClientTable())
+    return 0;
+
+  TUYA_FD_SET_T rfds;
+  TAL_FD_ZERO(&rfds);
+  TAL_FD_SET(sockfd, &rfds);
+  int maxfd = sockfd;
+  for(uint8_t i = 0; i < _max_clients; i++){
+    int fd = _conns[i].used ? _conns[i].client.fd() : -1;
+    if(fd < 0)
+      continue;
+    TAL_FD_SET(fd, &rfds);
+    if(fd > maxfd)
+      maxfd = fd;
+  }
+
+  int events = 0;
+  unsigned long now;
+  if(_accepted_sockfd >= 0){
+    // left over from hasClient()
+    timeout_ms = 0;
+  }
+  int res = tal_net_select(maxfd + 1, &rfds, NULL, NULL, timeout_ms);
+  if(res < 0){
+    TAL_FD_ZERO(&rfds);
+  }
+  now = millis();
+
+  if(_accepted_sockfd >= 0 || TAL_FD_ISSET(sockfd, &rfds)){
+    events += _acceptClients(now) ? 1 : 0;
+  }
+
+  for(uint8_t i = 0; i < _max_clients; i++){
+    WiFiServerConnection &conn = _conns[i];
+    if(!conn.used)
+      continue;
+    int fd = conn.client.fd();
+    if(fd >= 0 && TAL_FD_ISSET(fd, &rfds)){
+      events++;
+      _readClient(i, now);
+    }
+    if(!conn.used)
+      continue;
+    if(!conn.client.connected()){
+      _releaseClient(i);
+    } else if(_idleTimeout && (now - conn.stats.lastActivity) > _idleTimeout){
+      PR_DEBUG("WiFiServer: slot %d idle for %lu ms, closing", i, now - conn.stats.lastActivity);
+      _releaseClient(i);
+    }
+  }
+  return events;
+}
+
+WiFiClient *WiFiServer::client(uint8_t slot){
+  if(!_conns || slot >= _max_clients || !_conns[slot].used)
+    return NULL;
+  return &_conns[slot].client;
+}
+
+bool WiFiServer::clientStats(uint8_t slot, WiFiServerClientStats &stats){
+  if(!_conns || slot >= _max_clients || !_conns[slot].used)
+    return false;
+  stats = _conns[slot].stats;
+  return true;
+}
+
+void WiFiServer::closeClient(uint8_t slot){
+  if(!_conns || slot >= _max_clients || !_conns[slot].used)
+    return;
+  _releaseClient(slot);
+}
 
 WiFiClient WiFiServer::available(){
   if(!_listening)
@@ -56,6 +283,7 @@ WiFiClient WiFiServer::available(){
     if(tal_net_setsockopt(client_sock, SOL_SOCKET, SO_KEEPALIVE, (char*)&val, sizeof(int)) == 0) {
       val = _noDelay;
       if(tal_net_setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, (char*)&val, sizeof(int)) == 0){
+        _countAccepted();
         return WiFiClient(client_sock);
       }
     }
@@ -74,16 +302,22 @@ void WiFiServer::begin(uint16_t port, int enable){
       _port = port;
   }
   sockfd = tal_net_socket_create(PROTOCOL_TCP);
-  if (sockfd < 0)
+  if (sockfd < 0){
+    _countError(errno);
     return;
+  }
 
   tal_net_setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(int));
   uint32_t tmpIP = static_cast<uint32_t>(_addr);
   TUYA_IP_ADDR_T serverIP = (TUYA_IP_ADDR_T)UNI_HTONL(tmpIP);
-  if(tal_net_bind(sockfd,serverIP,_port)< 0)
+  if(tal_net_bind(sockfd,serverIP,_port)< 0){
+    _countError(errno);
     return;
-  if(tal_net_listen(sockfd , _max_clients) < 0)
+  }
+  if(tal_net_listen(sockfd , _max_clients) < 0){
+    _countError(errno);
     return;
+  }
   tal_net_set_block(sockfd,false);
   _listening = true;
   _noDelay = false;
@@ -110,7 +344,11 @@ bool WiFiServer::hasClient() {
 }
 
 void WiFiServer::end(){
-
+  stopAll();
+  if(_accepted_sockfd >= 0){
+    tal_net_close(_accepted_sockfd);
+    _accepted_sockfd = -1;
+  }
   tal_net_close(sockfd);
   sockfd = -1;
   _listening = false;
@@ -124,3 +362,24 @@ void WiFiServer::stop(){
   end();
 }
 
+void WiFiServer::_countAccepted(){
+  _stats.connects++;
+  _server_stats.connects++;
+}
+
+void WiFiServer::_countError(int err){
+  wifiStatsError(_stats, err);
+  wifiStatsError(_server_stats, err);
+}
+
+void WiFiServer::resetStats(){
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+const WiFiNetStats &WiFiServer::globalStats(){
+  return _server_stats;
+}
+
+void WiFiServer::resetGlobalStats(){
+  memset(&_server_stats, 0, sizeof(_server_stats));
+}
@@ -5,6 +5,22 @@
 #include "WiFiClient.h"
 #include "api/IPAddress.h"
 #include "tal_log.h"
+#include <functional>
+
+typedef struct {
+    IPAddress remoteIP;
+    uint16_t remotePort;
+    unsigned long connectedAt;   // millis() when accepted
+    unsigned long lastActivity;  // millis() of the last received data
+    uint32_t rxBytes;
+    uint32_t txBytes;            // through the server's write() calls only
+} WiFiServerClientStats;
+
+typedef std::function<void(uint8_t slot, WiFiClient &client)> WiFiServerClientCb;
+typedef std::function<void(uint8_t slot, WiFiClient &client, const uint8_t *data, size_t len)> WiFiServerDataCb;
+
+struct WiFiServerConnection;
+
 class WiFiServer : public Server {
   private:
     int sockfd;
@@ -15,6 +31,25 @@ class WiFiServer : public Server {
     bool _listening;
     bool _noDelay = false;
 
+    // connection table, allocated by the first handleClients()
+    WiFiServerConnection *_conns = NULL;
+    uint8_t *_rxScratch = NULL;
+    uint8_t _numClients = 0;
+    uint32_t _idleTimeout = 0;
+    uint32_t _rejected = 0;
+    WiFiNetStats _stats = {};
+    WiFiServerClientCb _connectCb;
+    WiFiServerDataCb _dataCb;
+    WiFiServerClientCb _disconnectCb;
+
+    bool _allocClientTable();
+    void _freeClientTable();
+    int _acceptClients(unsigned long now);
+    int _readClient(uint8_t slot, unsigned long now);
+    void _releaseClient(uint8_t slot);
+    void _countAccepted();
+    void _countError(int err);
+
   public:
     void listenOnLocalhost(){}
 
@@ -25,7 +60,7 @@ class WiFiServer : public Server {
     WiFiServer(const IPAddress& addr, uint16_t port=80, uint8_t max_clients=4):sockfd(-1),_accepted_sockfd(-1),_addr(addr),_port(port),_max_clients(max_clients),_listening(false),_noDelay(false) {
       PR_INFO("WiFiServer::WiFiServer(addr=%s, port=%d, ...)\r\n", addr.toString().c_str(), port);
     }
-    ~WiFiServer(){ end();}
+    ~WiFiServer(){ end(); _freeClientTable();}
     WiFiClient available();
     WiFiClient accept(){return available();}
     void begin( ){ begin(0); };
@@ -34,12 +69,41 @@ class WiFiServer : public Server {
     void setNoDelay(bool nodelay);
     bool getNoDelay();
     bool hasClient();
+    // broadcast to every client in the connection table
     size_t write(const uint8_t *data, size_t len);
     size_t write(uint8_t data){
       return write(&data, 1);
     }
+    size_t write(uint8_t slot, const uint8_t *data, size_t len);
     using Print::write;
 
+    // Connection table mode: the server keeps up to max_clients accepted
+    // clients and handleClients() accepts, reads and expires all of them in
+    // a single select pass. Returns the number of sockets that had events.
+    int handleClients(uint32_t timeout_ms = 0);
+    void onClientConnect(WiFiServerClientCb cb){ _connectCb = cb; }
+    // without a data callback, received data is left in the client for the sketch to read
+    void onClientData(WiFiServerDataCb cb){ _dataCb = cb; }
+    void onClientDisconnect(WiFiServerClientCb cb){ _disconnectCb = cb; }
+    // drop clients that sent nothing for ms (0 = never)
+    void setIdleTimeout(uint32_t ms){ _idleTimeout = ms; }
+    uint8_t clientCount(){ return _numClients; }
+    uint8_t maxClients(){ return _max_clients; }
+    uint32_t rejectedClients(){ return _rejected; }
+    WiFiClient *client(uint8_t slot);
+    bool clientStats(uint8_t slot, WiFiServerClientStats &stats);
+    void closeClient(uint8_t slot);
+
+    // Accepted (connects) and refused (connectFails) clients and listen
+    // errors; bytes only of the connection table, through write(slot, ...)
+    // and the data callback. The traffic of every accepted client is also in
+    // its own WiFiClient::stats() and in WiFiClient::globalStats().
+    const WiFiNetStats &stats() const { return _stats; }
+    void resetStats();
+    // summed over all servers
+    static const WiFiNetStats &globalStats();
+    static void resetGlobalStats();
+
     void end();
     void close();
     void stop();
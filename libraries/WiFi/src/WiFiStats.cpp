@@ -0,0 +1,84 @@
+#include "WiFiStats.h"
+
+void wifiStatsLatency(WiFiLatencyStats &l, uint32_t ms)
+{
+    l.count++;
+    l.totalMs += ms;
+    if (ms > l.maxMs) {
+        l.maxMs = ms;
+    }
+}
+
+void wifiStatsError(WiFiNetStats &s, int err)
+{
+    s.errors++;
+    for (uint8_t i = 0; i < WIFI_STATS_ERRNO_MAX; i++) {
+        if (!s.errnos[i].count) {
+            s.errnos[i].err = err;
+            s.errnos[i].count = 1;
+            return;
+        }
+        if (s.errnos[i].err == err) {
+            s.errnos[i].count++;
+            return;
+        }
+    }
+    s.otherErrors++;
+}
+
+uint32_t wifiStatsAverage(const WiFiLatencyStats &l)
+{
+    return l.count ? l.totalMs / l.count : 0;
+}
+
+void printLatencyStats(Print &p, const char *name, const WiFiLatencyStats &l)
+{
+    p.print(name);
+    p.print(": n=");
+    p.print(l.count);
+    p.print(" avg=");
+    p.print(wifiStatsAverage(l));
+    p.print("ms max=");
+    p.print(l.maxMs);
+    p.println("ms");
+}
+
+void printNetStats(Print &p, const char *name, const WiFiNetStats &s)
+{
+    p.print(name);
+    p.print(": in ");
+    p.print(s.bytesIn);
+    p.print("B/");
+    p.print(s.packetsIn);
+    p.print(" out ");
+    p.print(s.bytesOut);
+    p.print("B/");
+    p.print(s.packetsOut);
+    p.print(" connects ");
+    p.print(s.connects);
+    p.print(" failed ");
+    p.println(s.connectFails);
+
+    p.print("  ");
+    printLatencyStats(p, "connect", s.connect);
+    p.print("  ");
+    printLatencyStats(p, "dns", s.dns);
+    p.print("  ");
+    printLatencyStats(p, "first byte", s.firstByte);
+    p.print("  ");
+    printLatencyStats(p, "send stall", s.stall);
+
+    p.print("  errors ");
+    p.print(s.errors);
+    for (uint8_t i = 0; i < WIFI_STATS_ERRNO_MAX && s.errnos[i].count; i++) {
+        p.print(" errno ");
+        p.print(s.errnos[i].err);
+        p.print(":");
+        p.print(s.errnos[i].count);
+    }
+    if (s.otherErrors) {
+        p.print(" other:");
+        p.print(s.otherErrors);
+    }
+    p.println();
+}
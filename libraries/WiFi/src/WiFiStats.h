@@ -0,0 +1,48 @@
+#ifndef _WIFISTATS_H_
+#define _WIFISTATS_H_
+
+#include <stdint.h>
+#include "api/Print.h"
+
+#define WIFI_STATS_ERRNO_MAX    (8)     // distinct errno values counted per set
+
+typedef struct {
+    uint32_t count;
+    uint32_t totalMs;
+    uint32_t maxMs;
+} WiFiLatencyStats;
+
+typedef struct {
+    int16_t err;
+    uint16_t count;
+} WiFiErrnoCount;
+
+/*
+ * Counters of one connection, or summed over all connections of a kind.
+ * They are updated without a lock, so totals taken while other threads
+ * send or receive may miss a few increments.
+ */
+typedef struct {
+    uint32_t bytesIn;
+    uint32_t bytesOut;
+    uint32_t packetsIn;         // recv() calls returning data, datagrams for UDP
+    uint32_t packetsOut;        // send() calls, datagrams for UDP
+    uint32_t connects;          // established, accepted for a server
+    uint32_t connectFails;      // failed, refused for a server
+    WiFiLatencyStats connect;   // TCP handshake
+    WiFiLatencyStats dns;       // host name lookups by connect() or beginPacket()
+    WiFiLatencyStats firstByte; // from the last write to the first byte of the reply
+    WiFiLatencyStats stall;     // write() waiting in select for send buffer space
+    uint32_t errors;
+    uint32_t otherErrors;       // errno values that found the table full
+    WiFiErrnoCount errnos[WIFI_STATS_ERRNO_MAX];
+} WiFiNetStats;
+
+void wifiStatsLatency(WiFiLatencyStats &l, uint32_t ms);
+void wifiStatsError(WiFiNetStats &s, int err);
+uint32_t wifiStatsAverage(const WiFiLatencyStats &l);
+// one line per group of counters, prefixed with name
+void printNetStats(Print &p, const char *name, const WiFiNetStats &s);
+void printLatencyStats(Print &p, const char *name, const WiFiLatencyStats &l);
+
+#endif /* _WIFISTATS_H_ */
@@ -18,6 +18,7 @@
 */
 #include <Arduino.h>
 #include "WiFiUdp.h"
+#include "WiFiGeneric.h"
 #include <new>  
 #include <lwip/sockets.h>
 #include <lwip/netdb.h>
@@ -30,6 +31,7 @@
 #undef write
 #undef read
 
+static WiFiNetStats _udp_stats;
 
 
 WiFiUDP::WiFiUDP()
@@ -39,10 +41,26 @@ WiFiUDP::WiFiUDP()
 , tx_buffer(0)
 , tx_buffer_len(0)
 , rx_buffer(0)
-{}
+, rx_len(0)
+, rx_pos(0)
+, pool(0)
+, pool_data(0)
+, pool_count(0)
+, pool_size(0)
+{
+  memset(&_stats, 0, sizeof(_stats));
+}
 
 WiFiUDP::~WiFiUDP(){
    stop();
+   if(pool){
+     tal_free(pool);
+     pool = NULL;
+   }
+   if(pool_data){
+     tal_free(pool_data);
+     pool_data = NULL;
+   }
 }
 
 uint8_t WiFiUDP::begin(IPAddress address, uint16_t port){
@@ -50,7 +68,7 @@ uint8_t WiFiUDP::begin(IPAddress address, uint16_t port){
 
   server_port = port;
 
-  tx_buffer = (char *)tal_malloc(1460);
+  tx_buffer = (char *)tal_malloc(WIFI_UDP_MAX_PACKET);
   if(!tx_buffer){
     PR_ERR("could not create tx buffer: %d\r\n", errno);
     return 0;
@@ -84,7 +102,7 @@ uint8_t WiFiUDP::begin(uint16_t p){
 
 uint8_t WiFiUDP::beginMulticast(IPAddress a, uint16_t p){
   if(begin(IPAddress(static_cast<uint32_t>INADDR_ANY), p)){
-    if(!a){
+    if(static_cast<uint32_t>(a)){
       struct ip_mreq mreq;
       mreq.imr_multiaddr.s_addr = (in_addr_t)a;
       mreq.imr_interface.s_addr = INADDR_ANY;
@@ -107,13 +125,14 @@ void WiFiUDP::stop(){
   }
   tx_buffer_len = 0;
   if(rx_buffer){
-    cbuf *b = rx_buffer;
+    tal_free(rx_buffer);
     rx_buffer = NULL;
-    delete b;
   }
+  rx_len = 0;
+  rx_pos = 0;
   if(udp_server == -1)
     return;
-  if(!multicast_ip){
+  if(static_cast<uint32_t>(multicast_ip)){
     struct ip_mreq mreq;
     mreq.imr_multiaddr.s_addr = (in_addr_t)multicast_ip;
     mreq.imr_interface.s_addr = (in_addr_t)0;
@@ -138,7 +157,7 @@ int WiFiUDP::beginPacket(){
 
   // allocate tx_buffer if is necessary
   if(!tx_buffer){
-    tx_buffer = (char *)tal_malloc(1460);
+    tx_buffer = (char *)tal_malloc(WIFI_UDP_MAX_PACKET);
     if(!tx_buffer){
       PR_ERR("could not create tx buffer: %d", errno);
       return 0;
@@ -167,26 +186,33 @@ int WiFiUDP::beginPacket(IPAddress ip, uint16_t port){
 }
 
 int WiFiUDP::beginPacket(const char *host, uint16_t port){
-  TUYA_IP_ADDR_T addr;
-  int res = tal_net_gethostbyname(host,&addr);
-  if (res != OPRT_OK){
-    PR_ERR("could not get host from dns: %d", errno);
+  IPAddress ip;
+  unsigned long start = millis();
+  if(!WiFiGenericClass::hostByName(host, ip)){
+    PR_ERR("could not get host from dns: %s", host);
+    countError(EHOSTUNREACH);
     return 0;
   }
-  return beginPacket(IPAddress((const uint8_t*)addr), port);
+  uint32_t ms = millis() - start;
+  wifiStatsLatency(_stats.dns, ms);
+  wifiStatsLatency(_udp_stats.dns, ms);
+  return beginPacket(ip, port);
 }
 
 int WiFiUDP::endPacket(){
-  int sent = tal_net_send_to(udp_server, tx_buffer, tx_buffer_len,(uint32_t)remote_ip,remote_port);
+  // tal_net_* take the address in host byte order, IPAddress keeps network order
+  int sent = tal_net_send_to(udp_server, tx_buffer, tx_buffer_len,UNI_HTONL(static_cast<uint32_t>(remote_ip)),remote_port);
   if(sent < 0){
     PR_ERR("could not send data: %d", errno);
+    countError(errno);
     return 0;
   }
+  countSent(sent);
   return 1;
 }
 
 size_t WiFiUDP::write(uint8_t data){
-  if(tx_buffer_len == 1460){
+  if(tx_buffer_len == WIFI_UDP_MAX_PACKET){
     endPacket();
     tx_buffer_len = 0;
   }
@@ -195,58 +221,58 @@ size_t WiFiUDP::write(uint8_t data){
 }
 
 size_t WiFiUDP::write(const uint8_t *buffer, size_t size){
-  size_t i;
-  for(i=0;i<size;i++)
-    write(buffer[i]);
-  return i;
+  size_t done = 0;
+  while(done < size){
+    if(tx_buffer_len == WIFI_UDP_MAX_PACKET){
+      endPacket();
+      tx_buffer_len = 0;
+    }
+    size_t n = WIFI_UDP_MAX_PACKET - tx_buffer_len;
+    if(n > size - done)
+      n = size - done;
+    memcpy(tx_buffer + tx_buffer_len, buffer + done, n);
+    tx_buffer_len += n;
+    done += n;
+  }
+  return done;
 }
 
 int WiFiUDP::parsePacket(){
-  if(rx_buffer)
+  if(rx_pos < rx_len)
     return 0;
+  rx_len = 0;
+  rx_pos = 0;
+  // kept until stop(), so steady-state receiving does not allocate
+  if(!rx_buffer){
+    rx_buffer = (uint8_t *)tal_malloc(WIFI_UDP_MAX_PACKET);
+    if(!rx_buffer)
+      return 0;
+  }
   TUYA_IP_ADDR_T ip;
   uint16_t port;
   int len;
-  char *buf = (char *)tal_malloc(1460);
-  if(!buf) {
-    return 0;
-  }
-  if ((len = tal_net_recvfrom(udp_server, buf, 1460,&ip,&port)) == -1){
-    tal_free(buf);
+  if ((len = tal_net_recvfrom(udp_server, rx_buffer, WIFI_UDP_MAX_PACKET,&ip,&port)) == -1){
     if(errno == EWOULDBLOCK){
       return 0;
     }
     PR_ERR("could not receive data: %d", errno);
+    countError(errno);
     return 0;
   }
-  remote_ip = IPAddress(ip);
+  countReceived(len);
+  remote_ip = IPAddress(UNI_HTONL(ip));
   remote_port = port;
-  if (len > 0) {
-    rx_buffer = new(std::nothrow) cbuf(len);
-    if(!rx_buffer){
-      tal_free(buf);
-      return 0;
-    }
-    rx_buffer->write(buf, len);
-  }
-  tal_free(buf);
+  rx_len = len;
   return len;
 }
 
 int WiFiUDP::available(){
-  if(!rx_buffer) return 0;
-  return rx_buffer->available();
+  return rx_len - rx_pos;
 }
 
 int WiFiUDP::read(){
-  if(!rx_buffer) return -1;
-  int out = rx_buffer->read();
-  if(!rx_buffer->available()){
-    cbuf *b = rx_buffer;
-    rx_buffer = 0;
-    delete b;
-  }
-  return out;
+  if(rx_pos >= rx_len) return -1;
+  return rx_buffer[rx_pos++];
 }
 
 int WiFiUDP::read(unsigned char* buffer, size_t len){
@@ -254,26 +280,22 @@ int WiFiUDP::read(unsigned char* buffer, size_t len){
 }
 
 int WiFiUDP::read(char* buffer, size_t len){
-  if(!rx_buffer) return 0;
-  int out = rx_buffer->read(buffer, len);
-  if(!rx_buffer->available()){
-    cbuf *b = rx_buffer;
-    rx_buffer = 0;
-    delete b;
-  }
-  return out;
+  size_t left = rx_len - rx_pos;
+  if(len > left)
+    len = left;
+  memcpy(buffer, rx_buffer + rx_pos, len);
+  rx_pos += len;
+  return len;
 }
 
 int WiFiUDP::peek(){
-  if(!rx_buffer) return -1;
-  return rx_buffer->peek();
+  if(rx_pos >= rx_len) return -1;
+  return rx_buffer[rx_pos];
 }
 
 void WiFiUDP::flush(){
-  if(!rx_buffer) return;
-  cbuf *b = rx_buffer;
-  rx_buffer = 0;
-  delete b;
+  rx_len = 0;
+  rx_pos = 0;
 }
 
 IPAddress WiFiUDP::remoteIP(){
@@ -283,3 +305,140 @@ IPAddress WiFiUDP::remoteIP(){
 uint16_t WiFiUDP::remotePort(){
   return remote_port;
 }
+
+bool WiFiUDP::setPacketPool(uint8_t count, uint16_t packetSize){
+  if(!count || !packetSize)
+    return false;
+  if(pool && count == pool_count && packetSize == pool_size)
+    return true;
+  if(pool){
+    tal_free(pool);
+    pool = NULL;
+  }
+  if(pool_data){
+    tal_free(pool_data);
+    pool_data = NULL;
+  }
+  pool_count = 0;
+  pool_size = 0;
+  pool = (WiFiUDPPacket *)tal_malloc(count * sizeof(WiFiUDPPacket));
+  pool_data = (uint8_t *)tal_malloc((size_t)count * packetSize);
+  if(!pool || !pool_data){
+    PR_ERR("could not create packet pool: %d x %d", count, packetSize);
+    if(pool){
+      tal_free(pool);
+      pool = NULL;
+    }
+    if(pool_data){
+      tal_free(pool_data);
+      pool_data = NULL;
+    }
+    return false;
+  }
+  for(uint8_t i = 0; i < count; i++){
+    new (&pool[i]) WiFiUDPPacket();
+    pool[i].data = pool_data + (size_t)i * packetSize;
+    pool[i].len = 0;
+  }
+  pool_count = count;
+  pool_size = packetSize;
+  return true;
+}
+
+bool WiFiUDP::waitReadable(uint32_t timeout_ms){
+  TUYA_FD_SET_T readfds;
+  TAL_FD_ZERO(&readfds);
+  TAL_FD_SET(udp_server, &readfds);
+  return tal_net_select(udp_server + 1, &readfds, NULL, NULL, timeout_ms) > 0;
+}
+
+int WiFiUDP::receivePackets(uint32_t timeout_ms){
+  if(udp_server == -1 || !pool_count)
+    return 0;
+  if(timeout_ms && !waitReadable(timeout_ms))
+    return 0;
+  // the socket is non-blocking: drain until it would block or the pool is full
+  int n = 0;
+  while(n < pool_count){
+    WiFiUDPPacket *p = &pool[n];
+    TUYA_IP_ADDR_T ip;
+    uint16_t port;
+    int len = tal_net_recvfrom(udp_server, p->data, pool_size, &ip, &port);
+    if(len < 0){
+      if(errno != EWOULDBLOCK){
+        PR_ERR("could not receive data: %d", errno);
+        countError(errno);
+      }
+      break;
+    }
+    countReceived(len);
+    p->len = len;
+    p->ip = IPAddress(UNI_HTONL(ip));
+    p->port = port;
+    p->timestamp = millis();
+    n++;
+  }
+  return n;
+}
+
+const WiFiUDPPacket *WiFiUDP::packet(uint8_t index){
+  if(index >= pool_count)
+    return NULL;
+  return &pool[index];
+}
+
+int WiFiUDP::sendPackets(const WiFiUDPPacket *packets, uint8_t count){
+  if(udp_server == -1){
+    if ((udp_server = tal_net_socket_create(PROTOCOL_UDP)) == -1){
+      PR_ERR("could not create socket: %d", errno);
+      return 0;
+    }
+    tal_net_set_block(udp_server,0);
+  }
+  int sent = 0;
+  for(uint8_t i = 0; i < count; i++){
+    const WiFiUDPPacket *p = &packets[i];
+    if(tal_net_send_to(udp_server, p->data, p->len, UNI_HTONL(static_cast<uint32_t>(p->ip)), p->port) < 0){
+      // a full send queue fails the rest of the batch as well
+      if(errno != EWOULDBLOCK){
+        PR_ERR("could not send data: %d", errno);
+        countError(errno);
+      }
+      break;
+    }
+    countSent(p->len);
+    sent++;
+  }
+  return sent;
+}
+
+void WiFiUDP::countSent(int len){
+  _stats.bytesOut += len;
+  _stats.packetsOut++;
+  _udp_stats.bytesOut += len;
+  _udp_stats.packetsOut++;
+}
+
+void WiFiUDP::countReceived(int len){
+  _stats.bytesIn += len;
+  _stats.packetsIn++;
+  _udp_stats.bytesIn += len;
+  _udp_stats.packetsIn++;
+}
+
+void WiFiUDP::countError(int err){
+  wifiStatsError(_stats, err);
+  wifiStatsError(_udp_stats, err);
+}
+
+void WiFiUDP::resetStats(){
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+const WiFiNetStats &WiFiUDP::globalStats(){
+  return _udp_stats;
+}
+
+void WiFiUDP::resetGlobalStats(){
+  memset(&_udp_stats, 0, sizeof(_udp_stats));
+}
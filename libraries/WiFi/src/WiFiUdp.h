@@ -36,7 +36,18 @@
 #define _WIFIUDP_H_
 
 #include "api/Udp.h"
-#include <cbuf.h>
+#include "WiFiStats.h"
+
+#define WIFI_UDP_MAX_PACKET   (1460)
+
+// one datagram of a batch; data points into the pool (rx) or the caller's buffer (tx)
+typedef struct {
+  uint8_t *data;
+  uint16_t len;
+  IPAddress ip;
+  uint16_t port;
+  unsigned long timestamp;  // millis() when it was received
+} WiFiUDPPacket;
 
 using namespace arduino;
 class WiFiUDP : public UDP {
@@ -48,7 +59,19 @@ private:
   uint16_t remote_port;
   char * tx_buffer;
   size_t tx_buffer_len;
-  cbuf * rx_buffer;
+  uint8_t * rx_buffer;
+  size_t rx_len;
+  size_t rx_pos;
+  WiFiUDPPacket * pool;
+  uint8_t * pool_data;
+  uint8_t pool_count;
+  uint16_t pool_size;
+  WiFiNetStats _stats;
+
+  bool waitReadable(uint32_t timeout_ms);
+  void countSent(int len);
+  void countReceived(int len);
+  void countError(int err);
 public:
   WiFiUDP();
   ~WiFiUDP();
@@ -72,6 +95,23 @@ public:
   void flush();
   IPAddress remoteIP();
   uint16_t remotePort();
+
+  // Batch API. The pool is allocated once; receivePackets() then fills it
+  // with every queued datagram without touching the heap. Packets stay
+  // valid until the next receivePackets(); the pool survives stop().
+  bool setPacketPool(uint8_t count, uint16_t packetSize = WIFI_UDP_MAX_PACKET);
+  // waits up to timeout_ms for the first datagram, returns the number received
+  int receivePackets(uint32_t timeout_ms = 0);
+  const WiFiUDPPacket *packet(uint8_t index);
+  // sends each packet to its ip/port, returns how many went out
+  int sendPackets(const WiFiUDPPacket *packets, uint8_t count);
+
+  // datagrams and bytes of this object, kept across stop() and begin()
+  const WiFiNetStats &stats() const { return _stats; }
+  void resetStats();
+  // summed over all WiFiUDP objects
+  static const WiFiNetStats &globalStats();
+  static void resetGlobalStats();
 };
 
 #endif /* _WIFIUDP_H_ */
\ No newline at end of file
@@ -0,0 +1,53 @@
+#include <WiFi.h>
+#include <mDNS.h>
+
+const char* ssid     = "********";
+const char* password = "********";
+
+const char* hostName = "tuya-device";
+
+unsigned long lastBrowse = 0;
+
+void setup()
+{
+    Serial.begin(115200);
+
+    Serial.println();
+    Serial.print("Connecting to ");
+    Serial.println(ssid);
+
+    WiFi.begin(ssid, password);
+    while (WiFi.status() != WSS_GOT_IP) {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println("");
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+
+    if (!MDNS.begin(hostName)) {
+        Serial.println("mDNS start failed");
+        return;
+    }
+    // advertise a web server on port 80
+    MDNS.addService("http", "tcp", 80);
+    MDNS.addServiceTxt("http", "tcp", "path", "/");
+}
+
+void loop()
+{
+    // answers queries and runs probing/announcing
+    MDNS.update(50);
+
+    if (MDNS.isReady() && millis() - lastBrowse > 10000) {
+        lastBrowse = millis();
+        Serial.printf("%s.local is up, browsing _http._tcp\r\n", MDNS.hostname());
+
+        int n = MDNS.queryService("http", "tcp", 1000);
+        for (int i = 0; i < n; i++) {
+            Serial.printf("  %s -> %s.local (%s:%u) path=%s\r\n",
+                          MDNS.instanceName(i).c_str(), MDNS.hostname(i).c_str(),
+                          MDNS.IP(i).toString().c_str(), MDNS.port(i), MDNS.txt(i, "path").c_str());
+        }
+    }
+}
@@ -0,0 +1,1134 @@
+#include "mDNS.h"
+#include "WiFi.h"
+#include <new>
+#include <strings.h>
+
+extern "C" {
+#include "tal_log.h"
+#include "tal_memory.h"
+}
+
+#undef write
+#undef read
+
+#define MDNS_TYPE_A         (1)
+#define MDNS_TYPE_PTR       (12)
+#define MDNS_TYPE_TXT       (16)
+#define MDNS_TYPE_SRV       (33)
+#define MDNS_TYPE_ANY       (255)
+#define MDNS_CLASS_IN       (1)
+#define MDNS_CLASS_FLUSH    (0x8000)    // cache-flush in answers, unicast-response in questions
+#define MDNS_FLAGS_RESPONSE (0x8400)    // QR + AA
+
+#define MDNS_ENUM_NAME      "_services._dns-sd._udp.local"
+
+static const IPAddress MDNS_GROUP(224, 0, 0, 251);
+
+MDNSResponder MDNS;
+
+static inline uint16_t mdns_rd16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static inline uint32_t mdns_rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void mdns_wr16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v;
+}
+
+static inline void mdns_wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+/*
+ * Decodes the possibly compressed name at off into dotted form. Returns the
+ * offset behind the name where it starts, or -1 when the packet is malformed.
+ * A name that does not fit into out is returned as "" so callers can still
+ * skip over it.
+ */
+static int mdns_read_name(const uint8_t *pkt, size_t len, size_t off, char *out, size_t size)
+{
+    size_t o = 0;
+    int end = -1;
+    int jumps = 0;
+    bool fits = true;
+
+    for (;;) {
+        if (off >= len) {
+            return -1;
+        }
+        uint8_t l = pkt[off];
+        if ((l & 0xC0) == 0xC0) {
+            if (off + 1 >= len || ++jumps > 16) {
+                return -1;
+            }
+            if (end < 0) {
+                end = off + 2;
+            }
+            off = ((l & 0x3F) << 8) | pkt[off + 1];
+            continue;
+        }
+        if (l & 0xC0) {
+            return -1;
+        }
+        if (!l) {
+            if (end < 0) {
+                end = off + 1;
+            }
+            break;
+        }
+        if (off + 1 + l > len) {
+            return -1;
+        }
+        if (fits && o + l + 2 <= size) {
+            if (o) {
+                out[o++] = '.';
+            }
+            memcpy(out + o, pkt + off + 1, l);
+            o += l;
+        } else {
+            fits = false;
+        }
+        off += 1 + l;
+    }
+    out[fits ? o : 0] = '\0';
+    return end;
+}
+
+// writes a dotted name as plain labels, answers are not compressed
+static bool mdns_write_name(uint8_t *buf, size_t *pos, const char *name)
+{
+    size_t p = *pos;
+    while (*name) {
+        const char *dot = strchr(name, '.');
+        size_t l = dot ? (size_t)(dot - name) : strlen(name);
+        if (!l || l > 63 || p + 1 + l + 1 > MDNS_MAX_PACKET) {
+            return false;
+        }
+        buf[p++] = (uint8_t)l;
+        memcpy(buf + p, name, l);
+        p += l;
+        name += l;
+        if (*name == '.') {
+            name++;
+        }
+    }
+    if (p + 1 > MDNS_MAX_PACKET) {
+        return false;
+    }
+    buf[p++] = 0;
+    *pos = p;
+    return true;
+}
+
+// "http" and "_http" are both accepted
+static void mdns_label(char *out, size_t size, const char *in)
+{
+    snprintf(out, size, "%s%s", (in[0] == '_') ? "" : "_", in);
+}
+
+static bool mdns_expired(const mdns_cache_entry_t *e, unsigned long now)
+{
+    return !e->name[0] || now - e->received >= e->ttl * 1000UL;
+}
+
+MDNSResponder::MDNSResponder()
+    : _state(MDNS_STATE_IDLE)
+    , _instanceSet(false)
+    , _hostConflicts(0)
+    , _instanceConflicts(0)
+    , _step(0)
+    , _nextEvent(0)
+    , _serviceCount(0)
+    , _tx(NULL)
+    , _cache(NULL)
+    , _results(NULL)
+    , _resultCount(0)
+{
+    _base[0] = '\0';
+    _host[0] = '\0';
+    _instanceBase[0] = '\0';
+    _instance[0] = '\0';
+}
+
+MDNSResponder::~MDNSResponder()
+{
+    end();
+}
+
+bool MDNSResponder::begin(const char *hostname)
+{
+    if (_tx) {
+        end();
+    }
+    if (!hostname || !hostname[0] || strchr(hostname, '.')) {
+        PR_ERR("mDNS: invalid host name");
+        return false;
+    }
+    snprintf(_base, sizeof(_base), "%s", hostname);
+    snprintf(_host, sizeof(_host), "%s", _base);
+    _hostConflicts = 0;
+    if (!_instanceSet) {
+        snprintf(_instanceBase, sizeof(_instanceBase), "%s", _base);
+        snprintf(_instance, sizeof(_instance), "%s", _base);
+        _instanceConflicts = 0;
+    }
+
+    _tx = (uint8_t *)tal_malloc(MDNS_MAX_PACKET);
+    _cache = (mdns_cache_entry_t *)tal_malloc(MDNS_CACHE_SIZE * sizeof(mdns_cache_entry_t));
+    _results = new (std::nothrow) mdns_result_t[MDNS_MAX_RESULTS];
+    if (!_tx || !_cache || !_results) {
+        PR_ERR("mDNS: buffer alloc failed");
+        end();
+        return false;
+    }
+    memset(_cache, 0, MDNS_CACHE_SIZE * sizeof(mdns_cache_entry_t));
+    _resultCount = 0;
+
+    if (!_udp.setPacketPool(MDNS_RX_PACKETS, MDNS_MAX_PACKET) || !_udp.beginMulticast(MDNS_GROUP, MDNS_PORT)) {
+        PR_ERR("mDNS: could not open %s:%d", MDNS_GROUP.toString().c_str(), MDNS_PORT);
+        end();
+        return false;
+    }
+    _restartProbing();
+    return true;
+}
+
+void MDNSResponder::end()
+{
+    if (_tx && (_state == MDNS_STATE_ANNOUNCING || _state == MDNS_STATE_READY)) {
+        _sendRecords((1UL << _recordCount()) - 1, true);
+    }
+    _state = MDNS_STATE_IDLE;
+    _udp.stop();
+    if (_tx) {
+        tal_free(_tx);
+        _tx = NULL;
+    }
+    if (_cache) {
+        tal_free(_cache);
+        _cache = NULL;
+    }
+    if (_results) {
+        delete[] _results;
+        _results = NULL;
+    }
+    _resultCount = 0;
+}
+
+void MDNSResponder::setInstanceName(const char *name)
+{
+    if (!name || !name[0] || strchr(name, '.')) {
+        return;
+    }
+    snprintf(_instanceBase, sizeof(_instanceBase), "%s", name);
+    snprintf(_instance, sizeof(_instance), "%s", name);
+    _instanceSet = true;
+    _instanceConflicts = 0;
+    if (_state != MDNS_STATE_IDLE) {
+        _restartProbing();
+    }
+}
+
+mdns_service_t *MDNSResponder::_findService(const char *service, const char *proto)
+{
+    char svc[MDNS_LABEL_MAX];
+    char pr[8];
+    mdns_label(svc, sizeof(svc), service);
+    mdns_label(pr, sizeof(pr), proto);
+    for (uint8_t i = 0; i < _serviceCount; i++) {
+        if (!strcasecmp(_services[i].service, svc) && !strcasecmp(_services[i].proto, pr)) {
+            return &_services[i];
+        }
+    }
+    return NULL;
+}
+
+bool MDNSResponder::addService(const char *service, const char *proto, uint16_t port)
+{
+    mdns_service_t *s = _findService(service, proto);
+    if (!s) {
+        if (_serviceCount >= MDNS_MAX_SERVICES) {
+            PR_ERR("mDNS: too many services");
+            return false;
+        }
+        s = &_services[_serviceCount++];
+        mdns_label(s->service, sizeof(s->service), service);
+        mdns_label(s->proto, sizeof(s->proto), proto);
+        s->txtLen = 0;
+    }
+    s->port = port;
+    if (_state != MDNS_STATE_IDLE) {
+        // the new instance name has to be probed before it is announced
+        _restartProbing();
+    }
+    return true;
+}
+
+bool MDNSResponder::addServiceTxt(const char *service, const char *proto, const char *key, const char *value)
+{
+    mdns_service_t *s = _findService(service, proto);
+    if (!s) {
+        return false;
+    }
+    size_t kl = strlen(key);
+    size_t vl = strlen(value);
+    size_t l = kl + 1 + vl;
+    if (l > 255 || s->txtLen + 1 + l > MDNS_TXT_MAX) {
+        PR_ERR("mDNS: TXT record full");
+        return false;
+    }
+    uint8_t *p = s->txt + s->txtLen;
+    *p++ = (uint8_t)l;
+    memcpy(p, key, kl);
+    p[kl] = '=';
+    memcpy(p + kl + 1, value, vl);
+    s->txtLen += 1 + l;
+    if (_state == MDNS_STATE_READY) {
+        _state = MDNS_STATE_ANNOUNCING;
+        _step = 0;
+        _nextEvent = millis();
+    }
+    return true;
+}
+
+bool MDNSResponder::removeService(const char *service, const char *proto)
+{
+    mdns_service_t *s = _findService(service, proto);
+    if (!s) {
+        return false;
+    }
+    uint8_t idx = s - _services;
+    if (_tx && (_state == MDNS_STATE_ANNOUNCING || _state == MDNS_STATE_READY)) {
+        _sendRecords(0xFUL << (1 + 4 * idx), true);
+    }
+    memmove(&_services[idx], &_services[idx + 1], (_serviceCount - idx - 1) * sizeof(mdns_service_t));
+    _serviceCount--;
+    return true;
+}
+
+void MDNSResponder::_recordName(uint8_t rec, char *out, size_t size)
+{
+    if (!rec) {
+        snprintf(out, size, "%s.local", _host);
+        return;
+    }
+    const mdns_service_t *s = &_services[(rec - 1) / 4];
+    switch ((rec - 1) % 4) {
+    case 0:
+        snprintf(out, size, "%s.%s.local", s->service, s->proto);
+        break;
+    case 1:
+    case 2:
+        snprintf(out, size, "%s.%s.%s.local", _instance, s->service, s->proto);
+        break;
+    default:
+        snprintf(out, size, MDNS_ENUM_NAME);
+        break;
+    }
+}
+
+void MDNSResponder::_recordTarget(uint8_t rec, char *out, size_t size)
+{
+    const mdns_service_t *s = &_services[(rec - 1) / 4];
+    switch ((rec - 1) % 4) {
+    case 0:
+        snprintf(out, size, "%s.%s.%s.local", _instance, s->service, s->proto);
+        break;
+    case 1:
+        snprintf(out, size, "%s.local", _host);
+        break;
+    default:
+        snprintf(out, size, "%s.%s.local", s->service, s->proto);
+        break;
+    }
+}
+
+uint16_t MDNSResponder::_recordType(uint8_t rec)
+{
+    if (!rec) {
+        return MDNS_TYPE_A;
+    }
+    switch ((rec - 1) % 4) {
+    case 1:
+        return MDNS_TYPE_SRV;
+    case 2:
+        return MDNS_TYPE_TXT;
+    default:
+        return MDNS_TYPE_PTR;
+    }
+}
+
+uint32_t MDNSResponder::_recordTTL(uint8_t rec)
+{
+    uint16_t type = _recordType(rec);
+    return (type == MDNS_TYPE_A || type == MDNS_TYPE_SRV) ? MDNS_HOST_TTL : MDNS_SERVICE_TTL;
+}
+
+bool MDNSResponder::_recordUnique(uint8_t rec)
+{
+    return _recordType(rec) != MDNS_TYPE_PTR;
+}
+
+bool MDNSResponder::_sameRdata(uint8_t rec, const uint8_t *pkt, size_t len, size_t off, uint16_t rdlen)
+{
+    char name[MDNS_NAME_MAX];
+    char target[MDNS_NAME_MAX];
+
+    switch (_recordType(rec)) {
+    case MDNS_TYPE_A: {
+        IPAddress ip = WiFi.localIP();
+        return rdlen == 4 && pkt[off] == ip[0] && pkt[off + 1] == ip[1] && pkt[off + 2] == ip[2] && pkt[off + 3] == ip[3];
+    }
+    case MDNS_TYPE_PTR:
+        _recordTarget(rec, target, sizeof(target));
+        return mdns_read_name(pkt, len, off, name, sizeof(name)) > 0 && !strcasecmp(name, target);
+    case MDNS_TYPE_SRV:
+        if (rdlen < 7 || mdns_rd16(pkt + off + 4) != _services[(rec - 1) / 4].port) {
+            return false;
+        }
+        _recordTarget(rec, target, sizeof(target));
+        return mdns_read_name(pkt, len, off + 6, name, sizeof(name)) > 0 && !strcasecmp(name, target);
+    default: {
+        const mdns_service_t *s = &_services[(rec - 1) / 4];
+        if (!s->txtLen) {
+            return rdlen <= 1;
+        }
+        return rdlen == s->txtLen && !memcmp(pkt + off, s->txt, rdlen);
+    }
+    }
+}
+
+bool MDNSResponder::_writeRecord(uint8_t *buf, size_t *pos, uint8_t rec, uint32_t ttl, bool flush)
+{
+    char name[MDNS_NAME_MAX];
+    size_t p = *pos;
+    uint16_t type = _recordType(rec);
+
+    _recordName(rec, name, sizeof(name));
+    if (!mdns_write_name(buf, &p, name) || p + 10 > MDNS_MAX_PACKET) {
+        return false;
+    }
+    mdns_wr16(buf + p, type);
+    mdns_wr16(buf + p + 2, MDNS_CLASS_IN | ((flush && _recordUnique(rec)) ? MDNS_CLASS_FLUSH : 0));
+    mdns_wr32(buf + p + 4, ttl);
+    size_t rdpos = p + 8;
+    p += 10;
+
+    if (type == MDNS_TYPE_A) {
+        if (p + 4 > MDNS_MAX_PACKET) {
+            return false;
+        }
+        IPAddress ip = WiFi.localIP();
+        for (int i = 0; i < 4; i++) {
+            buf[p++] = ip[i];
+        }
+    } else if (type == MDNS_TYPE_TXT) {
+        const mdns_service_t *s = &_services[(rec - 1) / 4];
+        size_t l = s->txtLen ? s->txtLen : 1;
+        if (p + l > MDNS_MAX_PACKET) {
+            return false;
+        }
+        if (s->txtLen) {
+            memcpy(buf + p, s->txt, l);
+        } else {
+            buf[p] = 0;
+        }
+        p += l;
+    } else {
+        if (type == MDNS_TYPE_SRV) {
+            if (p + 6 > MDNS_MAX_PACKET) {
+                return false;
+            }
+            mdns_wr16(buf + p, 0);
+            mdns_wr16(buf + p + 2, 0);
+            mdns_wr16(buf + p + 4, _services[(rec - 1) / 4].port);
+            p += 6;
+        }
+        _recordTarget(rec, name, sizeof(name));
+        if (!mdns_write_name(buf, &p, name)) {
+            return false;
+        }
+    }
+    mdns_wr16(buf + rdpos, p - rdpos - 2);
+    *pos = p;
+    return true;
+}
+
+bool MDNSResponder::_send(size_t len, IPAddress ip, uint16_t port)
+{
+    WiFiUDPPacket pkt;
+    pkt.data = _tx;
+    pkt.len = len;
+    pkt.ip = ip;
+    pkt.port = port;
+    return _udp.sendPackets(&pkt, 1) == 1;
+}
+
+void MDNSResponder::_restartProbing()
+{
+    _state = MDNS_STATE_PROBING;
+    _step = 0;
+    // the first probe goes out after a random 0-250 ms delay
+    _nextEvent = millis() + random(MDNS_PROBE_INTERVAL_MS);
+}
+
+void MDNSResponder::_rename(bool host)
+{
+    if (host) {
+        _hostConflicts++;
+        snprintf(_host, sizeof(_host), "%s-%d", _base, _hostConflicts + 1);
+        if (!_instanceSet) {
+            snprintf(_instance, sizeof(_instance), "%s", _host);
+        }
+        PR_NOTICE("mDNS: name conflict, host renamed to %s", _host);
+    } else {
+        _instanceConflicts++;
+        snprintf(_instance, sizeof(_instance), "%s-%d", _instanceBase, _instanceConflicts + 1);
+        PR_NOTICE("mDNS: name conflict, instance renamed to %s", _instance);
+    }
+    _restartProbing();
+}
+
+void MDNSResponder::_sendProbe()
+{
+    char name[MDNS_NAME_MAX];
+    size_t pos = 12;
+    uint16_t qd = 0;
+    uint16_t ns = 0;
+
+    memset(_tx, 0, 12);
+    // questions for every unique name, asking for unicast replies
+    for (uint8_t rec = 0; rec < _recordCount(); rec++) {
+        if (rec && _recordType(rec) != MDNS_TYPE_SRV) {
+            continue;
+        }
+        _recordName(rec, name, sizeof(name));
+        if (!mdns_write_name(_tx, &pos, name) || pos + 4 > MDNS_MAX_PACKET) {
+            return;
+        }
+        mdns_wr16(_tx + pos, MDNS_TYPE_ANY);
+        mdns_wr16(_tx + pos + 2, MDNS_CLASS_IN | MDNS_CLASS_FLUSH);
+        pos += 4;
+        qd++;
+    }
+    // the proposed records go to the authority section
+    for (uint8_t rec = 0; rec < _recordCount(); rec++) {
+        if (rec && _recordType(rec) != MDNS_TYPE_SRV) {
+            continue;
+        }
+        if (!_writeRecord(_tx, &pos, rec, _recordTTL(rec), false)) {
+            return;
+        }
+        ns++;
+    }
+    mdns_wr16(_tx + 4, qd);
+    mdns_wr16(_tx + 8, ns);
+    _send(pos, MDNS_GROUP, MDNS_PORT);
+}
+
+bool MDNSResponder::_sendRecords(uint32_t mask, bool goodbye)
+{
+    size_t pos = 12;
+    uint16_t an = 0;
+
+    memset(_tx, 0, 12);
+    mdns_wr16(_tx + 2, MDNS_FLAGS_RESPONSE);
+    for (uint8_t rec = 0; rec < _recordCount(); rec++) {
+        if (!(mask & (1UL << rec))) {
+            continue;
+        }
+        if (!_writeRecord(_tx, &pos, rec, goodbye ? 0 : _recordTTL(rec), true)) {
+            break;
+        }
+        an++;
+    }
+    mdns_wr16(_tx + 6, an);
+    return an && _send(pos, MDNS_GROUP, MDNS_PORT);
+}
+
+bool MDNSResponder::_sendQuery(const char *name, uint16_t type, bool knownAnswers)
+{
+    size_t pos = 12;
+    uint16_t an = 0;
+    unsigned long now = millis();
+
+    memset(_tx, 0, 12);
+    if (!mdns_write_name(_tx, &pos, name) || pos + 4 > MDNS_MAX_PACKET) {
+        return false;
+    }
+    mdns_wr16(_tx + pos, type);
+    mdns_wr16(_tx + pos + 2, MDNS_CLASS_IN);
+    pos += 4;
+    mdns_wr16(_tx + 4, 1);
+
+    // list the PTR answers we already hold with more than half their TTL
+    // left, responders leave those out (RFC 6762 7.1)
+    for (int i = 0; knownAnswers && type == MDNS_TYPE_PTR && i < MDNS_CACHE_SIZE; i++) {
+        mdns_cache_entry_t *e = &_cache[i];
+        if (mdns_expired(e, now) || e->type != type || strcasecmp(e->name, name)) {
+            continue;
+        }
+        uint32_t age = (now - e->received) / 1000;
+        if (age * 2 > e->ttl) {
+            continue;
+        }
+        size_t p = pos;
+        if (!mdns_write_name(_tx, &p, e->name) || p + 10 > MDNS_MAX_PACKET) {
+            break;
+        }
+        mdns_wr16(_tx + p, type);
+        mdns_wr16(_tx + p + 2, MDNS_CLASS_IN);
+        mdns_wr32(_tx + p + 4, e->ttl - age);
+        size_t rdpos = p + 8;
+        p += 10;
+        if (!mdns_write_name(_tx, &p, (const char *)e->data)) {
+            break;
+        }
+        mdns_wr16(_tx + rdpos, p - rdpos - 2);
+        pos = p;
+        an++;
+    }
+    mdns_wr16(_tx + 6, an);
+    return _send(pos, MDNS_GROUP, MDNS_PORT);
+}
+
+void MDNSResponder::_runTimers(unsigned long now)
+{
+    if (_state == MDNS_STATE_PROBING && (long)(now - _nextEvent) >= 0) {
+        if (_step < MDNS_PROBE_COUNT) {
+            _sendProbe();
+            _step++;
+            _nextEvent = now + MDNS_PROBE_INTERVAL_MS;
+        } else {
+            // nobody objected within 250 ms of the last probe
+            _state = MDNS_STATE_ANNOUNCING;
+            _step = 0;
+            _nextEvent = now;
+        }
+    }
+    if (_state == MDNS_STATE_ANNOUNCING && (long)(now - _nextEvent) >= 0) {
+        _sendRecords((1UL << _recordCount()) - 1, false);
+        _step++;
+        _nextEvent = now + MDNS_ANNOUNCE_INTERVAL_MS;
+        if (_step >= MDNS_ANNOUNCE_COUNT) {
+            _state = MDNS_STATE_READY;
+            PR_DEBUG("mDNS: %s.local ready", _host);
+        }
+    }
+}
+
+void MDNSResponder::update(uint32_t timeout_ms)
+{
+    if (!_tx) {
+        return;
+    }
+    int n = _udp.receivePackets(timeout_ms);
+    for (int i = 0; i < n; i++) {
+        _handlePacket(_udp.packet(i));
+    }
+    _runTimers(millis());
+}
+
+void MDNSResponder::_handlePacket(const WiFiUDPPacket *p)
+{
+    if (p->len < 12 || p->ip == WiFi.localIP()) {
+        // too short, or our own multicast looped back
+        return;
+    }
+    uint16_t flags = mdns_rd16(p->data + 2);
+    if ((flags >> 11) & 0xF) {
+        return;
+    }
+    if (flags & 0x8000) {
+        if (!(flags & 0xF)) {
+            _handleResponse(p->data, p->len);
+        }
+    } else {
+        _handleQuery(p->data, p->len, p->ip, p->port);
+    }
+}
+
+void MDNSResponder::_handleQuery(const uint8_t *pkt, size_t len, IPAddress ip, uint16_t port)
+{
+    if (_state != MDNS_STATE_ANNOUNCING && _state != MDNS_STATE_READY) {
+        return;
+    }
+    char name[MDNS_NAME_MAX];
+    char rname[MDNS_NAME_MAX];
+    uint16_t id = mdns_rd16(pkt);
+    uint16_t qd = mdns_rd16(pkt + 4);
+    uint16_t an = mdns_rd16(pkt + 6);
+    uint8_t recs = _recordCount();
+    uint32_t answers = 0;
+    uint32_t known = 0;
+    bool unicast = false;
+    size_t off = 12;
+
+    for (uint16_t q = 0; q < qd; q++) {
+        int next = mdns_read_name(pkt, len, off, name, sizeof(name));
+        if (next < 0 || (size_t)next + 4 > len) {
+            return;
+        }
+        uint16_t type = mdns_rd16(pkt + next);
+        uint16_t cls = mdns_rd16(pkt + next + 2);
+        off = next + 4;
+        if (cls & MDNS_CLASS_FLUSH) {
+            unicast = true;
+        }
+        if (!name[0]) {
+            continue;
+        }
+        for (uint8_t rec = 0; rec < recs; rec++) {
+            if (type != MDNS_TYPE_ANY && type != _recordType(rec)) {
+                continue;
+            }
+            _recordName(rec, rname, sizeof(rname));
+            if (!strcasecmp(name, rname)) {
+                answers |= 1UL << rec;
+            }
+        }
+    }
+    if (!answers) {
+        return;
+    }
+    size_t qEnd = off;
+
+    // known-answer suppression
+    for (uint16_t a = 0; a < an; a++) {
+        int next = mdns_read_name(pkt, len, off, name, sizeof(name));
+        if (next < 0 || (size_t)next + 10 > len) {
+            break;
+        }
+        uint16_t type = mdns_rd16(pkt + next);
+        uint32_t ttl = mdns_rd32(pkt + next + 4);
+        uint16_t rdlen = mdns_rd16(pkt + next + 8);
+        size_t rdoff = next + 10;
+        if (rdoff + rdlen > len) {
+            break;
+        }
+        off = rdoff + rdlen;
+        for (uint8_t rec = 0; name[0] && rec < recs; rec++) {
+            if (!(answers & (1UL << rec)) || type != _recordType(rec) || ttl * 2 < _recordTTL(rec)) {
+                continue;
+            }
+            _recordName(rec, rname, sizeof(rname));
+            if (!strcasecmp(name, rname) && _sameRdata(rec, pkt, len, rdoff, rdlen)) {
+                known |= 1UL << rec;
+            }
+        }
+    }
+
+    // PTR answers carry SRV, TXT and A as additional records, SRV carries A
+    uint32_t extra = 0;
+    for (uint8_t rec = 1; rec < recs; rec++) {
+        if (!(answers & (1UL << rec))) {
+            continue;
+        }
+        uint8_t kind = (rec - 1) % 4;
+        if (kind == 0) {
+            extra |= (1UL << (rec + 1)) | (1UL << (rec + 2)) | 1UL;
+        } else if (kind == 1) {
+            extra |= 1UL;
+        }
+    }
+    answers &= ~known;
+    if (!answers) {
+        return;
+    }
+    extra &= ~(answers | known);
+
+    // queries not sent from port 5353 come from plain DNS resolvers
+    bool legacy = port != MDNS_PORT;
+    size_t pos = 12;
+    uint16_t anCount = 0;
+    uint16_t arCount = 0;
+
+    memset(_tx, 0, 12);
+    mdns_wr16(_tx + 2, MDNS_FLAGS_RESPONSE);
+    if (legacy) {
+        // echo the questions; pointers in them refer to the same offsets
+        if (qEnd > MDNS_MAX_PACKET) {
+            return;
+        }
+        mdns_wr16(_tx, id);
+        mdns_wr16(_tx + 4, qd);
+        memcpy(_tx + 12, pkt + 12, qEnd - 12);
+        pos = qEnd;
+    }
+    // answers first, then the additional records
+    for (int pass = 0; pass < 2; pass++) {
+        uint32_t set = pass ? extra : answers;
+        for (uint8_t rec = 0; rec < recs; rec++) {
+            if (!(set & (1UL << rec))) {
+                continue;
+            }
+            uint32_t ttl = _recordTTL(rec);
+            if (legacy && ttl > MDNS_LEGACY_TTL) {
+                ttl = MDNS_LEGACY_TTL;
+            }
+            if (!_writeRecord(_tx, &pos, rec, ttl, !legacy)) {
+                break;
+            }
+            if (pass) {
+                arCount++;
+            } else {
+                anCount++;
+            }
+        }
+    }
+    if (!anCount) {
+        return;
+    }
+    mdns_wr16(_tx + 6, anCount);
+    mdns_wr16(_tx + 10, arCount);
+    if (legacy) {
+        _send(pos, ip, port);
+    } else if (unicast) {
+        _send(pos, ip, MDNS_PORT);
+    } else {
+        _send(pos, MDNS_GROUP, MDNS_PORT);
+    }
+}
+
+void MDNSResponder::_handleResponse(const uint8_t *pkt, size_t len)
+{
+    char name[MDNS_NAME_MAX];
+    char rname[MDNS_NAME_MAX];
+    uint16_t qd = mdns_rd16(pkt + 4);
+    uint32_t total = (uint32_t)mdns_rd16(pkt + 6) + mdns_rd16(pkt + 8) + mdns_rd16(pkt + 10);
+    uint8_t recs = _recordCount();
+    int conflict = -1;
+    size_t off = 12;
+
+    for (uint16_t q = 0; q < qd; q++) {
+        int next = mdns_read_name(pkt, len, off, name, sizeof(name));
+        if (next < 0 || (size_t)next + 4 > len) {
+            return;
+        }
+        off = next + 4;
+    }
+    for (uint32_t r = 0; r < total; r++) {
+        int next = mdns_read_name(pkt, len, off, name, sizeof(name));
+        if (next < 0 || (size_t)next + 10 > len) {
+            break;
+        }
+        uint16_t type = mdns_rd16(pkt + next);
+        uint16_t cls = mdns_rd16(pkt + next + 2);
+        uint32_t ttl = mdns_rd32(pkt + next + 4);
+        uint16_t rdlen = mdns_rd16(pkt + next + 8);
+        size_t rdoff = next + 10;
+        if (rdoff + rdlen > len) {
+            break;
+        }
+        off = rdoff + rdlen;
+        if (!name[0] || (cls & ~MDNS_CLASS_FLUSH) != MDNS_CLASS_IN) {
+            continue;
+        }
+        // another host answering for one of our unique names with other data
+        for (uint8_t rec = 0; conflict < 0 && _state != MDNS_STATE_IDLE && rec < recs; rec++) {
+            if (!_recordUnique(rec) || type != _recordType(rec)) {
+                continue;
+            }
+            _recordName(rec, rname, sizeof(rname));
+            if (!strcasecmp(name, rname) && !_sameRdata(rec, pkt, len, rdoff, rdlen)) {
+                conflict = rec;
+            }
+        }
+        if (type == MDNS_TYPE_A || type == MDNS_TYPE_PTR || type == MDNS_TYPE_SRV || type == MDNS_TYPE_TXT) {
+            _cacheStore(name, type, ttl, cls & MDNS_CLASS_FLUSH, pkt, len, rdoff, rdlen);
+        }
+    }
+    if (conflict >= 0) {
+        _rename(conflict == 0);
+    }
+}
+
+void MDNSResponder::_cacheStore(const char *name, uint16_t type, uint32_t ttl, bool flush,
+                                const uint8_t *pkt, size_t len, size_t off, uint16_t rdlen)
+{
+    mdns_cache_entry_t rec;
+    unsigned long now = millis();
+
+    if (strlen(name) >= MDNS_NAME_MAX) {
+        return;
+    }
+    memset(&rec, 0, sizeof(rec));
+    switch (type) {
+    case MDNS_TYPE_A:
+        if (rdlen != 4) {
+            return;
+        }
+        memcpy(&rec.addr, pkt + off, 4);
+        break;
+    case MDNS_TYPE_PTR:
+        if (mdns_read_name(pkt, len, off, (char *)rec.data, sizeof(rec.data)) < 0 || !rec.data[0]) {
+            return;
+        }
+        rec.dataLen = strlen((char *)rec.data);
+        break;
+    case MDNS_TYPE_SRV:
+        if (rdlen < 7 || mdns_read_name(pkt, len, off + 6, (char *)rec.data, sizeof(rec.data)) < 0 || !rec.data[0]) {
+            return;
+        }
+        rec.port = mdns_rd16(pkt + off + 4);
+        rec.dataLen = strlen((char *)rec.data);
+        break;
+    default:
+        if (rdlen > MDNS_TXT_MAX) {
+            return;
+        }
+        memcpy(rec.data, pkt + off, rdlen);
+        rec.dataLen = rdlen;
+        break;
+    }
+    strcpy(rec.name, name);
+    rec.type = type;
+    rec.ttl = ttl;
+    rec.received = now;
+
+    mdns_cache_entry_t *slot = NULL;
+    for (int i = 0; i < MDNS_CACHE_SIZE; i++) {
+        mdns_cache_entry_t *e = &_cache[i];
+        if (mdns_expired(e, now) || e->type != type || strcasecmp(e->name, name)) {
+            continue;
+        }
+        bool same = e->addr == rec.addr && e->port == rec.port && e->dataLen == rec.dataLen &&
+                    (type == MDNS_TYPE_TXT ? !memcmp(e->data, rec.data, rec.dataLen)
+                                           : !strcasecmp((char *)e->data, (char *)rec.data));
+        if (same) {
+            slot = e;
+        } else if (flush && now - e->received > 1000) {
+            // cache-flush: older data for this unique record is stale
+            e->name[0] = '\0';
+        }
+    }
+    if (!ttl) {
+        // goodbye
+        if (slot) {
+            slot->name[0] = '\0';
+        }
+        return;
+    }
+    if (!slot) {
+        // a free or expired slot, otherwise the one closest to expiry
+        unsigned long best = ~0UL;
+        for (int i = 0; i < MDNS_CACHE_SIZE; i++) {
+            mdns_cache_entry_t *e = &_cache[i];
+            if (mdns_expired(e, now)) {
+                slot = e;
+                break;
+            }
+            unsigned long left = e->ttl * 1000UL - (now - e->received);
+            if (left < best) {
+                best = left;
+                slot = e;
+            }
+        }
+    }
+    memcpy(slot, &rec, sizeof(rec));
+}
+
+mdns_cache_entry_t *MDNSResponder::_cacheFind(const char *name, uint16_t type, unsigned long now)
+{
+    for (int i = 0; _cache && i < MDNS_CACHE_SIZE; i++) {
+        mdns_cache_entry_t *e = &_cache[i];
+        if (!mdns_expired(e, now) && e->type == type && !strcasecmp(e->name, name)) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+void MDNSResponder::clearCache()
+{
+    if (_cache) {
+        memset(_cache, 0, MDNS_CACHE_SIZE * sizeof(mdns_cache_entry_t));
+    }
+    _resultCount = 0;
+}
+
+IPAddress MDNSResponder::queryHost(const char *host, uint32_t timeout_ms)
+{
+    char name[MDNS_NAME_MAX];
+    size_t hl = strlen(host);
+
+    if (!_tx) {
+        return IPAddress();
+    }
+    if (hl > 6 && !strcasecmp(host + hl - 6, ".local")) {
+        snprintf(name, sizeof(name), "%s", host);
+    } else {
+        snprintf(name, sizeof(name), "%s.local", host);
+    }
+    if (!strncasecmp(name, _host, strlen(_host)) && !strcasecmp(name + strlen(_host), ".local")) {
+        return WiFi.localIP();
+    }
+
+    unsigned long start = millis();
+    mdns_cache_entry_t *e = _cacheFind(name, MDNS_TYPE_A, start);
+    if (e) {
+        return IPAddress(e->addr);
+    }
+    unsigned long sent = start;
+    _sendQuery(name, MDNS_TYPE_A, false);
+    while (millis() - start < timeout_ms) {
+        update(10);
+        e = _cacheFind(name, MDNS_TYPE_A, millis());
+        if (e) {
+            return IPAddress(e->addr);
+        }
+        if (millis() - sent >= MDNS_QUERY_RETRY_MS) {
+            sent = millis();
+            _sendQuery(name, MDNS_TYPE_A, false);
+        }
+    }
+    return IPAddress();
+}
+
+int MDNSResponder::queryService(const char *service, const char *proto, uint32_t timeout_ms)
+{
+    char svc[MDNS_LABEL_MAX];
+    char pr[8];
+    char name[MDNS_NAME_MAX];
+
+    if (!_tx) {
+        return 0;
+    }
+    mdns_label(svc, sizeof(svc), service);
+    mdns_label(pr, sizeof(pr), proto);
+    snprintf(name, sizeof(name), "%s.%s.local", svc, pr);
+
+    int found = _collectServices(name);
+    if (found) {
+        return found;
+    }
+    // responders delay shared answers by 20-120 ms, so keep collecting until
+    // none has come for MDNS_QUERY_QUIET_MS
+    _sendQuery(name, MDNS_TYPE_PTR, true);
+    unsigned long start = millis();
+    unsigned long sent = start;
+    unsigned long last = start;
+    while (millis() - start < timeout_ms) {
+        update(10);
+        int n = _collectServices(name);
+        if (n != found) {
+            found = n;
+            last = millis();
+        } else if (found && millis() - last >= MDNS_QUERY_QUIET_MS) {
+            break;
+        }
+        if (!found && millis() - sent >= MDNS_QUERY_RETRY_MS) {
+            sent = millis();
+            _sendQuery(name, MDNS_TYPE_PTR, true);
+        }
+    }
+    return _collectServices(name);
+}
+
+int MDNSResponder::_collectServices(const char *name)
+{
+    unsigned long now = millis();
+    _resultCount = 0;
+    for (int i = 0; i < MDNS_CACHE_SIZE && _resultCount < MDNS_MAX_RESULTS; i++) {
+        mdns_cache_entry_t *e = &_cache[i];
+        if (mdns_expired(e, now) || e->type != MDNS_TYPE_PTR || strcasecmp(e->name, name)) {
+            continue;
+        }
+        mdns_result_t *r = &_results[_resultCount];
+        snprintf(r->instance, sizeof(r->instance), "%s", (const char *)e->data);
+        r->host[0] = '\0';
+        r->ip = IPAddress();
+        r->port = 0;
+        r->txtLen = 0;
+
+        mdns_cache_entry_t *srv = _cacheFind(r->instance, MDNS_TYPE_SRV, now);
+        if (srv) {
+            r->port = srv->port;
+            snprintf(r->host, sizeof(r->host), "%s", (const char *)srv->data);
+            mdns_cache_entry_t *a = _cacheFind(r->host, MDNS_TYPE_A, now);
+            if (a) {
+                r->ip = IPAddress(a->addr);
+            }
+        }
+        mdns_cache_entry_t *txt = _cacheFind(r->instance, MDNS_TYPE_TXT, now);
+        if (txt) {
+            memcpy(r->txt, txt->data, txt->dataLen);
+            r->txtLen = txt->dataLen;
+        }
+        _resultCount++;
+    }
+    return _resultCount;
+}
+
+String MDNSResponder::instanceName(int idx)
+{
+    if (idx < 0 || idx >= _resultCount) {
+        return String();
+    }
+    String s(_results[idx].instance);
+    int dot = s.indexOf('.');
+    return (dot < 0) ? s : s.substring(0, dot);
+}
+
+String MDNSResponder::hostname(int idx)
+{
+    if (idx < 0 || idx >= _resultCount) {
+        return String();
+    }
+    String s(_results[idx].host);
+    if (s.endsWith(".local")) {
+        s.remove(s.length() - 6);
+    }
+    return s;
+}
+
+IPAddress MDNSResponder::IP(int idx)
+{
+    if (idx < 0 || idx >= _resultCount) {
+        return IPAddress();
+    }
+    return _results[idx].ip;
+}
+
+uint16_t MDNSResponder::port(int idx)
+{
+    if (idx < 0 || idx >= _resultCount) {
+        return 0;
+    }
+    return _results[idx].port;
+}
+
+String MDNSResponder::txt(int idx, const char *key)
+{
+    if (idx < 0 || idx >= _resultCount) {
+        return String();
+    }
+    const mdns_result_t *r = &_results[idx];
+    size_t kl = strlen(key);
+    for (uint16_t off = 0; off < r->txtLen;) {
+        uint8_t l = r->txt[off];
+        const char *s = (const char *)r->txt + off + 1;
+        if (off + 1 + l > r->txtLen) {
+            break;
+        }
+        if (l > kl && s[kl] == '=' && !strncasecmp(s, key, kl)) {
+            char v[256];
+            memcpy(v, s + kl + 1, l - kl - 1);
+            v[l - kl - 1] = '\0';
+            return String(v);
+        }
+        off += 1 + l;
+    }
+    return String();
+}
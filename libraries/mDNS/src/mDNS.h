@@ -0,0 +1,156 @@
+#ifndef _MDNS_H_
+#define _MDNS_H_
+
+#include <Arduino.h>
+#include "WiFiUdp.h"
+
+#define MDNS_PORT               (5353)
+#define MDNS_MAX_PACKET         (1460)
+#define MDNS_RX_PACKETS         (2)
+#define MDNS_NAME_MAX           (96)
+#define MDNS_LABEL_MAX          (32)
+#define MDNS_TXT_MAX            (128)
+#define MDNS_MAX_SERVICES       (4)
+#define MDNS_CACHE_SIZE         (16)
+#define MDNS_MAX_RESULTS        (6)
+
+#define MDNS_HOST_TTL           (120)
+#define MDNS_SERVICE_TTL        (4500)
+#define MDNS_LEGACY_TTL         (10)
+
+#define MDNS_PROBE_COUNT        (3)
+#define MDNS_PROBE_INTERVAL_MS  (250)
+#define MDNS_ANNOUNCE_COUNT     (2)
+#define MDNS_ANNOUNCE_INTERVAL_MS (1000)
+#define MDNS_QUERY_RETRY_MS     (1000)
+#define MDNS_QUERY_QUIET_MS     (250)   // queryService() stops once answers pause this long
+
+typedef enum {
+    MDNS_STATE_IDLE = 0,
+    MDNS_STATE_PROBING,
+    MDNS_STATE_ANNOUNCING,
+    MDNS_STATE_READY,
+} mdns_state_t;
+
+typedef struct {
+    char service[MDNS_LABEL_MAX];   // "_http"
+    char proto[8];                  // "_tcp"
+    uint16_t port;
+    uint8_t txt[MDNS_TXT_MAX];      // length-prefixed "key=value" strings
+    uint16_t txtLen;
+} mdns_service_t;
+
+// one record learned from the network, kept until its TTL runs out
+typedef struct {
+    char name[MDNS_NAME_MAX];
+    uint16_t type;
+    uint16_t port;                  // SRV
+    uint32_t addr;                  // A, network byte order like IPAddress
+    uint8_t data[MDNS_TXT_MAX];     // PTR/SRV target as a string, TXT raw
+    uint16_t dataLen;
+    uint32_t ttl;
+    unsigned long received;
+} mdns_cache_entry_t;
+
+typedef struct {
+    char instance[MDNS_NAME_MAX];
+    char host[MDNS_NAME_MAX];
+    IPAddress ip;
+    uint16_t port;
+    uint8_t txt[MDNS_TXT_MAX];
+    uint16_t txtLen;
+} mdns_result_t;
+
+/*
+ * mDNS responder and querier (RFC 6762 / RFC 6763) on a WiFiUDP multicast
+ * socket. begin() probes the host and service instance names and announces
+ * them; update() has to be called from loop() to answer queries, finish the
+ * probe/announce sequence and fill the answer cache. Queries are answered
+ * from the cache first and carry the cached answers as known answers, so
+ * peers only reply with what is new.
+ *
+ * Simultaneous probe tie-breaking is not implemented: when two devices probe
+ * the same name at once, the one that hears the other's announcement renames.
+ */
+class MDNSResponder
+{
+public:
+    MDNSResponder();
+    ~MDNSResponder();
+
+    bool begin(const char *hostname);
+    void end();
+    // processes everything received within timeout_ms and runs the timers
+    void update(uint32_t timeout_ms = 0);
+    bool isReady() const { return _state == MDNS_STATE_READY; }
+    const char *hostname() const { return _host; }
+
+    // defaults to the host name; must not contain '.'
+    void setInstanceName(const char *name);
+    bool addService(const char *service, const char *proto, uint16_t port);
+    bool addServiceTxt(const char *service, const char *proto, const char *key, const char *value);
+    bool removeService(const char *service, const char *proto);
+
+    // host may be given with or without ".local"; timeout 0 only looks at
+    // the cache and leaves the query running for later update() calls
+    IPAddress queryHost(const char *host, uint32_t timeout_ms = 2000);
+    // returns the number of instances found, read them with the accessors below;
+    // cached instances are returned at once without a query
+    int queryService(const char *service, const char *proto, uint32_t timeout_ms = 2000);
+    String instanceName(int idx);
+    String hostname(int idx);
+    IPAddress IP(int idx);
+    uint16_t port(int idx);
+    String txt(int idx, const char *key);
+    void clearCache();
+
+private:
+    WiFiUDP _udp;
+    mdns_state_t _state;
+    char _base[MDNS_LABEL_MAX];
+    char _host[MDNS_LABEL_MAX + 8];
+    char _instanceBase[MDNS_LABEL_MAX];
+    char _instance[MDNS_LABEL_MAX + 8];
+    bool _instanceSet;
+    uint8_t _hostConflicts;
+    uint8_t _instanceConflicts;
+    uint8_t _step;
+    unsigned long _nextEvent;
+    mdns_service_t _services[MDNS_MAX_SERVICES];
+    uint8_t _serviceCount;
+    uint8_t *_tx;
+    mdns_cache_entry_t *_cache;
+    mdns_result_t *_results;
+    uint8_t _resultCount;
+
+    // record 0 is the host A record, service i owns records 1 + 4 * i ..
+    uint8_t _recordCount() const { return 1 + 4 * _serviceCount; }
+    void _recordName(uint8_t rec, char *out, size_t size);
+    void _recordTarget(uint8_t rec, char *out, size_t size);
+    uint16_t _recordType(uint8_t rec);
+    uint32_t _recordTTL(uint8_t rec);
+    bool _recordUnique(uint8_t rec);
+    bool _sameRdata(uint8_t rec, const uint8_t *pkt, size_t len, size_t off, uint16_t rdlen);
+    bool _writeRecord(uint8_t *buf, size_t *pos, uint8_t rec, uint32_t ttl, bool flush);
+
+    void _restartProbing();
+    void _rename(bool host);
+    void _runTimers(unsigned long now);
+    void _sendProbe();
+    bool _sendRecords(uint32_t mask, bool goodbye);
+    bool _sendQuery(const char *name, uint16_t type, bool knownAnswers);
+    bool _send(size_t len, IPAddress ip, uint16_t port);
+
+    void _handlePacket(const WiFiUDPPacket *p);
+    void _handleQuery(const uint8_t *pkt, size_t len, IPAddress ip, uint16_t port);
+    void _handleResponse(const uint8_t *pkt, size_t len);
+    void _cacheStore(const char *name, uint16_t type, uint32_t ttl, bool flush,
+                     const uint8_t *pkt, size_t len, size_t off, uint16_t rdlen);
+    mdns_cache_entry_t *_cacheFind(const char *name, uint16_t type, unsigned long now);
+    mdns_service_t *_findService(const char *service, const char *proto);
+    int _collectServices(const char *name);
+};
+
+extern MDNSResponder MDNS;
+
+#endif /* _MDNS_H_ */